@@ -12,6 +12,12 @@
 #include <SortArray.h>
 #include <TChannelLiteral.h>
 #include <RemoteArray.h>
+#include "TPokeySimulator.h"
+#include "TPokeyBenchmark.h"
+#include "TPokeyShard.h"
+#include "TPokeyCluster.h"
+#include <fstream>
+#include <cstdio>
 
 
 const char* TPokeyMeta::CoordDelim = "/";
@@ -37,11 +43,16 @@ std::ostream& operator<< (std::ostream &out,const TPokeyMeta &in)
 		out << "IGNORED;";
 	}
 	
+	if ( in.mLatchEnabled )
+	{
+		out << "latched;";
+	}
+	
 	if ( cr )
 	{
 		//	gr@ chrome on windows thinks there's some binary in this output and won#t display inline
 		//	out << in.mChannelRef;
-		if ( in.mChannelRef.IsValid() )
+		if ( in.GetChannelRef().IsValid() )
 			out << "has channel";
 		else
 			out << "no channel";
@@ -49,7 +60,7 @@ std::ostream& operator<< (std::ostream &out,const TPokeyMeta &in)
 
 	if ( addr )
 	{
-		out << "@" << in.mAddress;
+		out << "@" << in.GetAddress();
 		if ( in.HasBootupAddress() )
 			out << "(bootup)";
 		out << " " << ( in.mDhcpEnabled ? "dhcp ip" : "fixed ip" );
@@ -58,7 +69,7 @@ std::ostream& operator<< (std::ostream &out,const TPokeyMeta &in)
 	if ( gridmap )
 		out << in.GetGridMapString().substr(0, 10) << "... x" << in.GetGridMapCount();
 	if ( v )
-		out << " v" << in.mVersion;
+		out << " v" << in.GetVersion();
 
 	out << "}";
 
@@ -72,14 +83,28 @@ std::ostream& operator<< (std::ostream &out,const vec2x<int> &in)
 }
 
 
-TPinMeta::TPinMeta() :
-	mDownDuration	( 0 ),
-	mCoord			( TPokeyMeta::GridCoordInvalid )
+TPokeyMeta::TPokeyMeta() :
+	mStateSlot		( TPokeyBoardStates::Get().Alloc() ),
+	mSerial			( -1 ),
+	mDhcpEnabled	( false ),
+	mIgnored		( false ),
+	mLatchEnabled	( false ),
+	mLatchConfigured	( false ),
+	mLatchPins		( 0 ),
+	mShard			( -1 ),
+	mRemote			( -1 ),
+	mRemoteConnected	( false ),
+	mGridMapVersion	( 0 ),
+	mState			( &TPokeyBoardStates::Get().GetState(mStateSlot) )
 {
-	
 }
 
-bool TPokeyMeta::SetGridMap(std::string GridMapString,std::stringstream& Error)
+TPokeyMeta::~TPokeyMeta()
+{
+	TPokeyBoardStates::Get().Free( mStateSlot );
+}
+
+bool TPokeyMeta::ParseGridMap(std::string GridMapString,ArrayBridge<vec2x<int>>&& PinToGridMap,std::stringstream& Error)
 {
 	//	repalce tab
 	for ( int i = 0; i < GridMapString.length(); i++ )
@@ -103,8 +128,7 @@ bool TPokeyMeta::SetGridMap(std::string GridMapString,std::stringstream& Error)
 		//	special case
 		if ( IndexString == "lasergate" )
 		{
-			auto& Pin = GetPin(i);
-			Pin.mCoord = TPokeyMeta::GridCoordLaserGate;
+			PinToGridMap.PushBack( TPokeyMeta::GridCoordLaserGate );
 			continue;
 		}
 		
@@ -124,13 +148,71 @@ bool TPokeyMeta::SetGridMap(std::string GridMapString,std::stringstream& Error)
 			return false;
 		}
 		
-		auto& Pin = GetPin(i);
-		Pin.mCoord = Coord;
+		PinToGridMap.PushBack( Coord );
 	}
 	
 	return true;
 }
 
+bool TPokeyMeta::SetGridMap(std::string GridMapString,std::stringstream& Error)
+{
+	//	gr: apply whatever parsed before an error, as we always have
+	BufferArray<vec2x<int>,100> PinToGridMap;
+	bool Success = ParseGridMap( GridMapString, GetArrayBridge(PinToGridMap), Error );
+	SetGridMap( GetArrayBridge(PinToGridMap) );
+	return Success;
+}
+
+void TPokeyMeta::SetGridMap(const ArrayBridge<vec2x<int>>& PinToGridMap)
+{
+	std::lock_guard<std::mutex> Lock( mStateLock );
+	auto& State = *mState;
+	auto PinCount = PinToGridMap.GetSize();
+	if ( PinCount > TPokeyBoardState::MaxPins )
+	{
+		std::Debug << "Warning: gridmap for " << (*this) << " has " << PinCount << " pins, only using the first " << TPokeyBoardState::MaxPins << std::endl;
+		PinCount = TPokeyBoardState::MaxPins;
+	}
+	
+	//	keep existing pin meta (down durations) and just replace coords
+	AddPins( PinCount );
+	State.mMappedPins = 0;
+	State.mLaserGatePins = 0;
+	for ( size_t p=0;	p<State.mPinCount;	p++ )
+	{
+		State.mCoord[p] = ( p < PinCount ) ? PinToGridMap[p] : TPokeyMeta::GridCoordInvalid;
+		if ( State.mCoord[p] != TPokeyMeta::GridCoordInvalid )
+			State.mMappedPins |= 1ull << p;
+		if ( State.mCoord[p] == TPokeyMeta::GridCoordLaserGate )
+			State.mLaserGatePins |= 1ull << p;
+	}
+	
+	//	latch pins follow the map, so set them up again
+	mLatchConfigured = false;
+	mGridMapVersion++;
+}
+
+bool TPokeyMeta::IsGridMapEqual(const ArrayBridge<vec2x<int>>& PinToGridMap) const
+{
+	auto& State = *mState;
+	for ( size_t p=0;	p<State.mPinCount;	p++ )
+	{
+		auto Coord = ( p < PinToGridMap.GetSize() ) ? PinToGridMap[p] : TPokeyMeta::GridCoordInvalid;
+		if ( State.mCoord[p] != Coord )
+			return false;
+	}
+	return PinToGridMap.GetSize() <= State.mPinCount;
+}
+
+void TPokeyMeta::AddPins(size_t PinCount)
+{
+	//	pins past the map still get meta for duration etc; new ones are already reset
+	if ( PinCount > TPokeyBoardState::MaxPins )
+		PinCount = TPokeyBoardState::MaxPins;
+	if ( PinCount > mState->mPinCount )
+		mState->mPinCount = static_cast<uint32>( PinCount );
+}
+
 namespace Soy
 {
 	template<typename TYPE>
@@ -145,117 +227,195 @@ namespace Soy
 
 vec2x<int> TPokeyMeta::UpdatePins(const ArrayBridge<bool> &Pins)
 {
-	//	get delta
-	SoyTime Now(true);
-	if ( !mLastUpdate.IsValid() )
-		mLastUpdate = Now;
-	float Delta = (Now.GetTime() - mLastUpdate.GetTime()) / 1000.0f;
-	mLastUpdate = Now;
+	bool NewPress;
+	return UpdatePins( Pins, NewPress, Soy::GetMonotonicNs() );
+}
+
+vec2x<int> TPokeyMeta::UpdatePins(const ArrayBridge<bool> &Pins,bool& NewPress,uint64 SampleTimeNs)
+{
+	uint64 Down = 0;
+	size_t PinCount = std::min<size_t>( Pins.GetSize(), size_t(TPokeyBoardState::MaxPins) );
+	for ( size_t i=0;	i<PinCount;	i++ )
+	{
+		if ( Pins[i] )
+			Down |= 1ull << i;
+	}
+	std::lock_guard<std::mutex> Lock( mStateLock );
+	return UpdatePins( Down, PinCount, NewPress, SampleTimeNs );
+}
 
-	//	catch errors
+vec2x<int> TPokeyMeta::UpdatePins(uint64 Down,size_t PinCount,bool& NewPress,uint64 SampleTimeNs)
+{
+	NewPress = false;
+	auto& State = *mState;
+	
+	//	get delta from when the samples arrived, not when we got round to processing them
+	if ( State.mLastUpdateNs == 0 )
+		State.mLastUpdateNs = SampleTimeNs;
+	float Delta = 0.f;
+	if ( SampleTimeNs > State.mLastUpdateNs )
+		Delta = (SampleTimeNs - State.mLastUpdateNs) / 1000000000.0f;
+	State.mLastUpdateNs = std::max( State.mLastUpdateNs, SampleTimeNs );
+
+	//	a gap (disconnect) shouldn't count as the pin being held
 	Soy::Clamp( Delta, 0.f, 1.f );
 	
-	vec2x<int> Result = GridCoordInvalid;
-
-	//	update each pin
-	for ( int i=0;	i<Pins.GetSize();	i++ )
+	AddPins( PinCount );
+	
+	//	only pins that are or were down have a duration to update
+	auto WasDown = State.mDownPins;
+	for ( auto Bits = Down | WasDown;	Bits;	Bits &= Bits-1 )
 	{
-		bool PinDown = Pins[i];
-		auto& Pin = GetPin(i);
+		auto i = TPokeyBoardState::GetLowestPin( Bits );
+		if ( Down & (1ull << i) )
+			State.mDownDuration[i] += Delta;
+		else
+			State.mDownDuration[i] = 0;
 		
-		//	update how long the pin has been down (or reset)
-		if ( PinDown )
-			Pin.mDownDuration += Delta;
+		if ( State.mDownDuration[i] >= TPokeyMeta::PinDownTooLong )
+			State.mStuckPins |= 1ull << i;
 		else
-			Pin.mDownDuration = 0;
-
-		//	not down, nothging else to do
-		if ( !PinDown )
-			continue;
-
-		//	check if pin is being ignored
-		if ( IsPinIgnored(i) )
-			continue;
-
-		//	set as result
-		auto PinGridCoord = GetPinGridCoord(i);
-		if ( PinGridCoord == TPokeyMeta::GridCoordInvalid )
+			State.mStuckPins &= ~(1ull << i);
+	}
+	State.mDownPins = Down;
+	
+	//	so the counters don't push a press the polls already did
+	for ( auto Bits = Down & ~WasDown & State.mEdgeCountPins;	Bits;	Bits &= Bits-1 )
+	{
+		auto i = TPokeyBoardState::GetLowestPin( Bits );
+		if ( State.mPolledPresses[i] < 255 )
+			State.mPolledPresses[i]++;
+	}
+	
+	//	last down pin that isn't being ignored wins, as it always has. Gate pins aren't presses,
+	//	the app times their edges separately
+	vec2x<int> Result = GridCoordInvalid;
+	for ( auto Bits = Down & ~State.mStuckPins & ~State.mLaserGatePins;	Bits;	Bits &= Bits-1 )
+	{
+		auto i = TPokeyBoardState::GetLowestPin( Bits );
+		if ( !(State.mMappedPins & (1ull << i)) )
 		{
 			std::Debug << "Warning: pin " << i << " down that's out of grid-map range on " << (*this) << std::endl;
 			continue;
 		}
 		
-		Result = PinGridCoord;
+		Result = State.mCoord[i];
+		NewPress = !(WasDown & (1ull << i));
 	}
 	
 	return Result;
 }
 
+void TPokeyMeta::UpdateEdgeCounts(const ArrayBridge<size_t>& Pins,const ArrayBridge<uint32>& Counts,ArrayBridge<vec2x<int>>&& MissedPresses)
+{
+	std::lock_guard<std::mutex> Lock( mStateLock );
+	auto& State = *mState;
+	
+	//	counters see both edges, so from the pin's state at the last read and now we know how many
+	//	times it went down in between. Any the polls didn't see were taps that fell between them
+	for ( int i=0;	i<Pins.GetSize() && i<Counts.GetSize();	i++ )
+	{
+		auto Pin = Pins[i];
+		if ( Pin >= TPokeyBoardState::MaxPins )
+			continue;
+		AddPins( Pin+1 );
+		
+		auto PinBit = 1ull << Pin;
+		auto Count = Counts[i];
+		bool HadBaseline = (State.mEdgeCountPins & PinBit) != 0;
+		auto LastCount = State.mEdgeCount[Pin];
+		int WasDown = (State.mEdgeCountDownPins & PinBit) ? 1 : 0;
+		int IsDown = (State.mDownPins & PinBit) ? 1 : 0;
+		auto PolledPresses = State.mPolledPresses[Pin];
+		State.mEdgeCount[Pin] = Count;
+		State.mEdgeCountPins |= PinBit;
+		State.mEdgeCountDownPins = (State.mEdgeCountDownPins & ~PinBit) | (State.mDownPins & PinBit);
+		State.mPolledPresses[Pin] = 0;
+		
+		//	first read, or counters were reset/pokey rebooted
+		if ( !HadBaseline || Count < LastCount )
+			continue;
+		
+		auto Edges = static_cast<sint64>( Count - LastCount );
+		auto Presses = ( Edges + IsDown - WasDown ) / 2;
+		auto Missed = Presses - PolledPresses;
+		if ( Missed <= 0 )
+			continue;
+		if ( State.mStuckPins & PinBit )
+			continue;
+		if ( !(State.mMappedPins & PinBit) || (State.mLaserGatePins & PinBit) )
+			continue;
+		
+		for ( sint64 p=0;	p<Missed;	p++ )
+			MissedPresses.PushBack( State.mCoord[Pin] );
+	}
+}
+
+void TPokeyMeta::ResetEdgeCounts()
+{
+	std::lock_guard<std::mutex> Lock( mStateLock );
+	mState->mEdgeCountPins = 0;
+}
+
+void TPokeyMeta::GetLatchPins(ArrayBridge<size_t>&& Pins)
+{
+	//	a gridmap change rewrites the mapped pins
+	std::lock_guard<std::mutex> Lock( mStateLock );
+	
+	//	only mapped pins, and pokeys only have 55
+	for ( auto Bits = mState->mMappedPins & ((1ull << 55)-1);	Bits;	Bits &= Bits-1 )
+		Pins.PushBack( TPokeyBoardState::GetLowestPin( Bits ) );
+}
+
 bool TPokeyMeta::IsPinIgnored(size_t Pin)
 {
-	//	oob
-	if ( Pin >= mPins.GetSize() )
-		return false;
+	std::lock_guard<std::mutex> Lock( mStateLock );
 	
-	auto Duration = mPins[Pin].mDownDuration;
-	if ( Duration < TPokeyMeta::PinDownTooLong )
+	//	oob
+	if ( Pin >= mState->mPinCount )
 		return false;
 	
-	return true;
+	return (mState->mStuckPins & (1ull << Pin)) != 0;
 }
 
 
 vec2x<int> TPokeyMeta::GetPinGridCoord(size_t Pin)
 {
 	//	oob
-	if ( Pin >= mPins.GetSize() )
+	if ( Pin >= mState->mPinCount )
 		return TPokeyMeta::GridCoordInvalid;
 	
-	return mPins[Pin].mCoord;
+	return mState->mCoord[Pin];
 }
 
 
 float TPokeyMeta::GetPinDownDuration(size_t Pin)
 {
 	//	oob
-	if ( Pin >= mPins.GetSize() )
+	if ( Pin >= mState->mPinCount )
 		return -1.0f;
 	
-	return mPins[Pin].mDownDuration;
+	return mState->mDownDuration[Pin];
 }
 
 
-TPinMeta& TPokeyMeta::GetPin(size_t Pin)
-{
-	//	if OOB, then the array hasn't been initialised (maybe no grid layout), but we still want meta for duration etc
-	if ( Pin >= mPins.GetSize() )
-	{
-		mPins.SetSize( Pin+1 );
-	}
-
-	return mPins[Pin];
-}
-
 float TPokeyMeta::GetTimeSinceUpdate() const
 {
 	//	never heard from
-	if ( !mLastUpdate.IsValid() )
+	auto LastUpdateNs = mState->mLastUpdateNs;
+	if ( LastUpdateNs == 0 )
 		return -1;
 	
-	SoyTime Now(true);
-	auto DeltaMs = Now.GetTime() - mLastUpdate.GetTime();
-	return DeltaMs / 1000.f;
+	auto Now = Soy::GetMonotonicNs();
+	if ( Now < LastUpdateNs )
+		return 0.f;
+	return (Now - LastUpdateNs) / 1000000000.f;
 }
 
 void TPokeyMeta::GetIgnoredPins(ArrayBridge<size_t>&& IgnoredPins)
 {
-	for ( int p=0;	p<mPins.GetSize();	p++ )
-	{
-		if ( !IsPinIgnored(p) )
-			continue;
-		
-		IgnoredPins.PushBack(p);
-	}
+	for ( auto Bits = mState->mStuckPins;	Bits;	Bits &= Bits-1 )
+		IgnoredPins.PushBack( TPokeyBoardState::GetLowestPin( Bits ) );
 }
 
 
@@ -269,6 +429,27 @@ TPokeyDiscoverThread::TPokeyDiscoverThread(std::shared_ptr<TChannel>& Channel) :
 
 
 
+TPokeyAddressCacheThread::TPokeyAddressCacheThread(std::function<void()> Write) :
+	SoyWorkerThread	( Soy::GetTypeName(*this), SoyWorkerWaitMode::Wake ),
+	mWrite			( Write ),
+	mPending		( false )
+{
+}
+
+TPokeyAddressCacheThread::~TPokeyAddressCacheThread()
+{
+	Stop();
+	WaitToFinish();
+}
+
+bool TPokeyAddressCacheThread::Iteration()
+{
+	if ( mPending.exchange( false ) )
+		mWrite();
+	return true;
+}
+
+
 bool TPokeyDiscoverThread::Iteration()
 {
 	if ( !mEnabled )
@@ -288,11 +469,16 @@ bool TPokeyDiscoverThread::Iteration()
 
 
 
-TPollPokeyThread::TPollPokeyThread(TPokeyManager& PokeyManager,TChannelManager& Channels) :
+TPollPokeyThread::TPollPokeyThread(TPokeyManager& PokeyManager,TChannelManager& Channels,const std::string& Name) :
 	mPokeyManager	( PokeyManager ),
 	mChannels		( Channels ),
 	SoyWorkerThread	( "TPollPokeyThread", SoyWorkerWaitMode::Sleep ),
-	mEnabled		( true )
+	mEnabled		( true ),
+	mPollIntervalMs	( 13 ),
+	mTimerParamsChanged	( false ),
+	mRealtime		( false ),
+	mLastPollNs		( 0 ),
+	mMetrics		( TPokeyMetrics::Get().GetPoll( Name ) )
 {
 	Start();
 }
@@ -300,18 +486,77 @@ TPollPokeyThread::TPollPokeyThread(TPokeyManager& PokeyManager,TChannelManager&
 
 std::chrono::milliseconds TPollPokeyThread::GetSleepDuration()
 {
-	static int DurationMs = 13;
-	return std::chrono::milliseconds(DurationMs);
+	if ( mRealtime )
+		return std::chrono::milliseconds(0);
+	return std::chrono::milliseconds(mPollIntervalMs);
+}
+
+void TPollPokeyThread::SetTimerParams(const TPokeyPollTimerParams& Params)
+{
+	std::lock_guard<std::mutex> Lock( mTimerLock );
+	mTimerParams = Params;
+	mTimerParamsChanged = true;
+}
+
+TPokeyPollTimerParams TPollPokeyThread::GetTimerParams()
+{
+	std::lock_guard<std::mutex> Lock( mTimerLock );
+	return mTimerParams;
+}
+
+void TPollPokeyThread::GetTimerStatus(std::ostream& Status)
+{
+	auto Params = GetTimerParams();
+	auto& Jitter = mMetrics->mJitterUs;
+	Status << mMetrics->mName << " poll " << Params.mMode << " every " << mPollIntervalMs << "ms jitter p50 " << Jitter.GetPercentile(50) << "us p99 " << Jitter.GetPercentile(99) << "us max " << Jitter.GetMax() << "us overruns " << mMetrics->mOverruns.load();
+}
+
+void TPollPokeyThread::WaitForPoll()
+{
+	{
+		std::lock_guard<std::mutex> Lock( mTimerLock );
+		if ( mTimerParamsChanged )
+		{
+			//	created here so priority and affinity apply to this thread
+			mTimerParamsChanged = false;
+			mTimer.reset();
+			if ( mTimerParams.IsRealtime() )
+				mTimer.reset( new TPokeyPollTimer( mTimerParams ) );
+			mRealtime = (mTimer != nullptr);
+			mLastPollNs = 0;
+		}
+	}
+	
+	auto IntervalNs = static_cast<uint64>( mPollIntervalMs ) * 1000000;
+	if ( mTimer )
+		mTimer->Wait( IntervalNs );
+	
+	//	measured in both modes, so sleep and rt can be compared
+	auto NowNs = Soy::GetMonotonicNs();
+	if ( mLastPollNs != 0 )
+	{
+		auto PollIntervalNs = NowNs - mLastPollNs;
+		auto JitterNs = (PollIntervalNs > IntervalNs) ? (PollIntervalNs - IntervalNs) : (IntervalNs - PollIntervalNs);
+		mMetrics->mJitterUs.Record( JitterNs / 1000 );
+		if ( PollIntervalNs >= IntervalNs * 2 )
+			mMetrics->mOverruns++;
+	}
+	mLastPollNs = NowNs;
 }
 
 
 bool TPollPokeyThread::Iteration()
 {
+	WaitForPoll();
+	mPokeyManager.OnPrePoll();
+	
 	if ( !mEnabled )
 		return true;
 //	SendGetDeviceMeta();
 //	SendGetUserMeta();
 	SendGetDeviceState();
+	SendLatchJobs();
+	SendOutputJobs();
 	
 	return true;
 }
@@ -340,7 +585,7 @@ void TPollPokeyThread::SendGetDeviceState()
 void TPollPokeyThread::SendJob(TJob& Job)
 {
 	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
-	mPokeyManager.GetPokeys( GetArrayBridge(Pokeys) );
+	mPokeyManager.GetPollPokeys( GetArrayBridge(Pokeys) );
 
 	for ( int i=0;	i<Pokeys.GetSize();	i++ )
 	{
@@ -349,17 +594,165 @@ void TPollPokeyThread::SendJob(TJob& Job)
 			continue;
 		if ( pPokey->mIgnored )
 			continue;
-		auto pChannel = mChannels.GetChannel( pPokey->mChannelRef );
+		auto pChannel = mChannels.GetChannel( pPokey->GetChannelRef() );
 		if ( !pChannel )
 			continue;
 		auto& Channel = *pChannel;
-		if ( !Channel.IsConnected() )
+		bool Connected = Channel.IsConnected();
+		if ( pPokey->mMetrics )
+			pPokey->mMetrics->OnConnectedState( Connected );
+		if ( !Connected )
+		{
+			//	don't know what a reconnected pokey is outputting
+			pPokey->mOutputs.Invalidate();
+			continue;
+		}
+		
+		SendPokeyJob( *pPokey, Channel, Job );
+	}
+
+}
+
+void TPollPokeyThread::SendPokeyJob(TPokeyMeta& Pokey,TChannel& Channel,TJob& Job)
+{
+	//	copy so each channel's protocol learns which serial it's talking to
+	TJob PokeyJob = Job;
+	PokeyJob.mParams.AddParam("serial", Pokey.mSerial );
+	
+	//	output changes since the last poll go with the poll
+	if ( Job.mParams.mCommand == TPokeyCommand::ToString( TPokeyCommand::GetDeviceState ) )
+	{
+		std::string Outputs;
+		if ( Pokey.mOutputs.PopPinChanges( Outputs ) )
+			PokeyJob.mParams.AddParam("outputs", Outputs );
+	}
+	
+	PokeyJob.mChannelMeta.mChannelRef = Channel.GetChannelRef();
+	Channel.SendCommand( PokeyJob );
+}
+
+std::shared_ptr<TChannel> TPollPokeyThread::GetConnectedChannel(TPokeyMeta& Pokey)
+{
+	auto pChannel = mChannels.GetChannel( Pokey.GetChannelRef() );
+	if ( !pChannel || !pChannel->IsConnected() )
+		return nullptr;
+	return pChannel;
+}
+
+void TPollPokeyThread::SendLatchJobs()
+{
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	mPokeyManager.GetPollPokeys( GetArrayBridge(Pokeys) );
+
+	for ( int i=0;	i<Pokeys.GetSize();	i++ )
+	{
+		auto pPokey = Pokeys[i];
+		if ( !pPokey || pPokey->mIgnored )
+			continue;
+		auto& Pokey = *pPokey;
+		
+		//	a reconnect may be a rebooted pokey, so set the pins up again when it's back
+		auto pChannel = GetConnectedChannel( Pokey );
+		if ( !pChannel )
+		{
+			Pokey.mLatchConfigured = false;
+			continue;
+		}
+		
+		if ( Pokey.mLatchEnabled != Pokey.mLatchConfigured )
+		{
+			SendLatchSetup( Pokey, *pChannel, Pokey.mLatchEnabled );
+			Pokey.mLatchConfigured = Pokey.mLatchEnabled;
+			continue;
+		}
+		
+		if ( !Pokey.mLatchEnabled )
+			continue;
+		
+		//	read counters just after the state so both cover the same interval
+		BufferArray<size_t,100> Pins;
+		Pokey.GetLatchPins( GetArrayBridge(Pins) );
+		for ( int p=0;	p<Pins.GetSize();	p+=TPokeyCommand::MaxCounterPins )
+		{
+			std::stringstream CounterPins;
+			for ( int c=p;	c<Pins.GetSize() && c<p+TPokeyCommand::MaxCounterPins;	c++ )
+				CounterPins << (c>p ? "," : "") << Pins[c];
+			
+			TJob Job;
+			Job.mParams.mCommand = TPokeyCommand::ToString( TPokeyCommand::GetDigitalCounters );
+			Job.mParams.AddParam("counterpins", CounterPins.str() );
+			SendPokeyJob( Pokey, *pChannel, Job );
+		}
+	}
+}
+
+void TPollPokeyThread::SendOutputJobs()
+{
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	mPokeyManager.GetPollPokeys( GetArrayBridge(Pokeys) );
+
+	//	PoExtBus has its own command; at most one per pokey per poll however many changes were made,
+	//	and sent after the state poll so it never delays input
+	for ( int i=0;	i<Pokeys.GetSize();	i++ )
+	{
+		auto pPokey = Pokeys[i];
+		if ( !pPokey || pPokey->mIgnored )
+			continue;
+		auto pChannel = GetConnectedChannel( *pPokey );
+		if ( !pChannel )
+			continue;
+		
+		std::string ExtBus;
+		if ( !pPokey->mOutputs.PopExtBusChanges( ExtBus ) )
 			continue;
 		
-		Job.mChannelMeta.mChannelRef = Channel.GetChannelRef();
-		Channel.SendCommand( Job );
+		TJob Job;
+		Job.mParams.mCommand = TPokeyCommand::ToString( TPokeyCommand::SetExtBus );
+		Job.mParams.AddParam("extbus", ExtBus );
+		SendPokeyJob( *pPokey, *pChannel, Job );
 	}
+}
 
+void TPollPokeyThread::SendLatchSetup(TPokeyMeta& Pokey,TChannel& Channel,bool Latch)
+{
+	std::Debug << (Latch ? "enabling" : "disabling") << " latched inputs on pokey " << Pokey << std::endl;
+	
+	BufferArray<size_t,100> Pins;
+	if ( Latch )
+		Pokey.GetLatchPins( GetArrayBridge(Pins) );
+	uint64 LatchPins = 0;
+	for ( int p=0;	p<Pins.GetSize();	p++ )
+		LatchPins |= 1ull << Pins[p];
+	
+	//	only pins we made counters go back to plain inputs; that includes ones a new gridmap dropped
+	for ( auto Bits = Pokey.mLatchPins & ~LatchPins;	Bits;	Bits &= Bits-1 )
+	{
+		TJob Job;
+		Job.mParams.mCommand = TPokeyCommand::ToString( TPokeyCommand::SetPinSettings );
+		Job.mParams.AddParam("pin", static_cast<int>( TPokeyBoardState::GetLowestPin( Bits ) ) );
+		Job.mParams.AddParam("settings", TPokeyPinSetting::DigitalInput );
+		SendPokeyJob( Pokey, Channel, Job );
+	}
+	
+	//	count both edges so a tap is always 2 whichever way round the pin is wired
+	for ( int p=0;	p<Pins.GetSize();	p++ )
+	{
+		TJob Job;
+		Job.mParams.mCommand = TPokeyCommand::ToString( TPokeyCommand::SetPinSettings );
+		Job.mParams.AddParam("pin", static_cast<int>(Pins[p]) );
+		Job.mParams.AddParam("settings", TPokeyPinSetting::DigitalInput | TPokeyPinSetting::DigitalCounter );
+		Job.mParams.AddParam("options", TPokeyPinSetting::CountRising | TPokeyPinSetting::CountFalling );
+		SendPokeyJob( Pokey, Channel, Job );
+	}
+	Pokey.mLatchPins = LatchPins;
+	
+	if ( !Latch )
+		return;
+	
+	TJob ResetJob;
+	ResetJob.mParams.mCommand = TPokeyCommand::ToString( TPokeyCommand::ResetDigitalCounters );
+	SendPokeyJob( Pokey, Channel, ResetJob );
+	Pokey.ResetEdgeCounts();
 }
 
 
@@ -368,8 +761,27 @@ void TPollPokeyThread::SendJob(TJob& Job)
 
 TPopPokey::TPopPokey() :
 	TJobHandler		( static_cast<TChannelManager&>(*this) ),
-	mLastGridCoord	( TPokeyMeta::GridCoordInvalid )
+	mLastGridCoord	( TPokeyMeta::GridCoordInvalid ),
+	mLastGridCoordNs	( 0 ),
+	mLastLaserGateNs	( 0 ),
+	mShardCount		( 0 )
 {
+	for ( size_t i=0;	i<sizeofarray(mShardBySerial);	i++ )
+		mShardBySerial[i] = 0;
+	
+	mDefaultMergeInput = mEventMerger.AddInput();
+	mEventMerger.mOnEvent.AddListener( [this](TPokeyMergeEvent& Event)
+	{
+		PushGridCoord( Event.mCoord, Event.mTrace.IsValid() ? &Event.mTrace : nullptr );
+	});
+	
+	//	PopLaserGate latches each break until it's read
+	mLaserGate.mOnEvent.AddListener( [this](const TPokeyLaserGateEvent& Event)
+	{
+		if ( Event.mType == TPokeyLaserGateEventType::Break )
+			PushLaserGateState( true );
+	});
+	
 	TParameterTraits InitPokeyTraits;
 	InitPokeyTraits.mAssumedKeys.PushBack("ref");
 	InitPokeyTraits.mAssumedKeys.PushBack("address");
@@ -404,13 +816,22 @@ TPopPokey::TPopPokey() :
 	PushLaserGateStateTraits.mRequiredKeys.PushBack("state");
 	AddJobHandler("PushLaserGate", PushLaserGateStateTraits, *this, &TPopPokey::OnPushLaserGateState );
 	
+	//	batch commands=PopGridCoord;PopLaserGate format=json
+	TParameterTraits BatchTraits;
+	BatchTraits.mAssumedKeys.PushBack("commands");
+	AddJobHandler("batch", BatchTraits, *this, &TPopPokey::OnBatch );
+	
 	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::UnknownReply ), TParameterTraits(), *this, &TPopPokey::OnUnknownPokeyReply );
 	
 	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::Discover ), TParameterTraits(), *this, &TPopPokey::OnDiscoverPokey );
 
 	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::GetDeviceState ), TParameterTraits(), *this, &TPopPokey::OnPokeyPollReply );
+	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::GetDigitalCounters ), TParameterTraits(), *this, &TPopPokey::OnPokeyCountersReply );
+	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::SetPinSettings ), TParameterTraits(), *this, &TPopPokey::OnPokeyLatchSetupReply );
+	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::ResetDigitalCounters ), TParameterTraits(), *this, &TPopPokey::OnPokeyLatchSetupReply );
+	AddJobHandler( TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::SetExtBus ), TParameterTraits(), *this, &TPopPokey::OnPokeyExtBusReply );
 	
-	mPollPokeyThread.reset( new TPollPokeyThread( *this, static_cast<TChannelManager&>(*this) ) );
+	mPollPokeyThread.reset( new TPollPokeyThread( *this, static_cast<TChannelManager&>(*this), "main" ) );
 	mDiscoverPokeyThread.reset( new TPokeyDiscoverThread( mDiscoverPokeyChannel ) );
 	
 	AddJobHandler("enablediscovery", TParameterTraits(), *this, &TPopPokey::OnEnableDiscovery);
@@ -428,6 +849,79 @@ TPopPokey::TPopPokey() :
 	IgnorePokeyTraits.mDefaultParams.PushBack( std::make_tuple("ignore","1") );
 	AddJobHandler("IgnorePokey", IgnorePokeyTraits, *this, &TPopPokey::OnIgnorePokey );
 
+	TParameterTraits ReloadConfigTraits;
+	ReloadConfigTraits.mAssumedKeys.PushBack("filename");
+	AddJobHandler("reloadconfig", ReloadConfigTraits, *this, &TPopPokey::OnReloadConfig );
+	
+	TParameterTraits WatchConfigTraits;
+	WatchConfigTraits.mAssumedKeys.PushBack("watch");
+	WatchConfigTraits.mDefaultParams.PushBack( std::make_tuple("watch","1") );
+	AddJobHandler("watchconfig", WatchConfigTraits, *this, &TPopPokey::OnWatchConfig );
+
+	TParameterTraits StartCaptureTraits;
+	StartCaptureTraits.mAssumedKeys.PushBack("filename");
+	StartCaptureTraits.mRequiredKeys.PushBack("filename");
+	AddJobHandler("startcapture", StartCaptureTraits, *this, &TPopPokey::OnStartCapture );
+	AddJobHandler("stopcapture", TParameterTraits(), *this, &TPopPokey::OnStopCapture );
+
+	//	prometheus text, scrape http://host:8080/metrics
+	AddJobHandler("metrics", TParameterTraits(), *this, &TPopPokey::OnGetMetrics );
+	AddJobHandler("metricsjson", TParameterTraits(), *this, &TPopPokey::OnGetMetricsJson );
+	AddJobHandler("tracestats", TParameterTraits(), *this, &TPopPokey::OnGetTraceStats );
+	AddJobHandler("tracedump", TParameterTraits(), *this, &TPopPokey::OnGetTraceDump );
+	AddJobHandler("floorframe", TParameterTraits(), *this, &TPopPokey::OnGetFloorFrame );
+	AddJobHandler("tracks", TParameterTraits(), *this, &TPopPokey::OnGetTracks );
+	AddJobHandler("poptrackevents", TParameterTraits(), *this, &TPopPokey::OnPopTrackEvents );
+	AddJobHandler("triggerzones", TParameterTraits(), *this, &TPopPokey::OnGetTriggerZones );
+	AddJobHandler("poptriggerevents", TParameterTraits(), *this, &TPopPokey::OnPopTriggerEvents );
+	
+	//	gate state, counters and timing; each break and restore since the last pop, in order
+	AddJobHandler("lasergate", TParameterTraits(), *this, &TPopPokey::OnGetLaserGate );
+	AddJobHandler("poplasergateevents", TParameterTraits(), *this, &TPopPokey::OnPopLaserGateEvents );
+	
+	//	png, http://host:8080/heatmap?layer=occupancy|heat|presses|overlay
+	TParameterTraits HeatmapTraits;
+	HeatmapTraits.mAssumedKeys.PushBack("layer");
+	HeatmapTraits.mDefaultParams.PushBack( std::make_tuple("layer","heat") );
+	AddJobHandler("heatmap", HeatmapTraits, *this, &TPopPokey::OnGetHeatmap );
+	
+	//	from/to (unix ms) or last (secs), cell=x,y or region=x0,y0,x1,y1, serial, type=down|up, limit
+	AddJobHandler("events", TParameterTraits(), *this, &TPopPokey::OnQueryEvents );
+	AddJobHandler("eventcount", TParameterTraits(), *this, &TPopPokey::OnCountEvents );
+	
+	TParameterTraits SetOutputTraits;
+	SetOutputTraits.mAssumedKeys.PushBack("serial");
+	SetOutputTraits.mRequiredKeys.PushBack("output");
+	SetOutputTraits.mDefaultParams.PushBack( std::make_tuple("state","1") );
+	AddJobHandler("setoutput", SetOutputTraits, *this, &TPopPokey::OnSetOutput );
+	
+	TParameterTraits SetOutputsTraits;
+	SetOutputsTraits.mAssumedKeys.PushBack("serial");
+	AddJobHandler("setoutputs", SetOutputsTraits, *this, &TPopPokey::OnSetOutputs );
+	
+	TParameterTraits AddZoneTraits;
+	AddZoneTraits.mAssumedKeys.PushBack("name");
+	AddZoneTraits.mRequiredKeys.PushBack("name");
+	AddJobHandler("addzone", AddZoneTraits, *this, &TPopPokey::OnAddZone );
+	AddJobHandler("zones", TParameterTraits(), *this, &TPopPokey::OnGetZones );
+	AddJobHandler("cluster", TParameterTraits(), *this, &TPopPokey::OnGetCluster );
+	
+	TParameterTraits GetOutputsTraits;
+	GetOutputsTraits.mAssumedKeys.PushBack("serial");
+	AddJobHandler("getoutputs", GetOutputsTraits, *this, &TPopPokey::OnGetOutputs );
+
+	mConfigThread.reset( new TPokeyConfigThread() );
+	mConfigThread->mOnConfigLoaded.AddListener( [this](std::shared_ptr<TPokeyConfig>& Config)
+	{
+		std::lock_guard<std::mutex> Lock( mConfigLock );
+		mPendingConfig = Config;
+	});
+	mConfigThread->mOnConfigError.AddListener( [this](const std::string& Error)
+	{
+		std::Debug << Error << std::endl;
+		std::lock_guard<std::mutex> Lock( mConfigLock );
+		mConfigError = Error;
+	});
 }
 
 
@@ -440,7 +934,39 @@ TPopPokey::~TPopPokey()
 	if ( mDiscoverPokeyThread )
 		mDiscoverPokeyThread->Stop();
 	
+	if ( mConfigThread )
+		mConfigThread->Stop();
+	
+	if ( mReplayThread )
+		mReplayThread->Stop();
+	
+	for ( size_t i=0;	i<mShardCount;	i++ )
+		mShards[i]->Stop();
+	
+	if ( mLaserGatePoller )
+		mLaserGatePoller->Stop();
+	
+	if ( mClusterMember )
+		mClusterMember->Stop();
+	
+	if ( mClusterAggregator )
+		mClusterAggregator->Stop();
+	
+	if ( mHttpServer )
+		mHttpServer->Stop();
+	
+	//	channels may still post to it, so it's stopped but kept
+	if ( mPollMailbox )
+	{
+		mPollMailbox->Stop();
+		mPollMailbox->WaitToFinish();
+	}
+	
 	//	kill threads
+	mClusterMember.reset();
+	mClusterAggregator.reset();
+	mHttpServer.reset();
+	
 	if ( mPollPokeyThread )
 	{
 		mPollPokeyThread->WaitToFinish();
@@ -453,6 +979,29 @@ TPopPokey::~TPopPokey()
 		mDiscoverPokeyThread.reset();
 	}
 	
+	if ( mConfigThread )
+	{
+		mConfigThread->WaitToFinish();
+		mConfigThread.reset();
+	}
+	
+	if ( mReplayThread )
+	{
+		mReplayThread->WaitToFinish();
+		mReplayThread.reset();
+	}
+	
+	//	discovery's stopped, so whatever it last changed is written here rather than lost
+	if ( mAddressCacheThread )
+	{
+		mAddressCacheThread->Stop();
+		mAddressCacheThread->WaitToFinish();
+		mAddressCacheThread->Iteration();
+		mAddressCacheThread.reset();
+	}
+	
+	StopCapture();
+	
 	//	shutdown channel manager
 	//	shutdown job threads...
 }
@@ -475,7 +1024,7 @@ std::shared_ptr<TPokeyMeta> TPokeyManager::GetPokey(const TPokeyMeta &Pokey)
 		auto& Match = mPokeys[i];
 		if ( Pokey.mSerial == Match->mSerial )
 			return Match;
-		if ( Pokey.mAddress == Match->mAddress )
+		if ( Pokey.GetAddress() == Match->GetAddress() )
 			return Match;
 	}
 	
@@ -488,7 +1037,7 @@ std::shared_ptr<TPokeyMeta> TPokeyManager::GetPokey(SoyRef ChannelRef)
 	for ( int i=0;	i<mPokeys.GetSize();	i++ )
 	{
 		auto& Match = mPokeys[i];
-		if ( Match->mChannelRef == ChannelRef )
+		if ( Match->GetChannelRef() == ChannelRef )
 			return Match;
 	}
 	
@@ -511,6 +1060,7 @@ std::shared_ptr<TPokeyMeta> TPokeyManager::GetPokey(int Serial,bool Create)
 
 	std::shared_ptr<TPokeyMeta> Pokey( new TPokeyMeta() );
 	Pokey->mSerial = Serial;
+	Pokey->mMetrics = TPokeyMetrics::Get().GetBoard( Serial );
 	mPokeys.PushBack( Pokey );
 	return Pokey;
 }
@@ -518,9 +1068,9 @@ std::shared_ptr<TPokeyMeta> TPokeyManager::GetPokey(int Serial,bool Create)
 
 void TPopPokey::OnPokeyPollReply(TJobAndChannel& JobAndChannel)
 {
-	//	find pokey this is from, we don't have a serial or any id per-device so match channel
+	//	find pokey this is from; the protocol tells us the serial it was talking to, but the channel must match
 	auto& Job = JobAndChannel.GetJob();
-	auto Pokey = GetPokey( Job.mChannelMeta.mChannelRef );
+	auto Pokey = GetReplyPokey( Job );
 	if ( !Pokey )
 	{
 		//	gr: this comes up if you change pokey addresses whilst running... channel ref has been overwritten?
@@ -539,66 +1089,370 @@ void TPopPokey::OnPokeyPollReply(TJobAndChannel& JobAndChannel)
 	
 	//std::Debug << "pins: " << Job.mParams.GetParamAs<std::string>("pins") << std::endl;
 
-	UpdatePinState( *Pokey, GetArrayBridge(Pins) );
+	TPokeyPollMail Mail;
+	Mail.mPinCount = std::min<size_t>( Pins.GetSize(), size_t(TPokeyBoardState::MaxPins) );
+	for ( size_t i=0;	i<Mail.mPinCount;	i++ )
+	{
+		if ( Pins[i] != '0' )
+			Mail.mPins |= 1ull << i;
+	}
+	Mail.mRxTimeNs = Job.mParams.GetParamAsWithDefault<uint64>("rxtime", 0);
+	Mail.mDecodeTimeNs = Job.mParams.GetParamAsWithDefault<uint64>("decodetime", 0);
+	Mail.mOutputsFailed = Job.mParams.GetParamAsWithDefault<int>("status", 0) != 0;
+	
+	//	in flight is about the reply arriving, not being applied
+	if ( mLaserGatePoller && Pokey->GetState().mLaserGatePins )
+		mLaserGatePoller->OnReply( *Pokey, Mail.mRxTimeNs ? Mail.mRxTimeNs : Soy::GetMonotonicNs() );
+	
+	auto* Mailbox = GetPollMailbox( *Pokey );
+	if ( Mailbox )
+	{
+		Mailbox->Post( Pokey, Mail.mPins, Mail.mPinCount, Mail.mRxTimeNs, Mail.mDecodeTimeNs, Mail.mOutputsFailed );
+		return;
+	}
+	
+	BufferArray<uint64,1> Steps;
+	BufferArray<uint64,1> StepTimesNs;
+	Steps.PushBack( Mail.mPins );
+	StepTimesNs.PushBack( Mail.mRxTimeNs );
+	OnPollMail( *Pokey, Mail, GetArrayBridge(Steps), GetArrayBridge(StepTimesNs) );
+}
+
+TPokeyPollMailbox* TPopPokey::GetPollMailbox(const TPokeyMeta& Pokey)
+{
+	//	zones apply their own replies, so a burst in one doesn't hold up the others
+	auto Shard = Pokey.mShard.load();
+	if ( Shard >= 0 && Shard < mShardCount && mShards[Shard]->mPollMailbox )
+		return mShards[Shard]->mPollMailbox.get();
+	return mPollMailbox.get();
 }
 
-void TPopPokey::OnFakeDiscoverPokeys(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnPollMail(TPokeyMeta& Pokey,const TPokeyPollMail& Mail,const ArrayBridge<uint64>& Steps,const ArrayBridge<uint64>& StepTimesNs)
 {
-	auto& Job = JobAndChannel.GetJob();
-	int FakeCount = Job.mParams.GetParamAsWithDefault<int>("count",100);
-	
-	//	trigger x fake jobs
-	for ( int i=0;	i<FakeCount;	i++ )
+	//	earlier steps replay edges that a newer reply overwrote; only the newest reply is traced
+	BufferArray<char,TPokeyBoardState::MaxPins> Pins;
+	for ( int s=0;	s<Steps.GetSize();	s++ )
 	{
-		TJob NewJob;
-		NewJob.mParams.AddParam<int>("serial",9900+i);
+		Pins.Clear();
+		for ( size_t i=0;	i<Mail.mPinCount;	i++ )
+			Pins.PushBack( (Steps[s] & (1ull << i)) ? '1' : '0' );
 		
-		//	random address
-		std::stringstream Address;
-		int Port = 2600+i;
-		Address << (rand()%256) << '.' << (rand()%256) << '.' << (rand()%256) << '.' << (rand()%256) << ':' << Port;
-		NewJob.mParams.AddParam("address", Address.str() );
-		NewJob.mParams.AddParam("version", "fake" );
+		bool Newest = ( s == Steps.GetSize()-1 );
+		TPokeyTrace Trace;
+		Trace.mSerial = Pokey.mSerial;
+		Trace.mStageNs[TPokeyTraceStage::Received] = Mail.mRxTimeNs;
+		Trace.mStageNs[TPokeyTraceStage::Decoded] = Mail.mDecodeTimeNs;
+		UpdatePinState( Pokey, GetArrayBridge(Pins), Newest ? &Trace : nullptr, StepTimesNs[s] );
+	}
 	
-		TJobAndChannel NewJobAndChannel( NewJob, JobAndChannel.GetChannel() );
-		OnDiscoverPokey( NewJobAndChannel );
+	if ( Mail.mOutputsFailed )
+	{
+		std::Debug << "pokey " << Pokey << " failed to set outputs, will resend" << std::endl;
+		Pokey.mOutputs.Invalidate();
 	}
+	
+	if ( Mail.mRxTimeNs != 0 )
+		TPokeyMetrics::Get().mHandlerLatencyUs.Record( (Soy::GetMonotonicNs() - Mail.mRxTimeNs) / 1000 );
 }
 
-void TPopPokey::OnDiscoverPokey(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnPokeyCountersReply(TJobAndChannel& JobAndChannel)
 {
-	//	grab it's serial and see if it already exists
 	auto& Job = JobAndChannel.GetJob();
-
-	int Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
-	bool DhcpEnabled = Job.mParams.GetParamAsWithDefault<int>("dhcpenabled", 0)!=0;
+	auto Pokey = GetReplyPokey( Job );
+	if ( !Pokey )
+	{
+		std::Debug << "got pokey counters reply, but didn't match pokey ref " << Job.mChannelMeta.mChannelRef << std::endl;
+		return;
+	}
+	
+	//	comma separated, in the same order
+	BufferArray<size_t,TPokeyCommand::MaxCounterPins> Pins;
+	BufferArray<uint32,TPokeyCommand::MaxCounterPins> Counts;
+	std::stringstream PinsStream( Job.mParams.GetParamAs<std::string>("counterpins") );
+	std::stringstream CountsStream( Job.mParams.GetParamAs<std::string>("counters") );
+	std::string Pin;
+	std::string Count;
+	while ( Pins.GetSize() < Pins.MaxAllocSize() && std::getline( PinsStream, Pin, ',' ) && std::getline( CountsStream, Count, ',' ) )
+	{
+		Pins.PushBack( atoi( Pin.c_str() ) );
+		Counts.PushBack( static_cast<uint32>( strtoul( Count.c_str(), nullptr, 10 ) ) );
+	}
+	
+	Array<vec2x<int>> MissedPresses;
+	Pokey->UpdateEdgeCounts( GetArrayBridge(Pins), GetArrayBridge(Counts), GetArrayBridge(MissedPresses) );
+	if ( MissedPresses.IsEmpty() )
+		return;
+	
+	if ( Pokey->mMetrics )
+		Pokey->mMetrics->mLatchedPresses.fetch_add( MissedPresses.GetSize(), std::memory_order_relaxed );
+	
+	std::Debug << "pokey " << Pokey->mSerial << " latched " << MissedPresses.GetSize() << " press(es) between polls" << std::endl;
+	auto RxTimeNs = Job.mParams.GetParamAsWithDefault<uint64>("rxtime", 0);
+	for ( int i=0;	i<MissedPresses.GetSize();	i++ )
+		PushPress( *Pokey, MissedPresses[i], nullptr, RxTimeNs ? RxTimeNs : Soy::GetMonotonicNs() );
+}
+
+void TPopPokey::OnPokeyLatchSetupReply(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	if ( Job.mParams.GetParamAsWithDefault<int>("status", 0) == 0 )
+		return;
+	
+	//	pin out of range or config locked; polling still works, just without latching
+	auto Pokey = GetPokey( Job.mChannelMeta.mChannelRef );
+	std::Debug << "pokey ";
+	if ( Pokey )
+		std::Debug << *Pokey;
+	std::Debug << " rejected latched input setup (" << Job.mParams.mCommand << ")" << std::endl;
+}
+
+void TPopPokey::OnPokeyExtBusReply(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	if ( Job.mParams.GetParamAsWithDefault<int>("enabled", 1) != 0 )
+		return;
+	
+	auto Pokey = GetPokey( Job.mChannelMeta.mChannelRef );
+	std::Debug << "pokey ";
+	if ( Pokey )
+		std::Debug << *Pokey;
+	std::Debug << " didn't enable PoExtBus" << std::endl;
+}
+
+void TPopPokey::OnSetOutput(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	auto Output = Job.mParams.GetParamAsWithDefault<int>("output", -1);
+	auto State = Job.mParams.GetParamAsWithDefault<int>("state", 1) != 0;
+	
+	TJobReply Reply(JobAndChannel);
+	auto Pokey = GetPokey( Serial, false );
+	if ( !Pokey )
+	{
+		std::stringstream Error;
+		Error << "no pokey with serial " << Serial;
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else if ( Output < 0 || !Pokey->mOutputs.SetOutput( Output, State ) )
+	{
+		std::stringstream Error;
+		Error << "output " << Output << " out of range, 0-" << (TPokeyOutputs::OutputCount-1);
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else
+	{
+		std::stringstream ReplyString;
+		ReplyString << "pokey " << Serial << " output " << Output << " " << (State ? "on" : "off");
+		Reply.mParams.AddDefaultParam( ReplyString.str() );
+	}
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnSetOutputs(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	auto Outputs = Job.mParams.GetParamAs<std::string>("outputs");
+	auto ExtBus = Job.mParams.GetParamAs<std::string>("extbus");
+	
+	TJobReply Reply(JobAndChannel);
+	auto Pokey = GetPokey( Serial, false );
+	std::stringstream Error;
+	if ( !Pokey )
+	{
+		Error << "no pokey with serial " << Serial;
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else if ( !Pokey->mOutputs.SetOutputs( Outputs, ExtBus, Error ) )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else
+	{
+		std::stringstream Status;
+		Pokey->mOutputs.GetStatus( Status );
+		Reply.mParams.AddDefaultParam( Status.str() );
+	}
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnAddZone(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto Name = Job.mParams.GetParamAs<std::string>("name");
+	auto InterfaceAddress = Job.mParams.GetParamAs<std::string>("interface");
+	auto BroadcastAddress = Job.mParams.GetParamAs<std::string>("broadcast");
+	auto Serials = Job.mParams.GetParamAs<std::string>("serials");
+	
+	//	timed like the main poll, but a zone only gets a cpu or rt priority when it's given its own;
+	//	inheriting them would put every zone on the main poll's cpu
+	auto TimerParams = mPollPokeyThread ? mPollPokeyThread->GetTimerParams() : TPokeyPollTimerParams();
+	TimerParams.mCpu = -1;
+	TimerParams.mPriority = 0;
+	TimerParams.Read( Job.mParams );
+	
+	TJobReply Reply(JobAndChannel);
+	std::stringstream Error;
+	size_t Index = 0;
+	if ( !AddZone( Name, InterfaceAddress, BroadcastAddress, TimerParams, Index, Error ) )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else
+	{
+		//	pokeys can be put in a zone up front as well as by where they're discovered
+		std::stringstream SerialsStream( Serials );
+		std::string Serial;
+		while ( std::getline( SerialsStream, Serial, ',' ) )
+		{
+			if ( Serial.empty() )
+				continue;
+			AssignShard( GetPokey( atoi( Serial.c_str() ), true ), Index );
+		}
+		
+		std::stringstream Status;
+		mShards[Index]->GetStatus( Status );
+		Reply.mParams.AddDefaultParam( Status.str() );
+	}
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnGetZones(TJobAndChannel& JobAndChannel)
+{
+	std::stringstream Status;
+	for ( size_t i=0;	i<mShardCount;	i++ )
+	{
+		mShards[i]->GetStatus( Status );
+		Status << std::endl;
+	}
+	Status << "events ";
+	mEventMerger.GetStatus( Status );
+	
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam( Status.str() );
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnGetCluster(TJobAndChannel& JobAndChannel)
+{
+	std::stringstream Status;
+	if ( mClusterMember )
+	{
+		mClusterMember->GetStatus( Status );
+		Status << std::endl;
+	}
+	if ( mClusterAggregator )
+	{
+		mClusterAggregator->GetStatus( Status );
+		Status << std::endl;
+		Status << "events ";
+		mEventMerger.GetStatus( Status );
+	}
+	if ( !mClusterMember && !mClusterAggregator )
+		Status << "not clustered";
+	
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam( Status.str() );
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnGetOutputs(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	
+	TJobReply Reply(JobAndChannel);
+	auto Pokey = GetPokey( Serial, false );
+	if ( !Pokey )
+	{
+		std::stringstream Error;
+		Error << "no pokey with serial " << Serial;
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else
+	{
+		std::stringstream Status;
+		Pokey->mOutputs.GetStatus( Status );
+		Reply.mParams.AddDefaultParam( Status.str() );
+	}
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnFakeDiscoverPokeys(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	int FakeCount = Job.mParams.GetParamAsWithDefault<int>("count",100);
+	
+	//	trigger x fake jobs
+	for ( int i=0;	i<FakeCount;	i++ )
+	{
+		TJob NewJob;
+		NewJob.mParams.AddParam<int>("serial",9900+i);
+		
+		//	random address
+		std::stringstream Address;
+		int Port = 2600+i;
+		Address << (rand()%256) << '.' << (rand()%256) << '.' << (rand()%256) << '.' << (rand()%256) << ':' << Port;
+		NewJob.mParams.AddParam("address", Address.str() );
+		NewJob.mParams.AddParam("version", "fake" );
+	
+		TJobAndChannel NewJobAndChannel( NewJob, JobAndChannel.GetChannel() );
+		OnDiscoverPokey( NewJobAndChannel );
+	}
+}
+
+void TPopPokey::OnDiscoverPokey(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	UpdateDiscoveredPokey( Job );
+}
+
+std::shared_ptr<TPokeyMeta> TPopPokey::UpdateDiscoveredPokey(TJob& Job)
+{
+	//	grab it's serial and see if it already exists
+	int Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	bool DhcpEnabled = Job.mParams.GetParamAsWithDefault<int>("dhcpenabled", 0)!=0;
 	auto Address = Job.mParams.GetParamAs<std::string>("address");
 	auto Version = Job.mParams.GetParamAs<std::string>("version");
 //	std::Debug << "discovered pokey #" << Serial << " at " << Address << " v" << Version << std::endl;
 	if ( Serial == -1 )
 	{
 		std::Debug << "got pokey discovery with no/invalid serial; " << Job.mParams << std::endl;
-		return;
+		return nullptr;
 	}
 	
+	//	another instance in the cluster polls this one
+	if ( !IsClusterOwned( Serial ) )
+		return nullptr;
+	
 	//	get pokey with this serial
 	auto Pokey = GetPokey( Serial, true );
 	if ( !Pokey )
 	{
 		std::Debug << "failed to create/find existing pokey after discovery; " << Job.mParams << std::endl;
-		return;
+		return nullptr;
 	}
+	
+	//	a cluster member has it, don't take its connection
+	if ( Pokey->mRemote != -1 )
+		return nullptr;
 
 	//	update pokey meta, and if the channel differs (new, or replaced), then replace it
 	bool Changed = false;
 	//	todo: kill old channel
-	bool NewAddress = (Pokey->mAddress != Address);
-
-	if ( Pokey->mVersion != Version )
-	{
-		Pokey->mVersion = Version;
+	if ( Pokey->SetVersion( Version ) )
 		Changed = true;
-	}
 
 	if ( Pokey->mDhcpEnabled != DhcpEnabled )
 	{
@@ -606,117 +1460,256 @@ void TPopPokey::OnDiscoverPokey(TJobAndChannel& JobAndChannel)
 		Changed = true;
 	}
 
+	auto OldAddress = Pokey->GetAddress();
+	bool NewAddress = Pokey->SetAddress( Address );
 	if ( NewAddress )
 	{
-		if ( !Pokey->mAddress.empty() )
-			std::Debug << "Pokey " << *Pokey << " changed address: " << Address << std::endl;
-
-		Pokey->mAddress = Address;
+		if ( !OldAddress.empty() )
+			std::Debug << "Pokey " << *Pokey << " changed address from " << OldAddress << std::endl;
 		Changed = true;
 	}
 	
 	//	if the pokey has changed address, or had no channel, make a new channel
 	//	we cannot currently determine if the existing channel matches the address... this job won't come from the pokey's channel
-	if ( NewAddress || !Pokey->mChannelRef.IsValid() )
+	if ( NewAddress || !Pokey->GetChannelRef().IsValid() )
 	{
-		bool CreateChannel = true;
-		
-		if ( Pokey->HasBootupAddress() )
-		{
-			std::Debug << "skipping channel creation on pokey (bootup ip) " << *Pokey << std::endl;
-			CreateChannel = false;
-		}
-		else if ( Pokey->mIgnored )
-		{
-			//	gr: commented out for now as it's a bit spammy
-			//std::Debug << "skipping channel creation on pokey (ignored) " << *Pokey << std::endl;
-			CreateChannel = false;
-		}
-		else if ( Pokey->mChannelRef.IsValid() )
-		{
-			std::Debug << "replacing channel on pokey " << *Pokey << std::endl;
-		}
-		else
-		{
-			std::Debug << "creating new channel on pokey " << *Pokey << std::endl;
-		}
-		
-		if ( CreateChannel )
-		{
-			//	create a new pokey channel
-			SoyRef ChannelRef(Soy::StreamToString(std::stringstream() << Serial).c_str());
-			Pokey->mChannelRef = FindUnusedChannelRef(ChannelRef);
+		auto OldChannelRef = Pokey->GetChannelRef();
+		CreatePokeyChannel( *Pokey );
+		if ( Pokey->GetChannelRef() != OldChannelRef )
 			Changed = true;
-			
-			std::shared_ptr<TChannel> PokeyChannel(new TChan<TChannelSocketTcpClient, TProtocolPokey>(Pokey->mChannelRef, Pokey->mAddress));
-			AddChannel(PokeyChannel);
-		}
 	}
 	
 	if ( Changed )
+	{
 		std::Debug << "Updated Pokey " << (*Pokey) << std::endl;
+		SaveAddressCache();
+	}
+	
+	return Pokey;
 }
 
-void TPopPokey::OnInitPokey(TJobAndChannel& JobAndChannel)
+void TPopPokey::CreatePokeyChannel(TPokeyMeta& Pokey)
 {
-	auto& Job = JobAndChannel.GetJob();
+	bool CreateChannel = true;
 	
-	auto RefString = Job.mParams.GetParamAs<std::string>("ref");
-	SoyRef Ref( RefString.c_str() );
-	auto Address = Job.mParams.GetParamAs<std::string>("address");
-
-	if ( !Ref.IsValid() )
+	if ( Pokey.HasBootupAddress() )
 	{
-		TJobReply Reply( JobAndChannel );
-		std::stringstream Error;
-		Error << RefString << " not a valid ref";
-		Reply.mParams.AddErrorParam(Error.str());
-		
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted( Reply );
-		return;
+		std::Debug << "skipping channel creation on pokey (bootup ip) " << Pokey << std::endl;
+		CreateChannel = false;
+	}
+	else if ( Pokey.mIgnored )
+	{
+		//	gr: commented out for now as it's a bit spammy
+		//std::Debug << "skipping channel creation on pokey (ignored) " << Pokey << std::endl;
+		CreateChannel = false;
+	}
+	else if ( Pokey.GetChannelRef().IsValid() )
+	{
+		std::Debug << "replacing channel on pokey " << Pokey << std::endl;
+		if ( Pokey.mMetrics )
+			Pokey.mMetrics->OnNewChannel();
+	}
+	else
+	{
+		std::Debug << "creating new channel on pokey " << Pokey << std::endl;
 	}
+	
+	if ( !CreateChannel )
+		return;
 
 	//	create a new pokey channel
-	std::shared_ptr<TChannel> PokeyChannel( new TChan<TChannelSocketTcpClient,TProtocolPokey>( Ref, Address ) );
-	AddChannel( PokeyChannel );
-	
-	TJobReply Reply( JobAndChannel );
-	std::stringstream Debug;
-	Debug << "Added new channel " + PokeyChannel->GetDescription();
-	Reply.mParams.AddDefaultParam( Debug.str() );
+	//	gr: channels connect on their own thread, so creating a batch of these connects them in parallel
+	SoyRef ChannelRef(Soy::StreamToString(std::stringstream() << Pokey.mSerial).c_str());
+	ChannelRef = FindUnusedChannelRef(ChannelRef);
+	Pokey.SetChannelRef( ChannelRef );
 	
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	std::shared_ptr<TChannel> PokeyChannel(new TChan<TChannelSocketTcpClient, TProtocolPokey>(ChannelRef, Pokey.GetAddress()));
+	AddChannel(PokeyChannel);
 }
 
-void TPopPokey::OnSetupPokey(TJobAndChannel& JobAndChannel)
+bool TPopPokey::LoadAddressCache(const std::string& Filename,std::stringstream& Error)
 {
-	auto& Job = JobAndChannel.GetJob();
-
-	//	get the required params
-	auto GridMap = Job.mParams.GetParamAs<std::string>("gridmap");
-
-	//	how do we identify the pokey
-	int Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	{
+		std::lock_guard<std::mutex> Lock( mAddressCacheLock );
+		mAddressCacheFilename = Filename;
+	}
+	if ( !mAddressCacheThread && !Filename.empty() )
+	{
+		mAddressCacheThread.reset( new TPokeyAddressCacheThread( [this]{	WriteAddressCache();	} ) );
+		mAddressCacheThread->Start();
+	}
+	
+	Array<std::string> Lines;
+	if ( !Soy::FileToStringLines( Filename, GetArrayBridge(Lines), Error ) )
+		return false;
 
-	if ( Serial == -1 )
+	//	one pokey per line; serial address version dhcp
+	int CachedCount = 0;
+	for ( int i=0;	i<Lines.GetSize();	i++ )
 	{
-		TJobReply Reply(JobAndChannel);
-		std::stringstream Error;
-		Error << "failed to parse serial param when setting gridmap=" << GridMap;
-		Reply.mParams.AddErrorParam(Error.str());
+		auto& Line = Lines[i];
+		if ( Line.empty() || Line[0] == '#' )
+			continue;
+		
+		std::stringstream LineStream( Line );
+		int Serial = -1;
+		std::string Address;
+		std::string Version;
+		int DhcpEnabled = 0;
+		LineStream >> Serial >> Address >> Version >> DhcpEnabled;
+		if ( LineStream.fail() || Serial == -1 || Address.empty() )
+		{
+			Error << "bad address cache line " << (i+1) << ": " << Line << std::endl;
+			continue;
+		}
+		
+		if ( !IsClusterOwned( Serial ) )
+			continue;
 
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted(Reply);
-		return;
+		auto Pokey = GetPokey( Serial, true );
 
+		//	already found by discovery, which is more recent than us
+		if ( !Pokey->GetAddress().empty() )
+			continue;
+		
+		Pokey->SetAddress( Address );
+		Pokey->SetVersion( Version );
+		Pokey->mDhcpEnabled = (DhcpEnabled != 0);
+		
+		//	connect straight away. If the address is stale, discovery will replace the channel when the pokey answers
+		if ( !Pokey->GetChannelRef().IsValid() )
+			CreatePokeyChannel( *Pokey );
+		CachedCount++;
 	}
+	
+	std::Debug << "Restored " << CachedCount << " pokeys from address cache " << Filename << std::endl;
+	return true;
+}
 
-	//	fetch pokey
+void TPopPokey::SaveAddressCache()
+{
+	//	discovery threads shouldn't wait on the disk
+	if ( mAddressCacheThread )
+		mAddressCacheThread->Save();
+}
+
+void TPopPokey::WriteAddressCache()
+{
+	std::string Filename;
+	{
+		std::lock_guard<std::mutex> Lock( mAddressCacheLock );
+		Filename = mAddressCacheFilename;
+	}
+	if ( Filename.empty() )
+		return;
+	
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	GetPokeys( GetArrayBridge(Pokeys) );
+
+	std::stringstream Cache;
+	Cache << "# serial address version dhcp. Written by PopPokey whenever discovery changes a pokey" << std::endl;
+	for ( int i=0;	i<Pokeys.GetSize();	i++ )
+	{
+		auto& pPokey = Pokeys[i];
+		if ( !pPokey )
+			continue;
+		auto& Pokey = *pPokey;
+
+		//	nothing useful to reconnect to
+		auto Address = Pokey.GetAddress();
+		auto Version = Pokey.GetVersion();
+		if ( Address.empty() || Pokey.HasBootupAddress() )
+			continue;
+		if ( Version == "fake" )
+			continue;
+		
+		Cache << Pokey.mSerial << " " << Address << " " << (Version.empty() ? "?" : Version) << " " << (Pokey.mDhcpEnabled ? 1 : 0) << std::endl;
+	}
+	
+	//	write to a temp file and swap it in so a crash mid-write never leaves a truncated cache
+	auto TempFilename = Filename + ".tmp";
+	{
+		std::ofstream File( TempFilename, std::ios::out | std::ios::trunc );
+		File << Cache.str();
+		if ( !File.good() )
+		{
+			std::Debug << "Failed to write pokey address cache " << TempFilename << std::endl;
+			return;
+		}
+	}
+	std::remove( Filename.c_str() );
+	if ( std::rename( TempFilename.c_str(), Filename.c_str() ) != 0 )
+		std::Debug << "Failed to replace pokey address cache " << Filename << std::endl;
+}
+
+void TPopPokey::OnInitPokey(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	
+	auto RefString = Job.mParams.GetParamAs<std::string>("ref");
+	SoyRef Ref( RefString.c_str() );
+	auto Address = Job.mParams.GetParamAs<std::string>("address");
+
+	if ( !Ref.IsValid() )
+	{
+		TJobReply Reply( JobAndChannel );
+		std::stringstream Error;
+		Error << RefString << " not a valid ref";
+		Reply.mParams.AddErrorParam(Error.str());
+		
+		TChannel& Channel = JobAndChannel;
+		Channel.OnJobCompleted( Reply );
+		return;
+	}
+
+	//	create a new pokey channel
+	std::shared_ptr<TChannel> PokeyChannel( new TChan<TChannelSocketTcpClient,TProtocolPokey>( Ref, Address ) );
+	AddChannel( PokeyChannel );
+	
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Debug;
+	Debug << "Added new channel " + PokeyChannel->GetDescription();
+	Reply.mParams.AddDefaultParam( Debug.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted( Reply );
+}
+
+void TPopPokey::OnSetupPokey(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+
+	//	get the required params
+	auto GridMap = Job.mParams.GetParamAs<std::string>("gridmap");
+
+	//	how do we identify the pokey
+	int Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+
+	if ( Serial == -1 )
+	{
+		TJobReply Reply(JobAndChannel);
+		std::stringstream Error;
+		Error << "failed to parse serial param when setting gridmap=" << GridMap;
+		Reply.mParams.AddErrorParam(Error.str());
+
+		TChannel& Channel = JobAndChannel;
+		Channel.OnJobCompleted(Reply);
+		return;
+
+	}
+
+	//	fetch pokey
 	std::shared_ptr<TPokeyMeta> Pokey = GetPokey(Serial, true);
 	std::stringstream Error;
 	Pokey->SetGridMap(GridMap, Error);
+	
+	int Latch = Job.mParams.GetParamAsWithDefault<int>("latch", -1);
+	if ( Latch != -1 )
+	{
+		//	the poll thread reads it to set up latching, same as a config reload
+		std::lock_guard<std::mutex> Lock( Pokey->mStateLock );
+		Pokey->mLatchEnabled = (Latch != 0);
+	}
 
 	TJobReply Reply(JobAndChannel);
 
@@ -767,7 +1760,14 @@ void TPopPokey::GetConnectedStatus(std::ostream& Status)
 		
 		PokeyCount++;
 		
-		auto pChannel = GetChannel(Pokey->mChannelRef);
+		if ( Pokey->mRemote != -1 )
+		{
+			if ( Pokey->mRemoteConnected )
+				PokeyConnectedCount++;
+			continue;
+		}
+		
+		auto pChannel = GetChannel(Pokey->GetChannelRef());
 		if ( pChannel )
 		{
 			if ( pChannel->IsConnected() )
@@ -780,316 +1780,1182 @@ void TPopPokey::GetConnectedStatus(std::ostream& Status)
 
 
 
-void TPopPokey::GetIgnoredPinStatus(std::ostream& Status)
+void TPopPokey::GetIgnoredPinStatus(std::ostream& Status)
+{
+	//	list any pokeys with ignored pins. Usually there are none, which the board states can say
+	//	without visiting every pokey
+	if ( !TPokeyBoardStates::Get().HasStuckPins() )
+		return;
+
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	GetPokeys( GetArrayBridge(Pokeys) );
+	
+	for ( int p = 0; p < Pokeys.GetSize(); p++ )
+	{
+		auto& pPokey = Pokeys[p];
+		if ( !pPokey )
+			continue;
+		auto& Pokey = *pPokey;
+		if ( Pokey.mIgnored )
+			continue;
+		
+		//	get list of ignored pins, as of one sample
+		std::stringstream PinsStatus;
+		{
+			std::lock_guard<std::mutex> Lock( Pokey.mStateLock );
+			BufferArray<size_t,100> IgnoredPins;
+			Pokey.GetIgnoredPins( GetArrayBridge(IgnoredPins) );
+			for ( int ipi=0;	ipi<IgnoredPins.GetSize();	ipi++ )
+			{
+				auto Pin = IgnoredPins[ipi];
+				//	gr: display pin indexes from 1
+				PinsStatus << (Pin+1) << "(" << Pokey.GetPinGridCoord(Pin) << "; " << Pokey.GetPinDownDuration(Pin) << "secs) ";
+			}
+		}
+		
+		if ( PinsStatus.str().empty() )
+			continue;
+		
+		Status << Pokey << " ignoring pins " << PinsStatus.str() << std::endl;
+	}
+}
+
+
+
+void TPopPokey::OnGetStatus(TJobAndChannel& JobAndChannel)
+{
+	//	make up a status string
+	std::stringstream Status;
+	GetStatus( Status );
+	
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam( Status.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::GetStatus(std::ostream& Status)
+{
+	GetConnectedStatus( Status );
+	GetIgnoredPinStatus( Status );
+	
+	{
+		std::lock_guard<std::mutex> Lock( mConfigLock );
+		if ( !mConfigError.empty() )
+			Status << mConfigError << std::endl;
+	}
+	
+	auto Capture = TProtocolPokey::GetCapture();
+	if ( Capture )
+	{
+		Capture->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	if ( mReplayThread )
+	{
+		mReplayThread->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	if ( mPollPokeyThread && mPollPokeyThread->GetTimerParams().IsRealtime() )
+	{
+		mPollPokeyThread->GetTimerStatus( Status );
+		Status << std::endl;
+	}
+	
+	if ( mClusterMember )
+	{
+		mClusterMember->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	if ( mClusterAggregator )
+	{
+		mClusterAggregator->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	if ( mHttpServer )
+	{
+		mHttpServer->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	mTracker.GetStatus( Status );
+	Status << std::endl;
+	
+	mHeatmap.GetStatus( Status );
+	Status << std::endl;
+	
+	mTriggerZones.GetStatus( Status );
+	Status << std::endl;
+	
+	mSubscriptions.GetStatus( Status );
+	Status << std::endl;
+	
+	mFloorSnapshot.GetStatus( Status );
+	Status << std::endl;
+	
+	if ( mPollMailbox )
+	{
+		mPollMailbox->GetStatus( Status );
+		Status << std::endl;
+	}
+	for ( size_t i=0;	i<mShardCount;	i++ )
+	{
+		if ( !mShards[i]->mPollMailbox )
+			continue;
+		mShards[i]->mPollMailbox->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	mLaserGate.GetStatus( Status );
+	Status << std::endl;
+	if ( mLaserGatePoller )
+	{
+		mLaserGatePoller->GetStatus( Status );
+		Status << std::endl;
+	}
+	
+	if ( mEventStore )
+	{
+		mEventStore->GetStatus( Status );
+		Status << std::endl;
+	}
+}
+
+
+void TPopPokey::OnListPokeys(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
+
+	std::stringstream ReplyString;
+	GetPokeyList( ReplyString );
+	
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::GetPokeyList(std::ostream& ReplyString)
+{
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	GetPokeys( GetArrayBridge(Pokeys) );
+
+	for ( int i = 0; i < Pokeys.GetSize(); i++ )
+	{
+		//	get channel state
+		auto& pPokey = Pokeys[i];
+		if ( !pPokey )
+			continue;
+		auto& Pokey = *pPokey;
+		
+		auto pChannel = GetChannel(Pokey.GetChannelRef());
+		std::string ConnectionStatus;
+		if ( Pokey.mRemote != -1 )
+			ConnectionStatus = std::string( Pokey.mRemoteConnected ? "connected" : "disconnected" ) + " via " + ( mClusterAggregator ? mClusterAggregator->GetMemberName( Pokey.mRemote ) : std::string("?") );
+		else if ( !pChannel )
+			ConnectionStatus = "never connected";
+		else if ( !pChannel->IsConnected() )
+			ConnectionStatus = "disconnected";
+		else
+			ConnectionStatus = "connected";
+
+		auto TimeSinceUpdate = Pokey.GetTimeSinceUpdate();
+		
+		ReplyString << Pokey << " " << ConnectionStatus;
+		
+		if ( TimeSinceUpdate >= 0.f )
+			ReplyString << " (" << TimeSinceUpdate << "s ago)";
+
+		ReplyString << std::endl;
+	}
+}
+
+
+void TPopPokey::OnEnableDiscovery(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
+
+	bool OldState;
+	bool NewState = EnableDiscovery(true, OldState);
+
+	std::stringstream ReplyString;
+	ReplyString << "broadcast now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
+	std::Debug << ReplyString.str() << std::endl;
+
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnDisableDiscovery(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
+
+	bool OldState;
+	bool NewState = EnableDiscovery(false, OldState);
+
+	std::stringstream ReplyString;
+	ReplyString << "broadcast now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
+	std::Debug << ReplyString.str() << std::endl;
+
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnEnablePoll(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
+
+	bool OldState;
+	bool NewState = EnablePoll(true, OldState);
+
+	std::stringstream ReplyString;
+	ReplyString << "pokey poll now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
+	std::Debug << ReplyString.str() << std::endl;
+
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnDisablePoll(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
+
+	bool OldState;
+	bool NewState = EnablePoll(false, OldState);
+
+	std::stringstream ReplyString;
+	ReplyString << "pokey poll now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
+	std::Debug << ReplyString.str() << std::endl;
+
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+
+void TPopPokey::OnPushGridCoord(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	
+	vec2x<int> GridCoord;
+	GridCoord.x = Job.mParams.GetParamAsWithDefault<int>("pinx", -1);
+	GridCoord.y = Job.mParams.GetParamAsWithDefault<int>("piny", -1);
+	PushGridCoord( GridCoord );
+	
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Debug;
+	Debug << "Set grid coord to " << GridCoord;
+	Reply.mParams.AddDefaultParam( Debug.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted( Reply );
+}
+
+void TPopPokey::OnPopGridCoord(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	
+	TJobReply Reply( JobAndChannel );
+	std::stringstream ReplyString;
+	GetPopGridCoord( ReplyString );
+	Reply.mParams.AddDefaultParam( ReplyString.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted( Reply );
+}
+
+void TPopPokey::WriteGridCoord(std::ostream& ReplyString,vec2x<int> GridCoord)
+{
+	if ( GridCoord == TPokeyMeta::GridCoordLaserGate )
+		ReplyString << "lasergate";
+	else
+		ReplyString << GridCoord;
+}
+
+void TPopPokey::WriteLaserGateState(std::ostream& ReplyString,bool State)
+{
+	ReplyString << ( State ? "lasergate_on" : "lasergate_off" );
+}
+
+void TPopPokey::GetPopGridCoord(std::ostream& ReplyString)
+{
+	mLastGridCoordLock.lock();
+	auto LastGridCoord = PopGridCoordLocked();
+	auto Trace = TakeGridCoordTraceLocked();
+	mLastGridCoordLock.unlock();
+	OnTraceDelivered( Trace );
+	
+	WriteGridCoord( ReplyString, LastGridCoord );
+}
+
+
+void TPopPokey::OnPeekGridCoord(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	GetPeekGridCoord( ReplyString );
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::GetPeekGridCoord(std::ostream& ReplyString)
+{
+	TPokeyTrace Trace;
+	mLastGridCoordLock.lock();
+	auto LastGridCoord = PeekGridCoordLocked( Soy::GetMonotonicNs() );
+	if ( LastGridCoord != TPokeyMeta::GridCoordInvalid )
+		Trace = TakeGridCoordTraceLocked();
+	mLastGridCoordLock.unlock();
+	OnTraceDelivered( Trace );
+
+	WriteGridCoord( ReplyString, LastGridCoord );
+}
+
+void TPopPokey::OnPushLaserGateState(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	
+	bool State = false;
+	State = Job.mParams.GetParamAsWithDefault<int>("state", 0) != 0;
+	PushLaserGateState( State );
+	
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Debug;
+	Debug << "Set laser gate state to " << State;
+	Reply.mParams.AddDefaultParam( Debug.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted( Reply );
+}
+
+void TPopPokey::OnPopLaserGateState(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	GetPopLaserGateState( ReplyString );
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::GetPopLaserGateState(std::ostream& ReplyString)
+{
+	mLastGridCoordLock.lock();
+	auto LastState = PopLaserGateLocked();
+	mLastGridCoordLock.unlock();
+
+	WriteLaserGateState( ReplyString, LastState );
+}
+
+
+void TPopPokey::OnPeekLaserGateState(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	GetPeekLaserGateState( ReplyString );
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::GetPeekLaserGateState(std::ostream& ReplyString)
+{
+	mLastGridCoordLock.lock();
+	auto LastState = PeekLaserGateLocked( Soy::GetMonotonicNs() );
+	mLastGridCoordLock.unlock();
+
+	WriteLaserGateState( ReplyString, LastState );
+}
+
+bool TPopPokey::HasPeekExpired(uint64 SetNs,uint64 NowNs)
+{
+	//	if its been X secs since it was changed, then peeks don't see it
+	return NowNs > SetNs && (NowNs - SetNs) / 1000000 > 1000;
+}
+
+vec2x<int> TPopPokey::PeekGridCoordLocked(uint64 NowNs)
+{
+	if ( HasPeekExpired( mLastGridCoordNs, NowNs ) )
+		return TPokeyMeta::GridCoordInvalid;
+	return mLastGridCoord;
+}
+
+vec2x<int> TPopPokey::PopGridCoordLocked()
+{
+	auto GridCoord = mLastGridCoord;
+	mLastGridCoord = TPokeyMeta::GridCoordInvalid;
+	return GridCoord;
+}
+
+bool TPopPokey::PushGridCoordLocked(vec2x<int> GridCoord,TPokeyTrace* Trace,uint64 NowNs)
+{
+	if ( GridCoord == TPokeyMeta::GridCoordLaserGate )
+	{
+		PushLaserGateLocked( true, NowNs );
+		return false;
+	}
+	
+	//	the trace belongs to the press that set the coord, so any push replaces it, traced or not
+	bool DroppedTrace = mLastGridCoordTrace.IsValid();
+	mLastGridCoord = GridCoord;
+	mLastGridCoordNs = NowNs;
+	mLastGridCoordTrace = TPokeyTrace();
+	if ( Trace )
+	{
+		Trace->Stamp( TPokeyTraceStage::Published );
+		mLastGridCoordTrace = *Trace;
+	}
+	return DroppedTrace;
+}
+
+bool TPopPokey::PeekLaserGateLocked(uint64 NowNs)
+{
+	//	a beam that's still broken stays on however long ago it broke
+	if ( mLaserGate.IsBroken() )
+		return true;
+	return mLaserGateState && !HasPeekExpired( mLastLaserGateNs, NowNs );
+}
+
+bool TPopPokey::PopLaserGateLocked()
+{
+	auto State = mLaserGateState;
+	mLaserGateState = false;
+	return State;
+}
+
+void TPopPokey::PushLaserGateLocked(bool State,uint64 NowNs)
+{
+	mLaserGateState = State;
+	mLastLaserGateNs = NowNs;
+}
+
+TPokeyTrace TPopPokey::TakeGridCoordTraceLocked()
+{
+	TPokeyTrace Trace;
+	std::swap( Trace, mLastGridCoordTrace );
+	return Trace;
+}
+
+void TPopPokey::OnTraceDelivered(TPokeyTrace& Trace)
+{
+	if ( !Trace.IsValid() )
+		return;
+	
+	Trace.Stamp( TPokeyTraceStage::Delivered );
+	TPokeyTracer::Get().OnDelivered( Trace );
+}
+
+
+void TPopPokey::OnBatch(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto Commands = Job.mParams.GetParamAs<std::string>("commands");
+	auto Json = Job.mParams.GetParamAsWithDefault<std::string>("format", "text") == "json";
+	
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	std::stringstream Error;
+	if ( GetBatchReply( Commands, Json, ReplyString, Error ) )
+		Reply.mParams.AddDefaultParam( ReplyString.str() );
+	else
+		Reply.mParams.AddErrorParam( Error.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+bool TPopPokey::GetBatchReply(const std::string& Commands,bool Json,std::ostream& ReplyString,std::stringstream& Error)
+{
+	Array<TPokeyBatchCommand> Batch;
+	if ( !TPokeyBatch::Parse( Commands, GetArrayBridge(Batch), Error ) )
+		return false;
+	
+	Array<std::string> Replies;
+	if ( !RunBatch( GetArrayBridge(Batch), GetArrayBridge(Replies), Error ) )
+		return false;
+	
+	if ( Json )
+		TPokeyBatch::WriteJson( GetArrayBridge(Batch), GetArrayBridge(Replies), ReplyString );
+	else
+		TPokeyBatch::WriteText( GetArrayBridge(Batch), GetArrayBridge(Replies), ReplyString );
+	return true;
+}
+
+bool TPopPokey::RunBatch(const ArrayBridge<TPokeyBatchCommand>& Batch,ArrayBridge<std::string>&& Replies,std::stringstream& Error)
+{
+	//	check everything first so a bad command doesn't leave the others half done
+	for ( int i=0;	i<Batch.GetSize();	i++ )
+	{
+		auto& Command = Batch[i].mLowerCommand;
+		bool Known = Command == "popgridcoord" || Command == "peekgridcoord" || Command == "pushgridcoord" ||
+					Command == "poplasergate" || Command == "peeklasergate" || Command == "pushlasergate" ||
+					Command == "error" || Command == "list";
+		if ( !Known )
+		{
+			Error << Batch[i].mCommand << " can't be batched";
+			return false;
+		}
+	}
+	
+	//	status and list take their own locks, so they're done before the coord lock rather than under it;
+	//	they're from just before the coord and gate commands, not part of their snapshot
+	for ( int i=0;	i<Batch.GetSize();	i++ )
+	{
+		auto& Command = Batch[i].mLowerCommand;
+		std::stringstream Reply;
+		if ( Command == "error" )
+			GetStatus( Reply );
+		else if ( Command == "list" )
+			GetPokeyList( Reply );
+		Replies.PushBack( Reply.str() );
+	}
+	
+	//	the coord and gate commands all see one state; nothing pushed by the poll thread lands between them
+	size_t PushCount = 0;
+	size_t DroppedTraceCount = 0;
+	Array<TPokeyTrace> DeliveredTraces;
+	{
+		std::lock_guard<std::mutex> Lock( mLastGridCoordLock );
+		auto NowNs = Soy::GetMonotonicNs();
+		
+		for ( int i=0;	i<Batch.GetSize();	i++ )
+		{
+			auto& Command = Batch[i];
+			std::stringstream Reply;
+			
+			if ( Command.mLowerCommand == "popgridcoord" )
+			{
+				WriteGridCoord( Reply, PopGridCoordLocked() );
+				DeliveredTraces.PushBack( TakeGridCoordTraceLocked() );
+			}
+			else if ( Command.mLowerCommand == "peekgridcoord" )
+			{
+				auto GridCoord = PeekGridCoordLocked( NowNs );
+				WriteGridCoord( Reply, GridCoord );
+				if ( GridCoord != TPokeyMeta::GridCoordInvalid )
+					DeliveredTraces.PushBack( TakeGridCoordTraceLocked() );
+			}
+			else if ( Command.mLowerCommand == "pushgridcoord" )
+			{
+				vec2x<int> GridCoord( Command.GetParamAsInt("pinx",-1), Command.GetParamAsInt("piny",-1) );
+				if ( PushGridCoordLocked( GridCoord, nullptr, NowNs ) )
+					DroppedTraceCount++;
+				PushCount++;
+				Reply << "Set grid coord to " << GridCoord;
+			}
+			else if ( Command.mLowerCommand == "poplasergate" )
+			{
+				WriteLaserGateState( Reply, PopLaserGateLocked() );
+			}
+			else if ( Command.mLowerCommand == "peeklasergate" )
+			{
+				WriteLaserGateState( Reply, PeekLaserGateLocked( NowNs ) );
+			}
+			else if ( Command.mLowerCommand == "pushlasergate" )
+			{
+				bool State = Command.GetParamAsInt("state",0) != 0;
+				PushLaserGateLocked( State, NowNs );
+				PushCount++;
+				Reply << "Set laser gate state to " << State;
+			}
+			else
+			{
+				continue;
+			}
+			Replies[i] = Reply.str();
+		}
+	}
+	
+	for ( size_t i=0;	i<PushCount;	i++ )
+		TPokeyMetrics::Get().OnEventPushed();
+	for ( size_t i=0;	i<DroppedTraceCount;	i++ )
+		TPokeyTracer::Get().OnDropped();
+	for ( int i=0;	i<DeliveredTraces.GetSize();	i++ )
+		OnTraceDelivered( DeliveredTraces[i] );
+	return true;
+}
+
+
+void TPopPokey::OnIgnorePokey(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	
+	auto Serial = Job.mParams.GetParamAs<int>("serial");
+	auto NewIgnore = Job.mParams.GetParamAsWithDefault<int>("ignore",true);
+	
+	//	fetch pokey
+	std::shared_ptr<TPokeyMeta> Pokey = GetPokey(Serial, true);
+	
+	auto OldIgnore = Pokey->mIgnored;
+	Pokey->mIgnored = NewIgnore;
+
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	ReplyString << "Updated Pokey " << ( *Pokey ) << ", " << (NewIgnore ? "IGNORED" : "NOT ignored" ) << ", was " << ( OldIgnore ? "IGNORED" : "NOT ignored" ) << std::endl;
+	
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+	
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnReloadConfig(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	
+	auto Filename = Job.mParams.GetParamAs<std::string>("filename");
+	if ( Filename.empty() )
+		Filename = mConfigFilename;
+
+	//	parsed on the config thread and swapped in by the poll thread when it's ready
+	mConfigThread->Reload( Filename );
+	
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	ReplyString << "reloading config " << Filename;
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnWatchConfig(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	bool Watch = Job.mParams.GetParamAsWithDefault<int>("watch", 1) != 0;
+	
+	TJobReply Reply(JobAndChannel);
+	std::stringstream ReplyString;
+	
+	if ( Watch )
+	{
+		std::stringstream Error;
+		if ( mConfigThread->Watch( mConfigFilename, Error ) )
+			ReplyString << "watching config " << mConfigFilename;
+		else
+			Reply.mParams.AddErrorParam( Error.str() );
+	}
+	else
+	{
+		mConfigThread->Unwatch();
+		ReplyString << "stopped watching config " << mConfigFilename;
+	}
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnStartCapture(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto Filename = Job.mParams.GetParamAs<std::string>("filename");
+	
+	TJobReply Reply(JobAndChannel);
+	std::stringstream Error;
+	if ( StartCapture( Filename, Error ) )
+		Reply.mParams.AddDefaultParam( "capturing to " + Filename );
+	else
+		Reply.mParams.AddErrorParam( Error.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnStopCapture(TJobAndChannel& JobAndChannel)
+{
+	std::stringstream ReplyString;
+	auto Capture = TProtocolPokey::GetCapture();
+	if ( Capture )
+		Capture->GetStatus( ReplyString );
+	else
+		ReplyString << "not capturing";
+	
+	StopCapture();
+	
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam(ReplyString.str());
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
+
+void TPopPokey::OnGetMetrics(TJobAndChannel& JobAndChannel)
 {
-	//	list any pokeys with ignored pins
-
-	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
-	GetPokeys( GetArrayBridge(Pokeys) );
+	std::stringstream Metrics;
+	TPokeyMetrics::Get().WritePrometheus( Metrics );
+	TPokeyTracer::Get().WritePrometheus( Metrics );
 	
-	for ( int p = 0; p < Pokeys.GetSize(); p++ )
-	{
-		auto& pPokey = Pokeys[p];
-		if ( !pPokey )
-			continue;
-		auto& Pokey = *pPokey;
-		if ( Pokey.mIgnored )
-			continue;
-		
-		//	get list of ignored pins
-		BufferArray<size_t,100> IgnoredPins;
-		Pokey.GetIgnoredPins( GetArrayBridge(IgnoredPins) );
-		
-		if ( IgnoredPins.IsEmpty() )
-			continue;
-		
-		Status << Pokey << " ignoring pins ";
-		for ( int ipi=0;	ipi<IgnoredPins.GetSize();	ipi++ )
-		{
-			auto Pin = IgnoredPins[ipi];
-			//	gr: display pin indexes from 1
-			Status << (Pin+1) << "(" << Pokey.GetPinGridCoord(Pin) << "; " << Pokey.GetPinDownDuration(Pin) << "secs) ";
-		}
-		Status << std::endl;
-	}
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam(Metrics.str());
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
 }
 
-
-
-void TPopPokey::OnGetStatus(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnGetMetricsJson(TJobAndChannel& JobAndChannel)
 {
-	//	make up a status string
-	std::stringstream Status;
-	
-	GetConnectedStatus( Status );
-	GetIgnoredPinStatus( Status );
+	std::stringstream Metrics;
+	TPokeyMetrics::Get().WriteJson( Metrics );
 	
 	TJobReply Reply(JobAndChannel);
-	Reply.mParams.AddDefaultParam( Status.str() );
+	Reply.mParams.AddDefaultParam(Metrics.str());
 	
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
+void TPopPokey::OnGetTraceStats(TJobAndChannel& JobAndChannel)
+{
+	std::stringstream Stats;
+	TPokeyTracer::Get().WriteJson( Stats );
+	
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam(Stats.str());
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
 
-void TPopPokey::OnListPokeys(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnGetTraceDump(TJobAndChannel& JobAndChannel)
 {
+	//	save the reply as .json and load it in chrome://tracing or perfetto
+	std::stringstream Dump;
+	TPokeyTracer::Get().WriteChromeTrace( Dump );
+	
 	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam(Dump.str());
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
 
-	std::stringstream ReplyString;
-	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
-	GetPokeys( GetArrayBridge(Pokeys) );
+void TPopPokey::OnGetFloorFrame(TJobAndChannel& JobAndChannel)
+{
+	TJobReply Reply(JobAndChannel);
 
-	for ( int i = 0; i < Pokeys.GetSize(); i++ )
+	TPokeyFloorFrame Frame;
+	if ( mFrameAssembler.GetLatestFrame( Frame ) )
 	{
-		//	get channel state
-		auto& pPokey = Pokeys[i];
-		if ( !pPokey )
-			continue;
-		auto& Pokey = *pPokey;
-		
-		auto pChannel = GetChannel(Pokey.mChannelRef);
-		std::string ConnectionStatus;
-		if ( !pChannel )
-			ConnectionStatus = "never connected";
-		else if ( !pChannel->IsConnected() )
-			ConnectionStatus = "disconnected";
-		else
-			ConnectionStatus = "connected";
-
-		auto TimeSinceUpdate = Pokey.GetTimeSinceUpdate();
-		
-		ReplyString << Pokey << " " << ConnectionStatus;
-		
-		if ( TimeSinceUpdate >= 0.f )
-			ReplyString << " (" << TimeSinceUpdate << "s ago)";
-
-		ReplyString << std::endl;
+		std::stringstream FrameJson;
+		Frame.WriteJson( FrameJson );
+		Reply.mParams.AddDefaultParam( FrameJson.str() );
+	}
+	else
+	{
+		Reply.mParams.AddErrorParam( std::string("no floor frame yet") );
 	}
-
 	
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
-
-void TPopPokey::OnEnableDiscovery(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnGetTracks(TJobAndChannel& JobAndChannel)
 {
+	Array<TPokeyTrackEvent> Tracks;
+	mTracker.GetTracks( GetArrayBridge(Tracks) );
+	
+	std::stringstream Json;
+	Json << "[";
+	for ( int i=0;	i<Tracks.GetSize();	i++ )
+	{
+		if ( i > 0 )
+			Json << ",";
+		Tracks[i].WriteJson( Json );
+	}
+	Json << "]";
+	
 	TJobReply Reply(JobAndChannel);
-
-	bool OldState;
-	bool NewState = EnableDiscovery(true, OldState);
-
-	std::stringstream ReplyString;
-	ReplyString << "broadcast now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
-	std::Debug << ReplyString.str() << std::endl;
-
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
+	Reply.mParams.AddDefaultParam( Json.str() );
+	
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
-void TPopPokey::OnDisableDiscovery(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnPopTrackEvents(TJobAndChannel& JobAndChannel)
 {
+	Array<TPokeyTrackEvent> Events;
+	mTracker.PopEvents( GetArrayBridge(Events) );
+	
+	std::stringstream Json;
+	Json << "[";
+	for ( int i=0;	i<Events.GetSize();	i++ )
+	{
+		if ( i > 0 )
+			Json << ",";
+		Events[i].WriteJson( Json );
+	}
+	Json << "]";
+	
 	TJobReply Reply(JobAndChannel);
-
-	bool OldState;
-	bool NewState = EnableDiscovery(false, OldState);
-
-	std::stringstream ReplyString;
-	ReplyString << "broadcast now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
-	std::Debug << ReplyString.str() << std::endl;
-
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
+	Reply.mParams.AddDefaultParam( Json.str() );
+	
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
-void TPopPokey::OnEnablePoll(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnGetTriggerZones(TJobAndChannel& JobAndChannel)
 {
+	std::stringstream Json;
+	mTriggerZones.WriteJson( Json );
+	
 	TJobReply Reply(JobAndChannel);
-
-	bool OldState;
-	bool NewState = EnablePoll(true, OldState);
-
-	std::stringstream ReplyString;
-	ReplyString << "pokey poll now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
-	std::Debug << ReplyString.str() << std::endl;
-
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
+	Reply.mParams.AddDefaultParam( Json.str() );
+	
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
-void TPopPokey::OnDisablePoll(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnPopTriggerEvents(TJobAndChannel& JobAndChannel)
 {
+	Array<TPokeyTriggerEvent> Events;
+	mTriggerZones.PopEvents( GetArrayBridge(Events) );
+	
+	std::stringstream Json;
+	Json << "[";
+	for ( int i=0;	i<Events.GetSize();	i++ )
+	{
+		if ( i > 0 )
+			Json << ",";
+		Events[i].WriteJson( Json );
+	}
+	Json << "]";
+	
 	TJobReply Reply(JobAndChannel);
-
-	bool OldState;
-	bool NewState = EnablePoll(false, OldState);
-
-	std::stringstream ReplyString;
-	ReplyString << "pokey poll now " << ( NewState ? "enabled" : "disabled" ) << ", was " << ( OldState ? "enabled" : "disabled" );
-	std::Debug << ReplyString.str() << std::endl;
-
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
+	Reply.mParams.AddDefaultParam( Json.str() );
+	
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
+void TPopPokey::OnGetLaserGate(TJobAndChannel& JobAndChannel)
+{
+	std::stringstream Json;
+	mLaserGate.WriteJson( Json );
+	
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam( Json.str() );
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted(Reply);
+}
 
-void TPopPokey::OnPushGridCoord(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnPopLaserGateEvents(TJobAndChannel& JobAndChannel)
 {
-	auto& Job = JobAndChannel.GetJob();
+	Array<TPokeyLaserGateEvent> Events;
+	mLaserGate.PopEvents( GetArrayBridge(Events) );
 	
-	vec2x<int> GridCoord;
-	GridCoord.x = Job.mParams.GetParamAsWithDefault<int>("pinx", -1);
-	GridCoord.y = Job.mParams.GetParamAsWithDefault<int>("piny", -1);
-	PushGridCoord( GridCoord );
+	std::stringstream Json;
+	Json << "[";
+	for ( int i=0;	i<Events.GetSize();	i++ )
+	{
+		if ( i > 0 )
+			Json << ",";
+		Events[i].WriteJson( Json );
+	}
+	Json << "]";
 	
-	TJobReply Reply( JobAndChannel );
-	std::stringstream Debug;
-	Debug << "Set grid coord to " << GridCoord;
-	Reply.mParams.AddDefaultParam( Debug.str() );
+	TJobReply Reply(JobAndChannel);
+	Reply.mParams.AddDefaultParam( Json.str() );
 	
 	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	Channel.OnJobCompleted(Reply);
 }
 
-void TPopPokey::OnPopGridCoord(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnGetHeatmap(TJobAndChannel& JobAndChannel)
 {
 	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply(JobAndChannel);
 	
-	mLastGridCoordLock.lock();
-	auto LastGridCoord = mLastGridCoord;
-	mLastGridCoord = TPokeyMeta::GridCoordInvalid;
-	mLastGridCoordLock.unlock();
-	
-	TJobReply Reply( JobAndChannel );
-	std::stringstream ReplyString;
-	if ( LastGridCoord == TPokeyMeta::GridCoordLaserGate )
-		ReplyString << "lasergate";
+	auto LayerName = Job.mParams.GetParamAs<std::string>("layer");
+	auto Layer = TPokeyHeatmapLayer::FromString( LayerName );
+	if ( Layer == TPokeyHeatmapLayer::Count )
+	{
+		Reply.mParams.AddErrorParam( std::string("unknown heatmap layer ") + LayerName );
+	}
 	else
-		ReplyString << LastGridCoord;
-	Reply.mParams.AddDefaultParam( ReplyString.str() );
+	{
+		//	shared with every other viewer that asked since the last change
+		auto Png = mHeatmap.GetPng( Layer, Soy::GetMonotonicNs() );
+		if ( Png )
+			Reply.mParams.AddDefaultParam( *Png, "image/png" );
+		else
+			Reply.mParams.AddErrorParam( std::string("no cells mapped yet") );
+	}
 	
 	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	Channel.OnJobCompleted(Reply);
 }
 
-
-void TPopPokey::OnPeekGridCoord(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnQueryEvents(TJobAndChannel& JobAndChannel)
 {
-	auto& Job = JobAndChannel.GetJob();
+	QueryEvents( JobAndChannel, true );
+}
 
-	auto LastGridCoord = mLastGridCoord;
-	//	if its been X secs since coord was changed, then return invalid
-	auto TimeDiff = SoyTime(true).GetTime() - mLastGridCoordTime.GetTime();
-	if ( TimeDiff > 1000 )
-		LastGridCoord = TPokeyMeta::GridCoordInvalid;
+void TPopPokey::OnCountEvents(TJobAndChannel& JobAndChannel)
+{
+	QueryEvents( JobAndChannel, false );
+}
 
+void TPopPokey::QueryEvents(TJobAndChannel& JobAndChannel,bool IncludeRecords)
+{
+	auto& Job = JobAndChannel.GetJob();
 	TJobReply Reply(JobAndChannel);
-	std::stringstream ReplyString;
-	if ( LastGridCoord == TPokeyMeta::GridCoordLaserGate )
-		ReplyString << "lasergate";
+	
+	std::stringstream Error;
+	TPokeyEventQuery Query;
+	TPokeyEventQueryResult Result;
+	if ( !mEventStore )
+	{
+		Reply.mParams.AddErrorParam( std::string("event store not enabled, start with eventstore=<directory>") );
+	}
+	else if ( !Query.Read( Job.mParams, mEventStore->GetWallTimeUs( Soy::GetMonotonicNs() ), Error ) || !mEventStore->Query( Query, Result, Error ) )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
 	else
-		ReplyString << LastGridCoord;
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
+	{
+		std::stringstream Json;
+		Result.WriteJson( Json, IncludeRecords );
+		Reply.mParams.AddDefaultParam( Json.str() );
+	}
+	
 	TChannel& Channel = JobAndChannel;
 	Channel.OnJobCompleted(Reply);
 }
 
-void TPopPokey::OnPushLaserGateState(TJobAndChannel& JobAndChannel)
+bool TPopPokey::StartCapture(const std::string& Filename,std::stringstream& Error)
 {
-	auto& Job = JobAndChannel.GetJob();
-	
-	bool State = false;
-	State = Job.mParams.GetParamAsWithDefault<int>("state", 0) != 0;
-	PushLaserGateState( State );
+	std::shared_ptr<TPokeyCaptureWriter> Capture( new TPokeyCaptureWriter() );
+	if ( !Capture->Open( Filename, Error ) )
+		return false;
 	
-	TJobReply Reply( JobAndChannel );
-	std::stringstream Debug;
-	Debug << "Set laser gate state to " << State;
-	Reply.mParams.AddDefaultParam( Debug.str() );
+	Capture->Start();
 	
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	//	old capture flushes and closes when the last decoder lets go of it
+	TProtocolPokey::SetCapture( Capture );
+	std::Debug << "capturing pokey frames to " << Filename << std::endl;
+	return true;
 }
 
-void TPopPokey::OnPopLaserGateState(TJobAndChannel& JobAndChannel)
+bool TPopPokey::StartEventStore(const std::string& Directory,const TJobParams& Params,std::stringstream& Error)
 {
-	auto& Job = JobAndChannel.GetJob();
+	std::shared_ptr<TPokeyEventStore> EventStore( new TPokeyEventStore() );
+	EventStore->mSegmentRecords = Params.GetParamAsWithDefault<int>("eventsegmentrecords", static_cast<int>(EventStore->mSegmentRecords) );
+	EventStore->mMaxSegments = Params.GetParamAsWithDefault<int>("eventmaxsegments", static_cast<int>(EventStore->mMaxSegments) );
+	EventStore->mRetentionSecs = static_cast<uint64>( Params.GetParamAsWithDefault<int>("eventretentiondays", 30) ) * 24 * 60 * 60;
+	if ( !EventStore->Open( Directory, Error ) )
+		return false;
+	
+	EventStore->Start();
+	mEventStore = EventStore;
+	std::Debug << "storing pin events in " << Directory << std::endl;
+	return true;
+}
 
-	mLastGridCoordLock.lock();
-	auto LastState = mLaserGateState;
-	mLaserGateState = false;
-	mLastGridCoordLock.unlock();
+void TPopPokey::StopCapture()
+{
+	TProtocolPokey::SetCapture( nullptr );
+}
 
-	TJobReply Reply(JobAndChannel);
-	std::stringstream ReplyString;
-	if ( LastState )
-		ReplyString << "lasergate_on";
-	else
-		ReplyString << "lasergate_off";
-	Reply.mParams.AddDefaultParam(ReplyString.str());
+bool TPopPokey::StartReplay(const std::string& Filename,float Speed,std::stringstream& Error)
+{
+	std::shared_ptr<TPokeyReplayThread> Replay( new TPokeyReplayThread( Filename, Speed ) );
+	if ( !Replay->Open( Error ) )
+		return false;
+	
+	Replay->mOnJob.AddListener( [this](TJob& Job)
+	{
+		OnReplayJob( Job );
+	});
+	
+	auto* pReplay = Replay.get();
+	Replay->mOnFinished.AddListener( [pReplay](const bool&)
+	{
+		std::stringstream Status;
+		pReplay->GetStatus( Status );
+		std::Debug << Status.str() << std::endl;
+	});
+	
+	mReplayThread = Replay;
+	mReplayThread->Start();
+	return true;
+}
 
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted(Reply);
+void TPopPokey::OnReplayJob(TJob& Job)
+{
+	//	replayed frames have no channel, so match pokeys on serial and never create channels
+	int Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	auto& Command = Job.mParams.mCommand;
+	
+	if ( Command == TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::Discover ) )
+	{
+		auto Pokey = GetPokey( Serial, true );
+		if ( !Pokey )
+			return;
+		Pokey->SetAddress( Job.mParams.GetParamAs<std::string>("address") );
+		Pokey->SetVersion( Job.mParams.GetParamAs<std::string>("version") );
+		Pokey->mDhcpEnabled = Job.mParams.GetParamAsWithDefault<int>("dhcpenabled", 0)!=0;
+		return;
+	}
+	
+	if ( Command == TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::GetDeviceState ) )
+	{
+		auto Pokey = GetPokey( Serial, false );
+		if ( !Pokey )
+		{
+			std::Debug << "replayed poll reply for unknown pokey " << Serial << std::endl;
+			return;
+		}
+		
+		Array<char> Pins;
+		if ( !Job.mParams.GetParamAs("pins", Pins ) )
+			return;
+		
+		//	stamped when the replay was due, so durations scale with the replay speed
+		auto SampleTimeNs = Job.mParams.GetParamAsWithDefault<uint64>("rxtime", 0);
+		if ( !Pokey->mIgnored )
+			UpdatePinState( *Pokey, GetArrayBridge(Pins), nullptr, SampleTimeNs );
+		return;
+	}
 }
 
-
-void TPopPokey::OnPeekLaserGateState(TJobAndChannel& JobAndChannel)
+void TPopPokey::OnPrePoll()
 {
-	auto& Job = JobAndChannel.GetJob();
-
-	auto LastState = mLaserGateState;
-	//	if its been X secs since coord was changed, then return invalid
-	auto TimeDiff = SoyTime(true).GetTime() - mLastLaserGateTime.GetTime();
-	if ( TimeDiff > 1000 )
-		LastState = false;
-
-	TJobReply Reply(JobAndChannel);
-	std::stringstream ReplyString;
-	if ( LastState )
-		ReplyString << "lasergate_on";
-	else
-		ReplyString << "lasergate_off";
-	Reply.mParams.AddDefaultParam(ReplyString.str());
-
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted(Reply);
+	//	emit a partial frame if some boards are late
+	mFrameAssembler.Update( Soy::GetMonotonicNs() );
+	mEventMerger.Release( Soy::GetMonotonicNs() );
+	mTracker.Update( Soy::GetMonotonicNs() );
+	if ( mLaserGatePoller )
+		mLaserGatePoller->Update();
+	
+	std::shared_ptr<TPokeyConfig> NewConfig;
+	std::shared_ptr<TPokeyConfig> OldConfig;
+	{
+		std::lock_guard<std::mutex> Lock( mConfigLock );
+		if ( !mPendingConfig )
+			return;
+		NewConfig = mPendingConfig;
+		OldConfig = mConfig;
+		mPendingConfig.reset();
+	}
+	
+	ApplyConfig( *NewConfig, OldConfig.get() );
+	
+	std::lock_guard<std::mutex> Lock( mConfigLock );
+	mConfig = NewConfig;
+	mConfigError.clear();
 }
 
-
-void TPopPokey::OnIgnorePokey(TJobAndChannel& JobAndChannel)
+void TPopPokey::SetConfig(std::shared_ptr<TPokeyConfig> Config)
 {
-	auto& Job = JobAndChannel.GetJob();
-	
-	auto Serial = Job.mParams.GetParamAs<int>("serial");
-	auto NewIgnore = Job.mParams.GetParamAsWithDefault<int>("ignore",true);
+	std::lock_guard<std::mutex> Lock( mConfigLock );
+	mConfig = Config;
+	mConfigFilename = Config ? Config->mFilename : std::string();
 	
-	//	fetch pokey
-	std::shared_ptr<TPokeyMeta> Pokey = GetPokey(Serial, true);
-	
-	auto OldIgnore = Pokey->mIgnored;
-	Pokey->mIgnored = NewIgnore;
+	if ( Config )
+		mTriggerZones.SetZones( GetArrayBridge(Config->mTriggerZones), Soy::GetMonotonicNs() );
+}
 
-	TJobReply Reply(JobAndChannel);
-	std::stringstream ReplyString;
-	ReplyString << "Updated Pokey " << ( *Pokey ) << ", " << (NewIgnore ? "IGNORED" : "NOT ignored" ) << ", was " << ( OldIgnore ? "IGNORED" : "NOT ignored" ) << std::endl;
+void TPopPokey::ApplyConfig(const TPokeyConfig& NewConfig,const TPokeyConfig* OldConfig)
+{
+	int ChangedCount = 0;
 	
-	Reply.mParams.AddDefaultParam(ReplyString.str());
+	for ( int b=0;	b<NewConfig.mBoards.GetSize();	b++ )
+	{
+		auto& Board = NewConfig.mBoards[b];
+		auto Pokey = GetPokey( Board.mSerial, true );
+		bool Changed = false;
+		
+		//	only touch what differs so unchanged pokeys keep their channel and pin state
+		if ( Board.mHasGridMap && !Pokey->IsGridMapEqual( GetArrayBridge(Board.mGridMap) ) )
+		{
+			Pokey->SetGridMap( GetArrayBridge(Board.mGridMap) );
+			Changed = true;
+		}
+		
+		//	channel threads are applying samples to this board, so change it between them
+		bool Unignored = false;
+		{
+			std::lock_guard<std::mutex> Lock( Pokey->mStateLock );
+			if ( Pokey->mLatchEnabled != Board.mLatch )
+			{
+				Pokey->mLatchEnabled = Board.mLatch;
+				Changed = true;
+			}
+			
+			if ( Pokey->mIgnored != Board.mIgnored )
+			{
+				Pokey->mIgnored = Board.mIgnored;
+				Changed = true;
+				Unignored = !Pokey->mIgnored;
+			}
+		}
+		
+		if ( Unignored && !Pokey->GetChannelRef().IsValid() && !Pokey->GetAddress().empty() )
+			CreatePokeyChannel( *Pokey );
+		
+		if ( Changed )
+		{
+			std::Debug << "config reload updated pokey " << *Pokey << std::endl;
+			ChangedCount++;
+		}
+	}
+	
+	//	pokeys dropped from the config go back to how they'd be after a restart
+	if ( OldConfig )
+	{
+		for ( int b=0;	b<OldConfig->mBoards.GetSize();	b++ )
+		{
+			auto& OldBoard = OldConfig->mBoards[b];
+			if ( NewConfig.GetBoard( OldBoard.mSerial ) )
+				continue;
+			
+			auto Pokey = GetPokey( OldBoard.mSerial, false );
+			if ( !Pokey )
+				continue;
+			
+			BufferArray<vec2x<int>,1> NoGridMap;
+			Pokey->SetGridMap( GetArrayBridge(NoGridMap) );
+			bool Unignored = false;
+			{
+				std::lock_guard<std::mutex> Lock( Pokey->mStateLock );
+				Pokey->mLatchEnabled = false;
+				Unignored = Pokey->mIgnored;
+				Pokey->mIgnored = false;
+			}
+			if ( Unignored && !Pokey->GetChannelRef().IsValid() && !Pokey->GetAddress().empty() )
+				CreatePokeyChannel( *Pokey );
+			std::Debug << "config reload removed pokey " << *Pokey << std::endl;
+			ChangedCount++;
+		}
+	}
 	
+	//	does nothing if the zones are unchanged
+	mTriggerZones.SetZones( GetArrayBridge(NewConfig.mTriggerZones), Soy::GetMonotonicNs() );
 	
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted(Reply);
+	std::Debug << "applied config " << NewConfig.mFilename << "; " << ChangedCount << " pokeys changed" << std::endl;
 }
 
 void TPopPokey::OnUnknownPokeyReply(TJobAndChannel& JobAndChannel)
@@ -1124,30 +2990,298 @@ bool TPopPokey::EnablePoll(bool Enable, bool& OldState)
 
 	OldState = mPollPokeyThread->IsEnabled();
 	mPollPokeyThread->Enable(Enable);
+	
+	for ( size_t i=0;	i<mShardCount;	i++ )
+	{
+		if ( mShards[i]->mPollThread )
+			mShards[i]->mPollThread->Enable(Enable);
+	}
 	return mPollPokeyThread->IsEnabled();
 }
 
 
-void TPopPokey::UpdatePinState(TPokeyMeta& Pokey,const ArrayBridge<char>& Pins)
+void TPopPokey::UpdatePinState(TPokeyMeta& Pokey,const ArrayBridge<char>& Pins,TPokeyTrace* Trace,uint64 SampleTimeNs)
 {
-	//	convert pin chars to bools
-	Array<bool> PinBools;
-	for ( int i=0;	i<Pins.GetSize();	i++ )
+	//	convert pin chars to a mask
+	uint64 PinsDown = 0;
+	size_t PinCount = std::min<size_t>( Pins.GetSize(), size_t(TPokeyBoardState::MaxPins) );
+	for ( size_t i=0;	i<PinCount;	i++ )
 	{
-		bool PinDown = (Pins[i] != '0');
-		PinBools.PushBack(PinDown);
+		if ( Pins[i] != '0' )
+			PinsDown |= 1ull << i;
 	}
 	
-	auto GridDown = Pokey.UpdatePins( GetArrayBridge(PinBools) );
+	bool NewPress = false;
+	if ( SampleTimeNs == 0 )
+		SampleTimeNs = Soy::GetMonotonicNs();
+	
+	//	everything below reads the state this sample wrote, so a gridmap swap waits for the whole sample
+	std::lock_guard<std::mutex> Lock( Pokey.mStateLock );
+	auto GridDown = Pokey.UpdatePins( PinsDown, PinCount, NewPress, SampleTimeNs );
+	
+	//	gate edges first, they're the time critical ones
+	auto& State = Pokey.GetState();
+	if ( State.mLaserGatePins )
+		mLaserGate.OnSample( Pokey.mSerial, (State.mDownPins & State.mLaserGatePins) != 0, SampleTimeNs );
+	
 	if ( GridDown != TPokeyMeta::GridCoordInvalid )
 	{
-		PushGridCoord( GridDown );
+		//	only trace the poll the press started on, held pins keep pushing the same coord
+		if ( Trace && NewPress && Trace->IsValid() )
+		{
+			Trace->Stamp( TPokeyTraceStage::Edge );
+			Trace->mCoord = GridDown;
+			PushPress( Pokey, GridDown, Trace, SampleTimeNs );
+		}
+		else
+		{
+			PushPress( Pokey, GridDown, nullptr, SampleTimeNs );
+		}
+	}
+	else if ( IsMerging() )
+	{
+		//	nothing pressed, but the merger still needs to know this zone has got this far
+		mEventMerger.Advance( GetMergeInput(Pokey), SampleTimeNs );
+	}
+	
+	//	only edges go to the aggregator
+	if ( mClusterMember )
+		mClusterMember->OnSample( Pokey, Pins, SampleTimeNs );
+	
+	//	feed the whole-floor frame
+	//	straight from the board's masks; only pins that are down or mapped touch the coords
+	TPokeyBoardSample Sample;
+	BufferArray<vec2x<int>,64> IgnoredCells;
+	uint64 IgnoredPins = State.mDownPins & State.mStuckPins;
+	Sample.mSerial = Pokey.mSerial;
+	Sample.mSampleTimeNs = SampleTimeNs;
+	Sample.mPins = State.mDownPins;
+	Sample.mLaserGate = (State.mDownPins & State.mLaserGatePins) != 0;
+	for ( auto Bits = State.mDownPins;	Bits;	Bits &= Bits-1 )
+	{
+		auto i = TPokeyBoardState::GetLowestPin( Bits );
+		auto& Coord = State.mCoord[i];
+		if ( Coord == TPokeyMeta::GridCoordLaserGate )
+			continue;
+		if ( IgnoredPins & (1ull << i) )
+			IgnoredCells.PushBack( Coord );
+		else if ( Coord != TPokeyMeta::GridCoordInvalid )
+			Sample.mDown.PushBack( Coord );
+	}
+	mFrameAssembler.OnSample( Sample );
+	mTracker.OnSample( Sample );
+	
+	BufferArray<vec2x<int>,64> MappedCells;
+	for ( auto Bits = State.mMappedPins;	Bits;	Bits &= Bits-1 )
+	{
+		auto& Coord = State.mCoord[ TPokeyBoardState::GetLowestPin( Bits ) ];
+		if ( Coord != TPokeyMeta::GridCoordLaserGate )
+			MappedCells.PushBack( Coord );
+	}
+	mHeatmap.OnSample( Sample, GetArrayBridge(MappedCells), GetArrayBridge(IgnoredCells) );
+	mTriggerZones.OnSample( Pokey, Sample.mPins & ~IgnoredPins, SampleTimeNs );
+	mSubscriptions.OnSample( Pokey, Sample.mPins & ~IgnoredPins, SampleTimeNs );
+	mFloorSnapshot.OnSample( Pokey, Sample.mPins & ~IgnoredPins );
+	
+	if ( mEventStore )
+		mEventStore->OnSample( Pokey, Sample.mPins, SampleTimeNs );
+}
+
+
+void TPopPokey::PushPress(TPokeyMeta& Pokey,vec2x<int> GridCoord,TPokeyTrace* Trace,uint64 SampleTimeNs)
+{
+	//	no zones or cluster members, nothing to merge
+	if ( !IsMerging() )
+	{
+		PushGridCoord( GridCoord, Trace );
+		return;
+	}
+	
+	TPokeyMergeEvent Event;
+	Event.mTimeNs = SampleTimeNs;
+	Event.mCoord = GridCoord;
+	if ( Trace )
+		Event.mTrace = *Trace;
+	mEventMerger.Push( GetMergeInput(Pokey), Event );
+}
+
+bool TPopPokey::IsMerging() const
+{
+	return mShardCount > 0 || mClusterAggregator;
+}
+
+size_t TPopPokey::GetMergeInput(const TPokeyMeta& Pokey)
+{
+	if ( Pokey.mRemote != -1 && mClusterAggregator )
+		return mClusterAggregator->GetMergeInput( Pokey.mRemote );
+	
+	auto Shard = Pokey.mShard.load();
+	if ( Shard < 0 || Shard >= mShardCount )
+		return mDefaultMergeInput;
+	return mShards[Shard]->mMergeInput;
+}
+
+void TPopPokey::GetPollPokeys(ArrayBridge<std::shared_ptr<TPokeyMeta>>&& Pokeys)
+{
+	//	zoned pokeys are polled by their shard, remote ones by their cluster member, gates by the gate poll
+	bool GatePolled = mLaserGatePoller && mLaserGatePoller->IsPolling();
+	std::lock_guard<std::mutex> Lock( mPokeysLock );
+	for ( int i=0;	i<mPokeys.GetSize();	i++ )
+	{
+		if ( mPokeys[i]->mShard != -1 || mPokeys[i]->mRemote != -1 )
+			continue;
+		if ( GatePolled && mLaserGatePoller->IsGatePokey( *mPokeys[i] ) )
+			continue;
+		Pokeys.PushBack( mPokeys[i] );
+	}
+}
+
+std::shared_ptr<TPokeyMeta> TPopPokey::GetReplyPokey(const TJob& Job)
+{
+	//	zoned pokeys are found in their shard's partition, so zones don't contend on the registry
+	auto Serial = Job.mParams.GetParamAsWithDefault<int>("serial", -1);
+	if ( Serial >= 0 && Serial < sizeofarray(mShardBySerial) )
+	{
+		size_t Shard = mShardBySerial[Serial].load();
+		if ( Shard != 0 && Shard <= mShardCount )
+		{
+			auto Pokey = mShards[Shard-1]->GetPokey( Serial, false );
+			if ( Pokey && Pokey->GetChannelRef() == Job.mChannelMeta.mChannelRef )
+				return Pokey;
+		}
+	}
+	
+	return GetPokey( Job.mChannelMeta.mChannelRef );
+}
+
+bool TPopPokey::AddZone(const std::string& Name,const std::string& InterfaceAddress,const std::string& BroadcastAddress,const TPokeyPollTimerParams& TimerParams,size_t& Index,std::stringstream& Error)
+{
+	std::lock_guard<std::mutex> Lock( mShardsLock );
+	Index = mShardCount.load();
+	for ( size_t i=0;	i<Index;	i++ )
+	{
+		if ( mShards[i]->mName == Name )
+		{
+			Error << "zone " << Name << " already exists";
+			return false;
+		}
+	}
+	if ( Index >= MaxShards )
+	{
+		Error << "too many zones, max " << MaxShards;
+		return false;
+	}
+	
+	int PollIntervalMs = mPollPokeyThread ? mPollPokeyThread->mPollIntervalMs : 13;
+	size_t ShardIndex = Index;
+	auto MergeInput = mEventMerger.AddInput();
+	std::shared_ptr<TPokeyShard> Shard( new TPokeyShard( Name, ShardIndex, MergeInput, mEventMerger, static_cast<TChannelManager&>(*this), PollIntervalMs ) );
+	Shard->mPollThread->SetTimerParams( TimerParams );
+	if ( mPollMailbox )
+		Shard->mPollMailbox = NewPollMailbox( "zone/" + Name );
+	
+	if ( !InterfaceAddress.empty() )
+	{
+		//	empty broadcast is the interface's subnet broadcast
+		if ( !Shard->StartDiscovery( InterfaceAddress, BroadcastAddress, Error ) )
+			return false;
+		
+		//	whatever answers on this interface belongs to this zone
+		Shard->mDiscoverThread->mOnDiscovery.AddListener( [this,ShardIndex](TJob& Job)
+		{
+			auto Pokey = UpdateDiscoveredPokey( Job );
+			if ( Pokey )
+				AssignShard( Pokey, ShardIndex );
+		});
 	}
 	
+	mShards[ShardIndex] = Shard;
+	mShardCount = ShardIndex + 1;
+	std::Debug << "added zone " << Name << " " << InterfaceAddress << std::endl;
+	return true;
+}
+
+void TPopPokey::AssignShard(std::shared_ptr<TPokeyMeta> Pokey,size_t ShardIndex)
+{
+	//	every zone's discovery thread and addzone can move pokeys
+	std::lock_guard<std::mutex> Lock( mShardsLock );
+	if ( !Pokey || ShardIndex >= mShardCount )
+		return;
+	int OldShard = Pokey->mShard;
+	if ( OldShard == static_cast<int>( ShardIndex ) )
+		return;
+	
+	//	in the new partition before the route points at it, so replies are never unroutable
+	mShards[ShardIndex]->AddPokey( Pokey );
+	Pokey->mShard = static_cast<int>( ShardIndex );
+	if ( Pokey->mSerial >= 0 && Pokey->mSerial < sizeofarray(mShardBySerial) )
+		mShardBySerial[Pokey->mSerial] = static_cast<unsigned char>( ShardIndex+1 );
+	if ( OldShard >= 0 && OldShard < mShardCount )
+		mShards[OldShard]->RemovePokey( Pokey->mSerial );
+	
+	std::Debug << "pokey " << Pokey->mSerial << " now in zone " << mShards[ShardIndex]->mName << std::endl;
+}
+
+bool TPopPokey::StartClusterMember(const std::string& Name,const std::string& AggregatorAddress,const std::string& Serials,std::stringstream& Error)
+{
+	Array<int> SerialList;
+	if ( !TPokeyCluster::ParseSerials( Serials, GetArrayBridge(SerialList), Error ) )
+		return false;
+	
+	mClusterMember.reset( new TPokeyClusterMember( *this, Name, AggregatorAddress, GetArrayBridge(SerialList) ) );
+	mClusterMember->Start();
+	std::Debug << "cluster member " << Name << " streaming to " << AggregatorAddress << std::endl;
+	return true;
+}
+
+bool TPopPokey::StartClusterAggregator(int Port,std::stringstream& Error)
+{
+	std::shared_ptr<TPokeyClusterAggregator> Aggregator( new TPokeyClusterAggregator( *this, Port ) );
+	if ( !Aggregator->Init( Error ) )
+		return false;
+	mClusterAggregator = Aggregator;
+	std::Debug << "cluster aggregator listening on " << Port << std::endl;
+	return true;
+}
+
+bool TPopPokey::StartHttpServer(int Port,int FallbackPort,std::stringstream& Error)
+{
+	std::shared_ptr<TPokeyHttpServer> Server( new TPokeyHttpServer( *this, Port, FallbackPort ) );
+	if ( !Server->Init( Error ) )
+		return false;
+	mHttpServer = Server;
+	std::Debug << "fast http listening on " << Port << ", everything else on " << FallbackPort << std::endl;
+	return true;
+}
+
+std::shared_ptr<TPokeyPollMailbox> TPopPokey::NewPollMailbox(const std::string& Name)
+{
+	std::shared_ptr<TPokeyPollMailbox> Mailbox( new TPokeyPollMailbox( Name, [this](TPokeyMeta& Pokey,const TPokeyPollMail& Mail,const ArrayBridge<uint64>& Steps,const ArrayBridge<uint64>& StepTimesNs)
+	{
+		OnPollMail( Pokey, Mail, Steps, StepTimesNs );
+	}) );
+	Mailbox->Start();
+	return Mailbox;
 }
 
+void TPopPokey::StartPollMailbox()
+{
+	//	zones added after this get their own
+	mPollMailbox = NewPollMailbox("main");
+}
+
+void TPopPokey::StartLaserGatePoll(int PollIntervalMs,const TPokeyPollTimerParams& TimerParams)
+{
+	//	the poll thread itself starts when a gate board turns up
+	mLaserGatePoller.reset( new TPokeyLaserGatePoller( *this, static_cast<TChannelManager&>(*this), PollIntervalMs, TimerParams ) );
+}
+
+bool TPopPokey::IsClusterOwned(int Serial)
+{
+	return !mClusterMember || mClusterMember->IsOwned( Serial );
+}
 
-void TPopPokey::PushGridCoord(vec2x<int> GridCoord)
+void TPopPokey::PushGridCoord(vec2x<int> GridCoord,TPokeyTrace* Trace)
 {
 	//	if laser gate, set the state
 	if ( GridCoord == TPokeyMeta::GridCoordLaserGate )
@@ -1157,9 +3291,11 @@ void TPopPokey::PushGridCoord(vec2x<int> GridCoord)
 	}
 	
 	mLastGridCoordLock.lock();
-	mLastGridCoord = GridCoord;
-	mLastGridCoordTime = SoyTime(true);
+	bool DroppedTrace = PushGridCoordLocked( GridCoord, Trace, Soy::GetMonotonicNs() );
 	mLastGridCoordLock.unlock();
+	TPokeyMetrics::Get().OnEventPushed();
+	if ( DroppedTrace )
+		TPokeyTracer::Get().OnDropped();
 	
 	std::Debug << "pin set to " << GridCoord << std::endl;
 }
@@ -1168,9 +3304,9 @@ void TPopPokey::PushGridCoord(vec2x<int> GridCoord)
 void TPopPokey::PushLaserGateState(bool State)
 {
 	mLastGridCoordLock.lock();
-	mLaserGateState = State;
-	mLastLaserGateTime = SoyTime(true);
+	PushLaserGateLocked( State, Soy::GetMonotonicNs() );
 	mLastGridCoordLock.unlock();
+	TPokeyMetrics::Get().OnEventPushed();
 	
 	std::Debug << "laser gate set to " << State << std::endl;
 }
@@ -1185,9 +3321,132 @@ std::shared_ptr<TChannel> gCaptureChannel;
 
 
 
+TPopAppError::Type PopSimulatorMain(TJobParams& Params)
+{
+	TPokeySimulatorParams SimulatorParams;
+	SimulatorParams.Read( Params );
+
+	TPokeySimulator Simulator( SimulatorParams );
+	std::stringstream Error;
+	if ( !Simulator.Init( Error ) )
+	{
+		std::Debug << "failed to start pokey simulator: " << Error.str() << std::endl;
+		return TPopAppError::InitError;
+	}
+	
+	if ( !SimulatorParams.mAddressCacheFilename.empty() )
+	{
+		if ( Simulator.WriteAddressCache( SimulatorParams.mAddressCacheFilename ) )
+			std::Debug << "wrote simulated pokeys to " << SimulatorParams.mAddressCacheFilename << std::endl;
+	}
+	
+	Simulator.Start();
+	
+	Soy::Platform::TConsoleApp ConsoleApp;
+	ConsoleApp.WaitForExit();
+	
+	std::stringstream Status;
+	Simulator.GetStatus( Status );
+	std::Debug << Status.str() << std::endl;
+	return TPopAppError::Success;
+}
+
+
+TPopAppError::Type PopBenchmarkMain(TJobParams& Params)
+{
+	TPokeyBenchmarkParams BenchmarkParams;
+	BenchmarkParams.Read( Params );
+
+	//	no channels and no polling so nothing else is touching the pokeys
+	TPopPokey App;
+	App.mPollPokeyThread->Enable(false);
+	
+	TPokeyBenchmark Benchmark( BenchmarkParams );
+	Benchmark.RunAll( App );
+
+	if ( BenchmarkParams.mOutputFilename.empty() )
+	{
+		Benchmark.WriteResults( std::cout );
+		return TPopAppError::Success;
+	}
+	
+	std::ofstream File( BenchmarkParams.mOutputFilename, std::ios::out | std::ios::trunc );
+	if ( !File.is_open() )
+	{
+		std::Debug << "failed to open benchmark output " << BenchmarkParams.mOutputFilename << std::endl;
+		return TPopAppError::InitError;
+	}
+	Benchmark.WriteResults( File );
+	std::Debug << "wrote benchmark results to " << BenchmarkParams.mOutputFilename << std::endl;
+	return TPopAppError::Success;
+}
+
+
+TPopAppError::Type PopHttpLoadTestMain(TJobParams& Params)
+{
+	TPokeyHttpLoadTestParams LoadTestParams;
+	LoadTestParams.Read( Params );
+
+	TPokeyHttpLoadTest LoadTest( LoadTestParams );
+	std::stringstream Error;
+	if ( !LoadTest.Run( Error ) )
+	{
+		std::Debug << "http load test failed: " << Error.str() << std::endl;
+		return TPopAppError::InitError;
+	}
+	
+	LoadTest.WriteResults( std::cout );
+	std::cout << std::endl;
+	return TPopAppError::Success;
+}
+
+
 TPopAppError::Type PopMain(TJobParams& Params)
 {
+	//	run as a pokey simulator instead, for testing without hardware
+	if ( Params.GetParamAsWithDefault<int>("simulate", 0) > 0 )
+		return PopSimulatorMain( Params );
+	
+	//	time the hot paths against fixed input and exit
+	if ( Params.GetParamAsWithDefault<int>("benchmark", 0) != 0 )
+		return PopBenchmarkMain( Params );
+	
+	//	hammer another instance's http and exit; httploadtest=host:8080
+	if ( !Params.GetParamAs<std::string>("httploadtest").empty() )
+		return PopHttpLoadTestMain( Params );
+	
 	TPopPokey App;
+	
+	//	set before the bootup commands so zones' poll threads get it too.
+	//	latched pokeys keep taps between polls, so they can be polled slower
+	if ( App.mPollPokeyThread )
+		App.mPollPokeyThread->mPollIntervalMs = Params.GetParamAsWithDefault<int>("pollms", 13);
+	
+	//	pollmode=rt for absolute deadlines; pollspinus, pollpriority, pollcpu and polltimerfd tune it
+	TPokeyPollTimerParams PollTimerParams;
+	PollTimerParams.Read( Params );
+	if ( App.mPollPokeyThread )
+		App.mPollPokeyThread->SetTimerParams( PollTimerParams );
+	
+	//	lasergatepollms gives gate boards their own poll, as fast as they answer up to that often; the
+	//	default 0 leaves them on the main poll. It spins on its own deadlines, so it's opt-in; its cpu
+	//	and priority are only what lasergatepollcpu, lasergatepollpriority etc say
+	auto LaserGatePollMs = Params.GetParamAsWithDefault<int>("lasergatepollms", 0);
+	if ( LaserGatePollMs > 0 )
+	{
+		TPokeyPollTimerParams LaserGateTimerParams;
+		LaserGateTimerParams.mMode = "rt";
+		LaserGateTimerParams.Read( Params, "lasergate" );
+		App.StartLaserGatePoll( LaserGatePollMs, LaserGateTimerParams );
+	}
+	
+	//	coalescepolls=0 applies poll replies on the channel threads as they arrive, one by one, rather
+	//	than the newest per board on a thread of its own
+	if ( Params.GetParamAsWithDefault<int>("coalescepolls", 1) != 0 )
+		App.StartPollMailbox();
+	
+	//	longest a zone's press waits for slower zones so the event stream stays in time order
+	App.mEventMerger.mMaxHoldNs = static_cast<uint64>( Params.GetParamAsWithDefault<int>("mergeholdms", 5) ) * 1000000;
 
 	auto CommandLineChannel = std::shared_ptr<TChan<TChannelLiteral,TProtocolCli>>( new TChan<TChannelLiteral,TProtocolCli>( SoyRef("cmdline") ) );
 	
@@ -1195,13 +3454,24 @@ TPopAppError::Type PopMain(TJobParams& Params)
 	gStdioChannel = CreateChannelFromInputString("std:", SoyRef("stdio") );
 
 	
-	App.mDiscoverPokeyChannel.reset( new TChan<TChannelSocketUdpBroadcastClient,TProtocolPokey>( SoyRef("discover"), 20055 ) );
-
-	auto HttpChannel = CreateChannelFromInputString("http:8080",SoyRef("http"));
+	//	several instances on one host (a loopback cluster) each need their own port
+	auto HttpPort = Params.GetParamAsWithDefault<int>("httpport", 8080);
+	
+	//	fasthttp=1 puts the keep-alive server on the http port and moves the job channel up one;
+	//	polled endpoints are answered directly and everything else is redirected
+	if ( Params.GetParamAsWithDefault<int>("fasthttp", 0) != 0 )
+	{
+		auto FallbackPort = Params.GetParamAsWithDefault<int>("fallbackhttpport", HttpPort+1);
+		std::stringstream HttpError;
+		if ( App.StartHttpServer( HttpPort, FallbackPort, HttpError ) )
+			HttpPort = FallbackPort;
+		else
+			std::Debug << "failed to start fast http: " << HttpError.str() << std::endl;
+	}
+	auto HttpChannel = CreateChannelFromInputString( "http:" + std::to_string(HttpPort), SoyRef("http") );
 
 	
 	App.AddChannel( CommandLineChannel );
-	App.AddChannel( App.mDiscoverPokeyChannel );
 	App.AddChannel( gStdioChannel );
 	App.AddChannel( HttpChannel );
 
@@ -1262,6 +3532,101 @@ TPopAppError::Type PopMain(TJobParams& Params)
 		CommandLineChannel->mOnJobRecieved.AddListener( RelayFunc );
 	}
 
+	//	keep a compiled copy of the config so reloads only change what differs
+	std::shared_ptr<TPokeyConfig> Config( new TPokeyConfig() );
+	Config->mFilename = ConfigFilename;
+	std::stringstream ConfigError;
+	if ( !Config->Parse( GetArrayBridge(Commands), ConfigError ) )
+		std::Debug << "config file " << ConfigFilename << " error: " << ConfigError.str() << std::endl;
+	App.SetConfig( Config );
+	
+	if ( Params.GetParamAsWithDefault<int>("watchconfig", 0) != 0 )
+	{
+		std::stringstream WatchError;
+		if ( !App.mConfigThread->Watch( ConfigFilename, WatchError ) )
+			std::Debug << "failed to watch config " << ConfigFilename << ": " << WatchError.str() << std::endl;
+	}
+
+	App.mFrameAssembler.SetDeadlineMs( Params.GetParamAsWithDefault<int>("framedeadlinems", 30) );
+	App.mHeatmap.mHeatHalfLifeSecs = Params.GetParamAsWithDefault<float>("heatmaphalflife", App.mHeatmap.mHeatHalfLifeSecs );
+	App.mHeatmap.mCellPixels = Params.GetParamAsWithDefault<int>("heatmapcellpixels", App.mHeatmap.mCellPixels );
+	App.mHeatmap.mMinEncodeIntervalMs = Params.GetParamAsWithDefault<int>("heatmapintervalms", App.mHeatmap.mMinEncodeIntervalMs );
+
+	
+	//	feed a capture through instead of talking to real pokeys
+	std::string ReplayFilename = Params.GetParamAs<std::string>("replay");
+	if ( !ReplayFilename.empty() )
+	{
+		bool OldState;
+		App.EnableDiscovery( false, OldState );
+		App.EnablePoll( false, OldState );
+		
+		float ReplaySpeed = Params.GetParamAsWithDefault<float>("replayspeed", 1.f);
+		std::stringstream ReplayError;
+		if ( !App.StartReplay( ReplayFilename, ReplaySpeed, ReplayError ) )
+		{
+			std::Debug << "failed to replay " << ReplayFilename << ": " << ReplayError.str() << std::endl;
+			return TPopAppError::InitError;
+		}
+		
+		App.mConsoleApp.WaitForExit();
+		gStdioChannel.reset();
+		return TPopAppError::Success;
+	}
+	
+	std::string CaptureFilename = Params.GetParamAs<std::string>("capture");
+	if ( !CaptureFilename.empty() )
+	{
+		std::stringstream CaptureError;
+		if ( !App.StartCapture( CaptureFilename, CaptureError ) )
+			std::Debug << "failed to start capture: " << CaptureError.str() << std::endl;
+	}
+
+	//	edge history for the events/eventcount jobs
+	std::string EventStoreDirectory = Params.GetParamAs<std::string>("eventstore");
+	if ( !EventStoreDirectory.empty() )
+	{
+		std::stringstream EventStoreError;
+		if ( !App.StartEventStore( EventStoreDirectory, Params, EventStoreError ) )
+			std::Debug << "failed to start event store: " << EventStoreError.str() << std::endl;
+	}
+
+	//	cluster before the address cache so a member only connects to the pokeys it owns
+	auto ClusterListenPort = Params.GetParamAsWithDefault<int>("clusterlisten", 0);
+	if ( ClusterListenPort > 0 )
+	{
+		std::stringstream ClusterError;
+		if ( !App.StartClusterAggregator( ClusterListenPort, ClusterError ) )
+			std::Debug << "failed to start cluster aggregator: " << ClusterError.str() << std::endl;
+	}
+	
+	std::string ClusterAggregator = Params.GetParamAs<std::string>("clusteraggregator");
+	if ( !ClusterAggregator.empty() )
+	{
+		auto ClusterName = Params.GetParamAsWithDefault<std::string>("clustername", "member");
+		auto ClusterSerials = Params.GetParamAs<std::string>("clusterserials");
+		std::stringstream ClusterError;
+		if ( !App.StartClusterMember( ClusterName, ClusterAggregator, ClusterSerials, ClusterError ) )
+		{
+			std::Debug << "failed to start cluster member: " << ClusterError.str() << std::endl;
+			return TPopAppError::InitError;
+		}
+	}
+	
+	//	connect to all the pokeys we knew about last time before discovery has had a chance to find them
+	std::string AddressCacheFilename = Params.GetParamAs<std::string>("addresscache");
+	if ( AddressCacheFilename.empty() )
+		AddressCacheFilename = "pokeycache.txt";
+	
+	std::stringstream AddressCacheError;
+	if ( !App.LoadAddressCache( AddressCacheFilename, AddressCacheError ) )
+		std::Debug << "no pokey address cache loaded from " << AddressCacheFilename << std::endl;
+	if ( !AddressCacheError.str().empty() )
+		std::Debug << "address cache " << AddressCacheFilename << " error: " << AddressCacheError.str() << std::endl;
+
+	//	start discovery after the cached pokeys so it only has to correct stale entries
+	App.mDiscoverPokeyChannel.reset( new TChan<TChannelSocketUdpBroadcastClient,TProtocolPokey>( SoyRef("discover"), 20055 ) );
+	App.AddChannel( App.mDiscoverPokeyChannel );
 	
 	
 	
@@ -7,6 +7,25 @@
 #include <SoyMath.h>
 
 #include "TProtocolPokey.h"
+#include "TPokeyConfig.h"
+#include "TPokeyCapture.h"
+#include "TPokeyMetrics.h"
+#include "TPokeyTrace.h"
+#include "TPokeyFrameAssembler.h"
+#include "TPokeyOutputs.h"
+#include "TPokeyEventMerger.h"
+#include "TPokeyPollTimer.h"
+#include "TPokeyTracker.h"
+#include "TPokeyHeatmap.h"
+#include "TPokeyEventStore.h"
+#include "TPokeyTriggerZones.h"
+#include "TPokeyHttpServer.h"
+#include "TPokeyBatch.h"
+#include "TPokeyBoardState.h"
+#include "TPokeyLaserGate.h"
+#include "TPokeySubscriptions.h"
+#include "TPokeyFloorSnapshot.h"
+#include "TPokeyPollMailbox.h"
 
 
 /*
@@ -49,16 +68,6 @@ public:
 	
 */
 
-class TPinMeta
-{
-public:
-	TPinMeta();
-
-public:
-	vec2x<int>	mCoord;
-	float		mDownDuration;	//	to detect stuck pins we increment/reset how long a pin has been held down
-};
-
 class TPokeyMeta
 {
 public:
@@ -71,51 +80,118 @@ public:
 	static float		PinDownTooLong;		//	if the pin has been down this long, ignore it
 	
 public:
-	TPokeyMeta() :
-		mSerial			( -1 ),
-		mDhcpEnabled	( false ),
-		mIgnored		( false )
-	{
-	}
+	TPokeyMeta();
+	TPokeyMeta(const TPokeyMeta& That) = delete;
+	~TPokeyMeta();
 	
-	bool			HasBootupAddress() const { return mAddress == "10.0.0.250:20055"; }
+	TPokeyMeta&		operator=(const TPokeyMeta& That) = delete;
+	
+	bool			HasBootupAddress() const { return GetAddress() == "10.0.0.250:20055"; }
 	bool			IsValid() const	{	return mSerial != -1;	}
 	bool			SetGridMap(std::string GridMapString,std::stringstream& Error);
+	void			SetGridMap(const ArrayBridge<vec2x<int>>& PinToGridMap);
+	bool			IsGridMapEqual(const ArrayBridge<vec2x<int>>& PinToGridMap) const;
+	static bool		ParseGridMap(std::string GridMapString,ArrayBridge<vec2x<int>>&& PinToGridMap,std::stringstream& Error);
 	std::string		GetGridMapString() const
 	{
 		Array<vec2x<int>> PinToGridMap;
-		for ( int p=0;	p<mPins.GetSize();	p++ )
+		for ( size_t p=0;	p<mState->mPinCount;	p++ )
 		{
-			PinToGridMap.PushBack( mPins[p].mCoord );
+			PinToGridMap.PushBack( mState->mCoord[p] );
 		}
 		return Soy::StringJoin( GetArrayBridge(PinToGridMap), CoordDelim );
 	}
 	size_t			GetGridMapCount() const
 	{
-		return mPins.GetSize();
+		return mState->mPinCount;
 	}
+	size_t			GetPinCount() const			{	return mState->mPinCount;	}
+	uint64			GetLastUpdateNs() const		{	return mState->mLastUpdateNs;	}
+	const TPokeyBoardState&	GetState() const	{	return *mState;	}
 
-	vec2x<int>			UpdatePins(const ArrayBridge<bool>& Pins);	//	returns coord if a pin down
+	//	replies on every channel thread match on this while discovery and the cluster replace it
+	SoyRef				GetChannelRef() const
+	{
+		std::lock_guard<std::mutex> Lock( mChannelRefLock );
+		return mChannelRef;
+	}
+	SoyRef				SetChannelRef(SoyRef ChannelRef)	//	returns the old one
+	{
+		std::lock_guard<std::mutex> Lock( mChannelRefLock );
+		std::swap( mChannelRef, ChannelRef );
+		return ChannelRef;
+	}
+
+	//	every zone's discovery thread writes these while list, status and the address cache read them
+	std::string			GetAddress() const
+	{
+		std::lock_guard<std::mutex> Lock( mAddressLock );
+		return mAddress;
+	}
+	bool				SetAddress(const std::string& Address)	//	false if unchanged
+	{
+		std::lock_guard<std::mutex> Lock( mAddressLock );
+		if ( mAddress == Address )
+			return false;
+		mAddress = Address;
+		return true;
+	}
+	std::string			GetVersion() const
+	{
+		std::lock_guard<std::mutex> Lock( mAddressLock );
+		return mVersion;
+	}
+	bool				SetVersion(const std::string& Version)	//	false if unchanged
+	{
+		std::lock_guard<std::mutex> Lock( mAddressLock );
+		if ( mVersion == Version )
+			return false;
+		mVersion = Version;
+		return true;
+	}
+
+	vec2x<int>			UpdatePins(const ArrayBridge<bool>& Pins);	//	returns coord if a pin down. Takes mStateLock
+	vec2x<int>			UpdatePins(const ArrayBridge<bool>& Pins,bool& NewPress,uint64 SampleTimeNs);	//	NewPress if the returned pin only just went down. Takes mStateLock
+	vec2x<int>			UpdatePins(uint64 Down,size_t PinCount,bool& NewPress,uint64 SampleTimeNs);	//	bit per pin, PinCount reported; caller holds mStateLock
 	
+	void				UpdateEdgeCounts(const ArrayBridge<size_t>& Pins,const ArrayBridge<uint32>& Counts,ArrayBridge<vec2x<int>>&& MissedPresses);	//	a coord for every press the polls missed
+	void				ResetEdgeCounts();
+	void				GetLatchPins(ArrayBridge<size_t>&& Pins);	//	takes mStateLock
 	void				UpdatePin(size_t Pin,bool PinDown,float Delta);
-	bool				IsPinIgnored(size_t Pin);		//	gr: remove double negative
-	void				GetIgnoredPins(ArrayBridge<size_t>&& IgnoredPins);
-	vec2x<int>			GetPinGridCoord(size_t Pin);
-	float				GetPinDownDuration(size_t Pin);
+	bool				IsPinIgnored(size_t Pin);		//	takes mStateLock. gr: remove double negative
+	void				GetIgnoredPins(ArrayBridge<size_t>&& IgnoredPins);	//	caller holds mStateLock
+	vec2x<int>			GetPinGridCoord(size_t Pin);	//	caller holds mStateLock
+	float				GetPinDownDuration(size_t Pin);	//	caller holds mStateLock
 	
-	TPinMeta&			GetPin(size_t Pin);
 	float				GetTimeSinceUpdate() const;			//	how long ago did we hear from this pokey
 	
+private:
+	void				AddPins(size_t PinCount);			//	pins get meta as they're mapped or reported
+	
 public:
-	//	gr: merge these into a pin struct
-	BufferArray<TPinMeta,100>	mPins;
-	std::string			mAddress;
+	//	per-poll pin state lives in TPokeyBoardStates; everything here is touched rarely
+	const size_t		mStateSlot;
 	int					mSerial;
+	std::atomic<bool>	mDhcpEnabled;
+	bool				mIgnored;		//	gr: fix double negative!
+	bool				mLatchEnabled;		//	count edges on the pokey so taps between polls aren't lost
+	bool				mLatchConfigured;	//	pin settings sent on the current connection
+	uint64				mLatchPins;			//	pins we've set up as counters, so only they are put back
+	std::atomic<int>	mShard;			//	zone this pokey is polled by, -1 for the default poll thread. Set under mShardsLock
+	std::atomic<int>	mRemote;		//	cluster member that polls this pokey for us, -1 if we do
+	bool				mRemoteConnected;	//	as last reported by the member
+	uint32				mGridMapVersion;	//	bumped whenever the map changes, for things compiled from it
+	std::mutex			mStateLock;		//	board state is written by poll replies, counter replies and gridmap changes on different threads
+	std::shared_ptr<TPokeyBoardMetrics>	mMetrics;
+	TPokeyOutputs		mOutputs;
+	
+private:
+	TPokeyBoardState*	mState;			//	slot never moves, so cached
+	mutable std::mutex	mChannelRefLock;
 	SoyRef				mChannelRef;
+	mutable std::mutex	mAddressLock;
+	std::string			mAddress;
 	std::string			mVersion;
-	bool				mDhcpEnabled;
-	bool				mIgnored;		//	gr: fix double negative!
-	SoyTime				mLastUpdate;
 };
 std::ostream& operator<< (std::ostream &out,const TPokeyMeta &in);
 
@@ -123,6 +199,10 @@ std::ostream& operator<< (std::ostream &out,const TPokeyMeta &in);
 class TPokeyManager
 {
 public:
+	virtual ~TPokeyManager()	{}
+	
+	virtual void				OnPrePoll()	{}	//	called on the poll thread between polls
+	
 	std::shared_ptr<TPokeyMeta>	GetPokey(const TPokeyMeta& Pokey);
 	std::shared_ptr<TPokeyMeta>	GetPokey(int Serial,bool Create=false);
 	std::shared_ptr<TPokeyMeta>	GetPokey(SoyRef ChannelRef);
@@ -133,6 +213,13 @@ public:
 		Pokeys.Copy( mPokeys );
 	}
 	
+	//	pokeys this manager's poll thread is responsible for
+	virtual void	GetPollPokeys(ArrayBridge<std::shared_ptr<TPokeyMeta>>&& Pokeys)
+	{
+		std::lock_guard<std::mutex> Lock( mPokeysLock );
+		Pokeys.Copy( mPokeys );
+	}
+	
 protected:
 	std::mutex			mPokeysLock;	//	for when resizing array
 	Array<std::shared_ptr<TPokeyMeta>>	mPokeys;
@@ -141,24 +228,66 @@ protected:
 class TPollPokeyThread : public SoyWorkerThread
 {
 public:
-	TPollPokeyThread(TPokeyManager& PokeyManager,TChannelManager& Channels);
+	TPollPokeyThread(TPokeyManager& PokeyManager,TChannelManager& Channels,const std::string& Name);	//	name labels its timing metrics
 
 	virtual bool		Iteration() override;
 
 	bool			IsEnabled() const { return mEnabled; }
 	void			Enable(bool Enable) { mEnabled = Enable; }
 	virtual std::chrono::milliseconds	GetSleepDuration();
+	virtual bool	CanSleep() override	{	return !mRealtime;	}	//	rt mode waits for its own deadlines
+
+	void			SetTimerParams(const TPokeyPollTimerParams& Params);	//	applied on the poll thread before the next poll
+	TPokeyPollTimerParams	GetTimerParams();
+	void			GetTimerStatus(std::ostream& Status);
 
 public:
 	void				SendGetDeviceMeta();
 	void				SendGetUserMeta();
 	void				SendGetDeviceState();
+	void				SendLatchJobs();
+	void				SendOutputJobs();
 	void				SendJob(TJob& Job);
 	
+private:
+	std::shared_ptr<TChannel>	GetConnectedChannel(TPokeyMeta& Pokey);
+	void				SendLatchSetup(TPokeyMeta& Pokey,TChannel& Channel,bool Latch);
+	void				SendPokeyJob(TPokeyMeta& Pokey,TChannel& Channel,TJob& Job);
+	void				WaitForPoll();
+
+public:
+	int					mPollIntervalMs;
+	
 private:
 	TPokeyManager&		mPokeyManager;
 	TChannelManager&	mChannels;
 	bool				mEnabled;
+	
+	std::mutex			mTimerLock;
+	TPokeyPollTimerParams	mTimerParams;
+	bool				mTimerParamsChanged;
+	std::atomic<bool>	mRealtime;
+	std::shared_ptr<TPokeyPollTimer>	mTimer;		//	only touched on the poll thread
+	uint64				mLastPollNs;
+	std::shared_ptr<TPokeyPollMetrics>	mMetrics;
+};
+
+
+//	writes the address cache off the discovery threads; any number of changes before it gets round
+//	to it are one write
+class TPokeyAddressCacheThread : public SoyWorkerThread
+{
+public:
+	TPokeyAddressCacheThread(std::function<void()> Write);
+	virtual ~TPokeyAddressCacheThread();
+	
+	void			Save()				{	mPending = true;	Wake();	}
+	virtual bool	Iteration() override;
+	virtual bool	CanSleep() override	{	return !mPending;	}
+	
+private:
+	std::function<void()>	mWrite;
+	std::atomic<bool>		mPending;
 };
 
 
@@ -178,6 +307,11 @@ public:
 };
 
 
+class TPokeyShard;
+class TPokeyClusterMember;
+class TPokeyClusterAggregator;
+class TPokeyLaserGatePoller;
+
 class TPopPokey : public TJobHandler, public TChannelManager, public TPokeyManager
 {
 public:
@@ -198,23 +332,103 @@ public:
 	void			OnPopLaserGateState(TJobAndChannel& JobAndChannel);
 	void			OnPeekLaserGateState(TJobAndChannel& JobAndChannel);
 	void			OnPushLaserGateState(TJobAndChannel& JobAndChannel);
+	void			OnGetLaserGate(TJobAndChannel& JobAndChannel);
+	void			OnPopLaserGateEvents(TJobAndChannel& JobAndChannel);
+	void			OnBatch(TJobAndChannel& JobAndChannel);
 	void			OnUnknownPokeyReply(TJobAndChannel& JobAndChannel);
 	void			OnPokeyPollReply(TJobAndChannel& JobAndChannel);
+	void			OnPollMail(TPokeyMeta& Pokey,const TPokeyPollMail& Mail,const ArrayBridge<uint64>& Steps,const ArrayBridge<uint64>& StepTimesNs);
+	void			OnPokeyCountersReply(TJobAndChannel& JobAndChannel);
+	void			OnPokeyLatchSetupReply(TJobAndChannel& JobAndChannel);
+	void			OnPokeyExtBusReply(TJobAndChannel& JobAndChannel);
+	void			OnSetOutput(TJobAndChannel& JobAndChannel);
+	void			OnSetOutputs(TJobAndChannel& JobAndChannel);
+	void			OnGetOutputs(TJobAndChannel& JobAndChannel);
+	void			OnAddZone(TJobAndChannel& JobAndChannel);
+	void			OnGetZones(TJobAndChannel& JobAndChannel);
 	void			OnEnableDiscovery(TJobAndChannel& JobAndChannel);
 	void			OnDisableDiscovery(TJobAndChannel& JobAndChannel);
 	void			OnEnablePoll(TJobAndChannel& JobAndChannel);
 	void			OnDisablePoll(TJobAndChannel& JobAndChannel);
 	void			OnFakeDiscoverPokeys(TJobAndChannel& JobAndChannel);
 	void			OnIgnorePokey(TJobAndChannel& JobAndChannel);
-
-
-	void			UpdatePinState(TPokeyMeta& Pokey,const ArrayBridge<char>& Pins);
-	void			PushGridCoord(vec2x<int> GridCoord);
+	void			OnReloadConfig(TJobAndChannel& JobAndChannel);
+	void			OnWatchConfig(TJobAndChannel& JobAndChannel);
+	void			OnStartCapture(TJobAndChannel& JobAndChannel);
+	void			OnStopCapture(TJobAndChannel& JobAndChannel);
+	void			OnGetMetrics(TJobAndChannel& JobAndChannel);
+	void			OnGetMetricsJson(TJobAndChannel& JobAndChannel);
+	void			OnGetTraceStats(TJobAndChannel& JobAndChannel);
+	void			OnGetTraceDump(TJobAndChannel& JobAndChannel);
+	void			OnGetFloorFrame(TJobAndChannel& JobAndChannel);
+	void			OnGetCluster(TJobAndChannel& JobAndChannel);
+	void			OnGetTracks(TJobAndChannel& JobAndChannel);
+	void			OnPopTrackEvents(TJobAndChannel& JobAndChannel);
+	void			OnGetTriggerZones(TJobAndChannel& JobAndChannel);
+	void			OnPopTriggerEvents(TJobAndChannel& JobAndChannel);
+	void			OnGetHeatmap(TJobAndChannel& JobAndChannel);
+	void			OnQueryEvents(TJobAndChannel& JobAndChannel);
+	void			OnCountEvents(TJobAndChannel& JobAndChannel);
+	void			QueryEvents(TJobAndChannel& JobAndChannel,bool IncludeRecords);
+	void			OnReplayJob(TJob& Job);
+
+	virtual void	OnPrePoll() override;
+	virtual void	GetPollPokeys(ArrayBridge<std::shared_ptr<TPokeyMeta>>&& Pokeys) override;
+
+	void			UpdatePinState(TPokeyMeta& Pokey,const ArrayBridge<char>& Pins,TPokeyTrace* Trace=nullptr,uint64 SampleTimeNs=0);	//	0 for now
+	void			CreatePokeyChannel(TPokeyMeta& Pokey);
+	void			SetConfig(std::shared_ptr<TPokeyConfig> Config);
+	void			ApplyConfig(const TPokeyConfig& NewConfig,const TPokeyConfig* OldConfig);
+	bool			StartCapture(const std::string& Filename,std::stringstream& Error);
+	void			StopCapture();
+	bool			StartEventStore(const std::string& Directory,const TJobParams& Params,std::stringstream& Error);
+	bool			StartReplay(const std::string& Filename,float Speed,std::stringstream& Error);
+	bool			LoadAddressCache(const std::string& Filename,std::stringstream& Error);
+	void			SaveAddressCache();		//	written soon, on mAddressCacheThread
+	void			WriteAddressCache();
+	void			PushGridCoord(vec2x<int> GridCoord,TPokeyTrace* Trace=nullptr);
+	void			PushPress(TPokeyMeta& Pokey,vec2x<int> GridCoord,TPokeyTrace* Trace,uint64 SampleTimeNs);	//	via the merger when zoned
+	std::shared_ptr<TPokeyMeta>	UpdateDiscoveredPokey(TJob& Job);
+	std::shared_ptr<TPokeyMeta>	GetReplyPokey(const TJob& Job);
+	bool			AddZone(const std::string& Name,const std::string& InterfaceAddress,const std::string& BroadcastAddress,const TPokeyPollTimerParams& TimerParams,size_t& Index,std::stringstream& Error);
+	void			AssignShard(std::shared_ptr<TPokeyMeta> Pokey,size_t ShardIndex);
+	size_t			GetMergeInput(const TPokeyMeta& Pokey);
+	TPokeyPollMailbox*	GetPollMailbox(const TPokeyMeta& Pokey);	//	its zone's, or the main one; null if replies aren't coalesced
+	bool			IsMerging() const;		//	presses go through the event merger
+	bool			StartClusterMember(const std::string& Name,const std::string& AggregatorAddress,const std::string& Serials,std::stringstream& Error);
+	bool			StartClusterAggregator(int Port,std::stringstream& Error);
+	bool			StartHttpServer(int Port,int FallbackPort,std::stringstream& Error);
+	void			StartLaserGatePoll(int PollIntervalMs,const TPokeyPollTimerParams& TimerParams);
+	void			StartPollMailbox();
+	std::shared_ptr<TPokeyPollMailbox>	NewPollMailbox(const std::string& Name);	//	started
+	bool			IsClusterOwned(int Serial);		//	false if another instance polls this serial
 	void			PushLaserGateState(bool State);
 	bool			EnableDiscovery(bool Enable, bool& OldState);
 	bool			EnablePoll(bool Enable, bool& OldState);
 
 	void			GetConnectedStatus(std::ostream& Status);
+	void			GetPokeyList(std::ostream& Status);
+	void			GetPeekGridCoord(std::ostream& Status);
+	void			GetPopGridCoord(std::ostream& Status);
+	void			GetPeekLaserGateState(std::ostream& Status);
+	void			GetPopLaserGateState(std::ostream& Status);
+	void			GetStatus(std::ostream& Status);
+	bool			GetBatchReply(const std::string& Commands,bool Json,std::ostream& Reply,std::stringstream& Error);
+	bool			RunBatch(const ArrayBridge<TPokeyBatchCommand>& Batch,ArrayBridge<std::string>&& Replies,std::stringstream& Error);	//	one reply per command. Coord and gate commands see one state; list and error are from just before
+
+	//	coord and gate state, shared by the jobs, the http server and batches; caller holds mLastGridCoordLock
+	vec2x<int>		PeekGridCoordLocked(uint64 NowNs);
+	vec2x<int>		PopGridCoordLocked();
+	bool			PushGridCoordLocked(vec2x<int> GridCoord,TPokeyTrace* Trace,uint64 NowNs);	//	true if an undelivered trace was replaced
+	bool			PeekLaserGateLocked(uint64 NowNs);
+	bool			PopLaserGateLocked();
+	void			PushLaserGateLocked(bool State,uint64 NowNs);
+	TPokeyTrace		TakeGridCoordTraceLocked();
+	static bool		HasPeekExpired(uint64 SetNs,uint64 NowNs);	//	peeks stop seeing a coord or gate a second after it was set
+	static void		OnTraceDelivered(TPokeyTrace& Trace);
+
+	static void		WriteGridCoord(std::ostream& Reply,vec2x<int> GridCoord);
+	static void		WriteLaserGateState(std::ostream& Reply,bool State);
 	void			GetIgnoredPinStatus(std::ostream& Status);
 
 public:
@@ -225,13 +439,50 @@ public:
 
 	std::shared_ptr<TChannel>	mDiscoverPokeyChannel;
 
+	std::shared_ptr<TPokeyConfigThread>	mConfigThread;
+	std::mutex					mConfigLock;
+	std::string					mConfigFilename;
+	std::shared_ptr<TPokeyConfig>	mConfig;			//	currently applied
+	std::shared_ptr<TPokeyConfig>	mPendingConfig;		//	parsed, waiting for the poll thread to swap in
+	std::string					mConfigError;			//	last reload error
+
+	std::shared_ptr<TPokeyReplayThread>	mReplayThread;
+	TPokeyFrameAssembler		mFrameAssembler;
+	TPokeyTracker				mTracker;				//	people on the floor, fed every board sample
+	TPokeyHeatmap				mHeatmap;				//	per-cell presses for the dashboard images
+	TPokeyTriggerZones			mTriggerZones;			//	named regions from config, enter/exit per sample
+	TPokeySubscriptions			mSubscriptions;			//	clients' regions, per-pin edges pushed by mHttpServer
+	TPokeyFloorSnapshot			mFloorSnapshot;			//	whole floor bitmap and deltas, read by mHttpServer
+	std::shared_ptr<TPokeyEventStore>	mEventStore;	//	edge history on disk, set at startup if enabled
+	TPokeyLaserGate				mLaserGate;				//	beam edges and timing from gate boards
+	std::shared_ptr<TPokeyLaserGatePoller>	mLaserGatePoller;	//	gate boards' own poll, set at startup if enabled
+	std::shared_ptr<TPokeyPollMailbox>	mPollMailbox;	//	poll replies applied off the channel threads, set at startup if enabled. Zones have their own
+
+	//	zones; only added, so readers need no lock for indexes below mShardCount
+	static const size_t			MaxShards = 16;
+	std::mutex					mShardsLock;			//	adding zones, moving pokeys between them
+	std::shared_ptr<TPokeyShard>	mShards[MaxShards];
+	std::atomic<size_t>			mShardCount;
+	std::atomic<unsigned char>	mShardBySerial[0x10000];	//	shard index+1, 0 for none. Routes replies without the registry lock
+	TPokeyEventMerger			mEventMerger;
+	size_t						mDefaultMergeInput;
+
+	std::shared_ptr<TPokeyClusterMember>		mClusterMember;		//	streaming our pokeys to an aggregator
+	std::shared_ptr<TPokeyClusterAggregator>	mClusterAggregator;	//	taking other instances' pokeys
+	std::shared_ptr<TPokeyHttpServer>			mHttpServer;		//	keep-alive fast path for polled endpoints
+
+	std::mutex					mAddressCacheLock;
+	std::string					mAddressCacheFilename;	//	last known serial->address table, empty to disable
+	std::shared_ptr<TPokeyAddressCacheThread>	mAddressCacheThread;	//	set when the filename is
+
 	
 	std::mutex					mLastGridCoordLock;
 	vec2x<int>					mLastGridCoord;
+	TPokeyTrace					mLastGridCoordTrace;	//	press that set mLastGridCoord, until something reads it
 	bool						mLaserGateState;
 
-	SoyTime						mLastGridCoordTime;		//	time coord was last set
-	SoyTime						mLastLaserGateTime;		//	time coord was last set
+	uint64						mLastGridCoordNs;		//	monotonic time coord was last set
+	uint64						mLastLaserGateNs;		//	monotonic time laser gate was last set
 };
 
 
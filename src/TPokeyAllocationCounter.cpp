@@ -0,0 +1,70 @@
+#include "TPokeyAllocationCounter.h"
+#include <new>
+#include <cstdlib>
+
+
+#if defined(POPPOKEY_COUNT_ALLOCATIONS)
+
+namespace
+{
+	thread_local uint64	gAllocationCount = 0;
+}
+
+bool TPokeyAllocationCounter::IsCounting()
+{
+	return true;
+}
+
+uint64 TPokeyAllocationCounter::GetCount()
+{
+	return gAllocationCount;
+}
+
+
+void* operator new(std::size_t Size)
+{
+	gAllocationCount++;
+	void* Data = std::malloc( Size ? Size : 1 );
+	if ( !Data )
+		throw std::bad_alloc();
+	return Data;
+}
+
+void* operator new[](std::size_t Size)
+{
+	return operator new( Size );
+}
+
+void operator delete(void* Data) noexcept
+{
+	std::free( Data );
+}
+
+void operator delete[](void* Data) noexcept
+{
+	std::free( Data );
+}
+
+void operator delete(void* Data,std::size_t) noexcept
+{
+	std::free( Data );
+}
+
+void operator delete[](void* Data,std::size_t) noexcept
+{
+	std::free( Data );
+}
+
+#else
+
+bool TPokeyAllocationCounter::IsCounting()
+{
+	return false;
+}
+
+uint64 TPokeyAllocationCounter::GetCount()
+{
+	return 0;
+}
+
+#endif
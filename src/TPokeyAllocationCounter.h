@@ -0,0 +1,11 @@
+#pragma once
+#include <ofxSoylent.h>
+
+
+//	counts allocations for the benchmark. The replaced global operator new this needs is only compiled
+//	in when POPPOKEY_COUNT_ALLOCATIONS is defined, so a normal build allocates as it always has
+namespace TPokeyAllocationCounter
+{
+	bool			IsCounting();
+	uint64			GetCount();		//	on this thread
+}
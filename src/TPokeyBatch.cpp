@@ -0,0 +1,121 @@
+#include "TPokeyBatch.h"
+#include "TPokeyConfig.h"
+#include <SoyString.h>
+#include <cstdio>
+
+
+int TPokeyBatchCommand::GetParamAsInt(const std::string& Name,int Default) const
+{
+	auto it = mParams.find( Name );
+	if ( it == mParams.end() )
+		return Default;
+	int Value = Default;
+	if ( !Soy::StringToType( Value, it->second ) )
+		return Default;
+	return Value;
+}
+
+
+bool TPokeyBatch::Parse(const std::string& Commands,ArrayBridge<TPokeyBatchCommand>&& Batch,std::stringstream& Error)
+{
+	size_t Start = 0;
+	while ( Start <= Commands.length() )
+	{
+		auto End = Commands.find_first_of( ";\n", Start );
+		if ( End == std::string::npos )
+			End = Commands.length();
+
+		std::stringstream Line( Commands.substr( Start, End-Start ) );
+		Start = End+1;
+
+		std::string Word;
+		if ( !(Line >> Word) )
+			continue;
+
+		if ( Batch.GetSize() >= MaxCommands )
+		{
+			Error << "batch has more than " << MaxCommands << " commands";
+			return false;
+		}
+
+		auto& Command = Batch.PushBack();
+		Command.mCommand = Word;
+		Command.mLowerCommand = Soy::StringToLowerCopy( Word );
+		while ( Line >> Word )
+		{
+			auto Equals = Word.find('=');
+			if ( Equals == std::string::npos || Equals == 0 )
+			{
+				Error << Command.mCommand << " param should be key=value, got " << Word;
+				return false;
+			}
+			Command.mParams[ Soy::StringToLowerCopy( Word.substr(0,Equals) ) ] = Word.substr( Equals+1 );
+		}
+	}
+
+	if ( Batch.IsEmpty() )
+	{
+		Error << "batch has no commands";
+		return false;
+	}
+	return true;
+}
+
+void TPokeyBatch::WriteText(const ArrayBridge<TPokeyBatchCommand>& Batch,const ArrayBridge<std::string>& Replies,std::ostream& Output)
+{
+	for ( int i=0;	i<Batch.GetSize() && i<Replies.GetSize();	i++ )
+	{
+		//	multi-line replies (status) keep their lines, but not a trailing blank one
+		auto& Reply = Replies[i];
+		auto Length = Reply.find_last_not_of( "\r\n" );
+		Length = ( Length == std::string::npos ) ? 0 : Length+1;
+		Output << Batch[i].mCommand << ": ";
+		Output.write( Reply.c_str(), Length );
+		Output << std::endl;
+	}
+}
+
+void TPokeyBatch::WriteJson(const ArrayBridge<TPokeyBatchCommand>& Batch,const ArrayBridge<std::string>& Replies,std::ostream& Output)
+{
+	Output << "[";
+	for ( int i=0;	i<Batch.GetSize() && i<Replies.GetSize();	i++ )
+	{
+		if ( i > 0 )
+			Output << ",";
+		Output << "{\"command\":";
+		WriteJsonString( Batch[i].mCommand, Output );
+		Output << ",\"reply\":";
+		WriteJsonString( Replies[i], Output );
+		Output << "}";
+	}
+	Output << "]";
+}
+
+void TPokeyBatch::WriteJsonString(const std::string& String,std::ostream& Output)
+{
+	Output << '"';
+	for ( auto c : String )
+	{
+		switch ( c )
+		{
+			case '"':	Output << "\\\"";	break;
+			case '\\':	Output << "\\\\";	break;
+			case '\n':	Output << "\\n";	break;
+			case '\r':	Output << "\\r";	break;
+			case '\t':	Output << "\\t";	break;
+			default:
+				if ( static_cast<unsigned char>(c) < 0x20 )
+				{
+					char Escaped[8];
+					snprintf( Escaped, sizeof(Escaped), "\\u%04x", c );
+					Output << Escaped;
+				}
+				else
+				{
+					Output << c;
+				}
+				break;
+		}
+	}
+	Output << '"';
+}
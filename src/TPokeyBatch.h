@@ -0,0 +1,29 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <map>
+
+
+//	one command in a batch, parsed from "PushGridCoord pinx=1 piny=2"
+class TPokeyBatchCommand
+{
+public:
+	int				GetParamAsInt(const std::string& Name,int Default) const;
+
+public:
+	std::string		mCommand;		//	as given, for the reply
+	std::string		mLowerCommand;
+	std::map<std::string,std::string>	mParams;
+};
+
+
+//	batch job; commands=PopGridCoord;PopLaserGate;error runs them in order as one step and replies
+//	with all their results at once. Replies are "command: result" lines, or a json array
+namespace TPokeyBatch
+{
+	const size_t	MaxCommands = 32;
+
+	bool			Parse(const std::string& Commands,ArrayBridge<TPokeyBatchCommand>&& Batch,std::stringstream& Error);	//	; or newline separated
+	void			WriteText(const ArrayBridge<TPokeyBatchCommand>& Batch,const ArrayBridge<std::string>& Replies,std::ostream& Output);
+	void			WriteJson(const ArrayBridge<TPokeyBatchCommand>& Batch,const ArrayBridge<std::string>& Replies,std::ostream& Output);
+	void			WriteJsonString(const std::string& String,std::ostream& Output);
+}
@@ -0,0 +1,839 @@
+#include "TPokeyBenchmark.h"
+#include "PopPokey.h"
+#include "TProtocolPokey.h"
+#include "TPokeyConfig.h"
+#include "TPokeyTracker.h"
+#include "TPokeyTriggerZones.h"
+#include "TPokeyAllocationCounter.h"
+#include <TProtocolCli.h>
+#include <SoyString.h>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+
+namespace Benchmark
+{
+	volatile uint64		gSink = 0;			//	results are written here so the optimiser can't drop the work
+
+	const int			PinCount = 55;		//	pins in a GetDeviceState reply
+
+	void				MakeStateFrame(BufferArray<unsigned char,64>& Frame,uint64 PinsDown);
+	void				MakeDiscoveryFrame(BufferArray<unsigned char,100>& Frame,int Serial,bool Protocol4913);
+	void				GetConfigGridMaps(const std::string& Filename,ArrayBridge<std::string>&& GridMaps,ArrayBridge<int>&& Serials);
+
+	//	perf stat style hardware counters for this thread. Invalid in containers and on other platforms
+	namespace TCounter
+	{
+		enum Type
+		{
+			Cycles,
+			Instructions,
+			CacheMisses,
+			L1dMisses,
+			Count
+		};
+	}
+	class TPerfCounters
+	{
+	public:
+		TPerfCounters();
+		~TPerfCounters();
+
+		bool			IsValid() const		{	return mValid;	}
+		void			Start();
+		void			Stop();				//	adds to mTotals
+
+	public:
+		uint64			mTotals[TCounter::Count];
+
+	private:
+		int				mFiles[TCounter::Count];
+		bool			mValid;
+	};
+
+	//	TPokeyMeta as it was before the pin state moved into TPokeyBoardStates; a heap object with the
+	//	per-pin structs between the strings, so the layout benchmark has something to compare against
+	class TLegacyPin
+	{
+	public:
+		TLegacyPin() :
+			mDownDuration	( 0 ),
+			mDown			( false ),
+			mHasEdgeCount	( false ),
+			mEdgeCount		( 0 ),
+			mCoord			( TPokeyMeta::GridCoordInvalid )
+		{
+		}
+
+	public:
+		float			mDownDuration;
+		bool			mDown;
+		bool			mHasEdgeCount;
+		uint32			mEdgeCount;
+		vec2x<int>		mCoord;
+	};
+	class TLegacyPokey
+	{
+	public:
+		TLegacyPokey() :
+			mSerial			( -1 ),
+			mIgnored		( false ),
+			mLastUpdateNs	( 0 )
+		{
+		}
+
+		vec2x<int>		UpdatePins(const ArrayBridge<bool>& Pins,uint64 SampleTimeNs);
+
+	public:
+		BufferArray<TLegacyPin,100>	mPins;
+		std::string		mAddress;
+		int				mSerial;
+		SoyRef			mChannelRef;
+		std::string		mVersion;
+		bool			mIgnored;
+		uint64			mLastUpdateNs;
+		std::shared_ptr<TPokeyBoardMetrics>	mMetrics;
+		TPokeyOutputs	mOutputs;
+	};
+}
+
+
+void Benchmark::MakeStateFrame(BufferArray<unsigned char,64>& Frame,uint64 PinsDown)
+{
+	Frame.SetSize( 64 );
+	for ( int i=0;	i<Frame.GetSize();	i++ )
+		Frame[i] = 0;
+
+	Frame[0] = 0xAA;
+	Frame[1] = TPokeyCommand::GetDeviceState;
+	Frame[6] = 1;
+	for ( int i=0;	i<PinCount;	i++ )
+	{
+		if ( PinsDown & (1ull<<i) )
+			Frame[8 + (i/8)] |= 1 << (i%8);
+	}
+	Frame[7] = TPokeyCommand::CalculateChecksum( Frame.GetArray() );
+}
+
+void Benchmark::MakeDiscoveryFrame(BufferArray<unsigned char,100>& Frame,int Serial,bool Protocol4913)
+{
+	Frame.SetSize( Protocol4913 ? 19 : 14 );
+	for ( int i=0;	i<Frame.GetSize();	i++ )
+		Frame[i] = 0;
+
+	Frame[0] = 1;
+	Frame[3] = Protocol4913 ? 49 : 33;
+	Frame[4] = Protocol4913 ? 13 : 52;
+	Frame[5] = 192;
+	Frame[6] = 168;
+	Frame[7] = 0;
+	Frame[8] = 100;
+	Frame[9] = 1;
+	Frame[10] = 192;
+	Frame[11] = 168;
+	Frame[12] = 0;
+	Frame[13] = 1;
+
+	if ( Protocol4913 )
+	{
+		Frame[14] = Serial & 0xff;
+		Frame[15] = (Serial >> 8) & 0xff;
+	}
+	else
+	{
+		Frame[1] = (Serial >> 8) & 0xff;
+		Frame[2] = Serial & 0xff;
+	}
+}
+
+void Benchmark::GetConfigGridMaps(const std::string& Filename,ArrayBridge<std::string>&& GridMaps,ArrayBridge<int>&& Serials)
+{
+	Array<std::string> Lines;
+	std::stringstream Error;
+	Soy::FileToStringLines( Filename, GetArrayBridge(Lines), Error );
+
+	for ( int i=0;	i<Lines.GetSize();	i++ )
+	{
+		auto& Line = Lines[i];
+		if ( Line.empty() || Line[0] == '#' )
+			continue;
+
+		TProtocolCli Protocol;
+		TJob Job;
+		if ( !Protocol.DecodeHeader( Job, Line ) )
+			continue;
+		if ( Soy::StringToLowerCopy( Job.mParams.mCommand ) != "setuppokey" )
+			continue;
+
+		GridMaps.PushBack( Job.mParams.GetParamAs<std::string>("gridmap") );
+		Serials.PushBack( Job.mParams.GetParamAsWithDefault<int>("serial",-1) );
+	}
+
+	//	same defaults PopMain falls back to
+	if ( GridMaps.IsEmpty() )
+	{
+		std::Debug << "benchmark: no gridmaps in " << Filename << ", using debug gridmaps" << std::endl;
+		GridMaps.PushBack("0,0/1,0/2,0");
+		Serials.PushBack(21244);
+		GridMaps.PushBack("0,1/1,1/2,1");
+		Serials.PushBack(22961);
+		GridMaps.PushBack("lasergate");
+		Serials.PushBack(22962);
+	}
+}
+
+
+Benchmark::TPerfCounters::TPerfCounters() :
+	mValid	( false )
+{
+	for ( int c=0;	c<TCounter::Count;	c++ )
+	{
+		mTotals[c] = 0;
+		mFiles[c] = -1;
+	}
+
+#if defined(__linux__)
+	perf_event_attr Attribs[TCounter::Count];
+	memset( Attribs, 0, sizeof(Attribs) );
+	Attribs[TCounter::Cycles].type = PERF_TYPE_HARDWARE;
+	Attribs[TCounter::Cycles].config = PERF_COUNT_HW_CPU_CYCLES;
+	Attribs[TCounter::Instructions].type = PERF_TYPE_HARDWARE;
+	Attribs[TCounter::Instructions].config = PERF_COUNT_HW_INSTRUCTIONS;
+	Attribs[TCounter::CacheMisses].type = PERF_TYPE_HARDWARE;
+	Attribs[TCounter::CacheMisses].config = PERF_COUNT_HW_CACHE_MISSES;
+	Attribs[TCounter::L1dMisses].type = PERF_TYPE_HW_CACHE;
+	Attribs[TCounter::L1dMisses].config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+	mValid = true;
+	for ( int c=0;	c<TCounter::Count;	c++ )
+	{
+		auto& Attrib = Attribs[c];
+		Attrib.size = sizeof(Attrib);
+		Attrib.disabled = 1;
+		Attrib.exclude_kernel = 1;
+		Attrib.exclude_hv = 1;
+		mFiles[c] = static_cast<int>( syscall( __NR_perf_event_open, &Attrib, 0, -1, -1, 0 ) );
+		if ( mFiles[c] < 0 )
+			mValid = false;
+	}
+#endif
+}
+
+Benchmark::TPerfCounters::~TPerfCounters()
+{
+#if defined(__linux__)
+	for ( int c=0;	c<TCounter::Count;	c++ )
+		if ( mFiles[c] >= 0 )
+			close( mFiles[c] );
+#endif
+}
+
+void Benchmark::TPerfCounters::Start()
+{
+#if defined(__linux__)
+	if ( !mValid )
+		return;
+	for ( int c=0;	c<TCounter::Count;	c++ )
+	{
+		ioctl( mFiles[c], PERF_EVENT_IOC_RESET, 0 );
+		ioctl( mFiles[c], PERF_EVENT_IOC_ENABLE, 0 );
+	}
+#endif
+}
+
+void Benchmark::TPerfCounters::Stop()
+{
+#if defined(__linux__)
+	if ( !mValid )
+		return;
+	for ( int c=0;	c<TCounter::Count;	c++ )
+		ioctl( mFiles[c], PERF_EVENT_IOC_DISABLE, 0 );
+	for ( int c=0;	c<TCounter::Count;	c++ )
+	{
+		uint64 Value = 0;
+		if ( read( mFiles[c], &Value, sizeof(Value) ) == sizeof(Value) )
+			mTotals[c] += Value;
+	}
+#endif
+}
+
+
+vec2x<int> Benchmark::TLegacyPokey::UpdatePins(const ArrayBridge<bool>& Pins,uint64 SampleTimeNs)
+{
+	if ( mLastUpdateNs == 0 )
+		mLastUpdateNs = SampleTimeNs;
+	float Delta = 0.f;
+	if ( SampleTimeNs > mLastUpdateNs )
+		Delta = std::min( 1.f, (SampleTimeNs - mLastUpdateNs) / 1000000000.0f );
+	mLastUpdateNs = std::max( mLastUpdateNs, SampleTimeNs );
+
+	vec2x<int> Result = TPokeyMeta::GridCoordInvalid;
+	for ( int i=0;	i<Pins.GetSize();	i++ )
+	{
+		bool PinDown = Pins[i];
+		if ( i >= mPins.GetSize() )
+			mPins.SetSize( i+1 );
+		auto& Pin = mPins[i];
+		Pin.mDown = PinDown;
+		if ( PinDown )
+			Pin.mDownDuration += Delta;
+		else
+			Pin.mDownDuration = 0;
+
+		if ( !PinDown || Pin.mDownDuration >= TPokeyMeta::PinDownTooLong )
+			continue;
+		if ( Pin.mCoord == TPokeyMeta::GridCoordInvalid )
+			continue;
+		Result = Pin.mCoord;
+	}
+	return Result;
+}
+
+
+std::ostream& operator<< (std::ostream &out,const TPokeyBenchmarkResult &in)
+{
+	out << "{";
+	out << "\"name\":\"" << in.mName << "\",";
+	out << "\"iterations\":" << in.mIterations << ",";
+	out << "\"ns_per_op\":" << in.mNsPerOp << ",";
+	out << "\"ns_per_op_min\":" << in.mNsPerOpMin;
+	if ( in.mHasAllocs )
+		out << ",\"allocs_per_op\":" << in.mAllocsPerOp;
+	if ( in.mHasCounters )
+	{
+		out << ",\"cycles_per_op\":" << in.mCyclesPerOp;
+		out << ",\"instructions_per_op\":" << in.mInstructionsPerOp;
+		out << ",\"cache_misses_per_op\":" << in.mCacheMissesPerOp;
+		out << ",\"l1d_misses_per_op\":" << in.mL1dMissesPerOp;
+	}
+	out << "}";
+	return out;
+}
+
+
+TPokeyBenchmarkParams::TPokeyBenchmarkParams() :
+	mConfigFilename	( "bootup.txt" ),
+	mRepeats		( 5 ),
+	mIterationScale	( 1.f )
+{
+}
+
+void TPokeyBenchmarkParams::Read(const TJobParams& Params)
+{
+	mFilter = Params.GetParamAs<std::string>("benchmarkfilter");
+	mOutputFilename = Params.GetParamAs<std::string>("benchmarkoutput");
+	mRepeats = std::max( 1, Params.GetParamAsWithDefault<int>("benchmarkrepeats", mRepeats) );
+	mIterationScale = std::max( 0.001f, Params.GetParamAsWithDefault<float>("benchmarkscale", mIterationScale) );
+
+	auto ConfigFilename = Params.GetParamAs<std::string>("config");
+	if ( !ConfigFilename.empty() )
+		mConfigFilename = ConfigFilename;
+}
+
+
+TPokeyBenchmark::TPokeyBenchmark(const TPokeyBenchmarkParams& Params) :
+	mParams		( Params )
+{
+}
+
+uint64 TPokeyBenchmark::GetAllocationCount()
+{
+	return TPokeyAllocationCounter::GetCount();
+}
+
+void TPokeyBenchmark::Run(const std::string& Name,uint64 Iterations,std::function<void()> Function)
+{
+	if ( !mParams.mFilter.empty() && Name.find( mParams.mFilter ) == std::string::npos )
+		return;
+
+	Iterations = std::max<uint64>( 1, static_cast<uint64>( Iterations * mParams.mIterationScale ) );
+
+	//	warm caches and let any lazy allocations happen before timing
+	for ( uint64 i=0;	i<Iterations/10;	i++ )
+		Function();
+
+	Array<float> NsPerOp;
+	uint64 Allocations = 0;
+	Benchmark::TPerfCounters Counters;
+	for ( int r=0;	r<mParams.mRepeats;	r++ )
+	{
+		auto AllocationsStart = GetAllocationCount();
+		Counters.Start();
+		auto Start = std::chrono::steady_clock::now();
+		for ( uint64 i=0;	i<Iterations;	i++ )
+			Function();
+		auto End = std::chrono::steady_clock::now();
+		Counters.Stop();
+		Allocations += GetAllocationCount() - AllocationsStart;
+
+		auto Ns = std::chrono::duration_cast<std::chrono::nanoseconds>( End - Start ).count();
+		NsPerOp.PushBack( Ns / static_cast<float>(Iterations) );
+	}
+
+	std::sort( NsPerOp.GetArray(), NsPerOp.GetArray() + NsPerOp.GetSize() );
+
+	auto& Result = mResults.PushBack();
+	Result.mName = Name;
+	Result.mIterations = Iterations;
+	Result.mNsPerOp = NsPerOp[NsPerOp.GetSize()/2];
+	Result.mNsPerOpMin = NsPerOp[0];
+	Result.mHasAllocs = TPokeyAllocationCounter::IsCounting();
+	Result.mAllocsPerOp = Allocations / static_cast<float>( Iterations * mParams.mRepeats );
+	Result.mHasCounters = Counters.IsValid();
+	auto TotalIterations = static_cast<float>( Iterations * mParams.mRepeats );
+	Result.mCyclesPerOp = Counters.mTotals[Benchmark::TCounter::Cycles] / TotalIterations;
+	Result.mInstructionsPerOp = Counters.mTotals[Benchmark::TCounter::Instructions] / TotalIterations;
+	Result.mCacheMissesPerOp = Counters.mTotals[Benchmark::TCounter::CacheMisses] / TotalIterations;
+	Result.mL1dMissesPerOp = Counters.mTotals[Benchmark::TCounter::L1dMisses] / TotalIterations;
+
+	std::Debug << "benchmark " << Result << std::endl;
+}
+
+void TPokeyBenchmark::WriteResults(std::ostream& Output)
+{
+	for ( int i=0;	i<mResults.GetSize();	i++ )
+		Output << mResults[i] << std::endl;
+}
+
+void TPokeyBenchmark::RunAll(TPopPokey& App)
+{
+	Array<std::string> GridMaps;
+	Array<int> Serials;
+	Benchmark::GetConfigGridMaps( mParams.mConfigFilename, GetArrayBridge(GridMaps), GetArrayBridge(Serials) );
+
+	RunDecode();
+	RunGridMap( GetArrayBridge(GridMaps) );
+	RunPins( App, GridMaps[0] );
+	RunGetPokey();
+	RunTracking();
+	RunTriggerZones();
+	RunBoardLayout();
+
+	//	app pokeys as they'd be after bootup
+	for ( int i=0;	i<GridMaps.GetSize();	i++ )
+	{
+		auto Pokey = App.GetPokey( Serials[i], true );
+		std::stringstream Error;
+		Pokey->SetGridMap( GridMaps[i], Error );
+		Pokey->SetAddress( "192.168.0.100:20055" );
+		Pokey->SetVersion( "49.13" );
+	}
+	RunReplies( App );
+}
+
+void TPokeyBenchmark::RunDecode()
+{
+	TProtocolPokey Protocol;
+
+	BufferArray<unsigned char,64> IdleFrame;
+	Benchmark::MakeStateFrame( IdleFrame, 0 );
+	Run("decode_reply_state_idle", 200000, [&]
+	{
+		TJob Job;
+		Protocol.DecodeReply( Job, IdleFrame );
+	});
+
+	BufferArray<unsigned char,64> PressedFrame;
+	Benchmark::MakeStateFrame( PressedFrame, 0x5555555555555ull );
+	Run("decode_reply_state_pressed", 200000, [&]
+	{
+		TJob Job;
+		Protocol.DecodeReply( Job, PressedFrame );
+	});
+
+	BufferArray<unsigned char,100> Discovery3352;
+	Benchmark::MakeDiscoveryFrame( Discovery3352, 21244, false );
+	Run("decode_discovery_33.52", 200000, [&]
+	{
+		TJob Job;
+		Protocol.DecodeDiscovery( Job, GetArrayBridge(Discovery3352) );
+	});
+
+	BufferArray<unsigned char,100> Discovery4913;
+	Benchmark::MakeDiscoveryFrame( Discovery4913, 21244, true );
+	Run("decode_discovery_49.13", 200000, [&]
+	{
+		TJob Job;
+		Protocol.DecodeDiscovery( Job, GetArrayBridge(Discovery4913) );
+	});
+
+	Run("discovery_reply_size", 5000000, [&]
+	{
+		Benchmark::gSink += TProtocolPokey::GetDiscoveryReplySize( GetArrayBridge(Discovery4913) );
+	});
+
+	Run("calculate_checksum", 5000000, [&]
+	{
+		Benchmark::gSink += TPokeyCommand::CalculateChecksum( PressedFrame.GetArray() );
+	});
+}
+
+void TPokeyBenchmark::RunGridMap(const ArrayBridge<std::string>& GridMaps)
+{
+	//	the biggest gridmap is the worst case
+	size_t Largest = 0;
+	for ( int i=1;	i<GridMaps.GetSize();	i++ )
+	{
+		if ( GridMaps[i].length() > GridMaps[Largest].length() )
+			Largest = i;
+	}
+	auto& GridMap = GridMaps[Largest];
+
+	TPokeyMeta Pokey;
+	Run("set_gridmap_string", 100000, [&]
+	{
+		std::stringstream Error;
+		Pokey.SetGridMap( GridMap, Error );
+	});
+
+	Run("set_gridmap_config", 20000, [&]
+	{
+		for ( int i=0;	i<GridMaps.GetSize();	i++ )
+		{
+			std::stringstream Error;
+			Pokey.SetGridMap( GridMaps[i], Error );
+		}
+	});
+}
+
+void TPokeyBenchmark::RunPins(TPopPokey& App,const std::string& GridMap)
+{
+	TPokeyMeta Pokey;
+	std::stringstream Error;
+	Pokey.SetGridMap( GridMap, Error );
+
+	BufferArray<bool,Benchmark::PinCount> IdlePins;
+	BufferArray<bool,Benchmark::PinCount> HeldPins;
+	{
+		std::lock_guard<std::mutex> Lock( Pokey.mStateLock );
+		for ( int i=0;	i<Benchmark::PinCount;	i++ )
+		{
+			IdlePins.PushBack( false );
+			//	only hold mapped pins, unmapped ones log a warning
+			HeldPins.PushBack( i < Pokey.GetGridMapCount() && Pokey.GetPinGridCoord(i) != TPokeyMeta::GridCoordInvalid );
+		}
+	}
+
+	Run("update_pins_idle", 500000, [&]
+	{
+		Benchmark::gSink += Pokey.UpdatePins( GetArrayBridge(IdlePins) ).x;
+	});
+
+	Run("update_pins_held", 500000, [&]
+	{
+		Benchmark::gSink += Pokey.UpdatePins( GetArrayBridge(HeldPins) ).x;
+	});
+
+	//	no presses; a press would push a coord and log it
+	BufferArray<char,Benchmark::PinCount> IdlePinChars;
+	for ( int i=0;	i<Benchmark::PinCount;	i++ )
+		IdlePinChars.PushBack('0');
+	Run("update_pin_state_idle", 200000, [&]
+	{
+		App.UpdatePinState( Pokey, GetArrayBridge(IdlePinChars) );
+	});
+}
+
+void TPokeyBenchmark::RunGetPokey()
+{
+	size_t Counts[] = { 15, 150, 1500 };
+	for ( int c=0;	c<sizeofarray(Counts);	c++ )
+	{
+		auto Count = Counts[c];
+		TPokeyManager Manager;
+		Array<int> Serials;
+		Array<SoyRef> ChannelRefs;
+		for ( int i=0;	i<Count;	i++ )
+		{
+			int Serial = 20000 + i;
+			auto Pokey = Manager.GetPokey( Serial, true );
+			Pokey->SetChannelRef( SoyRef( Soy::StreamToString( std::stringstream() << Serial ).c_str() ) );
+			Serials.PushBack( Serial );
+			ChannelRefs.PushBack( Pokey->GetChannelRef() );
+		}
+
+		//	look up every pokey in turn so the average covers the whole array
+		std::stringstream CountString;
+		CountString << Count;
+		size_t Next = 0;
+		Run("get_pokey_serial_" + CountString.str(), 100000, [&]
+		{
+			auto Pokey = Manager.GetPokey( Serials[Next], false );
+			Benchmark::gSink += Pokey ? 1 : 0;
+			Next = (Next+1) % Serials.GetSize();
+		});
+
+		Next = 0;
+		Run("get_pokey_channel_" + CountString.str(), 100000, [&]
+		{
+			auto Pokey = Manager.GetPokey( ChannelRefs[Next] );
+			Benchmark::gSink += Pokey ? 1 : 0;
+			Next = (Next+1) % ChannelRefs.GetSize();
+		});
+	}
+}
+
+void TPokeyBenchmark::RunTracking()
+{
+	//	same crowd on a small and a big floor; the cost should follow the footsteps, not the floor
+	int FloorSizes[] = { 100, 1000 };
+	const int PersonCount = 50;
+	for ( int f=0;	f<sizeofarray(FloorSizes);	f++ )
+	{
+		auto FloorSize = FloorSizes[f];
+		TPokeyTracker Tracker;
+
+		//	each person walks along their own row, feet two rows apart, one foot stepping past the other every frame
+		class TWalker
+		{
+		public:
+			vec2x<int>	mFeet[2];
+			int			mNextFoot;
+		};
+		Array<TWalker> Walkers;
+		uint64 TimeNs = 1;
+		for ( int p=0;	p<PersonCount;	p++ )
+		{
+			auto& Walker = Walkers.PushBack();
+			int Row = (p % 10) * (FloorSize / 10);
+			int Column = (p / 10) * (FloorSize / 5);
+			Walker.mFeet[0] = vec2x<int>( Column, Row );
+			Walker.mFeet[1] = vec2x<int>( Column+1, Row+2 );
+			Walker.mNextFoot = 0;
+			Tracker.OnCellDown( Walker.mFeet[0], TimeNs );
+			Tracker.OnCellDown( Walker.mFeet[1], TimeNs );
+		}
+		Tracker.Update( TimeNs );
+
+		std::stringstream FloorString;
+		FloorString << FloorSize;
+		Run("track_crowd_50_floor_" + FloorString.str(), 2000, [&]
+		{
+			TimeNs += 10 * 1000000;
+			for ( int p=0;	p<Walkers.GetSize();	p++ )
+			{
+				auto& Walker = Walkers[p];
+				auto& Foot = Walker.mFeet[Walker.mNextFoot];
+				auto& OtherFoot = Walker.mFeet[!Walker.mNextFoot];
+				Tracker.OnCellUp( Foot, TimeNs );
+				Foot.x = (OtherFoot.x + 1) % FloorSize;
+				Tracker.OnCellDown( Foot, TimeNs );
+				Walker.mNextFoot = !Walker.mNextFoot;
+			}
+			Tracker.Update( TimeNs );
+		});
+
+		Run("track_idle_50_floor_" + FloorString.str(), 20000, [&]
+		{
+			TimeNs += 10 * 1000000;
+			Tracker.Update( TimeNs );
+		});
+	}
+}
+
+void TPokeyBenchmark::RunTriggerZones()
+{
+	//	a 4x4 floor of boards, each pin its own cell, covered in overlapping zones
+	const int BoardsWide = 4;
+	const int BoardsHigh = 4;
+	const int BoardWidth = 11;
+	const int BoardHeight = Benchmark::PinCount / BoardWidth;
+	const int ZoneCount = 500;
+
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	for ( int b=0;	b<BoardsWide*BoardsHigh;	b++ )
+	{
+		std::shared_ptr<TPokeyMeta> Pokey( new TPokeyMeta() );
+		Pokey->mSerial = 20000 + b;
+		BufferArray<vec2x<int>,64> GridMap;
+		for ( int p=0;	p<Benchmark::PinCount;	p++ )
+			GridMap.PushBack( vec2x<int>( (b % BoardsWide) * BoardWidth + (p % BoardWidth), (b / BoardsWide) * BoardHeight + (p / BoardWidth) ) );
+		Pokey->SetGridMap( GetArrayBridge(GridMap) );
+		Pokeys.PushBack( Pokey );
+	}
+
+	//	fixed seed so runs compare
+	uint32 Random = 12345;
+	auto NextRandom = [&Random](int Max)
+	{
+		Random = Random * 1103515245 + 12345;
+		return static_cast<int>( (Random >> 16) % Max );
+	};
+	Array<TPokeyTriggerZoneConfig> Zones;
+	for ( int z=0;	z<ZoneCount;	z++ )
+	{
+		auto& Zone = Zones.PushBack();
+		std::stringstream Name;
+		Name << "zone" << z;
+		Zone.mName = Name.str();
+		Zone.mMin = vec2x<int>( NextRandom( BoardsWide*BoardWidth ), NextRandom( BoardsHigh*BoardHeight ) );
+		Zone.mMax = vec2x<int>( Zone.mMin.x + 1 + NextRandom(10), Zone.mMin.y + 1 + NextRandom(6) );
+	}
+
+	TPokeyTriggerZones TriggerZones;
+	TriggerZones.mMaxQueuedEvents = 0;
+	uint64 TimeNs = 1;
+	TriggerZones.SetZones( GetArrayBridge(Zones), TimeNs );
+	for ( int b=0;	b<Pokeys.GetSize();	b++ )
+		TriggerZones.OnSample( *Pokeys[b], 0, TimeNs );
+
+	//	one board's feet moving each sample, as most samples are
+	size_t Board = 0;
+	uint64 Step = 0;
+	Run("trigger_zones_500_board_changed", 200000, [&]
+	{
+		TimeNs += 1000000;
+		Step++;
+		uint64 Pins = (3ull << (Step % Benchmark::PinCount)) | (1ull << ((Step * 7) % Benchmark::PinCount));
+		TriggerZones.OnSample( *Pokeys[Board], Pins, TimeNs );
+		Board = (Board + 1) % Pokeys.GetSize();
+	});
+
+	Run("trigger_zones_500_board_unchanged", 1000000, [&]
+	{
+		TimeNs += 1000000;
+		TriggerZones.OnSample( *Pokeys[0], 0x55, TimeNs );
+	});
+
+	Run("trigger_zones_500_recompile", 2000, [&]
+	{
+		TimeNs += 1000000;
+		Pokeys[Board]->mGridMapVersion++;
+		TriggerZones.OnSample( *Pokeys[Board], 0, TimeNs );
+		Board = (Board + 1) % Pokeys.GetSize();
+	});
+}
+
+void TPokeyBenchmark::RunBoardLayout()
+{
+	//	every board polled once per op, as a poll thread does, in the old layout and the new one.
+	//	Boards are allocated between other allocations, as they are when discovered, so neither
+	//	layout gets a contiguous heap for free
+	size_t Counts[] = { 15, 1000 };
+	for ( int c=0;	c<sizeofarray(Counts);	c++ )
+	{
+		auto Count = Counts[c];
+		std::stringstream CountString;
+		CountString << Count;
+
+		BufferArray<vec2x<int>,64> GridMap;
+		for ( int p=0;	p<Benchmark::PinCount;	p++ )
+			GridMap.PushBack( vec2x<int>( p % 11, p / 11 ) );
+
+		Array<std::shared_ptr<Benchmark::TLegacyPokey>> LegacyPokeys;
+		Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+		Array<std::shared_ptr<std::string>> Clutter;
+		for ( int b=0;	b<Count;	b++ )
+		{
+			std::shared_ptr<Benchmark::TLegacyPokey> LegacyPokey( new Benchmark::TLegacyPokey() );
+			LegacyPokey->mSerial = 20000 + b;
+			LegacyPokey->mAddress = "192.168.0.100:20055";
+			LegacyPokey->mVersion = "49.13";
+			LegacyPokey->mPins.SetSize( GridMap.GetSize() );
+			for ( int p=0;	p<GridMap.GetSize();	p++ )
+				LegacyPokey->mPins[p].mCoord = GridMap[p];
+			LegacyPokeys.PushBack( LegacyPokey );
+			Clutter.PushBack( std::make_shared<std::string>( 200 + (b % 7) * 100, 'x' ) );
+
+			std::shared_ptr<TPokeyMeta> Pokey( new TPokeyMeta() );
+			Pokey->mSerial = 20000 + b;
+			Pokey->SetAddress( "192.168.0.100:20055" );
+			Pokey->SetVersion( "49.13" );
+			Pokey->SetGridMap( GetArrayBridge(GridMap) );
+			Pokeys.PushBack( Pokey );
+			Clutter.PushBack( std::make_shared<std::string>( 200 + (b % 5) * 100, 'x' ) );
+		}
+
+		//	mostly idle floor, a couple of boards with a foot down
+		BufferArray<bool,Benchmark::PinCount> IdlePins;
+		BufferArray<bool,Benchmark::PinCount> HeldPins;
+		for ( int i=0;	i<Benchmark::PinCount;	i++ )
+		{
+			IdlePins.PushBack( false );
+			HeldPins.PushBack( i == 3 || i == 4 );
+		}
+
+		uint64 TimeNs = 1;
+		Run("board_layout_legacy_update_" + CountString.str(), 20000000 / (Count*40), [&]
+		{
+			TimeNs += 1000000;
+			for ( int b=0;	b<LegacyPokeys.GetSize();	b++ )
+			{
+				auto& Pins = (b % 8) ? IdlePins : HeldPins;
+				Benchmark::gSink += LegacyPokeys[b]->UpdatePins( GetArrayBridge(Pins), TimeNs ).x;
+			}
+		});
+
+		//	same pins in, but the pin engine goes from them to a mask, under the lock UpdatePinState takes
+		Run("board_layout_dense_update_" + CountString.str(), 20000000 / (Count*40), [&]
+		{
+			TimeNs += 1000000;
+			bool NewPress;
+			for ( int b=0;	b<Pokeys.GetSize();	b++ )
+			{
+				auto& Pins = (b % 8) ? IdlePins : HeldPins;
+				uint64 Mask = 0;
+				for ( int p=0;	p<Pins.GetSize();	p++ )
+					Mask |= Pins[p] ? (1ull << p) : 0;
+				std::lock_guard<std::mutex> Lock( Pokeys[b]->mStateLock );
+				Benchmark::gSink += Pokeys[b]->UpdatePins( Mask, Pins.GetSize(), NewPress, TimeNs ).x;
+			}
+		});
+
+		//	status: are any pins stuck. How long the updates ran decides what's stuck, so both layouts
+		//	get the same floor instead; nothing stuck but the last board, so both walk all of it.
+		//	The dense boards get their own slots, so other benchmarks' boards aren't walked too
+		TPokeyBoardStates States;
+		for ( int b=0;	b<LegacyPokeys.GetSize();	b++ )
+		{
+			auto& Pokey = *LegacyPokeys[b];
+			auto& State = States.GetState( States.Alloc() );
+			for ( int p=0;	p<Pokey.mPins.GetSize();	p++ )
+			{
+				bool Stuck = ( b == LegacyPokeys.GetSize()-1 && p == 3 );
+				Pokey.mPins[p].mDownDuration = Stuck ? TPokeyMeta::PinDownTooLong : 0;
+				State.mStuckPins |= Stuck ? (1ull << p) : 0;
+			}
+		}
+
+		Run("board_layout_legacy_status_" + CountString.str(), 20000000 / (Count*10), [&]
+		{
+			bool Stuck = false;
+			for ( int b=0;	!Stuck && b<LegacyPokeys.GetSize();	b++ )
+			{
+				auto& Pokey = *LegacyPokeys[b];
+				for ( int p=0;	!Stuck && p<Pokey.mPins.GetSize();	p++ )
+					Stuck = ( Pokey.mPins[p].mDownDuration >= TPokeyMeta::PinDownTooLong );
+			}
+			Benchmark::gSink += Stuck ? 1 : 0;
+		});
+
+		Run("board_layout_dense_status_" + CountString.str(), 20000000 / (Count*10), [&]
+		{
+			Benchmark::gSink += States.HasStuckPins() ? 1 : 0;
+		});
+	}
+}
+
+void TPokeyBenchmark::RunReplies(TPopPokey& App)
+{
+	Run("peek_grid_coord_reply", 200000, [&]
+	{
+		std::stringstream Reply;
+		App.GetPeekGridCoord( Reply );
+		Benchmark::gSink += Reply.tellp();
+	});
+
+	Run("list_pokeys_reply", 20000, [&]
+	{
+		std::stringstream Reply;
+		App.GetPokeyList( Reply );
+		Benchmark::gSink += Reply.tellp();
+	});
+}
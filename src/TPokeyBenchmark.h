@@ -0,0 +1,71 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+#include <functional>
+
+
+class TPopPokey;
+
+
+class TPokeyBenchmarkParams
+{
+public:
+	TPokeyBenchmarkParams();
+
+	void			Read(const TJobParams& Params);
+
+public:
+	std::string		mFilter;			//	only run benchmarks whose name contains this
+	std::string		mOutputFilename;	//	json lines, stdout if empty
+	std::string		mConfigFilename;	//	gridmaps to benchmark against
+	int				mRepeats;			//	median is taken over repeats
+	float			mIterationScale;	//	scale every benchmark's iteration count
+};
+
+
+class TPokeyBenchmarkResult
+{
+public:
+	std::string		mName;
+	uint64			mIterations;
+	float			mNsPerOp;			//	median of repeats
+	float			mNsPerOpMin;
+	bool			mHasAllocs;			//	only in builds with POPPOKEY_COUNT_ALLOCATIONS
+	float			mAllocsPerOp;
+	bool			mHasCounters;		//	hardware counters, only where perf_event_open is allowed
+	float			mCyclesPerOp;
+	float			mInstructionsPerOp;
+	float			mCacheMissesPerOp;	//	last level
+	float			mL1dMissesPerOp;
+};
+std::ostream& operator<< (std::ostream &out,const TPokeyBenchmarkResult &in);
+
+
+//	times the decode, pin-update and reply paths with fixed inputs so runs can be compared without hardware.
+//	Results are written as one json object per line
+class TPokeyBenchmark
+{
+public:
+	TPokeyBenchmark(const TPokeyBenchmarkParams& Params);
+
+	void			RunAll(TPopPokey& App);
+	void			Run(const std::string& Name,uint64 Iterations,std::function<void()> Function);
+	void			WriteResults(std::ostream& Output);
+
+	static uint64	GetAllocationCount();		//	on this thread
+
+private:
+	void			RunDecode();
+	void			RunGridMap(const ArrayBridge<std::string>& GridMaps);
+	void			RunPins(TPopPokey& App,const std::string& GridMap);
+	void			RunGetPokey();
+	void			RunReplies(TPopPokey& App);
+	void			RunTracking();
+	void			RunTriggerZones();
+	void			RunBoardLayout();
+
+private:
+	TPokeyBenchmarkParams			mParams;
+	Array<TPokeyBenchmarkResult>	mResults;
+};
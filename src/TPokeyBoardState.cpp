@@ -0,0 +1,94 @@
+#include "TPokeyBoardState.h"
+#include "PopPokey.h"
+
+
+void TPokeyBoardState::Reset()
+{
+	mDownPins = 0;
+	mStuckPins = 0;
+	mMappedPins = 0;
+	mLaserGatePins = 0;
+	mEdgeCountPins = 0;
+	mEdgeCountDownPins = 0;
+	mLastUpdateNs = 0;
+	mPinCount = 0;
+	for ( size_t p=0;	p<MaxPins;	p++ )
+	{
+		mDownDuration[p] = 0;
+		mEdgeCount[p] = 0;
+		mPolledPresses[p] = 0;
+		mCoord[p] = TPokeyMeta::GridCoordInvalid;
+	}
+}
+
+
+TPokeyBoardStates::TPokeyBoardStates() :
+	mSlotCount	( 0 )
+{
+	for ( size_t c=0;	c<MaxChunks;	c++ )
+		mChunks[c] = nullptr;
+}
+
+TPokeyBoardStates::~TPokeyBoardStates()
+{
+	for ( size_t c=0;	c<MaxChunks;	c++ )
+		delete[] mChunks[c].load();
+}
+
+TPokeyBoardStates& TPokeyBoardStates::Get()
+{
+	static TPokeyBoardStates gBoardStates;
+	return gBoardStates;
+}
+
+size_t TPokeyBoardStates::Alloc()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+
+	//	reuse the lowest freed slot so live boards stay packed at the front
+	size_t Slot;
+	if ( !mFreeSlots.IsEmpty() )
+	{
+		size_t Lowest = 0;
+		for ( int i=1;	i<mFreeSlots.GetSize();	i++ )
+			if ( mFreeSlots[i] < mFreeSlots[Lowest] )
+				Lowest = i;
+		Slot = mFreeSlots[Lowest];
+		mFreeSlots.RemoveBlock( Lowest, 1 );
+	}
+	else
+	{
+		Slot = mSlotCount;
+		auto Chunk = Slot / ChunkSize;
+		if ( !Soy::Assert( Chunk < MaxChunks, "too many pokeys for the board state slots" ) )
+			return 0;
+		if ( !mChunks[Chunk] )
+			mChunks[Chunk] = new TPokeyBoardState[ChunkSize];
+	}
+
+	auto& State = GetState( Slot );
+	State.Reset();
+	State.mInUse = true;
+	if ( Slot >= mSlotCount )
+		mSlotCount = Slot+1;
+	return Slot;
+}
+
+void TPokeyBoardStates::Free(size_t Slot)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	GetState( Slot ).mInUse = false;
+	mFreeSlots.PushBack( Slot );
+}
+
+bool TPokeyBoardStates::HasStuckPins()
+{
+	auto SlotCount = GetSlotCount();
+	for ( size_t s=0;	s<SlotCount;	s++ )
+	{
+		auto& State = GetState( s );
+		if ( State.mInUse && State.mStuckPins )
+			return true;
+	}
+	return false;
+}
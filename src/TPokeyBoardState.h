@@ -0,0 +1,76 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyMath.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+//	what the pin engine touches every poll, per board. Masks first so an idle board is one cache
+//	line; the per-pin arrays are only read for pins whose bit is set
+class TPokeyBoardState
+{
+public:
+	static const size_t	MaxPins = 64;		//	pokeys have 55
+
+public:
+	void			Reset();
+
+	bool			IsMapped(size_t Pin) const	{	return Pin < mPinCount && (mMappedPins & (1ull << Pin));	}
+
+	static size_t	GetLowestPin(uint64 Pins)		//	Pins must be non-zero
+	{
+#if defined(_MSC_VER)
+		unsigned long Index;
+		_BitScanForward64( &Index, Pins );
+		return Index;
+#else
+		return __builtin_ctzll( Pins );
+#endif
+	}
+
+public:
+	uint64			mDownPins;			//	bit per pin at the last update, for edges
+	uint64			mStuckPins;			//	held past TPokeyMeta::PinDownTooLong, so ignored
+	uint64			mMappedPins;		//	pins with a coord, including the laser gate
+	uint64			mLaserGatePins;		//	mapped to GridCoordLaserGate; edges go to the gate, not presses
+	uint64			mEdgeCountPins;		//	pins whose mEdgeCount is a baseline from this connection
+	uint64			mEdgeCountDownPins;	//	mDownPins when the counters were last read
+	uint64			mLastUpdateNs;		//	monotonic time of the last sample
+	uint32			mPinCount;			//	pins with meta; the gridmap length or the most pins updated
+	bool			mInUse;
+
+	float			mDownDuration[MaxPins];	//	zero for pins not in mDownPins
+	uint32			mEdgeCount[MaxPins];	//	last digital counter value when latching
+	uint8			mPolledPresses[MaxPins];	//	presses the polls saw since the counters were last read
+	vec2x<int>		mCoord[MaxPins];		//	compiled pin -> cell, GridCoordInvalid if unmapped
+};
+
+
+//	every board's hot state in fixed chunks, so a slot never moves once handed out and boards can be
+//	walked in order without touching their TPokeyMeta. Slots are reused when a TPokeyMeta goes away
+class TPokeyBoardStates
+{
+public:
+	static const size_t	ChunkSize = 64;
+	static const size_t	MaxChunks = 1024;
+
+public:
+	TPokeyBoardStates();
+	~TPokeyBoardStates();
+
+	static TPokeyBoardStates&	Get();
+
+	size_t				Alloc();			//	state is Reset()
+	void				Free(size_t Slot);
+	TPokeyBoardState&	GetState(size_t Slot)	{	return mChunks[Slot / ChunkSize].load()[Slot % ChunkSize];	}
+	size_t				GetSlotCount() const	{	return mSlotCount;	}	//	walk below this, skipping !mInUse
+	bool				HasStuckPins();		//	any board, without touching their TPokeyMeta
+
+private:
+	std::mutex			mLock;				//	allocating
+	std::atomic<TPokeyBoardState*>	mChunks[MaxChunks];
+	std::atomic<size_t>	mSlotCount;
+	Array<size_t>		mFreeSlots;
+};
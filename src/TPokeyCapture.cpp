@@ -0,0 +1,398 @@
+#include "TPokeyCapture.h"
+#include "TProtocolPokey.h"
+#include <RemoteArray.h>
+#include <cstdio>
+#include <cstring>
+
+#if !defined(TARGET_WINDOWS)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+const char TPokeyCaptureHeader::Magic[8] = { 'P','K','Y','C','A','P','\0','\0' };
+
+
+TPokeyCaptureWriter::TPokeyCaptureWriter() :
+	SoyWorkerThread	( "TPokeyCaptureWriter", SoyWorkerWaitMode::Sleep ),
+	mFile			( nullptr ),
+	mPendingBuffer	( 0 ),
+	mWrittenCount	( 0 ),
+	mDroppedCount	( 0 )
+{
+}
+
+TPokeyCaptureWriter::~TPokeyCaptureWriter()
+{
+	Stop();
+	WaitToFinish();
+
+	//	write out anything pushed since the last iteration
+	Flush();
+
+	std::lock_guard<std::mutex> Lock( mFileLock );
+	if ( mFile )
+	{
+		fclose( mFile );
+		mFile = nullptr;
+	}
+}
+
+bool TPokeyCaptureWriter::Open(const std::string& Filename,std::stringstream& Error)
+{
+	std::lock_guard<std::mutex> Lock( mFileLock );
+
+	//	append-only; if the file already has a header it must be one we can append to
+	mFile = fopen( Filename.c_str(), "ab+" );
+	if ( !mFile )
+	{
+		Error << "failed to open capture " << Filename << " for append";
+		return false;
+	}
+
+	fseek( mFile, 0, SEEK_END );
+	auto Size = ftell( mFile );
+	if ( Size > 0 )
+	{
+		TPokeyCaptureHeader Header;
+		fseek( mFile, 0, SEEK_SET );
+		bool ReadHeader = fread( &Header, sizeof(Header), 1, mFile ) == 1;
+		fseek( mFile, 0, SEEK_END );
+
+		if ( !ReadHeader || memcmp( Header.mMagic, TPokeyCaptureHeader::Magic, sizeof(Header.mMagic) ) != 0 || Header.mVersion != TPokeyCaptureHeader::CurrentVersion || Header.mRecordSize != sizeof(TPokeyCaptureRecord) )
+		{
+			Error << Filename << " exists and is not a v" << TPokeyCaptureHeader::CurrentVersion << " pokey capture";
+			fclose( mFile );
+			mFile = nullptr;
+			return false;
+		}
+
+		//	a crash can leave a partial record, pad it out so everything after stays aligned
+		auto Partial = (Size - sizeof(TPokeyCaptureHeader)) % sizeof(TPokeyCaptureRecord);
+		if ( Partial != 0 )
+		{
+			std::Debug << "capture " << Filename << " has a partial record, padding" << std::endl;
+			TPokeyCaptureRecord Padding;
+			memset( &Padding, 0, sizeof(Padding) );
+			Padding.mSerial = -1;
+			fwrite( &Padding, sizeof(Padding) - Partial, 1, mFile );
+		}
+		
+		//	monotonic times from before now may be from before a reboot, so replay mustn't compare across this
+		TPokeyCaptureRecord Session;
+		memset( &Session, 0, sizeof(Session) );
+		Session.mTimeNs = Soy::GetMonotonicNs();
+		Session.mSerial = -1;
+		Session.mType = TPokeyCaptureFrame::Session;
+		fwrite( &Session, sizeof(Session), 1, mFile );
+		fflush( mFile );
+	}
+	else
+	{
+		TPokeyCaptureHeader Header;
+		memset( &Header, 0, sizeof(Header) );
+		memcpy( Header.mMagic, TPokeyCaptureHeader::Magic, sizeof(Header.mMagic) );
+		Header.mVersion = TPokeyCaptureHeader::CurrentVersion;
+		Header.mRecordSize = sizeof(TPokeyCaptureRecord);
+		Header.mStartTimeMs = SoyTime(true).GetTime();
+		Header.mStartTimeNs = Soy::GetMonotonicNs();
+		fwrite( &Header, sizeof(Header), 1, mFile );
+		fflush( mFile );
+	}
+
+	mFilename = Filename;
+	return true;
+}
+
+void TPokeyCaptureWriter::Push(TPokeyCaptureFrame::Type Type,int Serial,const unsigned char* Data,size_t Size,uint64 RxTimeNs)
+{
+	std::lock_guard<std::mutex> Lock( mPendingLock );
+	auto& Pending = mBuffers[mPendingBuffer];
+	if ( Pending.GetSize() >= MaxPendingRecords )
+	{
+		mDroppedCount++;
+		return;
+	}
+
+	auto& Record = Pending.PushBack();
+	Record.mTimeNs = RxTimeNs;
+	Record.mSerial = Serial;
+	Record.mSize = static_cast<uint16>( std::min<size_t>( Size, sizeof(Record.mData) ) );
+	Record.mType = Type;
+	Record.mPadding = 0;
+	memcpy( Record.mData, Data, Record.mSize );
+	memset( Record.mData + Record.mSize, 0, sizeof(Record.mData) - Record.mSize );
+}
+
+bool TPokeyCaptureWriter::Iteration()
+{
+	Flush();
+	return true;
+}
+
+void TPokeyCaptureWriter::Flush()
+{
+	std::lock_guard<std::mutex> FileLock( mFileLock );
+
+	//	swap buffers so decoders can keep pushing while we write
+	size_t WritingBuffer;
+	{
+		std::lock_guard<std::mutex> Lock( mPendingLock );
+		WritingBuffer = mPendingBuffer;
+		mPendingBuffer = 1 - mPendingBuffer;
+	}
+	auto& Writing = mBuffers[WritingBuffer];
+
+	if ( Writing.IsEmpty() )
+		return;
+
+	if ( mFile )
+	{
+		auto Written = fwrite( Writing.GetArray(), sizeof(TPokeyCaptureRecord), Writing.GetSize(), mFile );
+		fflush( mFile );
+		mWrittenCount += Written;
+		mDroppedCount += Writing.GetSize() - Written;
+	}
+	else
+	{
+		mDroppedCount += Writing.GetSize();
+	}
+
+	//	keep the allocation for next time
+	Writing.Clear(false);
+}
+
+void TPokeyCaptureWriter::GetStatus(std::ostream& Status)
+{
+	Status << "capturing to " << mFilename << "; " << mWrittenCount << " frames written, " << mDroppedCount << " dropped";
+}
+
+
+
+TPokeyCaptureReader::TPokeyCaptureReader() :
+	mData			( nullptr ),
+	mDataSize		( 0 ),
+	mRecordCount	( 0 ),
+	mMappedData		( nullptr )
+{
+}
+
+TPokeyCaptureReader::~TPokeyCaptureReader()
+{
+	Close();
+}
+
+void TPokeyCaptureReader::Close()
+{
+#if !defined(TARGET_WINDOWS)
+	if ( mMappedData )
+		munmap( mMappedData, mDataSize );
+#endif
+	mMappedData = nullptr;
+	mFileData.Clear();
+	mData = nullptr;
+	mDataSize = 0;
+	mRecordCount = 0;
+}
+
+bool TPokeyCaptureReader::Open(const std::string& Filename,std::stringstream& Error)
+{
+	Close();
+
+#if !defined(TARGET_WINDOWS)
+	int File = open( Filename.c_str(), O_RDONLY );
+	if ( File == -1 )
+	{
+		Error << "failed to open capture " << Filename;
+		return false;
+	}
+	struct stat FileStat;
+	if ( fstat( File, &FileStat ) == 0 && FileStat.st_size > 0 )
+	{
+		mDataSize = FileStat.st_size;
+		mMappedData = mmap( nullptr, mDataSize, PROT_READ, MAP_PRIVATE, File, 0 );
+		if ( mMappedData == MAP_FAILED )
+		{
+			mMappedData = nullptr;
+			mDataSize = 0;
+		}
+		else
+		{
+			mData = static_cast<const unsigned char*>( mMappedData );
+		}
+	}
+	close( File );
+#endif
+
+	if ( !mData )
+	{
+		FILE* File = fopen( Filename.c_str(), "rb" );
+		if ( !File )
+		{
+			Error << "failed to open capture " << Filename;
+			return false;
+		}
+		unsigned char Buffer[64*1024];
+		while ( true )
+		{
+			auto Read = fread( Buffer, 1, sizeof(Buffer), File );
+			if ( Read == 0 )
+				break;
+			mFileData.PushBackArray( GetRemoteArray( Buffer, Read ) );
+		}
+		fclose( File );
+		mData = mFileData.GetArray();
+		mDataSize = mFileData.GetSize();
+	}
+
+	if ( mDataSize < sizeof(TPokeyCaptureHeader) )
+	{
+		Error << Filename << " is too small to be a pokey capture";
+		Close();
+		return false;
+	}
+
+	auto& Header = GetHeader();
+	if ( memcmp( Header.mMagic, TPokeyCaptureHeader::Magic, sizeof(Header.mMagic) ) != 0 )
+	{
+		Error << Filename << " is not a pokey capture";
+		Close();
+		return false;
+	}
+	if ( Header.mVersion != TPokeyCaptureHeader::CurrentVersion || Header.mRecordSize != sizeof(TPokeyCaptureRecord) )
+	{
+		Error << Filename << " is capture v" << Header.mVersion << " with " << Header.mRecordSize << " byte records, expected v" << TPokeyCaptureHeader::CurrentVersion;
+		Close();
+		return false;
+	}
+
+	//	ignore a trailing partial record from a crash
+	mRecordCount = (mDataSize - sizeof(TPokeyCaptureHeader)) / sizeof(TPokeyCaptureRecord);
+	return true;
+}
+
+const TPokeyCaptureHeader& TPokeyCaptureReader::GetHeader() const
+{
+	return *reinterpret_cast<const TPokeyCaptureHeader*>( mData );
+}
+
+const TPokeyCaptureRecord& TPokeyCaptureReader::GetRecord(size_t Index) const
+{
+	auto* Records = mData + sizeof(TPokeyCaptureHeader);
+	return reinterpret_cast<const TPokeyCaptureRecord*>( Records )[Index];
+}
+
+
+
+TPokeyReplayThread::TPokeyReplayThread(const std::string& Filename,float Speed) :
+	SoyWorkerThread		( "TPokeyReplayThread", SoyWorkerWaitMode::NoWait ),
+	mFilename			( Filename ),
+	mSpeed				( Speed ),
+	mNextRecord			( 0 ),
+	mSessionStartNs		( 0 ),
+	mSessionOffsetNs	( 0 ),
+	mLastOffsetNs		( 0 ),
+	mStartNs			( 0 ),
+	mEndNs				( 0 ),
+	mDecodeFailedCount	( 0 ),
+	mFinished			( false )
+{
+}
+
+bool TPokeyReplayThread::Open(std::stringstream& Error)
+{
+	if ( !mReader.Open( mFilename, Error ) )
+		return false;
+
+	if ( mReader.GetRecordCount() > 0 )
+		mSessionStartNs = mReader.GetRecord(0).mTimeNs;
+	return true;
+}
+
+bool TPokeyReplayThread::Iteration()
+{
+	if ( mStartNs == 0 )
+		mStartNs = Soy::GetMonotonicNs();
+
+	if ( mNextRecord >= mReader.GetRecordCount() )
+	{
+		mEndNs = Soy::GetMonotonicNs();
+		mFinished = true;
+		bool Dummy = true;
+		mOnFinished.OnTriggered( Dummy );
+		return false;
+	}
+
+	auto& Record = mReader.GetRecord( mNextRecord );
+
+	//	each session has its own clock, so carry on from where the last one's records ended. Older
+	//	captures have no session records, time going backwards is the best we can tell
+	auto SessionNs = static_cast<sint64>( Record.mTimeNs - mSessionStartNs );
+	if ( Record.mType == TPokeyCaptureFrame::Session || SessionNs < 0 )
+	{
+		mSessionStartNs = Record.mTimeNs;
+		mSessionOffsetNs = mLastOffsetNs;
+		SessionNs = 0;
+	}
+	auto CaptureOffsetNs = mSessionOffsetNs + static_cast<uint64>( SessionNs );
+	auto RecordOffsetNs = ( mSpeed > 0.f ) ? static_cast<uint64>( CaptureOffsetNs / mSpeed ) : 0;
+
+	//	wait until this frame is due
+	if ( mSpeed > 0.f )
+	{
+		auto NowOffsetNs = Soy::GetMonotonicNs() - mStartNs;
+		if ( RecordOffsetNs > NowOffsetNs )
+		{
+			auto WaitNs = std::min<uint64>( RecordOffsetNs - NowOffsetNs, 10*1000*1000 );
+			std::this_thread::sleep_for( std::chrono::nanoseconds( WaitNs ) );
+			return true;
+		}
+	}
+	mNextRecord++;
+	mLastOffsetNs = CaptureOffsetNs;
+	
+	if ( Record.mType == TPokeyCaptureFrame::Session )
+		return true;
+
+	TProtocolPokey Protocol;
+	TJob Job;
+	bool Decoded = false;
+	if ( Record.mType == TPokeyCaptureFrame::Reply && Record.mSize == 64 )
+	{
+		BufferArray<unsigned char,64> Data;
+		GetArrayBridge(Data).PushBackArray( GetRemoteArray( Record.mData, Record.mSize ) );
+		Decoded = Protocol.DecodeReply( Job, Data );
+		Job.mParams.AddParam("serial", Record.mSerial );
+		
+		//	when it was due, so it compares with our clock; as fast as possible it's simply now
+		Job.mParams.AddParam("rxtime", ( mSpeed > 0.f ) ? mStartNs + RecordOffsetNs : Soy::GetMonotonicNs() );
+	}
+	else if ( Record.mType == TPokeyCaptureFrame::Discovery )
+	{
+		BufferArray<unsigned char,100> Data;
+		GetArrayBridge(Data).PushBackArray( GetRemoteArray( Record.mData, Record.mSize ) );
+		Decoded = Protocol.DecodeDiscovery( Job, GetArrayBridge(Data) );
+	}
+
+	if ( !Decoded )
+	{
+		mDecodeFailedCount++;
+		return true;
+	}
+
+	mOnJob.OnTriggered( Job );
+	return true;
+}
+
+void TPokeyReplayThread::GetStatus(std::ostream& Status)
+{
+	auto EndNs = mFinished ? mEndNs : Soy::GetMonotonicNs();
+	auto ElapsedSecs = ( mStartNs == 0 ) ? 0.f : (EndNs - mStartNs) / 1000000000.f;
+	Status << "replay " << mFilename << " x" << mSpeed << "; " << mNextRecord << "/" << mReader.GetRecordCount() << " frames";
+	Status << " in " << ElapsedSecs << "s";
+	if ( ElapsedSecs > 0.f )
+		Status << " (" << static_cast<uint64>( mNextRecord / ElapsedSecs ) << " frames/s)";
+	Status << ", " << mDecodeFailedCount << " failed to decode";
+}
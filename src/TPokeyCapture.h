@@ -0,0 +1,133 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+
+
+namespace TPokeyCaptureFrame
+{
+	enum Type : uint8
+	{
+		Reply		= 0,	//	64 byte 0xAA reply from a pokey channel
+		Discovery	= 1,	//	14 or 19 byte broadcast reply, serial is inside the frame
+		Session		= 2,	//	appended capture starts here; the monotonic clock restarts at mTimeNs, no data
+	};
+}
+
+
+//	fixed size so a capture can be mapped and indexed directly. Written in host byte order
+class TPokeyCaptureRecord
+{
+public:
+	uint64			mTimeNs;		//	monotonic time the decoder saw it, only comparable within a session
+	int32_t			mSerial;		//	pokey the channel belongs to, -1 if unknown
+	uint16			mSize;			//	bytes used in mData
+	uint8			mType;			//	TPokeyCaptureFrame
+	uint8			mPadding;
+	unsigned char	mData[64];
+};
+static_assert( sizeof(TPokeyCaptureRecord) == 80, "TPokeyCaptureRecord must stay packed, it's the file format" );
+
+
+class TPokeyCaptureHeader
+{
+public:
+	static const char	Magic[8];
+	static const uint32	CurrentVersion = 1;
+
+public:
+	char			mMagic[8];
+	uint32			mVersion;
+	uint32			mRecordSize;
+	uint64			mStartTimeMs;	//	wall clock when the file was created, to line up with show logs
+	uint64			mStartTimeNs;	//	monotonic clock at the same point
+};
+static_assert( sizeof(TPokeyCaptureHeader) == 32, "TPokeyCaptureHeader must stay packed, it's the file format" );
+
+
+//	appends frames to a capture file, starting a new session if it already has some. Frames are pushed into one buffer while the other is written
+//	out on this thread, so the decoding thread only ever takes a lock and copies 80 bytes
+class TPokeyCaptureWriter : public SoyWorkerThread
+{
+public:
+	static const size_t	MaxPendingRecords = 64*1024;	//	drop rather than grow if the disk can't keep up
+
+public:
+	TPokeyCaptureWriter();
+	virtual ~TPokeyCaptureWriter();
+
+	bool			Open(const std::string& Filename,std::stringstream& Error);
+	void			Push(TPokeyCaptureFrame::Type Type,int Serial,const unsigned char* Data,size_t Size,uint64 RxTimeNs);
+	virtual bool	Iteration() override;
+	virtual std::chrono::milliseconds	GetSleepDuration()	{	return std::chrono::milliseconds(100);	}
+	void			GetStatus(std::ostream& Status);
+
+private:
+	void			Flush();
+
+public:
+	std::string		mFilename;
+
+private:
+	std::mutex		mFileLock;
+	FILE*			mFile;
+
+	std::mutex		mPendingLock;
+	Array<TPokeyCaptureRecord>	mBuffers[2];	//	one filled by decoders, the other being written out
+	size_t			mPendingBuffer;
+
+	std::atomic<uint64>	mWrittenCount;
+	std::atomic<uint64>	mDroppedCount;
+};
+
+
+//	read-only view of a capture file. Mapped where we can so large captures don't need loading
+class TPokeyCaptureReader
+{
+public:
+	TPokeyCaptureReader();
+	~TPokeyCaptureReader();
+
+	bool			Open(const std::string& Filename,std::stringstream& Error);
+	void			Close();
+	size_t			GetRecordCount() const	{	return mRecordCount;	}
+	const TPokeyCaptureRecord&	GetRecord(size_t Index) const;
+	const TPokeyCaptureHeader&	GetHeader() const;
+
+private:
+	const unsigned char*	mData;
+	size_t			mDataSize;
+	size_t			mRecordCount;
+	Array<unsigned char>	mFileData;		//	when we can't map
+	void*			mMappedData;
+};
+
+
+//	feeds a capture back through TProtocolPokey at the original rate, N times faster, or as fast as possible
+class TPokeyReplayThread : public SoyWorkerThread
+{
+public:
+	TPokeyReplayThread(const std::string& Filename,float Speed);
+
+	bool			Open(std::stringstream& Error);
+	virtual bool	Iteration() override;
+	void			GetStatus(std::ostream& Status);
+	bool			IsFinished() const	{	return mFinished;	}
+
+public:
+	SoyEvent<TJob>			mOnJob;			//	decoded reply with its "serial" param set
+	SoyEvent<const bool>	mOnFinished;
+
+private:
+	std::string				mFilename;
+	float					mSpeed;			//	<= 0 is as fast as possible
+	TPokeyCaptureReader		mReader;
+	size_t					mNextRecord;
+	uint64					mSessionStartNs;	//	capture clock at the start of the current session
+	uint64					mSessionOffsetNs;	//	capture time into the replay the session starts at
+	uint64					mLastOffsetNs;		//	of the last record replayed
+	uint64					mStartNs;
+	uint64					mEndNs;
+	std::atomic<uint64>		mDecodeFailedCount;
+	std::atomic<bool>		mFinished;
+};
@@ -0,0 +1,830 @@
+#include "TPokeyCluster.h"
+#include "PopPokey.h"
+#include <SoyString.h>
+
+#if !defined(TARGET_WINDOWS)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+bool TPokeyCluster::ParseSerials(const std::string& SerialsString,ArrayBridge<int>&& Serials,std::stringstream& Error)
+{
+	Array<std::string> Parts;
+	Soy::StringSplitByString( GetArrayBridge(Parts), SerialsString, ",", false );
+	for ( int i=0;	i<Parts.GetSize();	i++ )
+	{
+		auto& Part = Parts[i];
+		auto RangePos = Part.find('-');
+		int First = -1;
+		int Last = -1;
+		if ( RangePos == std::string::npos )
+		{
+			if ( !Soy::StringToType( First, Part ) )
+			{
+				Error << "bad serial " << Part;
+				return false;
+			}
+			Last = First;
+		}
+		else if ( !Soy::StringToType( First, Part.substr(0,RangePos) ) || !Soy::StringToType( Last, Part.substr(RangePos+1) ) || Last < First )
+		{
+			Error << "bad serial range " << Part;
+			return false;
+		}
+
+		for ( int s=First;	s<=Last;	s++ )
+			Serials.PushBack( s );
+	}
+	return true;
+}
+
+std::string TPokeyCluster::PinsToHex(const ArrayBridge<char>& Pins)
+{
+	//	4 pins per digit, pin 0 in the low bit of the first digit
+	static const char* Digits = "0123456789abcdef";
+	std::string Hex( (Pins.GetSize()+3)/4, '0' );
+	for ( int i=0;	i<Pins.GetSize();	i++ )
+	{
+		if ( Pins[i] == '0' )
+			continue;
+		auto& Digit = Hex[i/4];
+		int Value = static_cast<int>( strchr( Digits, Digit ) - Digits );
+		Digit = Digits[ Value | (1 << (i%4)) ];
+	}
+	return Hex;
+}
+
+bool TPokeyCluster::HexToPins(const std::string& Hex,size_t PinCount,ArrayBridge<char>&& Pins)
+{
+	if ( Hex.length() != (PinCount+3)/4 )
+		return false;
+
+	for ( size_t i=0;	i<PinCount;	i++ )
+	{
+		auto Digit = Hex[i/4];
+		int Value;
+		if ( Digit >= '0' && Digit <= '9' )
+			Value = Digit - '0';
+		else if ( Digit >= 'a' && Digit <= 'f' )
+			Value = 10 + Digit - 'a';
+		else
+			return false;
+		Pins.PushBack( (Value & (1 << (i%4))) ? '1' : '0' );
+	}
+	return true;
+}
+
+
+
+TPokeyClusterMember::TPokeyClusterMember(TPopPokey& App,const std::string& Name,const std::string& AggregatorAddress,const ArrayBridge<int>& Serials) :
+	SoyWorkerThread		( Soy::GetTypeName(*this), SoyWorkerWaitMode::NoWait ),
+	mName				( Name ),
+	mAggregatorAddress	( AggregatorAddress ),
+	mApp				( App ),
+	mSocket				( -1 ),
+	mLastConnectMs		( 0 ),
+	mLastClockMs		( 0 ),
+	mLastHealthMs		( 0 ),
+	mSynced				( false ),
+	mConnectCount		( 0 ),
+	mEdgeCount			( 0 ),
+	mBytesSent			( 0 )
+{
+	mSerials.Copy( Serials );
+}
+
+TPokeyClusterMember::~TPokeyClusterMember()
+{
+	Stop();
+	mOutboxWake.notify_all();
+	WaitToFinish();
+	Disconnect();
+}
+
+bool TPokeyClusterMember::IsOwned(int Serial) const
+{
+	if ( mSerials.IsEmpty() )
+		return true;
+	for ( int i=0;	i<mSerials.GetSize();	i++ )
+		if ( mSerials[i] == Serial )
+			return true;
+	return false;
+}
+
+bool TPokeyClusterMember::Iteration()
+{
+	auto NowMs = Soy::GetMonotonicMs();
+	if ( mSocket == -1 )
+	{
+		if ( NowMs - mLastConnectMs < ReconnectMs )
+		{
+			std::this_thread::sleep_for( std::chrono::milliseconds(50) );
+			return true;
+		}
+		mLastConnectMs = NowMs;
+		if ( !Connect() )
+			return true;
+
+		//	resync; everything we own goes out again before any more edges
+		{
+			std::lock_guard<std::mutex> Lock( mOutboxLock );
+			mOutbox.clear();
+			mSentBoards.clear();
+			mSynced = false;
+		}
+		std::stringstream Hello;
+		Hello << "hello " << mName << " " << Soy::GetMonotonicNs();
+		Queue( Hello.str() );
+		QueueBoards();
+		Queue( "synced" );
+		{
+			std::lock_guard<std::mutex> Lock( mOutboxLock );
+			mSynced = true;
+		}
+		mLastHealthMs = NowMs;
+		mConnectCount++;
+		std::Debug << "cluster member " << mName << " connected to " << mAggregatorAddress << std::endl;
+	}
+
+	//	clock keeps the aggregator's merger moving when nothing is pressed
+	if ( NowMs - mLastClockMs >= ClockIntervalMs )
+	{
+		mLastClockMs = NowMs;
+		std::stringstream Clock;
+		Clock << "c " << Soy::GetMonotonicNs();
+		Queue( Clock.str() );
+	}
+
+	if ( NowMs - mLastHealthMs >= HealthIntervalMs )
+	{
+		mLastHealthMs = NowMs;
+		QueueBoards();
+	}
+
+	//	edges wake us straight away
+	{
+		std::unique_lock<std::mutex> Lock( mOutboxLock );
+		mOutboxWake.wait_for( Lock, std::chrono::milliseconds(ClockIntervalMs/4), [this]{ return !mOutbox.empty(); } );
+	}
+
+	if ( !Flush() )
+	{
+		std::Debug << "cluster member " << mName << " lost aggregator " << mAggregatorAddress << std::endl;
+		Disconnect();
+	}
+	return true;
+}
+
+bool TPokeyClusterMember::Connect()
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	auto PortPos = mAggregatorAddress.rfind(':');
+	if ( PortPos == std::string::npos )
+	{
+		std::Debug << "cluster aggregator address " << mAggregatorAddress << " needs a port" << std::endl;
+		return false;
+	}
+	auto Host = mAggregatorAddress.substr( 0, PortPos );
+	auto Port = mAggregatorAddress.substr( PortPos+1 );
+
+	addrinfo Hints;
+	memset( &Hints, 0, sizeof(Hints) );
+	Hints.ai_family = AF_INET;
+	Hints.ai_socktype = SOCK_STREAM;
+	addrinfo* Addresses = nullptr;
+	if ( getaddrinfo( Host.c_str(), Port.c_str(), &Hints, &Addresses ) != 0 || !Addresses )
+		return false;
+
+	int Socket = socket( AF_INET, SOCK_STREAM, 0 );
+	bool Connected = Socket != -1 && connect( Socket, Addresses->ai_addr, Addresses->ai_addrlen ) == 0;
+	freeaddrinfo( Addresses );
+	if ( !Connected )
+	{
+		if ( Socket != -1 )
+			close( Socket );
+		return false;
+	}
+
+	//	edges are tiny and latency matters more than packets
+	int Enable = 1;
+	setsockopt( Socket, IPPROTO_TCP, TCP_NODELAY, &Enable, sizeof(Enable) );
+	timeval Timeout;
+	Timeout.tv_sec = 1;
+	Timeout.tv_usec = 0;
+	setsockopt( Socket, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout) );
+	mSocket = Socket;
+	return true;
+#endif
+}
+
+void TPokeyClusterMember::Disconnect()
+{
+#if !defined(TARGET_WINDOWS)
+	if ( mSocket != -1 )
+		close( mSocket );
+#endif
+	mSocket = -1;
+
+	std::lock_guard<std::mutex> Lock( mOutboxLock );
+	mOutbox.clear();
+	mSynced = false;
+}
+
+void TPokeyClusterMember::QueueBoards()
+{
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	mApp.GetPokeys( GetArrayBridge(Pokeys) );
+
+	auto NowNs = Soy::GetMonotonicNs();
+	std::stringstream Lines;
+	for ( int i=0;	i<Pokeys.GetSize();	i++ )
+	{
+		auto& Pokey = *Pokeys[i];
+		if ( !IsOwned( Pokey.mSerial ) || Pokey.mRemote != -1 )
+			continue;
+
+		std::stringstream Board;
+		std::string GridMap;
+		bool Ignored;
+		{
+			//	the cluster's "b" lines, setuppokey and config reload change these
+			std::lock_guard<std::mutex> Lock( Pokey.mStateLock );
+			GridMap = Pokey.GetGridMapString();
+			Ignored = Pokey.mIgnored;
+		}
+		auto Version = Pokey.GetVersion();
+		Board << "b " << Pokey.mSerial << " " << (Ignored ? 1 : 0) << " " << (Version.empty() ? "-" : Version) << " " << (GridMap.empty() ? "-" : GridMap);
+
+		auto Channel = mApp.GetChannel( Pokey.GetChannelRef() );
+		bool Connected = Channel && Channel->IsConnected();
+		auto LastUpdateNs = Pokey.GetLastUpdateNs();
+		auto AgeMs = LastUpdateNs == 0 ? -1 : static_cast<sint64>( (NowNs - std::min(NowNs,LastUpdateNs)) / 1000000 );
+
+		std::lock_guard<std::mutex> Lock( mOutboxLock );
+		if ( mSentBoards[Pokey.mSerial] != Board.str() )
+		{
+			mSentBoards[Pokey.mSerial] = Board.str();
+			Lines << Board.str() << "\n";
+		}
+
+		//	last pins we sampled, so a resync also restores what's held down
+		auto& Pins = mSentPins[Pokey.mSerial];
+		Lines << "h " << Pokey.mSerial << " " << (Connected ? 1 : 0) << " " << AgeMs << " " << (Pins.empty() ? "0 - 0" : Pins) << "\n";
+	}
+
+	auto LinesString = Lines.str();
+	if ( LinesString.empty() )
+		return;
+	LinesString.pop_back();
+	Queue( LinesString );
+}
+
+void TPokeyClusterMember::OnSample(TPokeyMeta& Pokey,const ArrayBridge<char>& Pins,uint64 SampleTimeNs)
+{
+	if ( !IsOwned( Pokey.mSerial ) )
+		return;
+
+	std::stringstream PinsString;
+	PinsString << Pins.GetSize() << " " << TPokeyCluster::PinsToHex( Pins );
+
+	std::lock_guard<std::mutex> Lock( mOutboxLock );
+	auto& Sent = mSentPins[Pokey.mSerial];
+	auto Changed = Sent.compare( 0, PinsString.str().length(), PinsString.str() ) != 0;
+	PinsString << " " << SampleTimeNs;
+	Sent = PinsString.str();
+
+	//	not connected; the snapshot will carry it
+	if ( !Changed || !mSynced )
+		return;
+
+	mOutbox += "e ";
+	mOutbox += std::to_string( Pokey.mSerial );
+	mOutbox += " ";
+	mOutbox += Sent;
+	mOutbox += "\n";
+	mEdgeCount++;
+	mOutboxWake.notify_one();
+}
+
+void TPokeyClusterMember::Queue(const std::string& Line)
+{
+	std::lock_guard<std::mutex> Lock( mOutboxLock );
+	mOutbox += Line;
+	mOutbox += "\n";
+}
+
+bool TPokeyClusterMember::Flush()
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	if ( mSocket == -1 )
+		return false;
+
+	//	aggregator never talks back, so anything readable is it going away
+	char Peek;
+	auto Peeked = recv( mSocket, &Peek, 1, MSG_DONTWAIT | MSG_PEEK );
+	if ( Peeked == 0 || ( Peeked < 0 && errno != EAGAIN && errno != EWOULDBLOCK ) )
+		return false;
+
+	std::string Outbox;
+	{
+		std::lock_guard<std::mutex> Lock( mOutboxLock );
+		std::swap( Outbox, mOutbox );
+	}
+
+	size_t Written = 0;
+	while ( Written < Outbox.length() )
+	{
+		auto Sent = send( mSocket, Outbox.c_str() + Written, Outbox.length() - Written, MSG_NOSIGNAL );
+		if ( Sent <= 0 )
+			return false;
+		Written += Sent;
+	}
+	mBytesSent += Written;
+	return true;
+#endif
+}
+
+void TPokeyClusterMember::GetStatus(std::ostream& Status)
+{
+	Status << "cluster member " << mName << " -> " << mAggregatorAddress << " " << (mSocket != -1 ? "connected" : "disconnected");
+	Status << " connects " << mConnectCount.load() << " edges " << mEdgeCount.load() << " bytes " << mBytesSent.load();
+	Status << " owns " << (mSerials.IsEmpty() ? std::string("all") : Soy::StringJoin( GetArrayBridge(mSerials), "," ));
+}
+
+
+
+TPokeyClusterAggregator::TPokeyClusterAggregator(TPopPokey& App,int Port) :
+	SoyWorkerThread	( Soy::GetTypeName(*this), SoyWorkerWaitMode::NoWait ),
+	mApp			( App ),
+	mPort			( Port ),
+	mListenSocket	( -1 ),
+	mMemberCount	( 0 )
+{
+}
+
+TPokeyClusterAggregator::~TPokeyClusterAggregator()
+{
+	Stop();
+	WaitToFinish();
+#if !defined(TARGET_WINDOWS)
+	for ( int i=0;	i<mPeers.GetSize();	i++ )
+		close( mPeers[i].mSocket );
+	if ( mListenSocket != -1 )
+		close( mListenSocket );
+#endif
+}
+
+bool TPokeyClusterAggregator::Init(std::stringstream& Error)
+{
+#if defined(TARGET_WINDOWS)
+	Error << "cluster aggregator is not supported on windows";
+	return false;
+#else
+	mListenSocket = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( mListenSocket == -1 )
+	{
+		Error << "failed to create cluster socket errno " << errno;
+		return false;
+	}
+	int Enable = 1;
+	setsockopt( mListenSocket, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable) );
+
+	sockaddr_in Address;
+	memset( &Address, 0, sizeof(Address) );
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = htonl( INADDR_ANY );
+	Address.sin_port = htons( mPort );
+	if ( bind( mListenSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address) ) != 0 || listen( mListenSocket, MaxMembers ) != 0 )
+	{
+		Error << "failed to listen for cluster members on port " << mPort << " errno " << errno;
+		return false;
+	}
+	fcntl( mListenSocket, F_SETFL, O_NONBLOCK );
+
+	Start();
+	return true;
+#endif
+}
+
+bool TPokeyClusterAggregator::Iteration()
+{
+#if !defined(TARGET_WINDOWS)
+	Array<pollfd> Fds;
+	auto& ListenFd = Fds.PushBack();
+	ListenFd.fd = mListenSocket;
+	ListenFd.events = POLLIN;
+	ListenFd.revents = 0;
+	for ( int i=0;	i<mPeers.GetSize();	i++ )
+	{
+		auto& Fd = Fds.PushBack();
+		Fd.fd = mPeers[i].mSocket;
+		Fd.events = POLLIN;
+		Fd.revents = 0;
+	}
+
+	if ( poll( Fds.GetArray(), Fds.GetSize(), 100 ) < 0 )
+		return true;
+
+	//	peers first, accepting changes the array. A half-open connection (pulled cable, rebooted
+	//	host) never errors, so silent ones are dropped too, or the member's reconnect is refused
+	auto NowNs = Soy::GetMonotonicNs();
+	for ( int i=mPeers.GetSize()-1;	i>=0;	i-- )
+	{
+		auto& Peer = mPeers[i];
+		bool Alive;
+		if ( Fds[i+1].revents != 0 )
+			Alive = OnRecv( Peer );
+		else
+			Alive = ( NowNs - std::min( NowNs, Peer.mLastRecvNs ) ) < static_cast<uint64>(PeerTimeoutMs) * 1000000;
+		if ( Alive )
+			continue;
+		if ( Fds[i+1].revents == 0 )
+			std::Debug << "cluster peer silent for " << PeerTimeoutMs << "ms, dropping" << std::endl;
+		OnDisconnect( Peer );
+		mPeers.RemoveBlock( i, 1 );
+	}
+
+	if ( Fds[0].revents & POLLIN )
+		OnAccept();
+#endif
+	return true;
+}
+
+void TPokeyClusterAggregator::OnAccept()
+{
+#if !defined(TARGET_WINDOWS)
+	while ( true )
+	{
+		int Socket = accept( mListenSocket, nullptr, nullptr );
+		if ( Socket == -1 )
+			break;
+		fcntl( Socket, F_SETFL, O_NONBLOCK );
+		auto& Peer = mPeers.PushBack();
+		Peer = TPeer();
+		Peer.mSocket = Socket;
+		Peer.mLastRecvNs = Soy::GetMonotonicNs();
+	}
+#endif
+}
+
+bool TPokeyClusterAggregator::OnRecv(TPeer& Peer)
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	char Buffer[4096];
+	while ( true )
+	{
+		auto Read = recv( Peer.mSocket, Buffer, sizeof(Buffer), 0 );
+		if ( Read == 0 )
+			return false;
+		if ( Read < 0 )
+		{
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				break;
+			return false;
+		}
+		Peer.mRecvBuffer.append( Buffer, Read );
+		Peer.mLastRecvNs = Soy::GetMonotonicNs();
+	}
+
+	size_t LineStart = 0;
+	while ( true )
+	{
+		auto LineEnd = Peer.mRecvBuffer.find( '\n', LineStart );
+		if ( LineEnd == std::string::npos )
+			break;
+		if ( !OnLine( Peer, Peer.mRecvBuffer.substr( LineStart, LineEnd-LineStart ) ) )
+			return false;
+		LineStart = LineEnd+1;
+	}
+	Peer.mRecvBuffer.erase( 0, LineStart );
+
+	//	no line is ever this long, it's not a member
+	if ( Peer.mRecvBuffer.length() > 64*1024 )
+	{
+		std::Debug << "cluster peer sent a line that's too long, dropping" << std::endl;
+		return false;
+	}
+	return true;
+#endif
+}
+
+bool TPokeyClusterAggregator::OnLine(TPeer& Peer,const std::string& Line)
+{
+	std::stringstream LineStream( Line );
+	std::string Type;
+	LineStream >> Type;
+
+	if ( Type == "hello" )
+	{
+		std::string Name;
+		uint64 ClockNs = 0;
+		LineStream >> Name >> ClockNs;
+		if ( LineStream.fail() || Peer.mMember != -1 )
+			return false;
+
+		auto MemberIndex = GetMember( Name );
+		if ( MemberIndex == -1 )
+			return false;
+
+		std::lock_guard<std::mutex> Lock( mMembersLock );
+		auto& Member = mMembers[MemberIndex];
+		if ( Member.mConnected )
+		{
+			std::Debug << "cluster member " << Name << " is already connected, dropping the new connection" << std::endl;
+			return false;
+		}
+		Member.mConnected = true;
+		Member.mConnectCount++;
+		//	it may have restarted with a new clock
+		Member.mHasClockOffset = false;
+		Peer.mMember = MemberIndex;
+		OnClock( Member, ClockNs );
+		std::Debug << "cluster member " << Name << " connected" << std::endl;
+		return true;
+	}
+
+	if ( Peer.mMember == -1 )
+	{
+		std::Debug << "cluster peer sent " << Type << " before hello" << std::endl;
+		return false;
+	}
+
+	auto& Member = mMembers[Peer.mMember];
+	{
+		std::lock_guard<std::mutex> Lock( mMembersLock );
+		Member.mLines++;
+		Member.mLastHeardNs = Soy::GetMonotonicNs();
+	}
+
+	if ( Type == "c" )
+	{
+		uint64 ClockNs = 0;
+		LineStream >> ClockNs;
+		if ( LineStream.fail() )
+			return false;
+		std::lock_guard<std::mutex> Lock( mMembersLock );
+		OnClock( Member, ClockNs );
+		return true;
+	}
+
+	if ( Type == "b" )
+	{
+		int Serial = -1;
+		int Ignored = 0;
+		std::string Version;
+		std::string GridMap;
+		LineStream >> Serial >> Ignored >> Version >> GridMap;
+		if ( LineStream.fail() )
+			return false;
+
+		auto Pokey = GetRemotePokey( Peer.mMember, Serial );
+		if ( !Pokey )
+			return false;
+		{
+			//	list, status and the board queue read these from other threads
+			std::lock_guard<std::mutex> Lock( Pokey->mStateLock );
+			Pokey->mIgnored = (Ignored != 0);
+			Pokey->SetVersion( (Version == "-") ? std::string() : Version );
+		}
+		if ( GridMap == "-" )
+			GridMap.clear();
+		if ( GridMap != Pokey->GetGridMapString() )
+		{
+			std::stringstream Error;
+			if ( !Pokey->SetGridMap( GridMap, Error ) )
+				std::Debug << "cluster member " << Member.mName << " sent bad gridmap for " << Serial << ": " << Error.str() << std::endl;
+		}
+		return true;
+	}
+
+	if ( Type == "h" )
+	{
+		int Serial = -1;
+		int Connected = 0;
+		sint64 AgeMs = -1;
+		size_t PinCount = 0;
+		std::string PinsHex;
+		uint64 TimeNs = 0;
+		LineStream >> Serial >> Connected >> AgeMs >> PinCount >> PinsHex >> TimeNs;
+		if ( LineStream.fail() )
+			return false;
+
+		auto Pokey = GetRemotePokey( Peer.mMember, Serial );
+		if ( !Pokey )
+			return false;
+		Pokey->mRemoteConnected = (Connected != 0);
+
+		//	held pins keep counting down time and stuck pins get ignored as if we polled them
+		if ( Connected && PinCount > 0 )
+			OnPins( Peer.mMember, Serial, PinCount, PinsHex, TimeNs, true );
+		return true;
+	}
+
+	if ( Type == "e" )
+	{
+		int Serial = -1;
+		size_t PinCount = 0;
+		std::string PinsHex;
+		uint64 TimeNs = 0;
+		LineStream >> Serial >> PinCount >> PinsHex >> TimeNs;
+		if ( LineStream.fail() )
+			return false;
+
+		{
+			std::lock_guard<std::mutex> Lock( mMembersLock );
+			Member.mEdges++;
+		}
+		OnPins( Peer.mMember, Serial, PinCount, PinsHex, TimeNs, false );
+		return true;
+	}
+
+	if ( Type == "synced" )
+	{
+		std::lock_guard<std::mutex> Lock( mMembersLock );
+		std::Debug << "cluster member " << Member.mName << " synced " << Member.mSerials.GetSize() << " pokeys" << std::endl;
+		return true;
+	}
+
+	//	newer members may send more, skip it
+	return true;
+}
+
+void TPokeyClusterAggregator::OnDisconnect(TPeer& Peer)
+{
+#if !defined(TARGET_WINDOWS)
+	close( Peer.mSocket );
+#endif
+	if ( Peer.mMember == -1 )
+		return;
+
+	Array<int> Serials;
+	std::string Name;
+	{
+		std::lock_guard<std::mutex> Lock( mMembersLock );
+		auto& Member = mMembers[Peer.mMember];
+		Member.mConnected = false;
+		Serials.Copy( Member.mSerials );
+		Name = Member.mName;
+	}
+
+	//	keep the pokeys so status shows what's missing, the snapshot on reconnect puts them right
+	for ( int i=0;	i<Serials.GetSize();	i++ )
+	{
+		auto Pokey = mApp.GetPokey( Serials[i], false );
+		if ( Pokey && Pokey->mRemote == Peer.mMember )
+			Pokey->mRemoteConnected = false;
+	}
+	std::Debug << "cluster member " << Name << " disconnected" << std::endl;
+}
+
+int TPokeyClusterAggregator::GetMember(const std::string& Name)
+{
+	std::lock_guard<std::mutex> Lock( mMembersLock );
+	for ( size_t i=0;	i<mMemberCount;	i++ )
+		if ( mMembers[i].mName == Name )
+			return static_cast<int>(i);
+
+	if ( mMemberCount >= MaxMembers )
+	{
+		std::Debug << "too many cluster members, max " << MaxMembers << ", rejecting " << Name << std::endl;
+		return -1;
+	}
+
+	//	members keep their slot (and merge input) across reconnects
+	auto& Member = mMembers[mMemberCount];
+	Member.mName = Name;
+	Member.mMergeInput = mApp.mEventMerger.AddInput();
+	return static_cast<int>( mMemberCount++ );
+}
+
+void TPokeyClusterAggregator::OnClock(TMember& Member,uint64 MemberClockNs)
+{
+	//	the smallest offset seen is the one with the least transit in it. Let it creep up slowly
+	//	too so clock drift between hosts doesn't leave it behind
+	auto NowNs = Soy::GetMonotonicNs();
+	auto OffsetNs = static_cast<sint64>(NowNs) - static_cast<sint64>(MemberClockNs);
+	if ( !Member.mHasClockOffset || OffsetNs < Member.mClockOffsetNs )
+		Member.mClockOffsetNs = OffsetNs;
+	else
+		Member.mClockOffsetNs += (OffsetNs - Member.mClockOffsetNs) / 100;
+	Member.mHasClockOffset = true;
+
+	mApp.mEventMerger.Advance( Member.mMergeInput, ToLocalTime( Member, MemberClockNs ) );
+}
+
+uint64 TPokeyClusterAggregator::ToLocalTime(TMember& Member,uint64 MemberTimeNs)
+{
+	auto NowNs = Soy::GetMonotonicNs();
+	if ( MemberTimeNs == 0 || !Member.mHasClockOffset )
+		return NowNs;
+	auto LocalNs = static_cast<sint64>(MemberTimeNs) + Member.mClockOffsetNs;
+	if ( LocalNs <= 0 )
+		return NowNs;
+	return std::min( NowNs, static_cast<uint64>(LocalNs) );
+}
+
+void TPokeyClusterAggregator::OnPins(int MemberIndex,int Serial,size_t PinCount,const std::string& PinsHex,uint64 MemberTimeNs,bool Resync)
+{
+	BufferArray<char,100> Pins;
+	if ( PinCount > Pins.MaxAllocSize() || !TPokeyCluster::HexToPins( PinsHex, PinCount, GetArrayBridge(Pins) ) )
+	{
+		std::Debug << "bad cluster pins for " << Serial << ": " << PinCount << " " << PinsHex << std::endl;
+		return;
+	}
+
+	auto Pokey = GetRemotePokey( MemberIndex, Serial );
+	if ( !Pokey )
+		return;
+
+	//	health repeats the last pins; they only need applying again if an edge went missing, or
+	//	while pins are held so they keep pressing and can time out as stuck
+	if ( Resync )
+	{
+		uint64 PinsDown = 0;
+		for ( size_t i=0;	i<std::min<size_t>( Pins.GetSize(), size_t(TPokeyBoardState::MaxPins) );	i++ )
+		{
+			if ( Pins[i] != '0' )
+				PinsDown |= 1ull << i;
+		}
+		std::lock_guard<std::mutex> Lock( Pokey->mStateLock );
+		auto& State = Pokey->GetState();
+		if ( State.mDownPins == PinsDown && (PinsDown & ~State.mStuckPins) == 0 )
+			return;
+	}
+
+	uint64 SampleTimeNs;
+	{
+		std::lock_guard<std::mutex> Lock( mMembersLock );
+		SampleTimeNs = ToLocalTime( mMembers[MemberIndex], MemberTimeNs );
+	}
+	mApp.UpdatePinState( *Pokey, GetArrayBridge(Pins), nullptr, SampleTimeNs );
+}
+
+std::shared_ptr<TPokeyMeta> TPokeyClusterAggregator::GetRemotePokey(int MemberIndex,int Serial)
+{
+	if ( Serial < 0 )
+		return nullptr;
+
+	auto Pokey = mApp.GetPokey( Serial, true );
+	if ( !Pokey || Pokey->mRemote == MemberIndex )
+		return Pokey;
+
+	//	the member owns it now; stop talking to it ourselves, a pokey only takes one connection.
+	//	Owned first, so discovery doesn't make a new channel as we drop this one
+	Pokey->mRemote = MemberIndex;
+	auto ChannelRef = Pokey->SetChannelRef( SoyRef() );
+	if ( ChannelRef.IsValid() )
+		mApp.RemoveChannel( ChannelRef );
+
+	std::lock_guard<std::mutex> Lock( mMembersLock );
+	auto& Member = mMembers[MemberIndex];
+	Member.mSerials.PushBack( Serial );
+	std::Debug << "pokey " << Serial << " now owned by cluster member " << Member.mName << std::endl;
+	return Pokey;
+}
+
+size_t TPokeyClusterAggregator::GetMergeInput(int Member)
+{
+	std::lock_guard<std::mutex> Lock( mMembersLock );
+	if ( Member < 0 || Member >= mMemberCount )
+		return 0;
+	return mMembers[Member].mMergeInput;
+}
+
+std::string TPokeyClusterAggregator::GetMemberName(int Member)
+{
+	std::lock_guard<std::mutex> Lock( mMembersLock );
+	if ( Member < 0 || Member >= mMemberCount )
+		return std::string();
+	return mMembers[Member].mName;
+}
+
+void TPokeyClusterAggregator::GetStatus(std::ostream& Status)
+{
+	auto NowNs = Soy::GetMonotonicNs();
+	std::lock_guard<std::mutex> Lock( mMembersLock );
+	Status << "cluster aggregator on port " << mPort << ": " << mMemberCount << " members";
+	for ( size_t i=0;	i<mMemberCount;	i++ )
+	{
+		auto& Member = mMembers[i];
+		Status << std::endl << "member " << Member.mName << " " << (Member.mConnected ? "connected" : "disconnected");
+		Status << " pokeys " << Member.mSerials.GetSize() << " lines " << Member.mLines << " edges " << Member.mEdges << " connects " << Member.mConnectCount;
+		Status << " clockoffset " << (Member.mClockOffsetNs / 1000) << "us";
+		if ( Member.mLastHeardNs != 0 )
+			Status << " heard " << ( (NowNs - std::min(NowNs,Member.mLastHeardNs)) / 1000000 ) << "ms ago";
+	}
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <condition_variable>
+#include <map>
+
+
+class TPopPokey;
+class TPokeyMeta;
+
+
+//	cluster link is text lines over tcp, one message per line;
+//		hello <member> <clockns>
+//		c <clockns>										clock, so the aggregator can merge and map times
+//		b <serial> <ignored> <version> <gridmap>		board meta, resent when it changes
+//		h <serial> <connected> <agems> <pincount> <pinshex> <timens>	health, every HealthIntervalMs
+//		e <serial> <pincount> <pinshex> <timens>		pins changed
+//		synced											end of the snapshot sent on (re)connect
+namespace TPokeyCluster
+{
+	bool			ParseSerials(const std::string& SerialsString,ArrayBridge<int>&& Serials,std::stringstream& Error);	//	csv, with a-b ranges
+	std::string		PinsToHex(const ArrayBridge<char>& Pins);
+	bool			HexToPins(const std::string& Hex,size_t PinCount,ArrayBridge<char>&& Pins);
+};
+
+
+//	streams this instance's boards to an aggregator; a snapshot of every owned board on connect,
+//	then only edges and periodic health
+class TPokeyClusterMember : public SoyWorkerThread
+{
+public:
+	static const int	ClockIntervalMs = 100;
+	static const int	HealthIntervalMs = 500;
+	static const int	ReconnectMs = 1000;
+
+public:
+	TPokeyClusterMember(TPopPokey& App,const std::string& Name,const std::string& AggregatorAddress,const ArrayBridge<int>& Serials);
+	virtual ~TPokeyClusterMember();
+
+	virtual bool	Iteration() override;
+
+	bool			IsOwned(int Serial) const;			//	no serials means we own everything we find
+	void			OnSample(TPokeyMeta& Pokey,const ArrayBridge<char>& Pins,uint64 SampleTimeNs);
+	void			GetStatus(std::ostream& Status);
+
+private:
+	bool			Connect();
+	void			Disconnect();
+	void			QueueBoards();		//	board meta that changed and everyone's health
+	void			Queue(const std::string& Line);
+	bool			Flush();
+
+public:
+	const std::string	mName;
+	const std::string	mAggregatorAddress;
+
+private:
+	TPopPokey&			mApp;
+	Array<int>			mSerials;
+	int					mSocket;
+	uint64				mLastConnectMs;
+	uint64				mLastClockMs;
+	uint64				mLastHealthMs;
+
+	std::mutex			mOutboxLock;
+	std::condition_variable	mOutboxWake;
+	std::string			mOutbox;
+	bool				mSynced;				//	snapshot queued, edges can follow it
+	std::map<int,std::string>	mSentPins;		//	per serial, last pins sent so only changes go out
+	std::map<int,std::string>	mSentBoards;	//	per serial, last board line
+
+	std::atomic<uint64>	mConnectCount;
+	std::atomic<uint64>	mEdgeCount;
+	std::atomic<uint64>	mBytesSent;
+};
+
+
+//	accepts members and applies their boards to our registry as remote pokeys, so the grid, event
+//	stream and status look the same as if we polled them ourselves
+class TPokeyClusterAggregator : public SoyWorkerThread
+{
+public:
+	static const size_t	MaxMembers = 16;
+	static const int	PeerTimeoutMs = 10 * TPokeyClusterMember::ClockIntervalMs;	//	members send a clock every interval; this long silent and the connection's dead even if tcp hasn't noticed
+
+public:
+	TPokeyClusterAggregator(TPopPokey& App,int Port);
+	virtual ~TPokeyClusterAggregator();
+
+	bool			Init(std::stringstream& Error);
+	virtual bool	Iteration() override;
+
+	size_t			GetMergeInput(int Member);
+	std::string		GetMemberName(int Member);
+	void			GetStatus(std::ostream& Status);
+
+private:
+	class TPeer
+	{
+	public:
+		TPeer() :
+			mSocket		( -1 ),
+			mMember		( -1 ),
+			mLastRecvNs	( 0 )
+		{
+		}
+
+	public:
+		int			mSocket;
+		int			mMember;		//	-1 until hello
+		std::string	mRecvBuffer;
+		uint64		mLastRecvNs;
+	};
+
+	class TMember
+	{
+	public:
+		TMember() :
+			mMergeInput		( 0 ),
+			mConnected		( false ),
+			mClockOffsetNs	( 0 ),
+			mHasClockOffset	( false ),
+			mLines			( 0 ),
+			mEdges			( 0 ),
+			mConnectCount	( 0 ),
+			mLastHeardNs	( 0 )
+		{
+		}
+
+	public:
+		std::string	mName;
+		size_t		mMergeInput;
+		bool		mConnected;
+		sint64		mClockOffsetNs;		//	add to member times to get ours
+		bool		mHasClockOffset;
+		uint64		mLines;
+		uint64		mEdges;
+		uint64		mConnectCount;
+		uint64		mLastHeardNs;
+		Array<int>	mSerials;
+	};
+
+	void			OnAccept();
+	bool			OnRecv(TPeer& Peer);
+	bool			OnLine(TPeer& Peer,const std::string& Line);
+	void			OnDisconnect(TPeer& Peer);
+	int				GetMember(const std::string& Name);
+	uint64			ToLocalTime(TMember& Member,uint64 MemberTimeNs);
+	void			OnClock(TMember& Member,uint64 MemberClockNs);
+	void			OnPins(int MemberIndex,int Serial,size_t PinCount,const std::string& PinsHex,uint64 MemberTimeNs,bool Resync);	//	Resync skips pins that'd change nothing
+	std::shared_ptr<TPokeyMeta>	GetRemotePokey(int MemberIndex,int Serial);
+
+private:
+	TPopPokey&			mApp;
+	int					mPort;
+	int					mListenSocket;
+	Array<TPeer>		mPeers;
+
+	std::mutex			mMembersLock;
+	TMember				mMembers[MaxMembers];
+	size_t				mMemberCount;
+};
@@ -0,0 +1,380 @@
+#include "TPokeyConfig.h"
+#include "PopPokey.h"
+#include <TProtocolCli.h>
+#include <SoyString.h>
+#include <sys/stat.h>
+#include <cstdio>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+
+namespace Soy
+{
+	std::string	StringToLowerCopy(std::string String)
+	{
+		std::transform( String.begin(), String.end(), String.begin(), ::tolower );
+		return String;
+	}
+}
+
+
+bool TPokeyTriggerZoneConfig::Contains(vec2x<int> Cell) const
+{
+	if ( mMin.x <= mMax.x )
+		return Cell.x >= mMin.x && Cell.x <= mMax.x && Cell.y >= mMin.y && Cell.y <= mMax.y;
+
+	for ( int i=0;	i<mCells.GetSize();	i++ )
+		if ( mCells[i] == Cell )
+			return true;
+	return false;
+}
+
+bool TPokeyTriggerZoneConfig::ParseRegion(const std::string& Rect,const std::string& Cells,std::stringstream& Error)
+{
+	if ( !Rect.empty() )
+	{
+		int Values[4];
+		if ( sscanf( Rect.c_str(), "%d,%d,%d,%d", &Values[0], &Values[1], &Values[2], &Values[3] ) != 4 )
+		{
+			Error << "rect should be x0,y0,x1,y1, got " << Rect;
+			return false;
+		}
+		mMin = vec2x<int>( std::min( Values[0], Values[2] ), std::min( Values[1], Values[3] ) );
+		mMax = vec2x<int>( std::max( Values[0], Values[2] ), std::max( Values[1], Values[3] ) );
+		return true;
+	}
+	
+	if ( !Cells.empty() )
+		return TPokeyMeta::ParseGridMap( Cells, GetArrayBridge(mCells), Error );
+	
+	Error << "needs rect=x0,y0,x1,y1 or cells=x,y/x,y";
+	return false;
+}
+
+bool TPokeyTriggerZoneConfig::operator==(const TPokeyTriggerZoneConfig& That) const
+{
+	if ( mName != That.mName || mMin != That.mMin || mMax != That.mMax || mCells.GetSize() != That.mCells.GetSize() )
+		return false;
+	for ( int i=0;	i<mCells.GetSize();	i++ )
+		if ( mCells[i] != That.mCells[i] )
+			return false;
+	return true;
+}
+
+
+TPokeyBoardConfig* TPokeyConfig::GetBoard(int Serial)
+{
+	return mBoards.Find( Serial );
+}
+
+const TPokeyBoardConfig* TPokeyConfig::GetBoard(int Serial) const
+{
+	return const_cast<TPokeyConfig*>(this)->GetBoard( Serial );
+}
+
+TPokeyBoardConfig& TPokeyConfig::GetOrCreateBoard(int Serial)
+{
+	auto* Board = GetBoard( Serial );
+	if ( Board )
+		return *Board;
+
+	auto& NewBoard = mBoards.PushBack();
+	NewBoard.mSerial = Serial;
+	return NewBoard;
+}
+
+bool TPokeyConfig::Load(const std::string& Filename,std::stringstream& Error)
+{
+	mFilename = Filename;
+
+	Array<std::string> Lines;
+	if ( !Soy::FileToStringLines( Filename, GetArrayBridge(Lines), Error ) )
+		return false;
+
+	return Parse( GetArrayBridge(Lines), Error );
+}
+
+bool TPokeyConfig::Parse(const ArrayBridge<std::string>& Lines,std::stringstream& Error)
+{
+	bool Success = true;
+
+	for ( int i=0;	i<Lines.GetSize();	i++ )
+	{
+		auto& Line = Lines[i];
+
+		//	comment
+		if ( Line.empty() || Line[0] == '#' )
+			continue;
+
+		TProtocolCli Protocol;
+		TJob Job;
+		if ( !Protocol.DecodeHeader( Job, Line ) )
+		{
+			Error << "line " << (i+1) << ": couldn't decode command: " << Line << std::endl;
+			Success = false;
+			continue;
+		}
+
+		std::stringstream LineError;
+		if ( !ParseCommand( Job.mParams, LineError ) )
+		{
+			Error << "line " << (i+1) << ": " << LineError.str() << std::endl;
+			Success = false;
+		}
+	}
+
+	//	warn about cells mapped more than once, but allow it; miswired floors do this on purpose
+	std::map<std::pair<int,int>,int> CellOwners;
+	for ( int b=0;	b<mBoards.GetSize();	b++ )
+	{
+		auto& Board = mBoards[b];
+		for ( int p=0;	p<Board.mGridMap.GetSize();	p++ )
+		{
+			auto& Coord = Board.mGridMap[p];
+			if ( Coord == TPokeyMeta::GridCoordInvalid || Coord == TPokeyMeta::GridCoordLaserGate )
+				continue;
+
+			auto Cell = std::make_pair( Coord.x, Coord.y );
+			auto Existing = CellOwners.find( Cell );
+			if ( Existing != CellOwners.end() )
+				std::Debug << "config warning: cell " << Coord.x << "," << Coord.y << " mapped on pokey " << Existing->second << " and pokey " << Board.mSerial << std::endl;
+			else
+				CellOwners[Cell] = Board.mSerial;
+		}
+	}
+
+	return Success;
+}
+
+bool TPokeyConfig::ParseCommand(const TJobParams& Params,std::stringstream& Error)
+{
+	auto Command = Soy::StringToLowerCopy( Params.mCommand );
+
+	if ( Command == "setuppokey" )
+	{
+		int Serial = Params.GetParamAsWithDefault<int>("serial", -1);
+		if ( Serial == -1 )
+		{
+			Error << "setuppokey missing serial";
+			return false;
+		}
+
+		auto GridMapString = Params.GetParamAs<std::string>("gridmap");
+		BufferArray<vec2x<int>,100> GridMap;
+		if ( !TPokeyMeta::ParseGridMap( GridMapString, GetArrayBridge(GridMap), Error ) )
+			return false;
+
+		auto& Board = GetOrCreateBoard( Serial );
+		if ( Board.mHasGridMap )
+			std::Debug << "config warning: pokey " << Serial << " gridmap set more than once, using last" << std::endl;
+		Board.mGridMap.Copy( GridMap );
+		Board.mHasGridMap = true;
+		Board.mLatch = Params.GetParamAsWithDefault<int>("latch", 0) != 0;
+		return true;
+	}
+
+	if ( Command == "ignorepokey" )
+	{
+		int Serial = Params.GetParamAsWithDefault<int>("serial", -1);
+		if ( Serial == -1 )
+		{
+			Error << "ignorepokey missing serial";
+			return false;
+		}
+		auto& Board = GetOrCreateBoard( Serial );
+		Board.mIgnored = Params.GetParamAsWithDefault<int>("ignore",true) != 0;
+		return true;
+	}
+
+	//	triggerzone name=stage rect=0,0,9,4 or triggerzone name=door cells=1,1/2,1
+	if ( Command == "triggerzone" )
+	{
+		TPokeyTriggerZoneConfig Zone;
+		Zone.mName = Params.GetParamAs<std::string>("name");
+		if ( Zone.mName.empty() )
+		{
+			Error << "triggerzone missing name";
+			return false;
+		}
+		for ( int z=0;	z<mTriggerZones.GetSize();	z++ )
+		{
+			if ( mTriggerZones[z].mName == Zone.mName )
+			{
+				Error << "triggerzone " << Zone.mName << " defined more than once";
+				return false;
+			}
+		}
+
+		std::stringstream RegionError;
+		if ( !Zone.ParseRegion( Params.GetParamAs<std::string>("rect"), Params.GetParamAs<std::string>("cells"), RegionError ) )
+		{
+			Error << "triggerzone " << Zone.mName << " " << RegionError.str();
+			return false;
+		}
+
+		mTriggerZones.PushBack( Zone );
+		return true;
+	}
+
+	//	anything else (enablepoll etc) only makes sense once at bootup
+	mOtherCommands.PushBack( Params.mCommand );
+	return true;
+}
+
+
+
+TPokeyConfigThread::TPokeyConfigThread() :
+	SoyWorkerThread		( "TPokeyConfigThread", SoyWorkerWaitMode::Sleep ),
+	mWatchHandle		( -1 ),
+	mWatchDescriptor	( -1 ),
+	mWatchModifiedTime	( 0 )
+{
+	Start();
+}
+
+TPokeyConfigThread::~TPokeyConfigThread()
+{
+	Unwatch();
+}
+
+void TPokeyConfigThread::Reload(const std::string& Filename)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	mReloadFilename = Filename;
+}
+
+bool TPokeyConfigThread::Watch(const std::string& Filename,std::stringstream& Error)
+{
+	Unwatch();
+	std::lock_guard<std::mutex> Lock( mLock );
+
+#if defined(__linux__)
+	mWatchHandle = inotify_init1( IN_NONBLOCK );
+	if ( mWatchHandle == -1 )
+	{
+		Error << "inotify_init failed: " << errno;
+		return false;
+	}
+	//	editors often replace the file rather than write into it
+	mWatchDescriptor = inotify_add_watch( mWatchHandle, Filename.c_str(), IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB );
+	if ( mWatchDescriptor == -1 )
+	{
+		Error << "inotify_add_watch(" << Filename << ") failed: " << errno;
+		close( mWatchHandle );
+		mWatchHandle = -1;
+		return false;
+	}
+#endif
+
+	mWatchFilename = Filename;
+	struct stat FileStat;
+	mWatchModifiedTime = ( stat( Filename.c_str(), &FileStat ) == 0 ) ? FileStat.st_mtime : 0;
+	return true;
+}
+
+void TPokeyConfigThread::Unwatch()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+#if defined(__linux__)
+	if ( mWatchHandle != -1 )
+		close( mWatchHandle );
+#endif
+	mWatchHandle = -1;
+	mWatchDescriptor = -1;
+	mWatchFilename.clear();
+}
+
+bool TPokeyConfigThread::HasFileChanged()
+{
+	if ( mWatchFilename.empty() )
+		return false;
+
+#if defined(__linux__)
+	if ( mWatchHandle != -1 )
+	{
+		bool Changed = false;
+		bool Lost = ( mWatchDescriptor == -1 );
+		bool Rewatch = Lost;
+		alignas(struct inotify_event) char Buffer[4096];
+		while ( true )
+		{
+			auto Read = read( mWatchHandle, Buffer, sizeof(Buffer) );
+			if ( Read <= 0 )
+				break;
+
+			//	one read can hold several events, each followed by its name
+			for ( size_t Offset=0;	Offset + sizeof(struct inotify_event) <= static_cast<size_t>(Read);	)
+			{
+				auto& Event = *reinterpret_cast<struct inotify_event*>( Buffer + Offset );
+				Offset += sizeof(struct inotify_event) + Event.len;
+				Changed = true;
+				if ( Event.mask & (IN_MOVE_SELF|IN_DELETE_SELF|IN_IGNORED) )
+					Rewatch = true;
+			}
+		}
+
+		//	file was replaced, watch the new one. Mid-save it may not be there yet, so keep trying
+		//	and only reload once it's back
+		if ( Rewatch )
+		{
+			if ( !Lost )
+				inotify_rm_watch( mWatchHandle, mWatchDescriptor );
+			mWatchDescriptor = inotify_add_watch( mWatchHandle, mWatchFilename.c_str(), IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB );
+			if ( mWatchDescriptor == -1 )
+			{
+				if ( !Lost )
+					std::Debug << "config " << mWatchFilename << " can't be watched (" << errno << "), retrying" << std::endl;
+				return false;
+			}
+			if ( Lost )
+				std::Debug << "config " << mWatchFilename << " watched again" << std::endl;
+			Changed = true;
+		}
+		return Changed;
+	}
+#endif
+
+	struct stat FileStat;
+	if ( stat( mWatchFilename.c_str(), &FileStat ) != 0 )
+		return false;
+	uint64 ModifiedTime = FileStat.st_mtime;
+	if ( ModifiedTime == mWatchModifiedTime )
+		return false;
+	mWatchModifiedTime = ModifiedTime;
+	return true;
+}
+
+bool TPokeyConfigThread::Iteration()
+{
+	std::string Filename;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		Filename = mReloadFilename;
+		mReloadFilename.clear();
+
+		if ( Filename.empty() && HasFileChanged() )
+		{
+			std::Debug << "config " << mWatchFilename << " changed, reloading" << std::endl;
+			Filename = mWatchFilename;
+		}
+	}
+
+	if ( Filename.empty() )
+		return true;
+
+	std::shared_ptr<TPokeyConfig> Config( new TPokeyConfig() );
+	std::stringstream Error;
+	if ( !Config->Load( Filename, Error ) )
+	{
+		std::string ErrorString = "config " + Filename + " not reloaded; " + Error.str();
+		mOnConfigError.OnTriggered( ErrorString );
+		return true;
+	}
+
+	mOnConfigLoaded.OnTriggered( Config );
+	return true;
+}
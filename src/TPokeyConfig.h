@@ -0,0 +1,110 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+#include <SoyMath.h>
+
+
+namespace Soy
+{
+	std::string	StringToLowerCopy(std::string String);
+}
+
+
+//	settings for one pokey as described by the config file
+class TPokeyBoardConfig
+{
+public:
+	TPokeyBoardConfig() :
+		mSerial			( -1 ),
+		mHasGridMap		( false ),
+		mIgnored		( false ),
+		mLatch			( false )
+	{
+	}
+
+	inline bool		operator==(const int Serial) const	{	return mSerial == Serial;	}
+
+public:
+	int							mSerial;
+	bool						mHasGridMap;
+	BufferArray<vec2x<int>,100>	mGridMap;
+	bool						mIgnored;
+	bool						mLatch;			//	count pin edges on the pokey between polls
+};
+
+
+//	named area of the floor that emits enter/exit events, a rectangle or a list of cells
+class TPokeyTriggerZoneConfig
+{
+public:
+	TPokeyTriggerZoneConfig() :
+		mMin	( 0, 0 ),
+		mMax	( -1, -1 )
+	{
+	}
+
+	bool			Contains(vec2x<int> Cell) const;
+	bool			ParseRegion(const std::string& Rect,const std::string& Cells,std::stringstream& Error);	//	rect wins if both
+	bool			operator==(const TPokeyTriggerZoneConfig& That) const;
+
+public:
+	std::string		mName;
+	vec2x<int>		mMin;		//	inclusive rect, min > max if it's a cell list
+	vec2x<int>		mMax;
+	Array<vec2x<int>>	mCells;
+};
+
+
+//	whole config file compiled into board settings. Parsed and validated away from the poll thread
+//	so it can be swapped in as one unit
+class TPokeyConfig
+{
+public:
+	bool					Parse(const ArrayBridge<std::string>& Lines,std::stringstream& Error);
+	bool					Load(const std::string& Filename,std::stringstream& Error);
+	TPokeyBoardConfig*		GetBoard(int Serial);
+	const TPokeyBoardConfig*	GetBoard(int Serial) const;
+
+private:
+	TPokeyBoardConfig&		GetOrCreateBoard(int Serial);
+	bool					ParseCommand(const TJobParams& Params,std::stringstream& Error);
+
+public:
+	std::string				mFilename;
+	Array<TPokeyBoardConfig>	mBoards;
+	Array<TPokeyTriggerZoneConfig>	mTriggerZones;
+	Array<std::string>		mOtherCommands;		//	commands we don't compile, only run at bootup
+};
+
+
+//	parses config off-thread when asked to, or when the file changes if watching
+class TPokeyConfigThread : public SoyWorkerThread
+{
+public:
+	TPokeyConfigThread();
+	virtual ~TPokeyConfigThread();
+
+	virtual bool	Iteration() override;
+	virtual std::chrono::milliseconds	GetSleepDuration()	{	return std::chrono::milliseconds(500);	}
+
+	void			Reload(const std::string& Filename);
+	bool			Watch(const std::string& Filename,std::stringstream& Error);
+	void			Unwatch();
+	bool			IsWatching() const	{	return mWatchHandle != -1 || !mWatchFilename.empty();	}
+
+private:
+	bool			HasFileChanged();
+
+public:
+	SoyEvent<std::shared_ptr<TPokeyConfig>>	mOnConfigLoaded;
+	SoyEvent<const std::string>				mOnConfigError;
+
+private:
+	std::mutex		mLock;
+	std::string		mReloadFilename;	//	pending explicit reload
+	std::string		mWatchFilename;
+	int				mWatchHandle;		//	inotify descriptor
+	int				mWatchDescriptor;
+	uint64			mWatchModifiedTime;	//	fallback when inotify isn't available
+};
@@ -0,0 +1,139 @@
+#include "TPokeyEventMerger.h"
+#include "TProtocolPokey.h"
+
+
+TPokeyEventMerger::TPokeyEventMerger() :
+	mMaxHoldNs		( 5 * 1000000 ),
+	mInputTimeoutNs	( 500 * 1000000ull ),
+	mMergedCount	( 0 ),
+	mLateCount		( 0 ),
+	mInputCount		( 0 ),
+	mPendingCount	( 0 ),
+	mLastReleasedNs	( 0 )
+{
+}
+
+size_t TPokeyEventMerger::AddInput()
+{
+	//	slots are all constructed up front, so publishing the count is all adding one takes
+	auto Index = mInputCount.load();
+	do
+	{
+		if ( !Soy::Assert( Index < MaxInputs, "too many event merger inputs" ) )
+			return MaxInputs-1;
+	}
+	while ( !mInputCount.compare_exchange_weak( Index, Index+1 ) );
+	return Index;
+}
+
+void TPokeyEventMerger::Push(size_t Input,const TPokeyMergeEvent& Event)
+{
+	if ( Input >= mInputCount.load() )
+		return;
+
+	auto& In = mInputs[Input];
+	{
+		//	boards in one input reply on their own threads, so keep it sorted
+		std::lock_guard<std::mutex> Lock( In.mLock );
+		auto it = In.mQueue.end();
+		while ( it != In.mQueue.begin() && (it-1)->mTimeNs > Event.mTimeNs )
+			--it;
+		In.mQueue.insert( it, Event );
+	}
+	mPendingCount++;
+
+	Advance( Input, Event.mTimeNs );
+}
+
+void TPokeyEventMerger::Advance(size_t Input,uint64 SampleTimeNs)
+{
+	if ( Input >= mInputCount.load() )
+		return;
+
+	auto& In = mInputs[Input];
+	auto Clock = In.mClockNs.load();
+	while ( SampleTimeNs > Clock && !In.mClockNs.compare_exchange_weak( Clock, SampleTimeNs ) )
+	{
+	}
+
+	auto NowNs = Soy::GetMonotonicNs();
+	In.mHeardNs = NowNs;
+
+	if ( mPendingCount.load() > 0 )
+		Release( NowNs );
+}
+
+void TPokeyEventMerger::Release(uint64 NowNs)
+{
+	if ( mPendingCount.load() == 0 )
+		return;
+
+	std::lock_guard<std::mutex> ReleaseLock( mReleaseLock );
+	auto InputCount = mInputCount.load();
+
+	//	everything before the slowest active input's clock is final
+	uint64 Watermark = ~0ull;
+	for ( size_t i=0;	i<InputCount;	i++ )
+	{
+		auto& In = mInputs[i];
+		auto HeardNs = In.mHeardNs.load();
+		if ( HeardNs == 0 || NowNs > HeardNs + mInputTimeoutNs )
+			continue;
+		Watermark = std::min( Watermark, In.mClockNs.load() );
+	}
+
+	while ( true )
+	{
+		//	oldest head of all the inputs
+		size_t Oldest = InputCount;
+		uint64 OldestNs = ~0ull;
+		for ( size_t i=0;	i<InputCount;	i++ )
+		{
+			auto& In = mInputs[i];
+			std::lock_guard<std::mutex> Lock( In.mLock );
+			if ( In.mQueue.empty() )
+				continue;
+			if ( In.mQueue.front().mTimeNs >= OldestNs )
+				continue;
+			Oldest = i;
+			OldestNs = In.mQueue.front().mTimeNs;
+		}
+
+		if ( Oldest == InputCount )
+			break;
+		if ( OldestNs > Watermark && OldestNs + mMaxHoldNs > NowNs )
+			break;
+
+		TPokeyMergeEvent Event;
+		{
+			auto& In = mInputs[Oldest];
+			std::lock_guard<std::mutex> Lock( In.mLock );
+			Event = In.mQueue.front();
+			In.mQueue.pop_front();
+		}
+		mPendingCount--;
+
+		if ( Event.mTimeNs < mLastReleasedNs )
+			mLateCount++;
+		else
+			mLastReleasedNs = Event.mTimeNs;
+		mMergedCount++;
+
+		mOnEvent.OnTriggered( Event );
+	}
+}
+
+void TPokeyEventMerger::GetStatus(std::ostream& Status)
+{
+	auto NowNs = Soy::GetMonotonicNs();
+	Status << "merged " << mMergedCount.load() << " late " << mLateCount.load() << " pending " << mPendingCount.load() << " inputs";
+	for ( size_t i=0;	i<mInputCount.load();	i++ )
+	{
+		auto HeardNs = mInputs[i].mHeardNs.load();
+		Status << " " << i << ":";
+		if ( HeardNs == 0 )
+			Status << "never";
+		else
+			Status << ( (NowNs - std::min(NowNs,HeardNs)) / 1000000 ) << "ms";
+	}
+}
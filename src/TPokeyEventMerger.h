@@ -0,0 +1,75 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <deque>
+#include "TPokeyTrace.h"
+
+
+class TPokeyMergeEvent
+{
+public:
+	TPokeyMergeEvent() :
+		mTimeNs		( 0 ),
+		mCoord		( -1, -1 )
+	{
+	}
+
+public:
+	uint64			mTimeNs;		//	monotonic sample time of the press
+	vec2x<int>		mCoord;
+	TPokeyTrace		mTrace;			//	invalid if the press isn't traced
+};
+
+
+//	merges press events from each shard into one stream in timestamp order. An event is released
+//	once every active input has sampled past it, or after mMaxHoldNs so a slow or silent input can
+//	only ever delay the others by that much
+class TPokeyEventMerger
+{
+public:
+	static const size_t	MaxInputs = 32;
+
+public:
+	TPokeyEventMerger();
+
+	size_t			AddInput();			//	safe while other inputs push; a new input isn't waited for until it's first heard from
+	size_t			GetInputCount() const	{	return mInputCount.load();	}
+
+	void			Push(size_t Input,const TPokeyMergeEvent& Event);
+	void			Advance(size_t Input,uint64 SampleTimeNs);		//	input has sampled up to this time
+	void			Release(uint64 NowNs);
+
+	void			GetStatus(std::ostream& Status);
+
+public:
+	SoyEvent<TPokeyMergeEvent>	mOnEvent;	//	in timestamp order, on whichever thread released it
+	uint64				mMaxHoldNs;
+	uint64				mInputTimeoutNs;	//	inputs not heard from this long aren't waited for
+	std::atomic<uint64>	mMergedCount;
+	std::atomic<uint64>	mLateCount;			//	released out of order because it arrived after mMaxHoldNs
+
+private:
+	class TInput
+	{
+	public:
+		TInput() :
+			mClockNs	( 0 ),
+			mHeardNs	( 0 )
+		{
+		}
+
+	public:
+		std::mutex						mLock;		//	only between this input's threads and the releaser
+		std::deque<TPokeyMergeEvent>	mQueue;		//	sorted by time
+		std::atomic<uint64>				mClockNs;	//	latest sample time
+		std::atomic<uint64>				mHeardNs;	//	monotonic time of the last Advance
+	};
+
+	TInput				mInputs[MaxInputs];
+	std::atomic<size_t>	mInputCount;
+	std::atomic<uint64>	mPendingCount;		//	so Advance can skip Release when there's nothing to do
+
+	std::mutex			mReleaseLock;
+	uint64				mLastReleasedNs;
+};
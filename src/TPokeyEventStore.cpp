@@ -0,0 +1,656 @@
+#include "TPokeyEventStore.h"
+#include "PopPokey.h"
+#include "TProtocolPokey.h"
+#include <SoyTime.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+#if !defined(TARGET_WINDOWS)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#endif
+
+
+const char TPokeyEventSegmentHeader::Magic[8] = { 'P','K','Y','E','V','T','\0','\0' };
+
+namespace
+{
+	const char*		SegmentPrefix = "events-";
+	const char*		SegmentSuffix = ".pkev";
+	const int		MaxBitmapRegionCells = 256;		//	bigger regions just scan the segment
+
+	bool ParseInts(const std::string& String,int* Values,int Count)
+	{
+		std::stringstream Stream( String );
+		for ( int i=0;	i<Count;	i++ )
+		{
+			if ( i > 0 && Stream.get() != ',' )
+				return false;
+			if ( !(Stream >> Values[i]) )
+				return false;
+		}
+		return Stream.peek() == EOF;
+	}
+}
+
+
+TPokeyEventQuery::TPokeyEventQuery() :
+	mFromUs		( 0 ),
+	mToUs		( std::numeric_limits<uint64>::max() ),
+	mMin		( 0, 0 ),
+	mMax		( -1, -1 ),
+	mSerial		( -1 ),
+	mType		( -1 ),
+	mLimit		( 1000 )
+{
+}
+
+bool TPokeyEventQuery::Read(const TJobParams& Params,uint64 NowUs,std::stringstream& Error)
+{
+	//	times are unix ms so they can be pasted from show logs; last=seconds is relative to now
+	auto FromMs = Params.GetParamAsWithDefault<uint64>("from", 0 );
+	auto ToMs = Params.GetParamAsWithDefault<uint64>("to", 0 );
+	auto LastSecs = Params.GetParamAsWithDefault<uint64>("last", 0 );
+	if ( FromMs != 0 )
+		mFromUs = FromMs * 1000;
+	if ( ToMs != 0 )
+		mToUs = ToMs * 1000;
+	if ( LastSecs != 0 )
+		mFromUs = ( NowUs > LastSecs * 1000000 ) ? NowUs - LastSecs * 1000000 : 0;
+	if ( mFromUs > mToUs )
+	{
+		Error << "from is after to";
+		return false;
+	}
+
+	auto Cell = Params.GetParamAs<std::string>("cell");
+	auto Region = Params.GetParamAs<std::string>("region");
+	if ( !Cell.empty() )
+	{
+		int Coord[2];
+		if ( !ParseInts( Cell, Coord, 2 ) )
+		{
+			Error << "cell should be x,y, got " << Cell;
+			return false;
+		}
+		mMin = mMax = vec2x<int>( Coord[0], Coord[1] );
+	}
+	else if ( !Region.empty() )
+	{
+		int Corners[4];
+		if ( !ParseInts( Region, Corners, 4 ) )
+		{
+			Error << "region should be x0,y0,x1,y1, got " << Region;
+			return false;
+		}
+		mMin = vec2x<int>( std::min( Corners[0], Corners[2] ), std::min( Corners[1], Corners[3] ) );
+		mMax = vec2x<int>( std::max( Corners[0], Corners[2] ), std::max( Corners[1], Corners[3] ) );
+	}
+
+	mSerial = Params.GetParamAsWithDefault<int>("serial", mSerial );
+
+	auto Type = Params.GetParamAsWithDefault<std::string>("type", "all" );
+	if ( Type == "down" )
+		mType = TPokeyEventType::Down;
+	else if ( Type == "up" )
+		mType = TPokeyEventType::Up;
+	else if ( Type != "all" )
+	{
+		Error << "type should be down, up or all, got " << Type;
+		return false;
+	}
+
+	mLimit = Params.GetParamAsWithDefault<int>("limit", static_cast<int>(mLimit) );
+	return true;
+}
+
+bool TPokeyEventQuery::Match(const TPokeyEventRecord& Record) const
+{
+	if ( Record.mTimeUs < mFromUs || Record.mTimeUs > mToUs )
+		return false;
+	if ( mSerial != -1 && Record.mSerial != mSerial )
+		return false;
+	if ( mType != -1 && Record.mType != mType )
+		return false;
+	if ( HasCellFilter() )
+	{
+		if ( Record.mX < mMin.x || Record.mX > mMax.x || Record.mY < mMin.y || Record.mY > mMax.y )
+			return false;
+	}
+	return true;
+}
+
+
+void TPokeyEventQueryResult::WriteJson(std::ostream& Output,bool IncludeRecords) const
+{
+	Output << "{";
+	Output << "\"down\":" << mDownCount << ",";
+	Output << "\"up\":" << mUpCount << ",";
+	Output << "\"segments_scanned\":" << mSegmentsScanned << ",";
+	Output << "\"segments_skipped\":" << mSegmentsSkipped << ",";
+	Output << "\"blocks_scanned\":" << mBlocksScanned;
+	if ( IncludeRecords )
+	{
+		Output << ",\"events\":[";
+		for ( int i=0;	i<mRecords.GetSize();	i++ )
+		{
+			auto& Record = mRecords[i];
+			if ( i > 0 )
+				Output << ",";
+			Output << "{\"time_us\":" << Record.mTimeUs;
+			Output << ",\"serial\":" << Record.mSerial;
+			Output << ",\"pin\":" << static_cast<int>(Record.mPin);
+			Output << ",\"x\":" << Record.mX << ",\"y\":" << Record.mY;
+			Output << ",\"type\":\"" << ( Record.mType == TPokeyEventType::Down ? "down" : "up" ) << "\"}";
+		}
+		Output << "]";
+	}
+	Output << "}";
+}
+
+
+TPokeyEventSegment::TPokeyEventSegment() :
+	mData	( nullptr ),
+	mSize	( 0 )
+{
+}
+
+TPokeyEventSegment::~TPokeyEventSegment()
+{
+	Close();
+}
+
+size_t TPokeyEventSegment::GetCellBit(int x,int y)
+{
+	auto Hash = static_cast<uint32>(x) * 73856093u ^ static_cast<uint32>(y) * 19349663u;
+	return Hash % TPokeyEventSegmentHeader::CellBitmapBits;
+}
+
+size_t TPokeyEventSegment::GetRecordsOffset(size_t Capacity)
+{
+	auto BlockCount = (Capacity + TPokeyEventSegmentHeader::IndexStride - 1) / TPokeyEventSegmentHeader::IndexStride;
+	auto Offset = sizeof(TPokeyEventSegmentHeader) + TPokeyEventSegmentHeader::CellBitmapBits/8 + BlockCount * sizeof(TPokeyEventBlockIndex);
+
+	//	records start on a page
+	return (Offset + 4095) & ~static_cast<size_t>(4095);
+}
+
+void TPokeyEventSegment::Close()
+{
+#if !defined(TARGET_WINDOWS)
+	if ( mData )
+		munmap( mData, mSize );
+#endif
+	mData = nullptr;
+	mSize = 0;
+}
+
+bool TPokeyEventSegment::Map(int File,size_t Size,bool Writable,std::stringstream& Error)
+{
+#if !defined(TARGET_WINDOWS)
+	auto Protection = Writable ? (PROT_READ|PROT_WRITE) : PROT_READ;
+	auto* Data = mmap( nullptr, Size, Protection, MAP_SHARED, File, 0 );
+	if ( Data == MAP_FAILED )
+	{
+		Error << "mmap failed errno " << errno;
+		return false;
+	}
+	mData = static_cast<uint8*>( Data );
+	mSize = Size;
+	return true;
+#else
+	Error << "event store segments need mmap";
+	return false;
+#endif
+}
+
+bool TPokeyEventSegment::Create(const std::string& Filename,size_t Capacity,std::stringstream& Error)
+{
+	Close();
+#if !defined(TARGET_WINDOWS)
+	auto RecordsOffset = GetRecordsOffset( Capacity );
+	auto Size = RecordsOffset + Capacity * sizeof(TPokeyEventRecord);
+
+	int File = open( Filename.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644 );
+	if ( File == -1 )
+	{
+		Error << "failed to create event segment " << Filename << " errno " << errno;
+		return false;
+	}
+
+	//	sparse until written, so a big segment costs nothing up front
+	bool Mapped = ( ftruncate( File, Size ) == 0 ) && Map( File, Size, true, Error );
+	close( File );
+	if ( !Mapped )
+	{
+		Error << "; failed to size event segment " << Filename;
+		Close();
+		return false;
+	}
+
+	auto& Header = GetMutableHeader();
+	memset( &Header, 0, sizeof(Header) );
+	memcpy( Header.mMagic, TPokeyEventSegmentHeader::Magic, sizeof(Header.mMagic) );
+	Header.mVersion = TPokeyEventSegmentHeader::CurrentVersion;
+	Header.mRecordSize = sizeof(TPokeyEventRecord);
+	Header.mCapacity = Capacity;
+	Header.mCount = 0;
+	Header.mMinTimeUs = std::numeric_limits<uint64>::max();
+	Header.mMaxTimeUs = 0;
+	Header.mRecordsOffset = RecordsOffset;
+	return true;
+#else
+	Error << "event store segments need mmap";
+	return false;
+#endif
+}
+
+bool TPokeyEventSegment::Open(const std::string& Filename,std::stringstream& Error)
+{
+	Close();
+#if !defined(TARGET_WINDOWS)
+	int File = open( Filename.c_str(), O_RDONLY );
+	if ( File == -1 )
+	{
+		Error << "failed to open event segment " << Filename;
+		return false;
+	}
+	struct stat FileStat;
+	bool Mapped = ( fstat( File, &FileStat ) == 0 ) && FileStat.st_size >= static_cast<off_t>(sizeof(TPokeyEventSegmentHeader)) && Map( File, FileStat.st_size, false, Error );
+	close( File );
+	if ( !Mapped )
+	{
+		Error << Filename << " is not an event segment";
+		return false;
+	}
+
+	auto& Header = GetHeader();
+	if ( memcmp( Header.mMagic, TPokeyEventSegmentHeader::Magic, sizeof(Header.mMagic) ) != 0 || Header.mVersion != TPokeyEventSegmentHeader::CurrentVersion || Header.mRecordSize != sizeof(TPokeyEventRecord) )
+	{
+		Error << Filename << " is not a v" << TPokeyEventSegmentHeader::CurrentVersion << " event segment";
+		Close();
+		return false;
+	}
+	if ( Header.mRecordsOffset != GetRecordsOffset( Header.mCapacity ) || mSize < Header.mRecordsOffset + Header.mCapacity * sizeof(TPokeyEventRecord) )
+	{
+		Error << Filename << " is truncated";
+		Close();
+		return false;
+	}
+	return true;
+#else
+	Error << "event store segments need mmap";
+	return false;
+#endif
+}
+
+size_t TPokeyEventSegment::Append(const TPokeyEventRecord* Records,size_t Count)
+{
+	auto& Header = GetMutableHeader();
+	auto Start = Header.mCount;
+	Count = std::min<size_t>( Count, Header.mCapacity - Start );
+
+	auto* CellBitmap = mData + sizeof(TPokeyEventSegmentHeader);
+	auto* BlockIndex = const_cast<TPokeyEventBlockIndex*>( GetBlockIndex() );
+	auto* SegmentRecords = const_cast<TPokeyEventRecord*>( GetRecords() );
+	for ( size_t i=0;	i<Count;	i++ )
+	{
+		auto Index = Start + i;
+		auto& Record = Records[i];
+		SegmentRecords[Index] = Record;
+
+		auto& Block = BlockIndex[Index / TPokeyEventSegmentHeader::IndexStride];
+		if ( Index % TPokeyEventSegmentHeader::IndexStride == 0 )
+		{
+			Block.mMinTimeUs = Record.mTimeUs;
+			Block.mMaxTimeUs = Record.mTimeUs;
+		}
+		Block.mMinTimeUs = std::min( Block.mMinTimeUs, Record.mTimeUs );
+		Block.mMaxTimeUs = std::max( Block.mMaxTimeUs, Record.mTimeUs );
+
+		auto Bit = GetCellBit( Record.mX, Record.mY );
+		CellBitmap[Bit/8] |= 1 << (Bit%8);
+
+		Header.mMinTimeUs = std::min( Header.mMinTimeUs, Record.mTimeUs );
+		Header.mMaxTimeUs = std::max( Header.mMaxTimeUs, Record.mTimeUs );
+	}
+
+	//	readers map the same pages; everything above must land before they see the new count
+	std::atomic_thread_fence( std::memory_order_release );
+	Header.mCount = Start + Count;
+	return Count;
+}
+
+bool TPokeyEventSegment::MayContainCells(const TPokeyEventQuery& Query) const
+{
+	if ( !Query.HasCellFilter() )
+		return true;
+
+	auto Width = static_cast<int64_t>(Query.mMax.x) - Query.mMin.x + 1;
+	auto Height = static_cast<int64_t>(Query.mMax.y) - Query.mMin.y + 1;
+	if ( Width * Height > MaxBitmapRegionCells )
+		return true;
+
+	auto* CellBitmap = GetCellBitmap();
+	for ( int y=Query.mMin.y;	y<=Query.mMax.y;	y++ )
+	{
+		for ( int x=Query.mMin.x;	x<=Query.mMax.x;	x++ )
+		{
+			auto Bit = GetCellBit( x, y );
+			if ( CellBitmap[Bit/8] & (1 << (Bit%8)) )
+				return true;
+		}
+	}
+	return false;
+}
+
+void TPokeyEventSegment::Query(const TPokeyEventQuery& Query,TPokeyEventQueryResult& Result) const
+{
+	auto& Header = GetHeader();
+	auto Count = *reinterpret_cast<const volatile uint64*>( &Header.mCount );
+	std::atomic_thread_fence( std::memory_order_acquire );
+
+	if ( Count == 0 || Header.mMaxTimeUs < Query.mFromUs || Header.mMinTimeUs > Query.mToUs || !MayContainCells( Query ) )
+	{
+		Result.mSegmentsSkipped++;
+		return;
+	}
+	Result.mSegmentsScanned++;
+
+	auto* BlockIndex = GetBlockIndex();
+	auto* Records = GetRecords();
+	auto BlockCount = (Count + TPokeyEventSegmentHeader::IndexStride - 1) / TPokeyEventSegmentHeader::IndexStride;
+	for ( size_t b=0;	b<BlockCount;	b++ )
+	{
+		auto& Block = BlockIndex[b];
+		if ( Block.mMaxTimeUs < Query.mFromUs || Block.mMinTimeUs > Query.mToUs )
+			continue;
+		Result.mBlocksScanned++;
+
+		auto End = std::min<uint64>( Count, (b+1) * TPokeyEventSegmentHeader::IndexStride );
+		for ( auto r=b * TPokeyEventSegmentHeader::IndexStride;	r<End;	r++ )
+		{
+			auto& Record = Records[r];
+			if ( !Query.Match( Record ) )
+				continue;
+
+			if ( Record.mType == TPokeyEventType::Down )
+				Result.mDownCount++;
+			else
+				Result.mUpCount++;
+
+			if ( Result.mRecords.GetSize() < Query.mLimit )
+				Result.mRecords.PushBack( Record );
+		}
+	}
+}
+
+
+TPokeyEventStore::TPokeyEventStore() :
+	SoyWorkerThread		( "TPokeyEventStore", SoyWorkerWaitMode::Sleep ),
+	mSegmentRecords		( 1024*1024 ),
+	mMaxSegments		( 200 ),
+	mRetentionSecs		( 30 * 24 * 60 * 60 ),
+	mWallBaseUs			( SoyTime(true).GetTime() * 1000 ),
+	mMonotonicBaseNs	( Soy::GetMonotonicNs() ),
+	mRingHead			( 0 ),
+	mRingTail			( 0 ),
+	mDroppedCount		( 0 ),
+	mNextSequence		( 0 ),
+	mWrittenCount		( 0 )
+{
+	mRing.SetSize( RingSize );
+}
+
+TPokeyEventStore::~TPokeyEventStore()
+{
+	Stop();
+	WaitToFinish();
+
+	//	write out anything pushed since the last iteration
+	Flush();
+	mSegment.reset();
+}
+
+std::string TPokeyEventStore::GetSegmentFilename(uint32 Sequence) const
+{
+	char Name[32];
+	snprintf( Name, sizeof(Name), "%s%08u%s", SegmentPrefix, Sequence, SegmentSuffix );
+	return mDirectory + "/" + Name;
+}
+
+uint64 TPokeyEventStore::GetWallTimeUs(uint64 MonotonicNs) const
+{
+	//	from the monotonic sample time so events keep their order if the wall clock is stepped
+	if ( MonotonicNs < mMonotonicBaseNs )
+		return mWallBaseUs - (mMonotonicBaseNs - MonotonicNs) / 1000;
+	return mWallBaseUs + (MonotonicNs - mMonotonicBaseNs) / 1000;
+}
+
+bool TPokeyEventStore::Open(const std::string& Directory,std::stringstream& Error)
+{
+#if !defined(TARGET_WINDOWS)
+	mDirectory = Directory;
+	if ( mkdir( Directory.c_str(), 0755 ) != 0 && errno != EEXIST )
+	{
+		Error << "failed to create event store directory " << Directory << " errno " << errno;
+		return false;
+	}
+
+	DIR* Dir = opendir( Directory.c_str() );
+	if ( !Dir )
+	{
+		Error << "failed to open event store directory " << Directory;
+		return false;
+	}
+	Array<uint32> Sequences;
+	while ( auto* Entry = readdir( Dir ) )
+	{
+		unsigned int Sequence = 0;
+		char Suffix[8] = {0};
+		std::string Format = std::string(SegmentPrefix) + "%8u%7s";
+		if ( sscanf( Entry->d_name, Format.c_str(), &Sequence, Suffix ) == 2 && std::string(Suffix) == SegmentSuffix )
+			Sequences.PushBack( Sequence );
+	}
+	closedir( Dir );
+	std::sort( Sequences.GetArray(), Sequences.GetArray() + Sequences.GetSize() );
+
+	//	previous runs' segments stay queryable; we always start a new one rather than append to theirs
+	for ( int i=0;	i<Sequences.GetSize();	i++ )
+	{
+		TSegmentInfo Info;
+		Info.mSequence = Sequences[i];
+		Info.mFilename = GetSegmentFilename( Sequences[i] );
+
+		TPokeyEventSegment Segment;
+		std::stringstream SegmentError;
+		if ( !Segment.Open( Info.mFilename, SegmentError ) )
+		{
+			std::Debug << "event store skipping " << SegmentError.str() << std::endl;
+			continue;
+		}
+		Info.mMinTimeUs = Segment.GetHeader().mMinTimeUs;
+		Info.mMaxTimeUs = Segment.GetHeader().mMaxTimeUs;
+		Info.mCount = Segment.GetHeader().mCount;
+		mSegments.PushBack( Info );
+		mNextSequence = Sequences[i] + 1;
+	}
+
+	if ( !Rotate( Error ) )
+		return false;
+	ApplyRetention();
+	return true;
+#else
+	Error << "event store needs mmap, not supported on windows yet";
+	return false;
+#endif
+}
+
+void TPokeyEventStore::OnSample(TPokeyMeta& Pokey,uint64 Pins,uint64 SampleTimeNs)
+{
+	std::lock_guard<std::mutex> Lock( mRingLock );
+	auto& LastPins = mLastPins[Pokey.mSerial];
+	auto Changed = LastPins ^ Pins;
+	if ( Changed == 0 )
+		return;
+	LastPins = Pins;
+
+	auto TimeUs = GetWallTimeUs( SampleTimeNs );
+	for ( int Pin=0;	Pin<64 && Changed;	Pin++ )
+	{
+		uint64 PinBit = 1ull << Pin;
+		if ( !(Changed & PinBit) )
+			continue;
+		Changed &= ~PinBit;
+
+		if ( mRingHead - mRingTail >= RingSize )
+		{
+			mDroppedCount++;
+			continue;
+		}
+
+		auto Coord = Pokey.GetPinGridCoord( Pin );
+		auto& Record = mRing[ mRingHead % RingSize ];
+		memset( &Record, 0, sizeof(Record) );
+		Record.mTimeUs = TimeUs;
+		Record.mSerial = Pokey.mSerial;
+		Record.mX = static_cast<int16_t>( Coord.x );
+		Record.mY = static_cast<int16_t>( Coord.y );
+		Record.mPin = static_cast<uint8>( Pin );
+		Record.mType = (Pins & PinBit) ? TPokeyEventType::Down : TPokeyEventType::Up;
+		mRingHead++;
+	}
+}
+
+bool TPokeyEventStore::Iteration()
+{
+	Flush();
+	ApplyRetention();
+	return true;
+}
+
+void TPokeyEventStore::Flush()
+{
+	//	copy out and let the poll path carry on while we write
+	Array<TPokeyEventRecord> Pending;
+	{
+		std::lock_guard<std::mutex> Lock( mRingLock );
+		for ( ;	mRingTail<mRingHead;	mRingTail++ )
+			Pending.PushBack( mRing[ mRingTail % RingSize ] );
+	}
+	if ( Pending.IsEmpty() )
+		return;
+
+	size_t Written = 0;
+	while ( Written < Pending.GetSize() )
+	{
+		if ( !mSegment || mSegment->IsFull() )
+		{
+			std::stringstream Error;
+			if ( !Rotate( Error ) )
+			{
+				std::Debug << "event store: " << Error.str() << std::endl;
+				break;
+			}
+		}
+		Written += mSegment->Append( Pending.GetArray() + Written, Pending.GetSize() - Written );
+
+		std::lock_guard<std::mutex> Lock( mSegmentsLock );
+		auto& Info = mSegments.GetBack();
+		Info.mMinTimeUs = mSegment->GetHeader().mMinTimeUs;
+		Info.mMaxTimeUs = mSegment->GetHeader().mMaxTimeUs;
+		Info.mCount = mSegment->GetHeader().mCount;
+	}
+	mWrittenCount += Written;
+	mDroppedCount += Pending.GetSize() - Written;
+}
+
+bool TPokeyEventStore::Rotate(std::stringstream& Error)
+{
+	TSegmentInfo Info;
+	Info.mSequence = mNextSequence;
+	Info.mFilename = GetSegmentFilename( Info.mSequence );
+	Info.mMinTimeUs = std::numeric_limits<uint64>::max();
+	Info.mMaxTimeUs = 0;
+	Info.mCount = 0;
+
+	std::shared_ptr<TPokeyEventSegment> Segment( new TPokeyEventSegment() );
+	if ( !Segment->Create( Info.mFilename, mSegmentRecords, Error ) )
+		return false;
+
+	mNextSequence++;
+	mSegment = Segment;
+	std::lock_guard<std::mutex> Lock( mSegmentsLock );
+	mSegments.PushBack( Info );
+	return true;
+}
+
+void TPokeyEventStore::ApplyRetention()
+{
+	auto NowUs = GetWallTimeUs( Soy::GetMonotonicNs() );
+
+	std::lock_guard<std::mutex> Lock( mSegmentsLock );
+
+	//	never the current segment, it's the last
+	while ( mSegments.GetSize() > 1 )
+	{
+		auto& Oldest = mSegments[0];
+		bool TooMany = ( mMaxSegments != 0 && mSegments.GetSize() > mMaxSegments );
+		bool TooOld = ( mRetentionSecs != 0 && Oldest.mCount > 0 && Oldest.mMaxTimeUs + mRetentionSecs * 1000000 < NowUs );
+		if ( !TooMany && !TooOld )
+			break;
+
+		//	queries that already have it mapped keep reading the unlinked file
+		std::Debug << "event store deleting " << Oldest.mFilename << ( TooOld ? " (past retention)" : " (too many segments)" ) << std::endl;
+#if !defined(TARGET_WINDOWS)
+		unlink( Oldest.mFilename.c_str() );
+#endif
+		mSegments.RemoveBlock( 0, 1 );
+	}
+}
+
+bool TPokeyEventStore::Query(const TPokeyEventQuery& Query,TPokeyEventQueryResult& Result,std::stringstream& Error)
+{
+	Array<TSegmentInfo> Segments;
+	{
+		std::lock_guard<std::mutex> Lock( mSegmentsLock );
+		Segments.Copy( mSegments );
+	}
+
+	for ( int i=0;	i<Segments.GetSize();	i++ )
+	{
+		auto& Info = Segments[i];
+		if ( Info.mCount == 0 || Info.mMaxTimeUs < Query.mFromUs || Info.mMinTimeUs > Query.mToUs )
+		{
+			Result.mSegmentsSkipped++;
+			continue;
+		}
+
+		TPokeyEventSegment Segment;
+		std::stringstream SegmentError;
+		if ( !Segment.Open( Info.mFilename, SegmentError ) )
+		{
+			//	deleted by retention since we copied the list
+			std::Debug << "event query skipping " << SegmentError.str() << std::endl;
+			continue;
+		}
+		Segment.Query( Query, Result );
+	}
+	return true;
+}
+
+void TPokeyEventStore::GetStatus(std::ostream& Status)
+{
+	size_t SegmentCount;
+	{
+		std::lock_guard<std::mutex> Lock( mSegmentsLock );
+		SegmentCount = mSegments.GetSize();
+	}
+	Status << "event store " << mDirectory << "; " << SegmentCount << " segments, " << mWrittenCount << " events written, " << mDroppedCount << " dropped";
+}
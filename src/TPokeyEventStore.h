@@ -0,0 +1,207 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <TJob.h>
+#include <unordered_map>
+
+
+class TPokeyMeta;
+
+
+namespace TPokeyEventType
+{
+	enum Type : uint8
+	{
+		Up		= 0,
+		Down	= 1,
+	};
+}
+
+
+//	one pin edge. Fixed size so segments can be mapped and indexed directly. Written in host byte order
+class TPokeyEventRecord
+{
+public:
+	uint64			mTimeUs;		//	wall clock, microseconds since 1970
+	int32_t			mSerial;
+	int16_t			mX;				//	grid cell the pin was mapped to at the time
+	int16_t			mY;
+	uint8			mPin;
+	uint8			mType;			//	TPokeyEventType
+	uint8			mPadding[6];
+};
+static_assert( sizeof(TPokeyEventRecord) == 24, "TPokeyEventRecord must stay packed, it's the file format" );
+
+
+//	min and max time of each IndexStride records; records are only roughly in time order as they
+//	come from every channel's thread, so blocks keep both ends rather than assuming sorted
+class TPokeyEventBlockIndex
+{
+public:
+	uint64			mMinTimeUs;
+	uint64			mMaxTimeUs;
+};
+
+
+//	segment file: header, cell bitmap, block index, then records from RecordsOffset
+class TPokeyEventSegmentHeader
+{
+public:
+	static const char	Magic[8];
+	static const uint32	CurrentVersion = 1;
+	static const uint32	IndexStride = 1024;
+	static const uint32	CellBitmapBits = 4096;	//	cells hashed into this; a set bit means maybe
+
+public:
+	char			mMagic[8];
+	uint32			mVersion;
+	uint32			mRecordSize;
+	uint64			mCapacity;		//	records
+	uint64			mCount;			//	records written, only ever grows. Readers trust records below this
+	uint64			mMinTimeUs;
+	uint64			mMaxTimeUs;
+	uint64			mRecordsOffset;
+	uint64			mReserved;
+};
+static_assert( sizeof(TPokeyEventSegmentHeader) == 64, "TPokeyEventSegmentHeader must stay packed, it's the file format" );
+
+
+class TPokeyEventQuery
+{
+public:
+	TPokeyEventQuery();
+
+	bool			Read(const TJobParams& Params,uint64 NowUs,std::stringstream& Error);
+	bool			HasCellFilter() const	{	return mMin.x <= mMax.x;	}
+	bool			Match(const TPokeyEventRecord& Record) const;
+
+public:
+	uint64			mFromUs;
+	uint64			mToUs;			//	inclusive
+	vec2x<int>		mMin;			//	inclusive cell region, min > max for any cell
+	vec2x<int>		mMax;
+	int				mSerial;		//	-1 for any
+	int				mType;			//	TPokeyEventType, -1 for either
+	size_t			mLimit;			//	records returned; counts keep going
+};
+
+class TPokeyEventQueryResult
+{
+public:
+	TPokeyEventQueryResult() :
+		mDownCount			( 0 ),
+		mUpCount			( 0 ),
+		mSegmentsScanned	( 0 ),
+		mSegmentsSkipped	( 0 ),
+		mBlocksScanned		( 0 )
+	{
+	}
+
+	void			WriteJson(std::ostream& Output,bool IncludeRecords) const;
+
+public:
+	Array<TPokeyEventRecord>	mRecords;
+	uint64			mDownCount;
+	uint64			mUpCount;
+	size_t			mSegmentsScanned;
+	size_t			mSegmentsSkipped;	//	by time range or cell bitmap
+	size_t			mBlocksScanned;
+};
+
+
+//	one mapped segment file, writable while it's the store's current segment
+class TPokeyEventSegment
+{
+public:
+	TPokeyEventSegment();
+	~TPokeyEventSegment();
+
+	bool			Create(const std::string& Filename,size_t Capacity,std::stringstream& Error);
+	bool			Open(const std::string& Filename,std::stringstream& Error);		//	read-only
+	void			Close();
+
+	bool			IsFull() const				{	return GetHeader().mCount >= GetHeader().mCapacity;	}
+	size_t			Append(const TPokeyEventRecord* Records,size_t Count);	//	returns how many fitted
+	void			Query(const TPokeyEventQuery& Query,TPokeyEventQueryResult& Result) const;
+	const TPokeyEventSegmentHeader&	GetHeader() const	{	return *reinterpret_cast<const TPokeyEventSegmentHeader*>( mData );	}
+
+	static size_t	GetCellBit(int x,int y);
+	static size_t	GetRecordsOffset(size_t Capacity);
+
+private:
+	bool			Map(int File,size_t Size,bool Writable,std::stringstream& Error);
+	TPokeyEventSegmentHeader&	GetMutableHeader()	{	return *reinterpret_cast<TPokeyEventSegmentHeader*>( mData );	}
+	const uint8*	GetCellBitmap() const	{	return mData + sizeof(TPokeyEventSegmentHeader);	}
+	const TPokeyEventBlockIndex*	GetBlockIndex() const	{	return reinterpret_cast<const TPokeyEventBlockIndex*>( GetCellBitmap() + TPokeyEventSegmentHeader::CellBitmapBits/8 );	}
+	const TPokeyEventRecord*	GetRecords() const	{	return reinterpret_cast<const TPokeyEventRecord*>( mData + GetHeader().mRecordsOffset );	}
+	bool			MayContainCells(const TPokeyEventQuery& Query) const;
+
+private:
+	uint8*			mData;
+	size_t			mSize;
+};
+
+
+//	append-only history of pin edges, for "how many presses on this cell last night" and rebuilding
+//	sessions. The poll path diffs pins and pushes edges into a ring; this thread drains the ring into
+//	the current mapped segment, rotates full segments and deletes ones past retention.
+//	Queries skip segments by time range and cell bitmap, then blocks by time index
+class TPokeyEventStore : public SoyWorkerThread
+{
+public:
+	static const size_t	RingSize = 64*1024;		//	drop rather than block the poll thread if we can't keep up
+
+public:
+	TPokeyEventStore();
+	virtual ~TPokeyEventStore();
+
+	bool			Open(const std::string& Directory,std::stringstream& Error);
+	void			OnSample(TPokeyMeta& Pokey,uint64 Pins,uint64 SampleTimeNs);	//	board's mStateLock held
+	bool			Query(const TPokeyEventQuery& Query,TPokeyEventQueryResult& Result,std::stringstream& Error);
+	uint64			GetWallTimeUs(uint64 MonotonicNs) const;
+
+	virtual bool	Iteration() override;
+	virtual std::chrono::milliseconds	GetSleepDuration()	{	return std::chrono::milliseconds(50);	}
+	void			GetStatus(std::ostream& Status);
+
+public:
+	size_t			mSegmentRecords;		//	records per segment file
+	size_t			mMaxSegments;			//	oldest deleted past this, 0 for no limit
+	uint64			mRetentionSecs;			//	segments whose newest event is older are deleted, 0 to keep
+
+private:
+	class TSegmentInfo
+	{
+	public:
+		uint32			mSequence;
+		std::string		mFilename;
+		uint64			mMinTimeUs;
+		uint64			mMaxTimeUs;
+		uint64			mCount;
+	};
+
+	void			Flush();
+	bool			Rotate(std::stringstream& Error);
+	void			ApplyRetention();
+	std::string		GetSegmentFilename(uint32 Sequence) const;
+
+private:
+	std::string		mDirectory;
+	uint64			mWallBaseUs;			//	wall clock at mMonotonicBaseNs
+	uint64			mMonotonicBaseNs;
+
+	std::mutex		mRingLock;
+	Array<TPokeyEventRecord>	mRing;
+	size_t			mRingHead;				//	next write
+	size_t			mRingTail;				//	next read
+	std::unordered_map<int,uint64>	mLastPins;	//	by serial, for edges
+	std::atomic<uint64>	mDroppedCount;
+
+	//	only the worker thread touches mSegment; queries go through mSegments
+	std::shared_ptr<TPokeyEventSegment>	mSegment;
+	std::mutex		mSegmentsLock;
+	Array<TSegmentInfo>	mSegments;			//	oldest first, the last is the one being written
+	uint32			mNextSequence;
+	std::atomic<uint64>	mWrittenCount;
+};
@@ -0,0 +1,266 @@
+#include "TPokeyFloorSnapshot.h"
+#include "PopPokey.h"
+#include <algorithm>
+
+
+namespace
+{
+	const int		MaxGridSize = 1024;		//	cells per axis; bigger is a typo in a gridmap
+	const size_t	MinKeyframeCompareBytes = 256;	//	deltas smaller than this are sent without encoding a keyframe to compare
+
+	void WriteVarint(std::string& Output,uint64 Value)
+	{
+		while ( Value >= 0x80 )
+		{
+			Output += static_cast<char>( (Value & 0x7f) | 0x80 );
+			Value >>= 7;
+		}
+		Output += static_cast<char>( Value );
+	}
+
+	void WriteSignedVarint(std::string& Output,sint64 Value)
+	{
+		WriteVarint( Output, (static_cast<uint64>(Value) << 1) ^ static_cast<uint64>(Value >> 63) );
+	}
+}
+
+
+TPokeyFloorSnapshot::TPokeyFloorSnapshot() :
+	mGridMin			( 0, 0 ),
+	mGridSize			( 0, 0 ),
+	mSeq				( 0 ),
+	mBaseSeq			( 0 ),
+	mDeltaBytes			( 0 ),
+	mKeyframeSeq		( 0 ),
+	mKeyframeCount		( 0 ),
+	mKeyframeReplies	( 0 ),
+	mDeltaReplies		( 0 ),
+	mOutsideBoards		( 0 )
+{
+}
+
+void TPokeyFloorSnapshot::OnSample(TPokeyMeta& Pokey,uint64 DownPins)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto& Board = mBoards[Pokey.mSerial];
+	if ( Board.mGridMapVersion != Pokey.mGridMapVersion )
+	{
+		//	lift this board's cells with the old map, then put them down with the new one
+		ApplyPins( Board, 0 );
+		Compile( Board, Pokey );
+	}
+	else if ( ((Board.mPins ^ DownPins) & Board.mMask) == 0 )
+	{
+		return;
+	}
+	ApplyPins( Board, DownPins );
+	PushDelta();
+}
+
+void TPokeyFloorSnapshot::Compile(TBoard& Board,TPokeyMeta& Pokey)
+{
+	Board.mGridMapVersion = Pokey.mGridMapVersion;
+	Board.mMask = 0;
+
+	auto& State = Pokey.GetState();
+	uint64 Mask = 0;
+	vec2x<int> Min;
+	vec2x<int> Max;
+	for ( auto Bits = State.mMappedPins;	Bits;	Bits &= Bits-1 )
+	{
+		auto p = TPokeyBoardState::GetLowestPin( Bits );
+		auto Coord = State.mCoord[p];
+		if ( Coord == TPokeyMeta::GridCoordLaserGate )
+			continue;
+		Min = Mask ? vec2x<int>( std::min( Min.x, Coord.x ), std::min( Min.y, Coord.y ) ) : Coord;
+		Max = Mask ? vec2x<int>( std::max( Max.x, Coord.x ), std::max( Max.y, Coord.y ) ) : Coord;
+		Board.mCoord[p] = Coord;
+		Mask |= 1ull << p;
+	}
+
+	//	a board that won't fit is left off the floor rather than making it silly big
+	if ( Mask && !Grow( Min, Max ) )
+	{
+		mOutsideBoards++;
+		Mask = 0;
+	}
+	Board.mMask = Mask;
+}
+
+bool TPokeyFloorSnapshot::Grow(vec2x<int> Min,vec2x<int> Max)
+{
+	Max = vec2x<int>( Max.x+1, Max.y+1 );
+	bool Inside = ( Min.x >= mGridMin.x && Min.y >= mGridMin.y && Max.x <= mGridMin.x + mGridSize.x && Max.y <= mGridMin.y + mGridSize.y );
+	if ( Inside )
+		return true;
+
+	//	only happens as boards are first mapped
+	if ( !mDownCounts.IsEmpty() )
+	{
+		Min = vec2x<int>( std::min( Min.x, mGridMin.x ), std::min( Min.y, mGridMin.y ) );
+		Max = vec2x<int>( std::max( Max.x, mGridMin.x + mGridSize.x ), std::max( Max.y, mGridMin.y + mGridSize.y ) );
+	}
+	vec2x<int> Size( Max.x - Min.x, Max.y - Min.y );
+	if ( Size.x > MaxGridSize || Size.y > MaxGridSize )
+		return false;
+
+	Array<uint16> DownCounts;
+	DownCounts.SetSize( Size.x * Size.y );
+	for ( int c=0;	c<DownCounts.GetSize();	c++ )
+		DownCounts[c] = 0;
+	for ( int y=0;	y<mGridSize.y;	y++ )
+		for ( int x=0;	x<mGridSize.x;	x++ )
+			DownCounts[ (y + mGridMin.y - Min.y) * Size.x + (x + mGridMin.x - Min.x) ] = mDownCounts[ y * mGridSize.x + x ];
+	mDownCounts.Copy( DownCounts );
+	mGridMin = Min;
+	mGridSize = Size;
+
+	//	cell indexes have all moved, so no delta can follow on; everyone gets a keyframe
+	mToggled.Clear();
+	mDeltas.clear();
+	mDeltaBytes = 0;
+	mSeq++;
+	mBaseSeq = mSeq;
+	return true;
+}
+
+void TPokeyFloorSnapshot::ApplyPins(TBoard& Board,uint64 Pins)
+{
+	Pins &= Board.mMask;
+	auto Changed = Board.mPins ^ Pins;
+	for ( ;	Changed;	Changed &= Changed-1 )
+	{
+		auto p = TPokeyBoardState::GetLowestPin( Changed );
+		auto& Coord = Board.mCoord[p];
+		uint32 Cell = (Coord.y - mGridMin.y) * mGridSize.x + (Coord.x - mGridMin.x);
+		auto& DownCount = mDownCounts[Cell];
+		bool WasDown = ( DownCount > 0 );
+		if ( Pins & (1ull<<p) )
+			DownCount++;
+		else
+			DownCount--;
+		if ( WasDown != (DownCount > 0) )
+			mToggled.PushBack( Cell );
+	}
+	Board.mPins = Pins;
+}
+
+void TPokeyFloorSnapshot::PushDelta()
+{
+	if ( mToggled.IsEmpty() )
+		return;
+
+	//	a cell toggled twice in one sample (a gridmap change) hasn't changed
+	std::sort( mToggled.GetArray(), mToggled.GetArray() + mToggled.GetSize() );
+	BufferArray<uint32,128> Cells;	//	a remapped board can lift 64 and put down 64
+	for ( int i=0;	i<mToggled.GetSize();	)
+	{
+		int Same = 1;
+		while ( i+Same < mToggled.GetSize() && mToggled[i+Same] == mToggled[i] )
+			Same++;
+		if ( Same & 1 )
+			Cells.PushBack( mToggled[i] );
+		i += Same;
+	}
+	mToggled.Clear(false);
+	if ( Cells.IsEmpty() )
+		return;
+
+	mSeq++;
+	std::string Delta;
+	Delta += TPokeyFloorSnapshotFrame::Delta;
+	WriteVarint( Delta, mSeq );
+	WriteVarint( Delta, Cells.GetSize() );
+	uint32 Previous = 0;
+	for ( int i=0;	i<Cells.GetSize();	i++ )
+	{
+		WriteVarint( Delta, Cells[i] - Previous );
+		Previous = Cells[i];
+	}
+
+	mDeltaBytes += Delta.length();
+	mDeltas.push_back( std::make_shared<const std::string>( Delta ) );
+	while ( mDeltas.size() > MaxDeltas )
+	{
+		mDeltaBytes -= mDeltas.front()->length();
+		mDeltas.pop_front();
+		mBaseSeq++;
+	}
+}
+
+std::shared_ptr<const std::string> TPokeyFloorSnapshot::GetKeyframe()
+{
+	if ( mKeyframe && mKeyframeSeq == mSeq )
+		return mKeyframe;
+
+	//	runs, so an empty floor is a handful of bytes however big it is
+	std::string Keyframe;
+	Keyframe += TPokeyFloorSnapshotFrame::Keyframe;
+	WriteVarint( Keyframe, mSeq );
+	WriteSignedVarint( Keyframe, mGridMin.x );
+	WriteSignedVarint( Keyframe, mGridMin.y );
+	WriteVarint( Keyframe, mGridSize.x );
+	WriteVarint( Keyframe, mGridSize.y );
+	bool Down = false;
+	uint64 Run = 0;
+	for ( int c=0;	c<mDownCounts.GetSize();	c++ )
+	{
+		if ( (mDownCounts[c] > 0) != Down )
+		{
+			WriteVarint( Keyframe, Run );
+			Down = !Down;
+			Run = 0;
+		}
+		Run++;
+	}
+	WriteVarint( Keyframe, Run );
+
+	mKeyframe = std::make_shared<const std::string>( Keyframe );
+	mKeyframeSeq = mSeq;
+	mKeyframeCount++;
+	return mKeyframe;
+}
+
+uint64 TPokeyFloorSnapshot::GetFrames(sint64 SinceSeq,ArrayBridge<std::shared_ptr<const std::string>>&& Frames)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( SinceSeq >= 0 && static_cast<uint64>(SinceSeq) == mSeq )
+		return mSeq;
+
+	bool Deltas = ( SinceSeq >= 0 && static_cast<uint64>(SinceSeq) >= mBaseSeq && static_cast<uint64>(SinceSeq) < mSeq );
+	size_t First = Deltas ? static_cast<size_t>( SinceSeq - mBaseSeq ) : 0;
+	if ( Deltas )
+	{
+		//	a long way behind can be more bytes than starting again
+		size_t Bytes = mDeltaBytes;
+		for ( size_t i=0;	i<First;	i++ )
+			Bytes -= mDeltas[i]->length();
+		if ( Bytes > MinKeyframeCompareBytes && Bytes > GetKeyframe()->length() )
+			Deltas = false;
+	}
+
+	if ( !Deltas )
+	{
+		mKeyframeReplies++;
+		Frames.PushBack( GetKeyframe() );
+		return mSeq;
+	}
+
+	mDeltaReplies++;
+	for ( auto i=First;	i<mDeltas.size();	i++ )
+		Frames.PushBack( mDeltas[i] );
+	return mSeq;
+}
+
+void TPokeyFloorSnapshot::GetStatus(std::ostream& Status)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	Status << "floor snapshot " << mGridSize.x << "x" << mGridSize.y << " seq " << mSeq << ", " << mDeltas.size() << " deltas ";
+	Status << "avg " << ( mDeltas.empty() ? 0 : mDeltaBytes / mDeltas.size() ) << " bytes, ";
+	Status << mKeyframeCount << " keyframes encoded" << ( mKeyframe ? " last " : "" );
+	if ( mKeyframe )
+		Status << mKeyframe->length() << " bytes";
+	Status << ", " << mDeltaReplies << " delta replies, " << mKeyframeReplies << " keyframe replies";
+	if ( mOutsideBoards )
+		Status << ", " << mOutsideBoards << " boards left off, wider than " << MaxGridSize << "x" << MaxGridSize;
+}
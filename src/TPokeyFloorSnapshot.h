@@ -0,0 +1,83 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+
+
+class TPokeyMeta;
+
+
+//	frames are binary, numbers are unsigned LEB128 varints, coords zigzagged
+//	keyframe:	'K' seq minx miny width height runs...		row-major cells, alternating up/down run lengths starting with up
+//	delta:		'D' seq count cell gap gap...				cells (y*width+x) that toggled, ascending
+namespace TPokeyFloorSnapshotFrame
+{
+	const char		Keyframe = 'K';
+	const char		Delta = 'D';
+}
+
+
+//	the whole floor as one bitmap with a sequence number that counts up every time a cell changes.
+//	Each change is kept as a pre-encoded delta of the cells that toggled, usually a few bytes, and
+//	clients ask for everything since the last seq they saw. Too old, or more delta bytes than a
+//	keyframe, and they get the keyframe instead. Frames are shared buffers, encoded once however many
+//	clients read them; the keyframe only when someone asks for it
+class TPokeyFloorSnapshot
+{
+public:
+	static const size_t	MaxDeltas = 4096;		//	seqs a client can fall behind before it needs a keyframe
+
+public:
+	TPokeyFloorSnapshot();
+
+	void			OnSample(TPokeyMeta& Pokey,uint64 DownPins);	//	ignored pins already removed
+	uint64			GetFrames(sint64 SinceSeq,ArrayBridge<std::shared_ptr<const std::string>>&& Frames);	//	<0 for a keyframe; returns the current seq
+	void			GetStatus(std::ostream& Status);
+
+private:
+	class TBoard
+	{
+	public:
+		TBoard() :
+			mGridMapVersion	( ~0u ),
+			mPins			( 0 ),
+			mMask			( 0 )
+		{
+		}
+
+	public:
+		uint32			mGridMapVersion;
+		uint64			mPins;			//	down, as applied to the cells
+		uint64			mMask;			//	pins with a cell
+		vec2x<int>		mCoord[64];
+	};
+
+	void			Compile(TBoard& Board,TPokeyMeta& Pokey);
+	bool			Grow(vec2x<int> Min,vec2x<int> Max);	//	inclusive; false if it would make the floor silly big
+	void			ApplyPins(TBoard& Board,uint64 Pins);
+	void			PushDelta();
+	std::shared_ptr<const std::string>	GetKeyframe();
+
+private:
+	std::mutex		mLock;			//	samples come from every channel's thread
+	std::unordered_map<int,TBoard>	mBoards;	//	by serial
+	vec2x<int>		mGridMin;
+	vec2x<int>		mGridSize;		//	cells, 0 until something's mapped
+	Array<uint16>	mDownCounts;	//	boards can share a cell, it's down if any are
+	Array<uint32>	mToggled;		//	cells changed by this sample
+
+	uint64			mSeq;
+	uint64			mBaseSeq;		//	oldest seq the deltas follow on from
+	std::deque<std::shared_ptr<const std::string>>	mDeltas;	//	seqs mBaseSeq+1 to mSeq
+	size_t			mDeltaBytes;
+	std::shared_ptr<const std::string>	mKeyframe;
+	uint64			mKeyframeSeq;
+
+	uint64			mKeyframeCount;	//	encoded
+	uint64			mKeyframeReplies;
+	uint64			mDeltaReplies;
+	uint64			mOutsideBoards;	//	mapped too far away to fit
+};
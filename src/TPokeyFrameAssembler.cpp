@@ -0,0 +1,159 @@
+#include "TPokeyFrameAssembler.h"
+#include "TProtocolPokey.h"
+
+
+void TPokeyFloorFrame::GetDown(ArrayBridge<vec2x<int>>&& Down) const
+{
+	for ( int b=0;	b<mBoards.GetSize();	b++ )
+	{
+		auto& Board = mBoards[b];
+		for ( int d=0;	d<Board.mDown.GetSize();	d++ )
+			Down.PushBack( Board.mDown[d] );
+	}
+}
+
+bool TPokeyFloorFrame::IsLaserGateDown() const
+{
+	for ( int b=0;	b<mBoards.GetSize();	b++ )
+	{
+		if ( mBoards[b].mLaserGate )
+			return true;
+	}
+	return false;
+}
+
+void TPokeyFloorFrame::WriteJson(std::ostream& Output) const
+{
+	Output << "{";
+	Output << "\"frame\":" << mFrameNumber << ",";
+	Output << "\"time_ns\":" << mTimeNs << ",";
+	Output << "\"complete\":" << (mComplete ? "true" : "false") << ",";
+	Output << "\"lasergate\":" << (IsLaserGateDown() ? "true" : "false") << ",";
+	Output << "\"boards\":[";
+	for ( int b=0;	b<mBoards.GetSize();	b++ )
+	{
+		auto& Board = mBoards[b];
+		if ( b > 0 )
+			Output << ",";
+		Output << "{\"serial\":" << Board.mSerial << ",";
+		Output << "\"age_us\":" << (mSampleAgeNs[b] / 1000) << ",";
+		Output << "\"pins\":\"" << std::hex << Board.mPins << std::dec << "\"}";
+	}
+	Output << "],\"down\":[";
+	BufferArray<vec2x<int>,1000> Down;
+	GetDown( GetArrayBridge(Down) );
+	for ( int d=0;	d<Down.GetSize();	d++ )
+	{
+		if ( d > 0 )
+			Output << ",";
+		Output << "[" << Down[d].x << "," << Down[d].y << "]";
+	}
+	Output << "]}";
+}
+
+
+
+TPokeyFrameAssembler::TPokeyFrameAssembler() :
+	mActiveTimeoutNs	( 500 * 1000000ull ),
+	mDeadlineNs			( 30 * 1000000ull ),
+	mLastFrameNs		( 0 ),
+	mFrameNumber		( 0 ),
+	mBackBuffer			( 0 ),
+	mReadyBuffer		( 1 ),
+	mFrontBuffer		( 2 )
+{
+}
+
+void TPokeyFrameAssembler::OnSample(const TPokeyBoardSample& Sample)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+
+	auto* Latest = mLatest.Find( Sample.mSerial );
+	if ( !Latest )
+	{
+		Latest = &mLatest.PushBack();
+		mReported.PushBack( false );
+	}
+	auto Index = Latest - mLatest.GetArray();
+	*Latest = Sample;
+	mReported[Index] = true;
+
+	auto NowNs = Soy::GetMonotonicNs();
+	if ( HaveAllActiveReported( NowNs ) )
+		EmitFrame( NowNs, true );
+}
+
+void TPokeyFrameAssembler::Update(uint64 NowNs)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+
+	if ( NowNs < mLastFrameNs + mDeadlineNs )
+		return;
+
+	//	nothing new, don't repeat the last frame
+	bool AnyReported = false;
+	for ( int i=0;	i<mReported.GetSize();	i++ )
+		AnyReported |= mReported[i];
+	if ( !AnyReported )
+		return;
+
+	EmitFrame( NowNs, false );
+}
+
+bool TPokeyFrameAssembler::HaveAllActiveReported(uint64 NowNs) const
+{
+	for ( int i=0;	i<mLatest.GetSize();	i++ )
+	{
+		if ( mReported[i] )
+			continue;
+
+		//	don't hold the floor up waiting for a board that's gone quiet
+		auto& Sample = mLatest[i];
+		if ( NowNs > Sample.mSampleTimeNs + mActiveTimeoutNs )
+			continue;
+
+		return false;
+	}
+	return true;
+}
+
+void TPokeyFrameAssembler::EmitFrame(uint64 NowNs,bool Complete)
+{
+	auto& Frame = mFrames[mBackBuffer];
+	Frame.mFrameNumber = ++mFrameNumber;
+	Frame.mTimeNs = NowNs;
+	Frame.mComplete = Complete;
+	Frame.mBoards.Copy( mLatest );
+	Frame.mSampleAgeNs.SetSize( mLatest.GetSize() );
+	for ( int i=0;	i<mLatest.GetSize();	i++ )
+	{
+		auto SampleTimeNs = mLatest[i].mSampleTimeNs;
+		Frame.mSampleAgeNs[i] = ( NowNs > SampleTimeNs ) ? (NowNs - SampleTimeNs) : 0;
+		mReported[i] = false;
+	}
+	mLastFrameNs = NowNs;
+
+	mOnFrame.OnTriggered( Frame );
+
+	//	publish, and take back whichever buffer was waiting (if the reader hasn't taken it, it's stale)
+	auto OldReady = mReadyBuffer.exchange( mBackBuffer | FrameReadyFlag );
+	mBackBuffer = OldReady & ~FrameReadyFlag;
+}
+
+bool TPokeyFrameAssembler::GetLatestFrame(TPokeyFloorFrame& Frame)
+{
+	std::lock_guard<std::mutex> Lock( mReaderLock );
+
+	if ( mReadyBuffer.load() & FrameReadyFlag )
+	{
+		auto Ready = mReadyBuffer.exchange( mFrontBuffer );
+		mFrontBuffer = Ready & ~FrameReadyFlag;
+	}
+
+	auto& Front = mFrames[mFrontBuffer];
+	if ( !Front.IsValid() )
+		return false;
+
+	Frame = Front;
+	return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+
+
+//	latest pin state from one pokey
+class TPokeyBoardSample
+{
+public:
+	TPokeyBoardSample() :
+		mSerial			( -1 ),
+		mPins			( 0 ),
+		mSampleTimeNs	( 0 ),
+		mLaserGate		( false )
+	{
+	}
+
+	inline bool		operator==(const int Serial) const	{	return mSerial == Serial;	}
+
+public:
+	int							mSerial;
+	uint64						mPins;			//	bit per pin, as reported
+	uint64						mSampleTimeNs;	//	monotonic time the reply was decoded
+	BufferArray<vec2x<int>,64>	mDown;			//	grid coords of pins down, ignored/stuck pins removed
+	bool						mLaserGate;		//	a lasergate pin is down
+};
+
+
+//	every board's latest sample at one point in time
+class TPokeyFloorFrame
+{
+public:
+	TPokeyFloorFrame() :
+		mFrameNumber	( 0 ),
+		mTimeNs			( 0 ),
+		mComplete		( false )
+	{
+	}
+
+	bool			IsValid() const	{	return mFrameNumber != 0;	}
+	void			GetDown(ArrayBridge<vec2x<int>>&& Down) const;
+	bool			IsLaserGateDown() const;
+	void			WriteJson(std::ostream& Output) const;
+
+public:
+	uint64					mFrameNumber;
+	uint64					mTimeNs;		//	monotonic time the frame was assembled
+	bool					mComplete;		//	every active board reported, rather than hitting the deadline
+	Array<TPokeyBoardSample>	mBoards;	//	in the order boards first reported
+	Array<uint64>			mSampleAgeNs;	//	per board, how old its sample was when the frame was made
+};
+
+
+//	collects per-board samples into whole-floor frames, emitted when every active board has reported
+//	since the last frame or at a deadline. Frames are triple buffered so the reader swaps in the latest
+//	frame without ever waiting on the writer
+class TPokeyFrameAssembler
+{
+public:
+	TPokeyFrameAssembler();
+
+	void			OnSample(const TPokeyBoardSample& Sample);
+	void			Update(uint64 NowNs);				//	emit a frame if the deadline has passed
+	bool			GetLatestFrame(TPokeyFloorFrame& Frame);	//	false if there has never been a frame
+
+	void			SetDeadlineMs(int DeadlineMs)	{	mDeadlineNs = static_cast<uint64>(DeadlineMs) * 1000000;	}
+
+public:
+	SoyEvent<const TPokeyFloorFrame>	mOnFrame;		//	called on the assembling thread before the frame is published
+	uint64			mActiveTimeoutNs;					//	boards silent this long aren't waited for
+
+private:
+	void			EmitFrame(uint64 NowNs,bool Complete);
+	bool			HaveAllActiveReported(uint64 NowNs) const;
+
+private:
+	std::mutex				mLock;					//	samples arrive from every channel's thread
+	Array<TPokeyBoardSample>	mLatest;
+	Array<bool>				mReported;				//	since the last frame
+	uint64					mDeadlineNs;
+	uint64					mLastFrameNs;
+	uint64					mFrameNumber;
+
+	//	triple buffer; writer owns mBackBuffer, reader owns mFrontBuffer, mReadyBuffer is the latest
+	//	published with FrameReadyFlag set until the reader takes it
+	static const int		FrameReadyFlag = 4;
+	TPokeyFloorFrame		mFrames[3];
+	int						mBackBuffer;
+	std::atomic<int>		mReadyBuffer;
+	std::mutex				mReaderLock;			//	only between readers
+	int						mFrontBuffer;
+};
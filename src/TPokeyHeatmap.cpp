@@ -0,0 +1,358 @@
+#include "TPokeyHeatmap.h"
+#include <cmath>
+
+
+namespace
+{
+	const int		MaxGridSize = 1024;		//	cells per axis; bigger is a typo in a gridmap
+	const float		ColdHeat = 0.01f;		//	below this a cell's drawn black and stops being repainted
+
+	class TRgb
+	{
+	public:
+		TRgb(uint8 r,uint8 g,uint8 b) :	r(r), g(g), b(b)	{}
+
+	public:
+		uint8	r;
+		uint8	g;
+		uint8	b;
+	};
+
+	//	black, red, yellow, white
+	TRgb GetRampColour(float Value)
+	{
+		Value = std::max( 0.f, std::min( 1.f, Value ) );
+		auto Channel = [Value](float Offset)
+		{
+			return static_cast<uint8>( 255.f * std::max( 0.f, std::min( 1.f, Value * 3.f - Offset ) ) );
+		};
+		return TRgb( Channel(0), Channel(1), Channel(2) );
+	}
+}
+
+
+const char* TPokeyHeatmapLayer::ToString(Type Layer)
+{
+	switch ( Layer )
+	{
+		case Occupancy:	return "occupancy";
+		case Heat:		return "heat";
+		case Presses:	return "presses";
+		case Overlay:	return "overlay";
+		default:		return "unknown";
+	}
+}
+
+TPokeyHeatmapLayer::Type TPokeyHeatmapLayer::FromString(const std::string& Layer)
+{
+	for ( int l=0;	l<Count;	l++ )
+		if ( Layer == ToString( static_cast<Type>(l) ) )
+			return static_cast<Type>(l);
+	return Count;
+}
+
+
+float TPokeyHeatmap::TCell::GetHeat(uint64 NowNs,float HalfLifeSecs) const
+{
+	if ( mHeat <= 0 || NowNs <= mHeatTimeNs )
+		return mHeat;
+	auto AgeSecs = (NowNs - mHeatTimeNs) / 1000000000.f;
+	return mHeat * std::exp2( -AgeSecs / HalfLifeSecs );
+}
+
+
+TPokeyHeatmap::TPokeyHeatmap() :
+	mHeatHalfLifeSecs		( 10.f ),
+	mCellPixels				( 8 ),
+	mMinEncodeIntervalMs	( 250 ),
+	mGridMin				( 0, 0 ),
+	mGridSize				( 0, 0 ),
+	mResized				( false ),
+	mTotalPresses			( 0 ),
+	mImageSize				( 0, 0 ),
+	mImageMin				( 0, 0 ),
+	mEncodeCount			( 0 )
+{
+}
+
+void TPokeyHeatmap::OnSample(const TPokeyBoardSample& Sample,const ArrayBridge<vec2x<int>>& Mapped,const ArrayBridge<vec2x<int>>& Ignored)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto& Board = mBoards[Sample.mSerial];
+
+	//	the usual case; nothing moved on this board since its last sample
+	bool MappedChanged = ( Board.mMapped.GetSize() != Mapped.GetSize() );
+	for ( int i=0;	!MappedChanged && i<Mapped.GetSize();	i++ )
+		MappedChanged = !( Board.mMapped[i] == Mapped[i] );
+	if ( !MappedChanged && Board.mPins == Sample.mPins && Board.mIgnored.GetSize() == Ignored.GetSize() && Board.mDown.GetSize() == Sample.mDown.GetSize() )
+		return;
+
+	if ( MappedChanged )
+	{
+		DiffCells( GetArrayBridge(Board.mMapped), Mapped, [](TCell& Cell,int Change)	{	Cell.mMappedCount += Change;	} );
+		Board.mMapped.Copy( Mapped );
+	}
+
+	DiffCells( GetArrayBridge(Board.mIgnored), Ignored, [](TCell& Cell,int Change)	{	Cell.mIgnoredCount += Change;	} );
+	Board.mIgnored.Copy( Ignored );
+
+	auto SampleTimeNs = Sample.mSampleTimeNs;
+	auto HalfLifeSecs = mHeatHalfLifeSecs;
+	auto& TotalPresses = mTotalPresses;
+	DiffCells( GetArrayBridge(Board.mDown), GetArrayBridge(Sample.mDown), [SampleTimeNs,HalfLifeSecs,&TotalPresses](TCell& Cell,int Change)
+	{
+		Cell.mDownCount += Change;
+		if ( Change < 0 || Cell.mDownCount != 1 )
+			return;
+		Cell.mPresses++;
+		Cell.mHeat = Cell.GetHeat( SampleTimeNs, HalfLifeSecs ) + 1.f;
+		Cell.mHeatTimeNs = SampleTimeNs;
+		TotalPresses++;
+	} );
+	Board.mDown.Copy( Sample.mDown );
+	Board.mPins = Sample.mPins;
+}
+
+void TPokeyHeatmap::DiffCells(const ArrayBridge<vec2x<int>>& Old,const ArrayBridge<vec2x<int>>& New,std::function<void(TCell&,int)> Change)
+{
+	//	a board has a few dozen cells at most, so a linear search beats building a set
+	auto Contains = [](const ArrayBridge<vec2x<int>>& Array,vec2x<int> Coord)
+	{
+		for ( int i=0;	i<Array.GetSize();	i++ )
+			if ( Array[i] == Coord )
+				return true;
+		return false;
+	};
+
+	for ( int i=0;	i<Old.GetSize();	i++ )
+	{
+		if ( Contains( New, Old[i] ) )
+			continue;
+		auto* Cell = GetCell( Old[i] );
+		if ( !Cell )
+			continue;
+		Change( *Cell, -1 );
+		MarkDirty( Cell - mCells.GetArray() );
+	}
+
+	for ( int i=0;	i<New.GetSize();	i++ )
+	{
+		if ( Contains( Old, New[i] ) )
+			continue;
+		auto* Cell = GetCell( New[i] );
+		if ( !Cell )
+			continue;
+		Change( *Cell, 1 );
+		MarkDirty( Cell - mCells.GetArray() );
+	}
+}
+
+TPokeyHeatmap::TCell* TPokeyHeatmap::GetCell(vec2x<int> Coord)
+{
+	bool Inside = ( Coord.x >= mGridMin.x && Coord.y >= mGridMin.y && Coord.x < mGridMin.x + mGridSize.x && Coord.y < mGridMin.y + mGridSize.y );
+	if ( !Inside )
+	{
+		//	only happens as boards are first mapped
+		vec2x<int> Min( Coord.x, Coord.y );
+		vec2x<int> Max( Coord.x+1, Coord.y+1 );
+		if ( !mCells.IsEmpty() )
+		{
+			Min = vec2x<int>( std::min( Min.x, mGridMin.x ), std::min( Min.y, mGridMin.y ) );
+			Max = vec2x<int>( std::max( Max.x, mGridMin.x + mGridSize.x ), std::max( Max.y, mGridMin.y + mGridSize.y ) );
+		}
+		vec2x<int> Size( Max.x - Min.x, Max.y - Min.y );
+		if ( Size.x > MaxGridSize || Size.y > MaxGridSize )
+			return nullptr;
+
+		Array<TCell> Cells;
+		Cells.SetSize( Size.x * Size.y );
+		for ( int y=0;	y<mGridSize.y;	y++ )
+		{
+			for ( int x=0;	x<mGridSize.x;	x++ )
+			{
+				auto& Cell = Cells[ (y + mGridMin.y - Min.y) * Size.x + (x + mGridMin.x - Min.x) ];
+				Cell = mCells[ y * mGridSize.x + x ];
+				Cell.mDirty = false;
+			}
+		}
+		mCells.Copy( Cells );
+		mGridMin = Min;
+		mGridSize = Size;
+
+		//	indexes have all moved; the renderer repaints everything instead
+		mDirtyCells.Clear();
+		mResized = true;
+	}
+
+	return &mCells[ (Coord.y - mGridMin.y) * mGridSize.x + (Coord.x - mGridMin.x) ];
+}
+
+void TPokeyHeatmap::MarkDirty(size_t CellIndex)
+{
+	if ( mResized )
+		return;
+	auto& Cell = mCells[CellIndex];
+	if ( Cell.mDirty )
+		return;
+	Cell.mDirty = true;
+	mDirtyCells.PushBack( CellIndex );
+}
+
+std::shared_ptr<const Array<char>> TPokeyHeatmap::GetPng(TPokeyHeatmapLayer::Type Layer,uint64 NowNs)
+{
+	std::lock_guard<std::mutex> Lock( mRenderLock );
+	auto& Image = mLayers[Layer];
+
+	auto MinIntervalNs = static_cast<uint64>( std::max( 0, mMinEncodeIntervalMs ) ) * 1000000;
+	if ( Image.mPng && NowNs < Image.mEncodeTimeNs + MinIntervalNs )
+		return Image.mPng;
+
+	PaintDirty( NowNs );
+	if ( mImageSize.x == 0 || mImageSize.y == 0 )
+		return nullptr;
+
+	if ( Image.mPng && !Image.mChanged )
+	{
+		Image.mEncodeTimeNs = NowNs;
+		return Image.mPng;
+	}
+
+	std::shared_ptr<Array<char>> Png( new Array<char>() );
+	if ( !Image.mPixels.GetPng( GetArrayBridge(*Png) ) )
+	{
+		std::Debug << "heatmap: failed to encode " << TPokeyHeatmapLayer::ToString(Layer) << " png" << std::endl;
+		return Image.mPng;
+	}
+	Image.mPng = Png;
+	Image.mChanged = false;
+	Image.mEncodeTimeNs = NowNs;
+	mEncodeCount++;
+	return Image.mPng;
+}
+
+void TPokeyHeatmap::PaintDirty(uint64 NowNs)
+{
+	//	copy out what changed and let the poll path carry on while we paint
+	bool Resized = false;
+	Array<size_t> DirtyIndexes;
+	Array<TCell> DirtyCells;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( mResized )
+		{
+			Resized = true;
+			mImageMin = mGridMin;
+			mImageSize = mGridSize;
+			mImageCells.Copy( mCells );
+			mResized = false;
+		}
+		else
+		{
+			for ( int i=0;	i<mDirtyCells.GetSize();	i++ )
+			{
+				auto Index = mDirtyCells[i];
+				mCells[Index].mDirty = false;
+				DirtyIndexes.PushBack( Index );
+				DirtyCells.PushBack( mCells[Index] );
+			}
+		}
+		mDirtyCells.Clear();
+	}
+
+	if ( Resized )
+	{
+		auto CellPixels = std::max( 1, mCellPixels );
+		for ( int l=0;	l<TPokeyHeatmapLayer::Count;	l++ )
+		{
+			mLayers[l].mPixels.Init( mImageSize.x * CellPixels, mImageSize.y * CellPixels, SoyPixelsFormat::RGB );
+			mLayers[l].mChanged = true;
+		}
+		mWarmCells.Clear();
+		for ( int i=0;	i<mImageCells.GetSize();	i++ )
+		{
+			mImageCells[i].mWarm = false;
+			PaintCell( i, mImageCells[i], NowNs );
+		}
+		return;
+	}
+
+	for ( int i=0;	i<DirtyIndexes.GetSize();	i++ )
+	{
+		auto Index = DirtyIndexes[i];
+		auto Warm = mImageCells[Index].mWarm;
+		mImageCells[Index] = DirtyCells[i];
+		mImageCells[Index].mWarm = Warm;
+		PaintCell( Index, mImageCells[Index], NowNs );
+	}
+
+	//	fading cells change every time, but it's only the ones pressed in the last few half lives
+	for ( int i=mWarmCells.GetSize()-1;	i>=0;	i-- )
+	{
+		auto Index = mWarmCells[i];
+		PaintCell( Index, mImageCells[Index], NowNs, true );
+	}
+}
+
+void TPokeyHeatmap::PaintCell(size_t CellIndex,const TCell& Cell,uint64 NowNs,bool HeatOnly)
+{
+	auto Heat = Cell.GetHeat( NowNs, mHeatHalfLifeSecs );
+	bool Warm = ( Heat >= ColdHeat );
+	if ( Warm != mImageCells[CellIndex].mWarm )
+	{
+		mImageCells[CellIndex].mWarm = Warm;
+		if ( Warm )
+			mWarmCells.PushBack( CellIndex );
+		else
+			for ( int i=mWarmCells.GetSize()-1;	i>=0;	i-- )
+				if ( mWarmCells[i] == CellIndex )
+					mWarmCells.RemoveBlock( i, 1 );
+	}
+
+	bool Mapped = ( Cell.mMappedCount > 0 );
+	bool Ignored = ( Cell.mIgnoredCount > 0 );
+	bool Down = ( Cell.mDownCount > 0 );
+
+	TRgb Colours[TPokeyHeatmapLayer::Count] =
+	{
+		Ignored ? TRgb(96,0,0) : ( Down ? TRgb(255,255,255) : ( Mapped ? TRgb(40,40,40) : TRgb(0,0,0) ) ),
+		Warm ? GetRampColour( Heat / (Heat + 1.f) ) : TRgb(0,0,0),
+		( Mapped && Cell.mPresses == 0 ) ? TRgb(0,0,80) : GetRampColour( std::log2( Cell.mPresses + 1.f ) / 12.f ),
+		Ignored ? TRgb(255,0,0) : ( Down ? TRgb(0,255,0) : ( !Mapped ? TRgb(0,0,0) : ( Cell.mPresses == 0 ? TRgb(0,0,160) : TRgb(60,60,60) ) ) ),
+	};
+
+	auto CellPixels = std::max( 1, mCellPixels );
+	auto x = (CellIndex % mImageSize.x) * CellPixels;
+	auto y = (CellIndex / mImageSize.x) * CellPixels;
+	auto Stride = mImageSize.x * CellPixels * 3;
+	for ( int l=0;	l<TPokeyHeatmapLayer::Count;	l++ )
+	{
+		if ( HeatOnly && l != TPokeyHeatmapLayer::Heat )
+			continue;
+		auto&& Pixels = mLayers[l].mPixels.GetPixelsArray();
+		auto& Colour = Colours[l];
+		for ( int py=0;	py<CellPixels;	py++ )
+		{
+			auto Row = (y + py) * Stride + x * 3;
+			for ( int px=0;	px<CellPixels;	px++ )
+			{
+				Pixels[Row + px*3 + 0] = Colour.r;
+				Pixels[Row + px*3 + 1] = Colour.g;
+				Pixels[Row + px*3 + 2] = Colour.b;
+			}
+		}
+		mLayers[l].mChanged = true;
+	}
+}
+
+void TPokeyHeatmap::GetStatus(std::ostream& Status)
+{
+	vec2x<int> GridSize;
+	uint64 TotalPresses;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		GridSize = mGridSize;
+		TotalPresses = mTotalPresses;
+	}
+	std::lock_guard<std::mutex> Lock( mRenderLock );
+	Status << "heatmap " << GridSize.x << "x" << GridSize.y << " cells, " << TotalPresses << " presses, " << mWarmCells.GetSize() << " warm cells, " << mEncodeCount << " pngs encoded";
+}
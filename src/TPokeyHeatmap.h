@@ -0,0 +1,129 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <SoyPixels.h>
+#include <map>
+#include <functional>
+#include "TPokeyFrameAssembler.h"
+
+
+namespace TPokeyHeatmapLayer
+{
+	enum Type
+	{
+		Occupancy,		//	cells down now
+		Heat,			//	presses, decaying
+		Presses,		//	presses since startup, log scale. Dead tiles stay black
+		Overlay,		//	mapped, never pressed, and stuck/ignored cells
+
+		Count,
+	};
+
+	const char*		ToString(Type Layer);
+	Type			FromString(const std::string& Layer);		//	Count if unknown
+}
+
+
+//	per-cell press counters and heat, kept from sample edges on the poll path, and rendered to PNGs
+//	for dashboards. The poll path only touches cells that changed and queues them; viewers repaint
+//	just those cells and encode at most once per mMinEncodeIntervalMs, sharing the cached PNG
+class TPokeyHeatmap
+{
+public:
+	TPokeyHeatmap();
+
+	void			OnSample(const TPokeyBoardSample& Sample,const ArrayBridge<vec2x<int>>& Mapped,const ArrayBridge<vec2x<int>>& Ignored);
+
+	std::shared_ptr<const Array<char>>	GetPng(TPokeyHeatmapLayer::Type Layer,uint64 NowNs);	//	null if nothing's been mapped yet
+	void			GetStatus(std::ostream& Status);
+
+public:
+	float			mHeatHalfLifeSecs;
+	int				mCellPixels;				//	image pixels per cell, edge length
+	int				mMinEncodeIntervalMs;		//	viewers within this get the last PNG even if it changed
+
+private:
+	class TCell
+	{
+	public:
+		TCell() :
+			mPresses		( 0 ),
+			mHeat			( 0 ),
+			mHeatTimeNs		( 0 ),
+			mDownCount		( 0 ),
+			mMappedCount	( 0 ),
+			mIgnoredCount	( 0 ),
+			mDirty			( false ),
+			mWarm			( false )
+		{
+		}
+
+		float		GetHeat(uint64 NowNs,float HalfLifeSecs) const;
+
+	public:
+		uint32		mPresses;
+		float		mHeat;			//	as of mHeatTimeNs
+		uint64		mHeatTimeNs;
+		uint16		mDownCount;		//	boards can share a cell, so these are counts
+		uint16		mMappedCount;
+		uint16		mIgnoredCount;
+		bool		mDirty;			//	in mDirtyCells
+		bool		mWarm;			//	in mWarmCells, heat still fading
+	};
+
+	class TBoardState
+	{
+	public:
+		TBoardState() :
+			mPins	( 0 )
+		{
+		}
+
+	public:
+		uint64						mPins;
+		BufferArray<vec2x<int>,64>	mDown;
+		BufferArray<vec2x<int>,64>	mIgnored;
+		BufferArray<vec2x<int>,100>	mMapped;
+	};
+
+	class TLayerImage
+	{
+	public:
+		TLayerImage() :
+			mChanged		( true ),
+			mEncodeTimeNs	( 0 )
+		{
+		}
+
+	public:
+		SoyPixels			mPixels;
+		bool				mChanged;		//	pixels painted since mPng was encoded
+		uint64				mEncodeTimeNs;
+		std::shared_ptr<const Array<char>>	mPng;
+	};
+
+	TCell*			GetCell(vec2x<int> Coord);				//	grows the grid to fit
+	void			MarkDirty(size_t CellIndex);
+	void			DiffCells(const ArrayBridge<vec2x<int>>& Old,const ArrayBridge<vec2x<int>>& New,std::function<void(TCell&,int)> Change);
+	void			PaintDirty(uint64 NowNs);
+	void			PaintCell(size_t CellIndex,const TCell& Cell,uint64 NowNs,bool HeatOnly=false);
+
+private:
+	std::mutex					mLock;			//	cells; samples come from every channel's thread
+	vec2x<int>					mGridMin;
+	vec2x<int>					mGridSize;		//	cells, 0 until something's mapped
+	Array<TCell>				mCells;
+	Array<size_t>				mDirtyCells;
+	bool						mResized;		//	every pixel needs repainting
+	std::map<int,TBoardState>	mBoards;		//	by serial
+	uint64						mTotalPresses;
+
+	std::mutex					mRenderLock;	//	viewers queue here so one encode serves them all
+	vec2x<int>					mImageSize;		//	cells
+	vec2x<int>					mImageMin;
+	Array<TCell>				mImageCells;	//	as last painted
+	Array<size_t>				mWarmCells;		//	still fading, repainted every encode
+	TLayerImage					mLayers[TPokeyHeatmapLayer::Count];
+	uint64						mEncodeCount;
+};
@@ -0,0 +1,865 @@
+#include "TPokeyHttpServer.h"
+#include "PopPokey.h"
+#include <SoyString.h>
+#include <algorithm>
+
+#if !defined(TARGET_WINDOWS)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+namespace Http
+{
+	//	case-insensitive header value, empty if missing. Headers is everything after the request line
+	std::string		GetHeader(const std::string& Headers,const char* Name);
+	bool			ParseStatusAndLength(const std::string& Buffer,size_t HeaderEnd,int& Status,size_t& ContentLength);
+	std::string		GetQueryParam(const std::string& Target,const char* Name);	//	url decoded, empty if missing
+}
+
+
+std::string Http::GetHeader(const std::string& Headers,const char* Name)
+{
+	auto NameLength = strlen( Name );
+	size_t LineStart = 0;
+	while ( LineStart < Headers.length() )
+	{
+		auto LineEnd = Headers.find( "\r\n", LineStart );
+		if ( LineEnd == std::string::npos )
+			LineEnd = Headers.length();
+
+		auto Colon = Headers.find( ':', LineStart );
+		if ( Colon != std::string::npos && Colon < LineEnd && Colon - LineStart == NameLength )
+		{
+			bool Match = true;
+			for ( size_t i=0;	Match && i<NameLength;	i++ )
+				Match = ( tolower( Headers[LineStart+i] ) == Name[i] );
+			if ( Match )
+			{
+				auto ValueStart = Headers.find_first_not_of( " \t", Colon+1 );
+				if ( ValueStart == std::string::npos || ValueStart >= LineEnd )
+					return std::string();
+				return Headers.substr( ValueStart, LineEnd-ValueStart );
+			}
+		}
+		LineStart = LineEnd + 2;
+	}
+	return std::string();
+}
+
+bool Http::ParseStatusAndLength(const std::string& Buffer,size_t HeaderEnd,int& Status,size_t& ContentLength)
+{
+	//	HTTP/1.1 200 OK
+	auto StatusStart = Buffer.find( ' ' );
+	if ( StatusStart == std::string::npos || StatusStart > HeaderEnd )
+		return false;
+	Status = atoi( Buffer.c_str() + StatusStart + 1 );
+
+	auto Length = GetHeader( Buffer.substr( 0, HeaderEnd ), "content-length" );
+	ContentLength = Length.empty() ? 0 : static_cast<size_t>( atol( Length.c_str() ) );
+	return true;
+}
+
+
+std::string Http::GetQueryParam(const std::string& Target,const char* Name)
+{
+	auto QueryStart = Target.find('?');
+	if ( QueryStart == std::string::npos )
+		return std::string();
+
+	std::string Key = std::string(Name) + "=";
+	size_t ParamStart = QueryStart+1;
+	while ( ParamStart < Target.length() )
+	{
+		auto ParamEnd = Target.find( '&', ParamStart );
+		if ( ParamEnd == std::string::npos )
+			ParamEnd = Target.length();
+
+		if ( Target.compare( ParamStart, Key.length(), Key ) == 0 )
+		{
+			std::string Value;
+			for ( auto i=ParamStart+Key.length();	i<ParamEnd;	i++ )
+			{
+				if ( Target[i] == '+' )
+					Value += ' ';
+				else if ( Target[i] == '%' && i+2 < ParamEnd && isxdigit(Target[i+1]) && isxdigit(Target[i+2]) )
+				{
+					Value += static_cast<char>( strtol( Target.substr(i+1,2).c_str(), nullptr, 16 ) );
+					i += 2;
+				}
+				else
+					Value += Target[i];
+			}
+			return Value;
+		}
+		ParamStart = ParamEnd+1;
+	}
+	return std::string();
+}
+
+
+TPokeyHttpServer::TPokeyHttpServer(TPopPokey& App,int Port,int FallbackPort) :
+	SoyWorkerThread		( Soy::GetTypeName(*this), SoyWorkerWaitMode::NoWait ),
+	mListCacheMs		( 100 ),
+	mApp				( App ),
+	mPort				( Port ),
+	mFallbackPort		( FallbackPort ),
+	mListenSocket		( -1 ),
+	mWakeRead			( -1 ),
+	mWakeWrite			( -1 ),
+	mWakePending		( false ),
+	mSubscriptionConnectionsChanged	( false ),
+	mListReplyNs		( 0 ),
+	mAcceptCount		( 0 ),
+	mRequestCount		( 0 ),
+	mRedirectCount		( 0 ),
+	mBadRequestCount	( 0 ),
+	mConnectionCount	( 0 ),
+	mSubscriberCount	( 0 )
+{
+}
+
+TPokeyHttpServer::~TPokeyHttpServer()
+{
+	mApp.mSubscriptions.SetOnPending( nullptr );
+	Stop();
+	WaitToFinish();
+#if !defined(TARGET_WINDOWS)
+	for ( int i=0;	i<mConnections.GetSize();	i++ )
+		CloseConnection( mConnections[i] );
+	if ( mListenSocket != -1 )
+		close( mListenSocket );
+	if ( mWakeRead != -1 )
+		close( mWakeRead );
+	if ( mWakeWrite != -1 )
+		close( mWakeWrite );
+#endif
+}
+
+bool TPokeyHttpServer::Init(std::stringstream& Error)
+{
+#if defined(TARGET_WINDOWS)
+	Error << "fast http is not supported on windows";
+	return false;
+#else
+	mListenSocket = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( mListenSocket == -1 )
+	{
+		Error << "failed to create http socket errno " << errno;
+		return false;
+	}
+	int Enable = 1;
+	setsockopt( mListenSocket, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable) );
+
+	sockaddr_in Address;
+	memset( &Address, 0, sizeof(Address) );
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = htonl( INADDR_ANY );
+	Address.sin_port = htons( mPort );
+	if ( bind( mListenSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address) ) != 0 || listen( mListenSocket, 128 ) != 0 )
+	{
+		Error << "failed to listen for http on port " << mPort << " errno " << errno;
+		return false;
+	}
+	fcntl( mListenSocket, F_SETFL, O_NONBLOCK );
+
+	int WakePipe[2];
+	if ( pipe( WakePipe ) != 0 )
+	{
+		Error << "failed to create http wake pipe errno " << errno;
+		return false;
+	}
+	mWakeRead = WakePipe[0];
+	mWakeWrite = WakePipe[1];
+	fcntl( mWakeRead, F_SETFL, O_NONBLOCK );
+	fcntl( mWakeWrite, F_SETFL, O_NONBLOCK );
+
+	//	called on the sampling threads, so just poke the poll
+	mApp.mSubscriptions.SetOnPending( [this]
+	{
+		if ( mWakePending.exchange( true ) )
+			return;
+		char Byte = 0;
+		if ( write( mWakeWrite, &Byte, 1 ) < 0 )
+			mWakePending = false;
+	});
+
+	Start();
+	return true;
+#endif
+}
+
+bool TPokeyHttpServer::Iteration()
+{
+#if !defined(TARGET_WINDOWS)
+	TakeEvents();
+
+	//	closing with nothing left to flush asks poll for nothing, so nothing would ever reap them
+	for ( int i=mConnections.GetSize()-1;	i>=0;	i-- )
+	{
+		auto& Connection = mConnections[i];
+		if ( !Connection.mClosing || Connection.mSendOffset < Connection.mSendBuffer.length() )
+			continue;
+		CloseConnection( Connection );
+		mConnections.RemoveBlock( i, 1 );
+		mSubscriptionConnectionsChanged = true;
+	}
+	mConnectionCount = mConnections.GetSize();
+
+	Array<pollfd> Fds;
+	auto& ListenFd = Fds.PushBack();
+	ListenFd.fd = mListenSocket;
+	ListenFd.events = ( mConnections.GetSize() < MaxConnections ) ? POLLIN : 0;
+	ListenFd.revents = 0;
+	auto& WakeFd = Fds.PushBack();
+	WakeFd.fd = mWakeRead;
+	WakeFd.events = POLLIN;
+	WakeFd.revents = 0;
+	for ( int i=0;	i<mConnections.GetSize();	i++ )
+	{
+		auto& Connection = mConnections[i];
+		auto& Fd = Fds.PushBack();
+		Fd.fd = Connection.mSocket;
+		Fd.events = 0;
+		Fd.revents = 0;
+		//	a client that isn't reading its replies doesn't get to queue more
+		auto Pending = Connection.mSendBuffer.length() - Connection.mSendOffset;
+		if ( !Connection.mClosing && Pending < MaxSendBuffer )
+			Fd.events |= POLLIN;
+		if ( Pending > 0 )
+			Fd.events |= POLLOUT;
+	}
+
+	if ( poll( Fds.GetArray(), Fds.GetSize(), 100 ) <= 0 )
+		return true;
+
+	//	connections first, accepting changes the array
+	for ( int i=mConnections.GetSize()-1;	i>=0;	i-- )
+	{
+		auto& Connection = mConnections[i];
+		auto Events = Fds[i+2].revents;
+		if ( Events == 0 )
+			continue;
+
+		bool Keep = true;
+		if ( Events & (POLLIN|POLLHUP|POLLERR) )
+			Keep = OnRecv( Connection );
+		if ( Keep )
+			Keep = OnSend( Connection );
+		if ( Keep )
+			continue;
+
+		CloseConnection( Connection );
+		mConnections.RemoveBlock( i, 1 );
+		mSubscriptionConnectionsChanged = true;
+	}
+	mConnectionCount = mConnections.GetSize();
+
+	if ( Fds[1].revents & POLLIN )
+		OnWake();
+	if ( Fds[0].revents & POLLIN )
+		OnAccept();
+#endif
+	return true;
+}
+
+void TPokeyHttpServer::OnWake()
+{
+#if !defined(TARGET_WINDOWS)
+	//	events are collected at the top of the next iteration, before the poll that sends them
+	char Buffer[64];
+	mWakePending = false;
+	while ( read( mWakeRead, Buffer, sizeof(Buffer) ) > 0 )
+	{
+	}
+#endif
+}
+
+void TPokeyHttpServer::TakeEvents()
+{
+	//	only subscribers with events waiting. One whose buffer was full stays pending and won't be
+	//	listed again, so it's kept until there's room
+	Array<uint32> Pending;
+	Pending.Copy( mBlockedSubscriptions );
+	mBlockedSubscriptions.Clear(false);
+	mApp.mSubscriptions.TakePending( GetArrayBridge(Pending) );
+	if ( Pending.IsEmpty() )
+		return;
+
+	if ( mSubscriptionConnectionsChanged )
+	{
+		mSubscriptionConnections.clear();
+		for ( int i=0;	i<mConnections.GetSize();	i++ )
+			if ( mConnections[i].mSubscription )
+				mSubscriptionConnections[mConnections[i].mSubscription] = i;
+		mSubscriptionConnectionsChanged = false;
+	}
+
+	for ( int p=0;	p<Pending.GetSize();	p++ )
+	{
+		auto Id = Pending[p];
+		auto Index = mSubscriptionConnections.find( Id );
+		if ( Index == mSubscriptionConnections.end() )
+			continue;
+		auto& Connection = mConnections[Index->second];
+		if ( Connection.mSendBuffer.length() - Connection.mSendOffset >= MaxSendBuffer )
+		{
+			if ( mBlockedSubscriptions.Find( Id ) == nullptr )
+				mBlockedSubscriptions.PushBack( Id );
+			continue;
+		}
+		if ( !mApp.mSubscriptions.TakeEvents( Id, Connection.mSendBuffer ) )
+			Connection.mClosing = true;
+	}
+}
+
+void TPokeyHttpServer::CloseConnection(TConnection& Connection)
+{
+#if !defined(TARGET_WINDOWS)
+	if ( Connection.mSubscription )
+	{
+		mApp.mSubscriptions.Unsubscribe( Connection.mSubscription );
+		Connection.mSubscription = 0;
+		mSubscriberCount--;
+	}
+	close( Connection.mSocket );
+#endif
+}
+
+void TPokeyHttpServer::OnAccept()
+{
+#if !defined(TARGET_WINDOWS)
+	while ( mConnections.GetSize() < MaxConnections )
+	{
+		int Socket = accept( mListenSocket, nullptr, nullptr );
+		if ( Socket == -1 )
+			break;
+		fcntl( Socket, F_SETFL, O_NONBLOCK );
+		//	replies are tiny, don't let nagle hold them back waiting for an ack
+		int Enable = 1;
+		setsockopt( Socket, IPPROTO_TCP, TCP_NODELAY, &Enable, sizeof(Enable) );
+		auto& Connection = mConnections.PushBack();
+		Connection = TConnection();
+		Connection.mSocket = Socket;
+		mAcceptCount++;
+	}
+	mConnectionCount = mConnections.GetSize();
+#endif
+}
+
+bool TPokeyHttpServer::OnRecv(TConnection& Connection)
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	char Buffer[16*1024];
+	bool Finished = false;
+	while ( true )
+	{
+		auto Read = recv( Connection.mSocket, Buffer, sizeof(Buffer), 0 );
+		if ( Read == 0 )
+		{
+			//	they've stopped sending, not necessarily reading; answer what they sent before closing
+			Finished = true;
+			break;
+		}
+		if ( Read < 0 )
+		{
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				break;
+			return false;
+		}
+		Connection.mRecvBuffer.append( Buffer, Read );
+		if ( Read < static_cast<ssize_t>(sizeof(Buffer)) )
+			break;
+	}
+	if ( !HandleRequests( Connection ) )
+		return false;
+	if ( Finished )
+		Connection.mClosing = true;
+	return true;
+#endif
+}
+
+bool TPokeyHttpServer::OnSend(TConnection& Connection)
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	while ( Connection.mSendOffset < Connection.mSendBuffer.length() )
+	{
+		auto Sent = send( Connection.mSocket, Connection.mSendBuffer.c_str() + Connection.mSendOffset, Connection.mSendBuffer.length() - Connection.mSendOffset, MSG_NOSIGNAL );
+		if ( Sent < 0 )
+		{
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				return true;
+			return false;
+		}
+		Connection.mSendOffset += Sent;
+	}
+
+	//	all sent; reuse the buffer rather than shifting it every reply
+	Connection.mSendBuffer.clear();
+	Connection.mSendOffset = 0;
+	return !Connection.mClosing;
+#endif
+}
+
+bool TPokeyHttpServer::HandleRequests(TConnection& Connection)
+{
+	auto& Buffer = Connection.mRecvBuffer;
+	size_t RequestStart = 0;
+
+	//	every complete request in the buffer, in order, so pipelined requests get one write of replies.
+	//	Once a connection is streaming events, anything else it sends is ignored
+	while ( !Connection.mClosing && !Connection.mSubscription )
+	{
+		auto HeaderEnd = Buffer.find( "\r\n\r\n", RequestStart );
+		if ( HeaderEnd == std::string::npos )
+		{
+			if ( Buffer.length() - RequestStart > MaxRequestHeaderSize )
+			{
+				mBadRequestCount++;
+				Connection.mClosing = true;
+				AppendResponse( Connection, "431 Request Header Fields Too Large", std::string() );
+			}
+			break;
+		}
+
+		//	GET /PeekGridCoord HTTP/1.1
+		auto LineEnd = Buffer.find( "\r\n", RequestStart );
+		auto MethodEnd = Buffer.find( ' ', RequestStart );
+		auto TargetEnd = ( MethodEnd == std::string::npos ) ? std::string::npos : Buffer.find( ' ', MethodEnd+1 );
+		if ( TargetEnd == std::string::npos || TargetEnd > LineEnd )
+		{
+			mBadRequestCount++;
+			Connection.mClosing = true;
+			AppendResponse( Connection, "400 Bad Request", std::string() );
+			break;
+		}
+		auto Target = Buffer.substr( MethodEnd+1, TargetEnd-MethodEnd-1 );
+		auto Version = Buffer.substr( TargetEnd+1, LineEnd-TargetEnd-1 );
+		auto Headers = Buffer.substr( LineEnd+2, HeaderEnd-LineEnd );
+
+		//	bodies aren't used by any of our endpoints, but they have to be skipped to find the next request.
+		//	Anything big is refused rather than buffered
+		auto ContentLength = Http::GetHeader( Headers, "content-length" );
+		size_t BodyLength = 0;
+		if ( !ContentLength.empty() )
+		{
+			char* LengthEnd = nullptr;
+			errno = 0;
+			auto Length = strtoull( ContentLength.c_str(), &LengthEnd, 10 );
+			bool Valid = ( errno == 0 && LengthEnd != ContentLength.c_str() && strspn( LengthEnd, " \t" ) == strlen( LengthEnd ) && ContentLength[0] != '-' );
+			if ( !Valid || Length > MaxRequestBodySize )
+			{
+				mBadRequestCount++;
+				Connection.mClosing = true;
+				AppendResponse( Connection, Valid ? "413 Payload Too Large" : "400 Bad Request", std::string() );
+				break;
+			}
+			BodyLength = static_cast<size_t>( Length );
+		}
+		//	compared as what's left so a huge length can't wrap
+		auto BodyStart = HeaderEnd + 4;
+		if ( BodyLength > Buffer.length() - BodyStart )
+			break;
+		auto RequestEnd = BodyStart + BodyLength;
+
+		auto ConnectionHeader = Soy::StringToLowerCopy( Http::GetHeader( Headers, "connection" ) );
+		bool KeepAlive = ( Version == "HTTP/1.1" ) ? ( ConnectionHeader != "close" ) : ( ConnectionHeader == "keep-alive" );
+		if ( !KeepAlive )
+			Connection.mClosing = true;
+
+		mRequestCount++;
+		Respond( Connection, Target, Http::GetHeader( Headers, "host" ) );
+		RequestStart = RequestEnd;
+	}
+
+	if ( Connection.mSubscription )
+		Buffer.clear();
+	else
+		Buffer.erase( 0, RequestStart );
+	return true;
+}
+
+void TPokeyHttpServer::Respond(TConnection& Connection,const std::string& Target,const std::string& Host)
+{
+	//	/PeekGridCoord?anything
+	auto CommandStart = ( !Target.empty() && Target[0] == '/' ) ? 1 : 0;
+	auto CommandEnd = Target.find( '?' );
+	if ( CommandEnd == std::string::npos )
+		CommandEnd = Target.length();
+	auto Command = Soy::StringToLowerCopy( Target.substr( CommandStart, CommandEnd-CommandStart ) );
+
+	//	same text the jobs reply with
+	if ( Command == "list" )
+	{
+		AppendResponse( Connection, "200 OK", GetListReply() );
+		return;
+	}
+	if ( Command == "subscribe" )
+	{
+		Subscribe( Connection, Target );
+		return;
+	}
+	if ( Command == "floor" )
+	{
+		AppendFloorFrames( Connection, Target );
+		return;
+	}
+
+	std::stringstream Body;
+	if ( Command == "peekgridcoord" )
+		mApp.GetPeekGridCoord( Body );
+	else if ( Command == "popgridcoord" )
+		mApp.GetPopGridCoord( Body );
+	else if ( Command == "peeklasergate" )
+		mApp.GetPeekLaserGateState( Body );
+	else if ( Command == "poplasergate" )
+		mApp.GetPopLaserGateState( Body );
+	else if ( Command == "batch" )
+	{
+		std::stringstream Error;
+		auto Json = Http::GetQueryParam( Target, "format" ) == "json";
+		if ( !mApp.GetBatchReply( Http::GetQueryParam( Target, "commands" ), Json, Body, Error ) )
+		{
+			AppendResponse( Connection, "400 Bad Request", Error.str() );
+			return;
+		}
+	}
+	else
+	{
+		//	everything else is the generic channel's. Same host, its port
+		mRedirectCount++;
+		if ( Host.empty() || mFallbackPort <= 0 )
+		{
+			AppendResponse( Connection, "404 Not Found", "not served on this port\n" );
+			return;
+		}
+		auto HostName = Host.substr( 0, Host.rfind(':') );
+		if ( !HostName.empty() && HostName.back() != ']' && HostName.find(':') != std::string::npos )
+			HostName = Host;	//	bare ipv6, there was no port
+		std::stringstream Location;
+		Location << "Location: http://" << HostName << ":" << mFallbackPort << Target << "\r\n";
+		AppendResponse( Connection, "307 Temporary Redirect", std::string(), Location.str() );
+		return;
+	}
+	AppendResponse( Connection, "200 OK", Body.str() );
+}
+
+void TPokeyHttpServer::AppendResponse(TConnection& Connection,const char* Status,const std::string& Body,const std::string& ExtraHeaders,const char* ContentType)
+{
+	auto& Output = Connection.mSendBuffer;
+	Output += "HTTP/1.1 ";
+	Output += Status;
+	Output += "\r\nContent-Type: ";
+	Output += ContentType;
+	Output += "\r\nContent-Length: ";
+	Output += std::to_string( Body.length() );
+	Output += Connection.mClosing ? "\r\nConnection: close\r\n" : "\r\nConnection: keep-alive\r\n";
+	Output += ExtraHeaders;
+	Output += "\r\n";
+	Output += Body;
+}
+
+void TPokeyHttpServer::Subscribe(TConnection& Connection,const std::string& Target)
+{
+	TPokeySubscriptionParams Params;
+	std::stringstream Error;
+	if ( !Params.Read( Http::GetQueryParam( Target, "rect" ), Http::GetQueryParam( Target, "cells" ), Http::GetQueryParam( Target, "events" ), Error ) )
+	{
+		mBadRequestCount++;
+		Error << "\n";
+		AppendResponse( Connection, "400 Bad Request", Error.str() );
+		return;
+	}
+
+	//	no length, the body is events until one of us closes
+	Connection.mClosing = false;
+	Connection.mSubscription = mApp.mSubscriptions.Subscribe( Params );
+	mSubscriptionConnectionsChanged = true;
+	mSubscriberCount++;
+	Connection.mSendBuffer += "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n";
+}
+
+void TPokeyHttpServer::AppendFloorFrames(TConnection& Connection,const std::string& Target)
+{
+	auto Since = Http::GetQueryParam( Target, "since" );
+	sint64 SinceSeq = Since.empty() ? -1 : static_cast<sint64>( strtoll( Since.c_str(), nullptr, 10 ) );
+
+	//	frames are encoded once and shared, this just joins them
+	Array<std::shared_ptr<const std::string>> Frames;
+	auto Seq = mApp.mFloorSnapshot.GetFrames( SinceSeq, GetArrayBridge(Frames) );
+	std::string Body;
+	for ( int i=0;	i<Frames.GetSize();	i++ )
+		Body += *Frames[i];
+
+	std::stringstream SeqHeader;
+	SeqHeader << "X-Floor-Seq: " << Seq << "\r\n";
+	AppendResponse( Connection, "200 OK", Body, SeqHeader.str(), "application/octet-stream" );
+}
+
+const std::string& TPokeyHttpServer::GetListReply()
+{
+	//	dashboards poll list as often as the coord, but it walks every pokey and channel
+	auto NowNs = Soy::GetMonotonicNs();
+	if ( mListReplyNs == 0 || NowNs - mListReplyNs >= static_cast<uint64>(mListCacheMs) * 1000000 )
+	{
+		std::stringstream List;
+		mApp.GetPokeyList( List );
+		mListReply = List.str();
+		mListReplyNs = NowNs;
+	}
+	return mListReply;
+}
+
+void TPokeyHttpServer::GetStatus(std::ostream& Status)
+{
+	Status << "fast http on " << mPort << ", " << mConnectionCount << " connections, " << mSubscriberCount << " subscribed, " << mAcceptCount << " accepted, " << mRequestCount << " requests, " << mRedirectCount << " redirected to " << mFallbackPort << ", " << mBadRequestCount << " bad";
+}
+
+
+TPokeyHttpLoadTestParams::TPokeyHttpLoadTestParams() :
+	mPath		( "/PeekGridCoord" ),
+	mClients	( 32 ),
+	mPipeline	( 8 ),
+	mSeconds	( 10 )
+{
+}
+
+void TPokeyHttpLoadTestParams::Read(const TJobParams& Params)
+{
+	mAddress = Params.GetParamAsWithDefault<std::string>("httploadtest", mAddress );
+	mPath = Params.GetParamAsWithDefault<std::string>("loadtestpath", mPath );
+	mClients = Params.GetParamAsWithDefault<int>("loadtestclients", mClients );
+	mPipeline = Params.GetParamAsWithDefault<int>("loadtestpipeline", mPipeline );
+	mSeconds = Params.GetParamAsWithDefault<int>("loadtestseconds", mSeconds );
+
+	if ( mPath.empty() || mPath[0] != '/' )
+		mPath = "/" + mPath;
+	mClients = std::max( 1, mClients );
+	mPipeline = std::max( 1, mPipeline );
+	mSeconds = std::max( 1, mSeconds );
+}
+
+
+TPokeyHttpLoadTest::TPokeyHttpLoadTest(const TPokeyHttpLoadTestParams& Params) :
+	mParams			( Params ),
+	mResponseCount	( 0 ),
+	mErrorCount		( 0 ),
+	mElapsedNs		( 0 )
+{
+	auto Host = mParams.mAddress.substr( 0, mParams.mAddress.rfind(':') );
+	mRequest = "GET " + mParams.mPath + " HTTP/1.1\r\nHost: " + Host + "\r\n\r\n";
+}
+
+bool TPokeyHttpLoadTest::Connect(TClient& Client,std::stringstream& Error)
+{
+#if defined(TARGET_WINDOWS)
+	Error << "http load test is not supported on windows";
+	return false;
+#else
+	auto PortPos = mParams.mAddress.rfind(':');
+	if ( PortPos == std::string::npos )
+	{
+		Error << "load test address should be host:port, got " << mParams.mAddress;
+		return false;
+	}
+	auto Host = mParams.mAddress.substr( 0, PortPos );
+	auto Port = mParams.mAddress.substr( PortPos+1 );
+
+	addrinfo Hints;
+	memset( &Hints, 0, sizeof(Hints) );
+	Hints.ai_family = AF_INET;
+	Hints.ai_socktype = SOCK_STREAM;
+	addrinfo* Result = nullptr;
+	if ( getaddrinfo( Host.c_str(), Port.c_str(), &Hints, &Result ) != 0 || !Result )
+	{
+		Error << "couldn't resolve " << mParams.mAddress;
+		return false;
+	}
+
+	Client.mSocket = socket( AF_INET, SOCK_STREAM, 0 );
+	bool Connected = ( Client.mSocket != -1 ) && connect( Client.mSocket, Result->ai_addr, Result->ai_addrlen ) == 0;
+	freeaddrinfo( Result );
+	if ( !Connected )
+	{
+		Error << "failed to connect to " << mParams.mAddress << " errno " << errno;
+		return false;
+	}
+
+	int Enable = 1;
+	setsockopt( Client.mSocket, IPPROTO_TCP, TCP_NODELAY, &Enable, sizeof(Enable) );
+	return true;
+#endif
+}
+
+bool TPokeyHttpLoadTest::SendRequests(TClient& Client,size_t Count,uint64 NowNs)
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	if ( Count == 0 )
+		return true;
+
+	//	one write for the whole batch, as a pipelining client would
+	std::string Batch;
+	Batch.reserve( mRequest.length() * Count );
+	for ( size_t i=0;	i<Count;	i++ )
+	{
+		Batch += mRequest;
+		Client.mSentNs.PushBack( NowNs );
+	}
+
+	size_t Offset = 0;
+	while ( Offset < Batch.length() )
+	{
+		auto Sent = send( Client.mSocket, Batch.c_str() + Offset, Batch.length() - Offset, MSG_NOSIGNAL );
+		if ( Sent <= 0 )
+			return false;
+		Offset += Sent;
+	}
+	return true;
+#endif
+}
+
+bool TPokeyHttpLoadTest::ReadResponses(TClient& Client,uint64 NowNs)
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	char Buffer[16*1024];
+	auto Read = recv( Client.mSocket, Buffer, sizeof(Buffer), MSG_DONTWAIT );
+	if ( Read == 0 )
+		return false;
+	if ( Read < 0 )
+		return ( errno == EAGAIN || errno == EWOULDBLOCK );
+	Client.mRecvBuffer.append( Buffer, Read );
+
+	size_t ResponseStart = 0;
+	size_t Completed = 0;
+	while ( true )
+	{
+		auto HeaderEnd = Client.mRecvBuffer.find( "\r\n\r\n", ResponseStart );
+		if ( HeaderEnd == std::string::npos )
+			break;
+
+		int Status = 0;
+		size_t ContentLength = 0;
+		if ( !Http::ParseStatusAndLength( Client.mRecvBuffer.substr( ResponseStart, HeaderEnd-ResponseStart ), HeaderEnd-ResponseStart, Status, ContentLength ) )
+			return false;
+		auto ResponseEnd = HeaderEnd + 4 + ContentLength;
+		if ( ResponseEnd > Client.mRecvBuffer.length() )
+			break;
+
+		if ( Status != 200 )
+			mErrorCount++;
+		if ( Completed < Client.mSentNs.GetSize() )
+		{
+			auto LatencyUs = ( NowNs - Client.mSentNs[Completed] ) / 1000;
+			mLatencyUs.PushBack( static_cast<uint32>( std::min<uint64>( LatencyUs, 0xffffffff ) ) );
+		}
+		Completed++;
+		mResponseCount++;
+		ResponseStart = ResponseEnd;
+	}
+	Client.mRecvBuffer.erase( 0, ResponseStart );
+	Client.mSentNs.RemoveBlock( 0, std::min<size_t>( Completed, Client.mSentNs.GetSize() ) );
+	return true;
+#endif
+}
+
+bool TPokeyHttpLoadTest::Run(std::stringstream& Error)
+{
+#if defined(TARGET_WINDOWS)
+	Error << "http load test is not supported on windows";
+	return false;
+#else
+	for ( int c=0;	c<mParams.mClients;	c++ )
+	{
+		auto& Client = mClients.PushBack();
+		if ( !Connect( Client, Error ) )
+			return false;
+	}
+
+	auto StartNs = Soy::GetMonotonicNs();
+	auto EndNs = StartNs + static_cast<uint64>(mParams.mSeconds) * 1000000000ull;
+	for ( int c=0;	c<mClients.GetSize();	c++ )
+	{
+		if ( !SendRequests( mClients[c], mParams.mPipeline, StartNs ) )
+		{
+			Error << "client " << c << " failed to send";
+			return false;
+		}
+	}
+
+	Array<pollfd> Fds;
+	for ( int c=0;	c<mClients.GetSize();	c++ )
+	{
+		auto& Fd = Fds.PushBack();
+		Fd.fd = mClients[c].mSocket;
+		Fd.events = POLLIN;
+		Fd.revents = 0;
+	}
+
+	uint64 NowNs = StartNs;
+	while ( NowNs < EndNs )
+	{
+		if ( poll( Fds.GetArray(), Fds.GetSize(), 100 ) < 0 )
+			break;
+		NowNs = Soy::GetMonotonicNs();
+		for ( int c=0;	c<mClients.GetSize();	c++ )
+		{
+			if ( Fds[c].revents == 0 )
+				continue;
+			auto& Client = mClients[c];
+			//	keep the pipeline full; whatever came back gets replaced
+			if ( !ReadResponses( Client, NowNs ) || !SendRequests( Client, mParams.mPipeline - Client.mSentNs.GetSize(), NowNs ) )
+			{
+				Error << "client " << c << " disconnected after " << mResponseCount << " responses";
+				return false;
+			}
+		}
+	}
+	mElapsedNs = NowNs - StartNs;
+
+	for ( int c=0;	c<mClients.GetSize();	c++ )
+		close( mClients[c].mSocket );
+	return true;
+#endif
+}
+
+void TPokeyHttpLoadTest::WriteResults(std::ostream& Output)
+{
+	auto Percentile = [this](float Fraction)
+	{
+		if ( mLatencyUs.IsEmpty() )
+			return 0u;
+		auto Index = std::min<size_t>( static_cast<size_t>( Fraction * mLatencyUs.GetSize() ), mLatencyUs.GetSize()-1 );
+		return mLatencyUs[Index];
+	};
+	std::sort( mLatencyUs.GetArray(), mLatencyUs.GetArray() + mLatencyUs.GetSize() );
+
+	auto Seconds = mElapsedNs / 1000000000.0;
+	Output << "{";
+	Output << "\"address\":\"" << mParams.mAddress << "\",";
+	Output << "\"path\":\"" << mParams.mPath << "\",";
+	Output << "\"clients\":" << mParams.mClients << ",";
+	Output << "\"pipeline\":" << mParams.mPipeline << ",";
+	Output << "\"seconds\":" << Seconds << ",";
+	Output << "\"responses\":" << mResponseCount << ",";
+	Output << "\"errors\":" << mErrorCount << ",";
+	Output << "\"requests_per_sec\":" << ( Seconds > 0 ? mResponseCount / Seconds : 0 ) << ",";
+	Output << "\"latency_p50_us\":" << Percentile(0.5f) << ",";
+	Output << "\"latency_p99_us\":" << Percentile(0.99f) << ",";
+	Output << "\"latency_max_us\":" << Percentile(1.f);
+	Output << "}";
+}
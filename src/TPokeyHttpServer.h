@@ -0,0 +1,150 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <unordered_map>
+#include <SoyApp.h>
+#include <TJob.h>
+
+
+class TPopPokey;
+
+
+//	keep-alive http for the endpoints games and dashboards poll many times a second. Requests on a
+//	connection are answered in order as soon as they're parsed, so pipelined clients get a batch of
+//	replies per read. Only PeekGridCoord, PopGridCoord, PeekLaserGate, PopLaserGate, list and batch are
+//	answered here, straight from the app's state without a job; anything else is redirected to the
+//	generic http channel on mFallbackPort. subscribe?rect=|cells=&events= turns the connection into an
+//	event stream of that region's pin edges, written as the app's subscriptions wake us. floor?since=seq
+//	replies with the binary floor frames a client needs to catch up from seq, a keyframe without it
+class TPokeyHttpServer : public SoyWorkerThread
+{
+public:
+	static const size_t	MaxConnections = 512;
+	static const size_t	MaxRequestHeaderSize = 8*1024;
+	static const size_t	MaxRequestBodySize = 64*1024;	//	no endpoint reads a body, this is only so they can be skipped
+	static const size_t	MaxSendBuffer = 1024*1024;		//	stop reading a client that doesn't read its replies
+
+public:
+	TPokeyHttpServer(TPopPokey& App,int Port,int FallbackPort);
+	virtual ~TPokeyHttpServer();
+
+	bool			Init(std::stringstream& Error);
+	virtual bool	Iteration() override;
+	void			GetStatus(std::ostream& Status);
+
+public:
+	int				mListCacheMs;			//	list is rebuilt at most this often
+
+private:
+	class TConnection
+	{
+	public:
+		TConnection() :
+			mSocket		( -1 ),
+			mSendOffset		( 0 ),
+			mClosing		( false ),
+			mSubscription	( 0 )
+		{
+		}
+
+	public:
+		int				mSocket;
+		std::string		mRecvBuffer;
+		std::string		mSendBuffer;
+		size_t			mSendOffset;	//	sent up to here
+		bool			mClosing;		//	close once mSendBuffer is sent
+		uint32			mSubscription;	//	streaming events, no more requests are read
+	};
+
+	void			OnAccept();
+	bool			OnRecv(TConnection& Connection);
+	bool			OnSend(TConnection& Connection);
+	void			OnWake();
+	void			TakeEvents();
+	void			CloseConnection(TConnection& Connection);
+	bool			HandleRequests(TConnection& Connection);	//	false on a malformed request
+	void			Respond(TConnection& Connection,const std::string& Target,const std::string& Host);
+	void			AppendResponse(TConnection& Connection,const char* Status,const std::string& Body,const std::string& ExtraHeaders=std::string(),const char* ContentType="text/plain");
+	void			AppendFloorFrames(TConnection& Connection,const std::string& Target);
+	void			Subscribe(TConnection& Connection,const std::string& Target);
+	const std::string&	GetListReply();
+
+private:
+	TPopPokey&		mApp;
+	int				mPort;
+	int				mFallbackPort;
+	int				mListenSocket;
+	int				mWakeRead;			//	pipe the subscriptions poke when they have events
+	int				mWakeWrite;
+	std::atomic<bool>	mWakePending;	//	only one byte in the pipe at a time
+	Array<TConnection>	mConnections;
+	std::unordered_map<uint32,size_t>	mSubscriptionConnections;	//	subscription id to connection index
+	bool			mSubscriptionConnectionsChanged;	//	rebuild before it's next used
+	Array<uint32>	mBlockedSubscriptions;	//	pending, but their send buffer was too full to take them
+
+	std::string		mListReply;
+	uint64			mListReplyNs;
+
+	std::atomic<uint64>	mAcceptCount;
+	std::atomic<uint64>	mRequestCount;
+	std::atomic<uint64>	mRedirectCount;
+	std::atomic<uint64>	mBadRequestCount;
+	std::atomic<size_t>	mConnectionCount;
+	std::atomic<size_t>	mSubscriberCount;
+};
+
+
+class TPokeyHttpLoadTestParams
+{
+public:
+	TPokeyHttpLoadTestParams();
+
+	void			Read(const TJobParams& Params);
+
+public:
+	std::string		mAddress;			//	host:port
+	std::string		mPath;
+	int				mClients;			//	connections
+	int				mPipeline;			//	requests in flight per connection
+	int				mSeconds;
+};
+
+
+//	drives a server with mClients keep-alive connections, each keeping mPipeline requests in flight,
+//	from one thread, and reports throughput and per-request latency
+class TPokeyHttpLoadTest
+{
+public:
+	TPokeyHttpLoadTest(const TPokeyHttpLoadTestParams& Params);
+
+	bool			Run(std::stringstream& Error);
+	void			WriteResults(std::ostream& Output);
+
+private:
+	class TClient
+	{
+	public:
+		TClient() :
+			mSocket	( -1 )
+		{
+		}
+
+	public:
+		int				mSocket;
+		std::string		mRecvBuffer;
+		Array<uint64>	mSentNs;		//	per request in flight, oldest first
+	};
+
+	bool			Connect(TClient& Client,std::stringstream& Error);
+	bool			SendRequests(TClient& Client,size_t Count,uint64 NowNs);
+	bool			ReadResponses(TClient& Client,uint64 NowNs);
+
+private:
+	TPokeyHttpLoadTestParams	mParams;
+	std::string		mRequest;
+	Array<TClient>	mClients;
+
+	uint64			mResponseCount;
+	uint64			mErrorCount;			//	non-200 replies
+	uint64			mElapsedNs;
+	Array<uint32>	mLatencyUs;				//	sampled per response
+};
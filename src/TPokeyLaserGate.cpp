@@ -0,0 +1,158 @@
+#include "TPokeyLaserGate.h"
+
+
+const char* TPokeyLaserGateEventType::ToString(Type Event)
+{
+	switch ( Event )
+	{
+		case Break:		return "break";
+		case Restore:	return "restore";
+	}
+	return "unknown";
+}
+
+
+void TPokeyLaserGateEvent::WriteJson(std::ostream& Output) const
+{
+	Output << "{";
+	Output << "\"event\":\"" << TPokeyLaserGateEventType::ToString( mType ) << "\",";
+	Output << "\"serial\":" << mSerial << ",";
+	Output << "\"break\":" << mBreak << ",";
+	Output << "\"time_ns\":" << mTimeNs << ",";
+	Output << "\"window_ns\":" << mWindowNs;
+	if ( mType == TPokeyLaserGateEventType::Restore )
+		Output << ",\"duration_ns\":" << mDurationNs;
+	else
+		Output << ",\"interval_ns\":" << mIntervalNs;
+	Output << "}";
+}
+
+
+TPokeyLaserGate::TPokeyLaserGate() :
+	mMaxQueuedEvents	( 1000 ),
+	mBrokenCount		( 0 ),
+	mDroppedEvents		( 0 )
+{
+}
+
+TPokeyLaserGate::TGate& TPokeyLaserGate::GetGate(int Serial)
+{
+	//	one or two gates, a start and a finish
+	for ( int g=0;	g<mGates.GetSize();	g++ )
+	{
+		if ( mGates[g].mSerial == Serial )
+			return mGates[g];
+	}
+	auto& Gate = mGates.PushBack();
+	Gate.mSerial = Serial;
+	return Gate;
+}
+
+void TPokeyLaserGate::OnSample(int Serial,bool Broken,uint64 SampleTimeNs)
+{
+	TPokeyLaserGateEvent Event;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		auto& Gate = GetGate( Serial );
+
+		//	a reply that arrived before the last one we handled says nothing new
+		if ( SampleTimeNs < Gate.mLastSampleNs )
+			return;
+
+		auto WindowNs = Gate.mLastSampleNs ? SampleTimeNs - Gate.mLastSampleNs : 0;
+		bool FirstSample = ( Gate.mLastSampleNs == 0 );
+		Gate.mLastSampleNs = SampleTimeNs;
+		if ( !FirstSample )
+			mSampleIntervalUs.Record( WindowNs / 1000 );
+
+		if ( Broken == Gate.mBroken )
+			return;
+		Gate.mBroken = Broken;
+
+		Event.mSerial = Serial;
+		Event.mTimeNs = SampleTimeNs;
+		Event.mWindowNs = WindowNs;
+		if ( Broken )
+		{
+			Event.mType = TPokeyLaserGateEventType::Break;
+			if ( Gate.mBreakCount > 0 )
+			{
+				Event.mIntervalNs = SampleTimeNs - Gate.mBreakNs;
+				mBreakIntervalUs.Record( Event.mIntervalNs / 1000 );
+			}
+			Gate.mBreakNs = SampleTimeNs;
+			Gate.mBreakCount++;
+			mBrokenCount++;
+		}
+		else
+		{
+			Event.mType = TPokeyLaserGateEventType::Restore;
+			Event.mDurationNs = SampleTimeNs - Gate.mBreakNs;
+			mBreakDurationUs.Record( Event.mDurationNs / 1000 );
+			mBrokenCount--;
+		}
+		Event.mBreak = Gate.mBreakCount;
+	}
+
+	{
+		std::lock_guard<std::mutex> Lock( mEventsLock );
+		mEvents.push_back( Event );
+		while ( mEvents.size() > mMaxQueuedEvents )
+		{
+			mEvents.pop_front();
+			mDroppedEvents++;
+		}
+	}
+	mOnEvent.OnTriggered( Event );
+}
+
+void TPokeyLaserGate::PopEvents(ArrayBridge<TPokeyLaserGateEvent>&& Events)
+{
+	std::lock_guard<std::mutex> Lock( mEventsLock );
+	for ( auto it=mEvents.begin();	it!=mEvents.end();	it++ )
+		Events.PushBack( *it );
+	mEvents.clear();
+}
+
+void TPokeyLaserGate::WriteJson(std::ostream& Output)
+{
+	Output << "{\"gates\":[";
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		for ( int g=0;	g<mGates.GetSize();	g++ )
+		{
+			auto& Gate = mGates[g];
+			if ( g > 0 )
+				Output << ",";
+			Output << "{\"serial\":" << Gate.mSerial << ",\"broken\":" << (Gate.mBroken ? "true" : "false") << ",\"breaks\":" << Gate.mBreakCount << ",\"last_sample_ns\":" << Gate.mLastSampleNs << ",\"last_break_ns\":" << Gate.mBreakNs << "}";
+		}
+	}
+	Output << "],";
+	{
+		std::lock_guard<std::mutex> Lock( mEventsLock );
+		Output << "\"queued_events\":" << mEvents.size() << ",";
+		Output << "\"dropped_events\":" << mDroppedEvents << ",";
+	}
+	Output << "\"sample_interval_us\":";
+	mSampleIntervalUs.WriteJson( Output );
+	Output << ",\"break_duration_us\":";
+	mBreakDurationUs.WriteJson( Output );
+	Output << ",\"break_interval_us\":";
+	mBreakIntervalUs.WriteJson( Output );
+	Output << "}";
+}
+
+void TPokeyLaserGate::GetStatus(std::ostream& Status)
+{
+	size_t GateCount;
+	uint64 BreakCount = 0;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		GateCount = mGates.GetSize();
+		for ( int g=0;	g<mGates.GetSize();	g++ )
+			BreakCount += mGates[g].mBreakCount;
+	}
+	Status << "laser gates " << GateCount << (IsBroken() ? " broken" : "") << ", " << BreakCount << " breaks, sample interval p50 " << mSampleIntervalUs.GetPercentile(50) << "us p99 " << mSampleIntervalUs.GetPercentile(99) << "us max " << mSampleIntervalUs.GetMax() << "us";
+	std::lock_guard<std::mutex> Lock( mEventsLock );
+	Status << ", " << mEvents.size() << " queued events, " << mDroppedEvents << " dropped";
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+#include <deque>
+#include "TPokeyMetrics.h"
+
+
+namespace TPokeyLaserGateEventType
+{
+	enum Type
+	{
+		Break,		//	beam interrupted
+		Restore,	//	beam back
+	};
+
+	const char*		ToString(Type Event);
+}
+
+//	times are when the first poll that showed the edge was decoded; the edge itself happened
+//	somewhere in the mWindowNs before that, plus however long the reply sat in the socket
+class TPokeyLaserGateEvent
+{
+public:
+	TPokeyLaserGateEvent() :
+		mType		( TPokeyLaserGateEventType::Break ),
+		mSerial		( -1 ),
+		mBreak		( 0 ),
+		mTimeNs		( 0 ),
+		mWindowNs	( 0 ),
+		mDurationNs	( 0 ),
+		mIntervalNs	( 0 )
+	{
+	}
+
+	void			WriteJson(std::ostream& Output) const;
+
+public:
+	TPokeyLaserGateEventType::Type	mType;
+	int				mSerial;
+	uint64			mBreak;			//	counts up per gate, restores share their break's number
+	uint64			mTimeNs;
+	uint64			mWindowNs;		//	since the previous sample
+	uint64			mDurationNs;	//	restore: how long the beam was broken
+	uint64			mIntervalNs;	//	break: since the previous break started, 0 for the first
+};
+
+
+//	beam edges from every board with a gate pin. Fed the raw pin, so a beam held broken isn't
+//	dropped as a stuck pin, and only edges make events; a held break is one break
+class TPokeyLaserGate
+{
+public:
+	TPokeyLaserGate();
+
+	void			OnSample(int Serial,bool Broken,uint64 SampleTimeNs);
+	bool			IsBroken() const	{	return mBrokenCount.load() > 0;	}	//	any gate, right now
+
+	void			PopEvents(ArrayBridge<TPokeyLaserGateEvent>&& Events);
+	void			WriteJson(std::ostream& Output);		//	gates, counters and timing
+	void			GetStatus(std::ostream& Status);
+
+public:
+	SoyEvent<const TPokeyLaserGateEvent>	mOnEvent;	//	called on the sampling thread
+	size_t			mMaxQueuedEvents;		//	oldest dropped if nobody pops them
+
+private:
+	class TGate
+	{
+	public:
+		TGate() :
+			mSerial			( -1 ),
+			mBroken			( false ),
+			mLastSampleNs	( 0 ),
+			mBreakNs		( 0 ),
+			mBreakCount		( 0 )
+		{
+		}
+
+	public:
+		int				mSerial;
+		bool			mBroken;
+		uint64			mLastSampleNs;
+		uint64			mBreakNs;		//	start of the current or last break
+		uint64			mBreakCount;
+	};
+
+	TGate&			GetGate(int Serial);
+
+private:
+	std::mutex		mLock;			//	gates can be on different channels' threads
+	Array<TGate>	mGates;
+	std::atomic<int>	mBrokenCount;
+
+	std::mutex		mEventsLock;
+	std::deque<TPokeyLaserGateEvent>	mEvents;
+	uint64			mDroppedEvents;
+
+	TPokeyHistogram	mSampleIntervalUs;	//	how well we know when an edge happened
+	TPokeyHistogram	mBreakDurationUs;
+	TPokeyHistogram	mBreakIntervalUs;
+};
@@ -0,0 +1,349 @@
+#include "TPokeyMetrics.h"
+#include "TProtocolPokey.h"
+#include <limits>
+#include <functional>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+namespace Metrics
+{
+	inline size_t	GetHighBit(uint64 Value)
+	{
+#if defined(_MSC_VER)
+		unsigned long Index;
+		_BitScanReverse64( &Index, Value );
+		return Index;
+#else
+		return 63 - __builtin_clzll( Value );
+#endif
+	}
+
+	void			AtomicMax(std::atomic<uint64>& Max,uint64 Value)
+	{
+		auto Old = Max.load( std::memory_order_relaxed );
+		while ( Value > Old && !Max.compare_exchange_weak( Old, Value, std::memory_order_relaxed ) )
+		{
+		}
+	}
+}
+
+
+TPokeyHistogram::TPokeyHistogram() :
+	mCount	( 0 ),
+	mSum	( 0 ),
+	mMax	( 0 )
+{
+	for ( size_t i=0;	i<BucketCount;	i++ )
+		mBuckets[i] = 0;
+}
+
+size_t TPokeyHistogram::GetBucketIndex(uint64 Value)
+{
+	//	small values get a bucket each
+	if ( Value < SubBucketCount )
+		return static_cast<size_t>( Value );
+
+	//	then SubBucketCount linear buckets per power of two
+	auto Shift = Metrics::GetHighBit( Value ) - SubBucketBits;
+	auto SubBucket = (Value >> Shift) & (SubBucketCount-1);
+	return (Shift+1) * SubBucketCount + static_cast<size_t>( SubBucket );
+}
+
+uint64 TPokeyHistogram::GetBucketUpperBound(size_t Index)
+{
+	if ( Index < SubBucketCount )
+		return Index;
+
+	auto Shift = (Index / SubBucketCount) - 1;
+	auto SubBucket = Index % SubBucketCount;
+	if ( Shift >= 64 - SubBucketBits - 1 )
+		return std::numeric_limits<uint64>::max();
+	return ( static_cast<uint64>(SubBucketCount + SubBucket + 1) << Shift ) - 1;
+}
+
+void TPokeyHistogram::Record(uint64 Value)
+{
+	mBuckets[ GetBucketIndex(Value) ].fetch_add( 1, std::memory_order_relaxed );
+	mCount.fetch_add( 1, std::memory_order_relaxed );
+	mSum.fetch_add( Value, std::memory_order_relaxed );
+	Metrics::AtomicMax( mMax, Value );
+}
+
+uint64 TPokeyHistogram::GetPercentile(float Percentile) const
+{
+	auto Count = GetCount();
+	if ( Count == 0 )
+		return 0;
+
+	auto Target = static_cast<uint64>( Count * (Percentile / 100.f) );
+	uint64 Total = 0;
+	for ( size_t i=0;	i<BucketCount;	i++ )
+	{
+		Total += mBuckets[i].load( std::memory_order_relaxed );
+		if ( Total > Target )
+			return std::min( GetBucketUpperBound(i), GetMax() );
+	}
+	return GetMax();
+}
+
+void TPokeyHistogram::WritePrometheus(std::ostream& Output,const std::string& Name,const std::string& Labels) const
+{
+	//	only emit boundaries at powers of two, a few hundred buckets per board is too much to scrape
+	std::string LabelPrefix = Labels.empty() ? "" : Labels + ",";
+	uint64 Total = 0;
+	for ( size_t i=0;	i<BucketCount;	i++ )
+	{
+		Total += mBuckets[i].load( std::memory_order_relaxed );
+		bool LastOfPower = (i >= SubBucketCount) && ( (i % SubBucketCount) == SubBucketCount-1 );
+		if ( !LastOfPower )
+			continue;
+		Output << Name << "_bucket{" << LabelPrefix << "le=\"" << GetBucketUpperBound(i) << "\"} " << Total << "\n";
+		if ( Total == GetCount() )
+			break;
+	}
+	Output << Name << "_bucket{" << LabelPrefix << "le=\"+Inf\"} " << GetCount() << "\n";
+	std::string LabelSet = Labels.empty() ? "" : "{" + Labels + "}";
+	Output << Name << "_sum" << LabelSet << " " << GetSum() << "\n";
+	Output << Name << "_count" << LabelSet << " " << GetCount() << "\n";
+}
+
+void TPokeyHistogram::WriteJson(std::ostream& Output) const
+{
+	Output << "{";
+	Output << "\"count\":" << GetCount() << ",";
+	Output << "\"sum\":" << GetSum() << ",";
+	Output << "\"p50\":" << GetPercentile(50) << ",";
+	Output << "\"p90\":" << GetPercentile(90) << ",";
+	Output << "\"p99\":" << GetPercentile(99) << ",";
+	Output << "\"max\":" << GetMax();
+	Output << "}";
+}
+
+
+
+TPokeyBoardMetrics::TPokeyBoardMetrics(int Serial) :
+	mSerial				( Serial ),
+	mPollsSent			( 0 ),
+	mRepliesReceived	( 0 ),
+	mPollsLost			( 0 ),
+	mChecksumFailures	( 0 ),
+	mUnknownReplies		( 0 ),
+	mReconnects			( 0 ),
+	mLatchedPresses		( 0 ),
+	mCoalescedReplies	( 0 ),
+	mLastReplyNs		( 0 ),
+	mLastIntervalNs		( 0 ),
+	mConnectedState		( -1 )
+{
+	for ( size_t i=0;	i<sizeofarray(mPollSentNs);	i++ )
+		mPollSentNs[i] = 0;
+}
+
+void TPokeyBoardMetrics::OnPollSent(unsigned char RequestId,uint64 TimeNs)
+{
+	if ( mPollSentNs[RequestId].exchange( TimeNs, std::memory_order_relaxed ) != 0 )
+		mPollsLost.fetch_add( 1, std::memory_order_relaxed );
+	mPollsSent.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void TPokeyBoardMetrics::OnReply(unsigned char RequestId,uint64 TimeNs,bool ChecksumOkay,bool KnownCommand,bool IsPoll)
+{
+	mRepliesReceived.fetch_add( 1, std::memory_order_relaxed );
+	if ( !ChecksumOkay )
+		mChecksumFailures.fetch_add( 1, std::memory_order_relaxed );
+	if ( !KnownCommand )
+		mUnknownReplies.fetch_add( 1, std::memory_order_relaxed );
+
+	//	take the sent time so a duplicate reply doesn't count twice
+	auto SentNs = mPollSentNs[RequestId].exchange( 0, std::memory_order_relaxed );
+	if ( SentNs != 0 && TimeNs >= SentNs )
+		mRoundTripUs.Record( (TimeNs - SentNs) / 1000 );
+
+	//	other commands are sent in bursts around the poll and would swamp the jitter
+	if ( !IsPoll )
+		return;
+	auto LastReplyNs = mLastReplyNs.exchange( TimeNs, std::memory_order_relaxed );
+	if ( LastReplyNs == 0 || TimeNs < LastReplyNs )
+		return;
+	auto IntervalNs = TimeNs - LastReplyNs;
+	auto LastIntervalNs = mLastIntervalNs.exchange( IntervalNs, std::memory_order_relaxed );
+	if ( LastIntervalNs == 0 )
+		return;
+	auto JitterNs = (IntervalNs > LastIntervalNs) ? (IntervalNs - LastIntervalNs) : (LastIntervalNs - IntervalNs);
+	mJitterUs.Record( JitterNs / 1000 );
+}
+
+void TPokeyBoardMetrics::OnConnectedState(bool Connected)
+{
+	auto Old = mConnectedState.exchange( Connected ? 1 : 0, std::memory_order_relaxed );
+
+	//	first connection isn't a reconnect
+	if ( Old == 0 && Connected )
+		mReconnects.fetch_add( 1, std::memory_order_relaxed );
+}
+
+uint64 TPokeyBoardMetrics::GetPollsInFlight(uint64 NowNs) const
+{
+	//	replies take their request's sent time, so what's left is waiting
+	uint64 InFlight = 0;
+	for ( size_t i=0;	i<sizeofarray(mPollSentNs);	i++ )
+	{
+		auto SentNs = mPollSentNs[i].load( std::memory_order_relaxed );
+		if ( SentNs != 0 && NowNs >= SentNs && NowNs - SentNs < PollTimeoutMs*1000000 )
+			InFlight++;
+	}
+	return InFlight;
+}
+
+
+
+TPokeyMetrics::TPokeyMetrics() :
+	mEventsPushed	( 0 ),
+	mStartTimeNs	( Soy::GetMonotonicNs() )
+{
+}
+
+TPokeyMetrics& TPokeyMetrics::Get()
+{
+	static TPokeyMetrics Metrics;
+	return Metrics;
+}
+
+std::shared_ptr<TPokeyBoardMetrics> TPokeyMetrics::GetBoard(int Serial)
+{
+	std::lock_guard<std::mutex> Lock( mBoardsLock );
+	auto& Board = mBoards[Serial];
+	if ( !Board )
+		Board.reset( new TPokeyBoardMetrics(Serial) );
+	return Board;
+}
+
+void TPokeyMetrics::GetBoards(ArrayBridge<std::shared_ptr<TPokeyBoardMetrics>>&& Boards)
+{
+	std::lock_guard<std::mutex> Lock( mBoardsLock );
+	for ( auto it=mBoards.begin();	it!=mBoards.end();	it++ )
+		Boards.PushBack( it->second );
+}
+
+std::shared_ptr<TPokeyPollMetrics> TPokeyMetrics::GetPoll(const std::string& Name)
+{
+	std::lock_guard<std::mutex> Lock( mBoardsLock );
+	auto& Poll = mPolls[Name];
+	if ( !Poll )
+		Poll.reset( new TPokeyPollMetrics(Name) );
+	return Poll;
+}
+
+void TPokeyMetrics::GetPolls(ArrayBridge<std::shared_ptr<TPokeyPollMetrics>>&& Polls)
+{
+	std::lock_guard<std::mutex> Lock( mBoardsLock );
+	for ( auto it=mPolls.begin();	it!=mPolls.end();	it++ )
+		Polls.PushBack( it->second );
+}
+
+void TPokeyMetrics::WritePrometheus(std::ostream& Output)
+{
+	Array<std::shared_ptr<TPokeyBoardMetrics>> Boards;
+	GetBoards( GetArrayBridge(Boards) );
+	Array<std::shared_ptr<TPokeyPollMetrics>> Polls;
+	GetPolls( GetArrayBridge(Polls) );
+
+	Output << "# TYPE poppokey_uptime_seconds gauge\n";
+	Output << "poppokey_uptime_seconds " << (Soy::GetMonotonicNs() - mStartTimeNs) / 1000000000.0 << "\n";
+
+	//	counters, one line per board
+	auto WriteCounter = [&](const char* Name,const char* Type,std::function<uint64(const TPokeyBoardMetrics&)> GetValue)
+	{
+		Output << "# TYPE " << Name << " " << Type << "\n";
+		for ( int b=0;	b<Boards.GetSize();	b++ )
+			Output << Name << "{serial=\"" << Boards[b]->mSerial << "\"} " << GetValue( *Boards[b] ) << "\n";
+	};
+	WriteCounter( "poppokey_polls_sent_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mPollsSent.load();	} );
+	WriteCounter( "poppokey_replies_received_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mRepliesReceived.load();	} );
+	WriteCounter( "poppokey_polls_lost_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mPollsLost.load();	} );
+	auto NowNs = Soy::GetMonotonicNs();
+	WriteCounter( "poppokey_polls_in_flight", "gauge", [NowNs](const TPokeyBoardMetrics& Board)	{	return Board.GetPollsInFlight( NowNs );	} );
+	WriteCounter( "poppokey_checksum_failures_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mChecksumFailures.load();	} );
+	WriteCounter( "poppokey_unknown_replies_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mUnknownReplies.load();	} );
+	WriteCounter( "poppokey_reconnects_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mReconnects.load();	} );
+	WriteCounter( "poppokey_latched_presses_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mLatchedPresses.load();	} );
+	WriteCounter( "poppokey_coalesced_replies_total", "counter", [](const TPokeyBoardMetrics& Board)	{	return Board.mCoalescedReplies.load();	} );
+
+	Output << "# TYPE poppokey_round_trip_microseconds histogram\n";
+	for ( int b=0;	b<Boards.GetSize();	b++ )
+	{
+		std::stringstream Labels;
+		Labels << "serial=\"" << Boards[b]->mSerial << "\"";
+		Boards[b]->mRoundTripUs.WritePrometheus( Output, "poppokey_round_trip_microseconds", Labels.str() );
+	}
+
+	Output << "# TYPE poppokey_reply_jitter_microseconds histogram\n";
+	for ( int b=0;	b<Boards.GetSize();	b++ )
+	{
+		std::stringstream Labels;
+		Labels << "serial=\"" << Boards[b]->mSerial << "\"";
+		Boards[b]->mJitterUs.WritePrometheus( Output, "poppokey_reply_jitter_microseconds", Labels.str() );
+	}
+
+	Output << "# TYPE poppokey_events_pushed_total counter\n";
+	Output << "poppokey_events_pushed_total " << mEventsPushed.load() << "\n";
+	Output << "# TYPE poppokey_handler_latency_microseconds histogram\n";
+	mHandlerLatencyUs.WritePrometheus( Output, "poppokey_handler_latency_microseconds", "" );
+	Output << "# TYPE poppokey_poll_jitter_microseconds histogram\n";
+	for ( int p=0;	p<Polls.GetSize();	p++ )
+		Polls[p]->mJitterUs.WritePrometheus( Output, "poppokey_poll_jitter_microseconds", "poll=\"" + Polls[p]->mName + "\"" );
+	Output << "# TYPE poppokey_poll_overruns_total counter\n";
+	for ( int p=0;	p<Polls.GetSize();	p++ )
+		Output << "poppokey_poll_overruns_total{poll=\"" << Polls[p]->mName << "\"} " << Polls[p]->mOverruns.load() << "\n";
+}
+
+void TPokeyMetrics::WriteJson(std::ostream& Output)
+{
+	Array<std::shared_ptr<TPokeyBoardMetrics>> Boards;
+	GetBoards( GetArrayBridge(Boards) );
+	Array<std::shared_ptr<TPokeyPollMetrics>> Polls;
+	GetPolls( GetArrayBridge(Polls) );
+
+	auto NowNs = Soy::GetMonotonicNs();
+	Output << "{\"boards\":[";
+	for ( int b=0;	b<Boards.GetSize();	b++ )
+	{
+		auto& Board = *Boards[b];
+		if ( b > 0 )
+			Output << ",";
+		Output << "{";
+		Output << "\"serial\":" << Board.mSerial << ",";
+		Output << "\"polls_sent\":" << Board.mPollsSent.load() << ",";
+		Output << "\"replies_received\":" << Board.mRepliesReceived.load() << ",";
+		Output << "\"polls_lost\":" << Board.mPollsLost.load() << ",";
+		Output << "\"polls_in_flight\":" << Board.GetPollsInFlight( NowNs ) << ",";
+		Output << "\"checksum_failures\":" << Board.mChecksumFailures.load() << ",";
+		Output << "\"unknown_replies\":" << Board.mUnknownReplies.load() << ",";
+		Output << "\"reconnects\":" << Board.mReconnects.load() << ",";
+		Output << "\"latched_presses\":" << Board.mLatchedPresses.load() << ",";
+		Output << "\"coalesced_replies\":" << Board.mCoalescedReplies.load() << ",";
+		Output << "\"round_trip_us\":";
+		Board.mRoundTripUs.WriteJson( Output );
+		Output << ",\"jitter_us\":";
+		Board.mJitterUs.WriteJson( Output );
+		Output << "}";
+	}
+	Output << "],";
+	Output << "\"events_pushed\":" << mEventsPushed.load() << ",";
+	Output << "\"handler_latency_us\":";
+	mHandlerLatencyUs.WriteJson( Output );
+	Output << ",\"polls\":[";
+	for ( int p=0;	p<Polls.GetSize();	p++ )
+	{
+		if ( p > 0 )
+			Output << ",";
+		Output << "{\"poll\":\"" << Polls[p]->mName << "\",\"jitter_us\":";
+		Polls[p]->mJitterUs.WriteJson( Output );
+		Output << ",\"overruns\":" << Polls[p]->mOverruns.load() << "}";
+	}
+	Output << "]";
+	Output << "}";
+}
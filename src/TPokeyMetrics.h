@@ -0,0 +1,117 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <map>
+
+
+//	log-linear buckets (8 per power of two) so recording is a couple of atomic adds and
+//	percentiles stay within ~12% at any scale
+class TPokeyHistogram
+{
+public:
+	static const size_t	SubBucketBits = 3;
+	static const size_t	SubBucketCount = 1<<SubBucketBits;
+	static const size_t	BucketCount = (64-SubBucketBits+1) * SubBucketCount;
+
+public:
+	TPokeyHistogram();
+
+	void			Record(uint64 Value);
+	uint64			GetCount() const	{	return mCount.load( std::memory_order_relaxed );	}
+	uint64			GetSum() const		{	return mSum.load( std::memory_order_relaxed );	}
+	uint64			GetMax() const		{	return mMax.load( std::memory_order_relaxed );	}
+	uint64			GetPercentile(float Percentile) const;
+	void			WritePrometheus(std::ostream& Output,const std::string& Name,const std::string& Labels) const;
+	void			WriteJson(std::ostream& Output) const;
+
+	static size_t	GetBucketIndex(uint64 Value);
+	static uint64	GetBucketUpperBound(size_t Index);
+
+private:
+	std::atomic<uint64>	mBuckets[BucketCount];
+	std::atomic<uint64>	mCount;
+	std::atomic<uint64>	mSum;
+	std::atomic<uint64>	mMax;
+};
+
+
+//	counters for one pokey. Held by the pokey's protocol and meta so recording never has to look it up
+class TPokeyBoardMetrics
+{
+public:
+	static const uint64	PollTimeoutMs = 1000;	//	a poll with no reply by now is lost
+	
+public:
+	TPokeyBoardMetrics(int Serial);
+
+	void			OnPollSent(unsigned char RequestId,uint64 TimeNs);
+	void			OnReply(unsigned char RequestId,uint64 TimeNs,bool ChecksumOkay,bool KnownCommand,bool IsPoll);
+	void			OnConnectedState(bool Connected);
+	void			OnNewChannel()	{	mReconnects++;	}
+	uint64			GetPollsInFlight(uint64 NowNs) const;	//	sent, not replied to and not timed out
+
+public:
+	const int			mSerial;
+	std::atomic<uint64>	mPollsSent;
+	std::atomic<uint64>	mRepliesReceived;
+	std::atomic<uint64>	mPollsLost;			//	request id reused before a reply came
+	std::atomic<uint64>	mChecksumFailures;
+	std::atomic<uint64>	mUnknownReplies;
+	std::atomic<uint64>	mReconnects;
+	std::atomic<uint64>	mLatchedPresses;	//	taps only seen by the pin counters, between two polls
+	std::atomic<uint64>	mCoalescedReplies;	//	replaced by a newer reply before they were applied
+	TPokeyHistogram		mRoundTripUs;
+	TPokeyHistogram		mJitterUs;			//	change in poll reply inter-arrival time
+
+private:
+	std::atomic<uint64>	mPollSentNs[256];	//	by request id, so late replies still get the right round trip
+	std::atomic<uint64>	mLastReplyNs;
+	std::atomic<uint64>	mLastIntervalNs;
+	std::atomic<int>	mConnectedState;	//	-1 never seen
+};
+
+
+//	one poll thread's timing; each has its own so a zone or the gate poll doesn't hide the main one's
+class TPokeyPollMetrics
+{
+public:
+	TPokeyPollMetrics(const std::string& Name) :
+		mName		( Name ),
+		mOverruns	( 0 )
+	{
+	}
+
+public:
+	const std::string	mName;
+	TPokeyHistogram		mJitterUs;			//	interval between polls vs the target
+	std::atomic<uint64>	mOverruns;			//	polls that came two or more intervals apart
+};
+
+
+class TPokeyMetrics
+{
+public:
+	TPokeyMetrics();
+
+	static TPokeyMetrics&	Get();
+
+	std::shared_ptr<TPokeyBoardMetrics>	GetBoard(int Serial);
+	void			GetBoards(ArrayBridge<std::shared_ptr<TPokeyBoardMetrics>>&& Boards);
+	std::shared_ptr<TPokeyPollMetrics>	GetPoll(const std::string& Name);	//	same name, same metrics, so a restarted poll carries on
+	void			GetPolls(ArrayBridge<std::shared_ptr<TPokeyPollMetrics>>&& Polls);
+
+	void			OnEventPushed()	{	mEventsPushed++;	}
+
+	void			WritePrometheus(std::ostream& Output);
+	void			WriteJson(std::ostream& Output);
+
+public:
+	std::atomic<uint64>	mEventsPushed;
+	TPokeyHistogram		mHandlerLatencyUs;	//	frame reaching the decoder to handler finished
+
+private:
+	std::mutex			mBoardsLock;		//	only taken when a board is first seen and when exporting
+	std::map<int,std::shared_ptr<TPokeyBoardMetrics>>	mBoards;
+	std::map<std::string,std::shared_ptr<TPokeyPollMetrics>>	mPolls;	//	also under mBoardsLock
+	uint64				mStartTimeNs;
+};
@@ -0,0 +1,177 @@
+#include "TPokeyOutputs.h"
+
+
+namespace
+{
+	void SetBit(uint64* Bits,size_t Index,bool State)
+	{
+		auto Mask = 1ull << (Index % 64);
+		if ( State )
+			Bits[Index/64] |= Mask;
+		else
+			Bits[Index/64] &= ~Mask;
+	}
+
+	bool GetBit(const uint64* Bits,size_t Index)
+	{
+		return ( Bits[Index/64] & (1ull << (Index % 64)) ) != 0;
+	}
+}
+
+
+TPokeyOutputs::TPokeyOutputs() :
+	mSetCount			( 0 ),
+	mPinWrites			( 0 ),
+	mExtBusWrites		( 0 ),
+	mPinsUsed			( false ),
+	mPinsDesired		( 0 ),
+	mPinsWritten		( 0 ),
+	mPinsWrittenValid	( false ),
+	mExtBusUsed			( false ),
+	mExtBusWrittenValid	( false )
+{
+	mExtBusDesired[0] = mExtBusDesired[1] = 0;
+	mExtBusWritten[0] = mExtBusWritten[1] = 0;
+}
+
+bool TPokeyOutputs::SetOutput(size_t Output,bool State)
+{
+	if ( Output >= OutputCount )
+		return false;
+
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( Output < PinCount )
+	{
+		SetBit( &mPinsDesired, Output, State );
+		mPinsUsed = true;
+	}
+	else
+	{
+		SetBit( mExtBusDesired, Output - PinCount, State );
+		mExtBusUsed = true;
+	}
+	mSetCount++;
+	return true;
+}
+
+bool TPokeyOutputs::SetOutputs(const std::string& Pins,const std::string& ExtBus,std::stringstream& Error)
+{
+	if ( Pins.length() > PinCount )
+	{
+		Error << "too many pins " << Pins.length() << "/" << PinCount;
+		return false;
+	}
+	if ( ExtBus.length() > ExtBusCount )
+	{
+		Error << "too many extbus outputs " << ExtBus.length() << "/" << ExtBusCount;
+		return false;
+	}
+
+	//	parse before taking the lock so a bad string changes nothing
+	uint64 NewPins = 0;
+	for ( size_t i=0;	i<Pins.length();	i++ )
+		SetBit( &NewPins, i, Pins[i] != '0' );
+	uint64 NewExtBus[2] = { 0, 0 };
+	for ( size_t i=0;	i<ExtBus.length();	i++ )
+		SetBit( NewExtBus, i, ExtBus[i] != '0' );
+
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( !Pins.empty() )
+	{
+		//	pins not given keep their state
+		auto Given = (Pins.length() == 64) ? ~0ull : ((1ull << Pins.length()) - 1);
+		mPinsDesired = (mPinsDesired & ~Given) | NewPins;
+		mPinsUsed = true;
+	}
+	if ( !ExtBus.empty() )
+	{
+		for ( size_t i=0;	i<ExtBus.length();	i++ )
+			SetBit( mExtBusDesired, i, GetBit( NewExtBus, i ) );
+		mExtBusUsed = true;
+	}
+	mSetCount++;
+	return true;
+}
+
+void TPokeyOutputs::Invalidate()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	mPinsWrittenValid = false;
+	mExtBusWrittenValid = false;
+}
+
+bool TPokeyOutputs::PopPinChanges(std::string& Pins)
+{
+	uint64 Desired;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( !mPinsUsed )
+			return false;
+		if ( mPinsWrittenValid && mPinsWritten == mPinsDesired )
+			return false;
+
+		//	written as soon as it's handed out; tcp won't drop it and a reconnect Invalidates
+		Desired = mPinsDesired;
+		mPinsWritten = Desired;
+		mPinsWrittenValid = true;
+	}
+
+	mPinWrites++;
+	Pins = PinsToString( Desired, PinCount );
+	return true;
+}
+
+bool TPokeyOutputs::PopExtBusChanges(std::string& ExtBus)
+{
+	uint64 Desired[2];
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( !mExtBusUsed )
+			return false;
+		if ( mExtBusWrittenValid && mExtBusWritten[0] == mExtBusDesired[0] && mExtBusWritten[1] == mExtBusDesired[1] )
+			return false;
+
+		Desired[0] = mExtBusWritten[0] = mExtBusDesired[0];
+		Desired[1] = mExtBusWritten[1] = mExtBusDesired[1];
+		mExtBusWrittenValid = true;
+	}
+
+	mExtBusWrites++;
+	ExtBus.resize( ExtBusCount );
+	for ( size_t i=0;	i<ExtBusCount;	i++ )
+		ExtBus[i] = GetBit( Desired, i ) ? '1' : '0';
+	return true;
+}
+
+std::string TPokeyOutputs::PinsToString(uint64 Pins,size_t Count)
+{
+	std::string String( Count, '0' );
+	for ( size_t i=0;	i<Count && i<64;	i++ )
+		if ( Pins & (1ull << i) )
+			String[i] = '1';
+	return String;
+}
+
+void TPokeyOutputs::GetStatus(std::ostream& Status)
+{
+	uint64 PinsDesired;
+	uint64 PinsWritten;
+	bool PinsWrittenValid;
+	uint64 ExtBusDesired[2];
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		PinsDesired = mPinsDesired;
+		PinsWritten = mPinsWritten;
+		PinsWrittenValid = mPinsWrittenValid;
+		ExtBusDesired[0] = mExtBusDesired[0];
+		ExtBusDesired[1] = mExtBusDesired[1];
+	}
+
+	Status << "outputs " << PinsToString( PinsDesired, PinCount );
+	if ( !PinsWrittenValid || PinsWritten != PinsDesired )
+		Status << " (pending)";
+	Status << " extbus ";
+	for ( size_t i=0;	i<ExtBusCount;	i++ )
+		Status << ( GetBit( ExtBusDesired, i ) ? '1' : '0' );
+	Status << " sets " << mSetCount.load() << " pinwrites " << mPinWrites.load() << " extbuswrites " << mExtBusWrites.load();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+
+
+//	desired output state for one pokey, and what was last written to it. Jobs set the desired state
+//	as often as they like; the poll thread takes whatever differs once per poll so changes coalesce
+//	per tick and unchanged state is never resent
+class TPokeyOutputs
+{
+public:
+	static const size_t	PinCount = 55;
+	static const size_t	ExtBusCount = 80;			//	10 daisy-chained shift registers
+	static const size_t	ExtBusBytes = ExtBusCount / 8;
+	static const size_t	OutputCount = PinCount + ExtBusCount;	//	outputs are numbered pins first, then PoExtBus
+
+public:
+	TPokeyOutputs();
+
+	bool			SetOutput(size_t Output,bool State);
+	bool			SetOutputs(const std::string& Pins,const std::string& ExtBus,std::stringstream& Error);	//	'0'/'1' per output like the poll reply, empty to leave alone
+	void			Invalidate();					//	resend everything, eg. after a reconnect
+
+	bool			PopPinChanges(std::string& Pins);	//	true and the whole pin state if it needs writing
+	bool			PopExtBusChanges(std::string& ExtBus);
+
+	void			GetStatus(std::ostream& Status);
+
+	static std::string	PinsToString(uint64 Pins,size_t Count);
+
+public:
+	std::atomic<uint64>	mSetCount;			//	changes requested
+	std::atomic<uint64>	mPinWrites;			//	writes actually sent
+	std::atomic<uint64>	mExtBusWrites;
+
+private:
+	std::mutex		mLock;
+	bool			mPinsUsed;				//	never write outputs to a pokey nobody has set any on
+	uint64			mPinsDesired;
+	uint64			mPinsWritten;
+	bool			mPinsWrittenValid;
+	bool			mExtBusUsed;
+	uint64			mExtBusDesired[2];		//	80 bits
+	uint64			mExtBusWritten[2];
+	bool			mExtBusWrittenValid;
+};
@@ -0,0 +1,158 @@
+#include "TPokeyPollMailbox.h"
+#include "PopPokey.h"
+#include <algorithm>
+
+
+void TPokeyPollMail::GetSteps(ArrayBridge<uint64>&& Steps,ArrayBridge<uint64>&& StepTimesNs) const
+{
+	//	one edge per pin at most, the newest pins say it all
+	auto Toggled = mRose & mFell;
+	if ( !Toggled )
+	{
+		Steps.PushBack( mPins );
+		StepTimesNs.PushBack( mRxTimeNs );
+		return;
+	}
+
+	//	pins that changed more than once: lift everything that fell at some point, then put down
+	//	everything that rose, then the newest. Down-up-down is a release and a press, up-down-up a
+	//	press and a release. The lift is stamped with the first fall, the put down with the newest
+	//	rise, and the times never go backwards
+	auto Released = mBasePins & ~mFell;
+	auto Pressed = Released | mRose;
+	uint64 Last = mBasePins;
+	uint64 LastTimeNs = 0;
+	auto PushStep = [&](uint64 Pins,uint64 TimeNs)
+	{
+		LastTimeNs = std::max( LastTimeNs, TimeNs );
+		Steps.PushBack( Last = Pins );
+		StepTimesNs.PushBack( LastTimeNs );
+	};
+	if ( Released != Last )
+		PushStep( Released, mFellRxTimeNs );
+	if ( Pressed != Last )
+		PushStep( Pressed, mRoseRxTimeNs );
+	if ( Steps.IsEmpty() || mPins != Last )
+		PushStep( mPins, mRxTimeNs );
+}
+
+
+TPokeyPollMailbox::TPokeyPollMailbox(const std::string& Name,TOnMail OnMail) :
+	SoyWorkerThread		( Soy::GetTypeName(*this) + " " + Name, SoyWorkerWaitMode::Wake ),
+	mName				( Name ),
+	mOnMail				( OnMail ),
+	mPostCount			( 0 ),
+	mAppliedCount		( 0 ),
+	mCoalescedCount		( 0 ),
+	mReplayedCount		( 0 )
+{
+}
+
+TPokeyPollMailbox::~TPokeyPollMailbox()
+{
+	Stop();
+	WaitToFinish();
+}
+
+void TPokeyPollMailbox::Post(std::shared_ptr<TPokeyMeta>& Pokey,uint64 Pins,size_t PinCount,uint64 RxTimeNs,uint64 DecodeTimeNs,bool OutputsFailed)
+{
+	mPostCount++;
+	bool Wake = false;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		auto SlotIndex = Pokey->mStateSlot;
+		while ( mSlots.GetSize() <= SlotIndex )
+			mSlots.PushBack();
+		auto& Slot = mSlots[SlotIndex];
+		if ( Slot.mOwner.owner_before( Pokey ) || Pokey.owner_before( Slot.mOwner ) )
+		{
+			Slot = TSlot();
+			Slot.mOwner = Pokey;
+		}
+
+		auto& Mail = Slot.mMail;
+		if ( Slot.mPending )
+		{
+			mCoalescedCount++;
+			if ( Pokey->mMetrics )
+				Pokey->mMetrics->mCoalescedReplies++;
+		}
+		else
+		{
+			Mail = TPokeyPollMail();
+			Mail.mBasePins = Slot.mLastPins;
+			Mail.mPostTimeNs = Soy::GetMonotonicNs();
+			Slot.mPokey = Pokey;
+			Slot.mPending = true;
+			mPendingSlots.PushBack( SlotIndex );
+			Wake = true;
+		}
+
+		auto Rose = ~Slot.mLastPins & Pins;
+		auto Fell = Slot.mLastPins & ~Pins;
+		if ( Fell && !Mail.mFell )
+			Mail.mFellRxTimeNs = RxTimeNs;
+		if ( Rose )
+			Mail.mRoseRxTimeNs = RxTimeNs;
+		Mail.mRose |= Rose;
+		Mail.mFell |= Fell;
+		Mail.mPins = Pins;
+		Mail.mPinCount = PinCount;
+		Mail.mRxTimeNs = RxTimeNs;
+		Mail.mDecodeTimeNs = DecodeTimeNs;
+		Mail.mOutputsFailed |= OutputsFailed;
+		Mail.mReplies++;
+		Slot.mLastPins = Pins;
+	}
+
+	if ( Wake )
+		SoyWorkerThread::Wake();
+}
+
+bool TPokeyPollMailbox::CanSleep()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	return mPendingSlots.IsEmpty();
+}
+
+bool TPokeyPollMailbox::Iteration()
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mTakenSlots.Copy( mPendingSlots );
+		mPendingSlots.Clear(false);
+	}
+
+	//	take each board's mail just before applying it, so anything that arrived while we were busy
+	//	with the boards before it is folded in
+	for ( int i=0;	i<mTakenSlots.GetSize();	i++ )
+	{
+		std::shared_ptr<TPokeyMeta> Pokey;
+		TPokeyPollMail Mail;
+		{
+			std::lock_guard<std::mutex> Lock( mLock );
+			auto& Slot = mSlots[ mTakenSlots[i] ];
+			if ( !Slot.mPending )
+				continue;
+			Mail = Slot.mMail;
+			Pokey.swap( Slot.mPokey );
+			Slot.mPending = false;
+		}
+
+		BufferArray<uint64,3> Steps;
+		BufferArray<uint64,3> StepTimesNs;
+		Mail.GetSteps( GetArrayBridge(Steps), GetArrayBridge(StepTimesNs) );
+		if ( Steps.GetSize() > 1 )
+			mReplayedCount += Steps.GetSize() - 1;
+
+		mOnMail( *Pokey, Mail, GetArrayBridge(Steps), GetArrayBridge(StepTimesNs) );
+		mAppliedCount++;
+		mWaitUs.Record( (Soy::GetMonotonicNs() - Mail.mPostTimeNs) / 1000 );
+	}
+	return true;
+}
+
+void TPokeyPollMailbox::GetStatus(std::ostream& Status)
+{
+	Status << "poll mailbox " << mName << ": " << mPostCount << " replies, " << mAppliedCount << " applied, " << mCoalescedCount << " coalesced, " << mReplayedCount << " replayed edges, wait p50 " << mWaitUs.GetPercentile(50) << "us p99 " << mWaitUs.GetPercentile(99) << "us max " << mWaitUs.GetMax() << "us";
+}
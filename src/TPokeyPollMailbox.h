@@ -0,0 +1,102 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <functional>
+#include "TPokeyMetrics.h"
+
+
+class TPokeyMeta;
+
+
+//	a board's poll reply waiting to be applied. Replies that arrive before it's applied replace it,
+//	but every pin that rose or fell on the way is kept, so a press that came and went between two
+//	applies still happens. Each edge keeps the time of the reply it arrived in, so a replayed press
+//	is stamped when it happened rather than when the mail was applied
+class TPokeyPollMail
+{
+public:
+	TPokeyPollMail() :
+		mPins			( 0 ),
+		mPinCount		( 0 ),
+		mBasePins		( 0 ),
+		mRose			( 0 ),
+		mFell			( 0 ),
+		mRxTimeNs		( 0 ),
+		mFellRxTimeNs	( 0 ),
+		mRoseRxTimeNs	( 0 ),
+		mDecodeTimeNs	( 0 ),
+		mPostTimeNs		( 0 ),
+		mOutputsFailed	( false ),
+		mReplies		( 0 )
+	{
+	}
+
+	void			GetSteps(ArrayBridge<uint64>&& Steps,ArrayBridge<uint64>&& StepTimesNs) const;	//	pins to apply in order, ending with mPins, and the rx time of each
+
+public:
+	uint64			mPins;			//	newest reply
+	size_t			mPinCount;
+	uint64			mBasePins;		//	as last applied
+	uint64			mRose;			//	since mBasePins, across every reply
+	uint64			mFell;
+	uint64			mRxTimeNs;		//	newest reply's
+	uint64			mFellRxTimeNs;	//	first reply a pin fell in
+	uint64			mRoseRxTimeNs;	//	newest reply a pin rose in
+	uint64			mDecodeTimeNs;
+	uint64			mPostTimeNs;	//	first reply's, how long the mail's been waiting
+	bool			mOutputsFailed;	//	any reply's
+	uint32			mReplies;		//	folded into this one
+};
+
+
+//	single-slot mailbox per board between the channel threads and the pin state. Channels only post,
+//	so a slow handler (a big list reply, a burst of logging) never backs up their replies; this thread
+//	applies the newest one per board, so latency is bounded at one sample however far behind it got
+class TPokeyPollMailbox : public SoyWorkerThread
+{
+public:
+	typedef std::function<void(TPokeyMeta&,const TPokeyPollMail&,const ArrayBridge<uint64>&,const ArrayBridge<uint64>&)>	TOnMail;	//	mail, its steps and their times
+
+public:
+	TPokeyPollMailbox(const std::string& Name,TOnMail OnMail);
+	virtual ~TPokeyPollMailbox();
+
+	void			Post(std::shared_ptr<TPokeyMeta>& Pokey,uint64 Pins,size_t PinCount,uint64 RxTimeNs,uint64 DecodeTimeNs,bool OutputsFailed);
+	virtual bool	Iteration() override;
+	virtual bool	CanSleep() override;
+	void			GetStatus(std::ostream& Status);
+
+private:
+	class TSlot
+	{
+	public:
+		TSlot() :
+			mPending	( false ),
+			mLastPins	( 0 )
+		{
+		}
+
+	public:
+		std::weak_ptr<TPokeyMeta>	mOwner;		//	state slots are reused by new boards; compared by owner, so a new board at a freed address isn't mistaken for the old one
+		std::shared_ptr<TPokeyMeta>	mPokey;		//	held only while mail is pending
+		TPokeyPollMail	mMail;
+		bool			mPending;
+		uint64			mLastPins;	//	newest posted
+	};
+
+public:
+	const std::string	mName;
+
+private:
+	TOnMail			mOnMail;
+	std::mutex		mLock;
+	Array<TSlot>	mSlots;			//	by board state slot
+	Array<size_t>	mPendingSlots;	//	in the order their mail arrived
+	Array<size_t>	mTakenSlots;	//	only touched on this thread
+
+	std::atomic<uint64>	mPostCount;
+	std::atomic<uint64>	mAppliedCount;
+	std::atomic<uint64>	mCoalescedCount;	//	replies replaced before they were applied
+	std::atomic<uint64>	mReplayedCount;		//	extra steps applied so in-between edges weren't lost
+	TPokeyHistogram	mWaitUs;		//	first post to applied
+};
@@ -0,0 +1,206 @@
+#include "TPokeyPollTimer.h"
+#include "TProtocolPokey.h"
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+TPokeyPollTimerParams::TPokeyPollTimerParams() :
+	mMode		( "sleep" ),
+	mSpinUs		( 200 ),
+	mPriority	( 0 ),
+	mCpu		( -1 ),
+	mUseTimerFd	( false )
+{
+}
+
+void TPokeyPollTimerParams::Read(const TJobParams& Params,const std::string& Prefix)
+{
+	mMode = Params.GetParamAsWithDefault<std::string>(Prefix + "pollmode", mMode );
+	mSpinUs = Params.GetParamAsWithDefault<int>(Prefix + "pollspinus", mSpinUs );
+	mPriority = Params.GetParamAsWithDefault<int>(Prefix + "pollpriority", mPriority );
+	mCpu = Params.GetParamAsWithDefault<int>(Prefix + "pollcpu", mCpu );
+	mUseTimerFd = Params.GetParamAsWithDefault<int>(Prefix + "polltimerfd", mUseTimerFd ? 1 : 0 ) != 0;
+}
+
+
+TPokeyPollTimer::TPokeyPollTimer(const TPokeyPollTimerParams& Params) :
+	mParams			( Params ),
+	mNextDeadlineNs	( 0 ),
+	mIntervalNs		( 0 ),
+	mTimerFd		( -1 )
+#if defined(__linux__)
+	,mThread			( pthread_self() ),
+	mOldTimerSlack		( -1 ),
+	mRestoreScheduler	( false ),
+	mOldPolicy			( SCHED_OTHER ),
+	mRestoreAffinity	( false )
+#endif
+{
+	ApplyThreadParams();
+}
+
+TPokeyPollTimer::~TPokeyPollTimer()
+{
+	RestoreThreadParams();
+#if defined(__linux__)
+	if ( mTimerFd != -1 )
+		close( mTimerFd );
+#endif
+}
+
+void TPokeyPollTimer::ApplyThreadParams()
+{
+	std::stringstream Error;
+#if defined(__linux__)
+	//	default 50us of slack is most of our budget
+	mOldTimerSlack = prctl( PR_GET_TIMERSLACK, 0, 0, 0, 0 );
+	prctl( PR_SET_TIMERSLACK, 1, 0, 0, 0 );
+
+	if ( mParams.mPriority > 0 )
+	{
+		mRestoreScheduler = ( pthread_getschedparam( pthread_self(), &mOldPolicy, &mOldSchedParam ) == 0 );
+		sched_param Param;
+		memset( &Param, 0, sizeof(Param) );
+		Param.sched_priority = mParams.mPriority;
+		auto Result = pthread_setschedparam( pthread_self(), SCHED_FIFO, &Param );
+		if ( Result != 0 )
+			Error << "SCHED_FIFO " << mParams.mPriority << " failed (" << Result << ", needs CAP_SYS_NICE or rtprio limit); ";
+	}
+
+	if ( mParams.mCpu >= 0 )
+	{
+		mRestoreAffinity = ( pthread_getaffinity_np( pthread_self(), sizeof(mOldCpus), &mOldCpus ) == 0 );
+		cpu_set_t Cpus;
+		CPU_ZERO( &Cpus );
+		CPU_SET( mParams.mCpu, &Cpus );
+		auto Result = pthread_setaffinity_np( pthread_self(), sizeof(Cpus), &Cpus );
+		if ( Result != 0 )
+			Error << "affinity to cpu " << mParams.mCpu << " failed (" << Result << "); ";
+	}
+
+	if ( mParams.mUseTimerFd )
+	{
+		mTimerFd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+		if ( mTimerFd == -1 )
+			Error << "timerfd_create failed errno " << errno << ", using clock_nanosleep; ";
+	}
+#else
+	if ( mParams.mPriority > 0 || mParams.mCpu >= 0 || mParams.mUseTimerFd )
+		Error << "poll priority, affinity and timerfd are linux only; ";
+#endif
+
+	mSetupError = Error.str();
+	if ( !mSetupError.empty() )
+		std::Debug << "poll timer: " << mSetupError << std::endl;
+}
+
+void TPokeyPollTimer::RestoreThreadParams()
+{
+#if defined(__linux__)
+	//	someone else's thread (or one that's gone) isn't ours to change
+	if ( !pthread_equal( mThread, pthread_self() ) )
+		return;
+
+	if ( mRestoreScheduler )
+		pthread_setschedparam( pthread_self(), mOldPolicy, &mOldSchedParam );
+	if ( mRestoreAffinity )
+		pthread_setaffinity_np( pthread_self(), sizeof(mOldCpus), &mOldCpus );
+	if ( mOldTimerSlack > 0 )
+		prctl( PR_SET_TIMERSLACK, mOldTimerSlack, 0, 0, 0 );
+#endif
+}
+
+void TPokeyPollTimer::Wait(uint64 IntervalNs)
+{
+	auto NowNs = Soy::GetMonotonicNs();
+	auto SpinNs = static_cast<uint64>( std::max( 0, mParams.mSpinUs ) ) * 1000;
+
+	//	first wait, interval changed, or we fell more than a whole interval behind; restart the
+	//	schedule from now rather than firing a burst of polls to catch up
+	bool Reschedule = ( mNextDeadlineNs == 0 || IntervalNs != mIntervalNs || NowNs > mNextDeadlineNs + IntervalNs );
+	if ( Reschedule )
+	{
+		mIntervalNs = IntervalNs;
+		mNextDeadlineNs = NowNs + IntervalNs;
+	}
+
+	auto DeadlineNs = mNextDeadlineNs;
+	mNextDeadlineNs += IntervalNs;
+
+	if ( !( mTimerFd != -1 && WaitTimerFd( IntervalNs ) ) )
+	{
+		if ( DeadlineNs > NowNs + SpinNs )
+			SleepUntil( DeadlineNs - SpinNs );
+	}
+
+	//	the scheduler can't be trusted for the last bit
+	while ( Soy::GetMonotonicNs() < DeadlineNs )
+	{
+	}
+}
+
+bool TPokeyPollTimer::WaitTimerFd(uint64 IntervalNs)
+{
+#if defined(__linux__)
+	auto SpinNs = static_cast<uint64>( std::max( 0, mParams.mSpinUs ) ) * 1000;
+
+	//	mNextDeadlineNs has already moved on, the one we're waiting for is an interval back
+	auto DeadlineNs = mNextDeadlineNs - IntervalNs;
+	auto FireNs = ( DeadlineNs > SpinNs ) ? DeadlineNs - SpinNs : DeadlineNs;
+
+	//	absolute one-shot each time; keeps the same deadlines as the sleep path when the interval
+	//	or schedule changes, and a missed expiry can't queue up a burst
+	itimerspec Spec;
+	memset( &Spec, 0, sizeof(Spec) );
+	Spec.it_value.tv_sec = FireNs / 1000000000;
+	Spec.it_value.tv_nsec = FireNs % 1000000000;
+	if ( timerfd_settime( mTimerFd, TFD_TIMER_ABSTIME, &Spec, nullptr ) != 0 )
+		return false;
+
+	uint64 Expirations = 0;
+	while ( read( mTimerFd, &Expirations, sizeof(Expirations) ) < 0 && errno == EINTR )
+	{
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void TPokeyPollTimer::SleepUntil(uint64 TimeNs)
+{
+#if defined(__linux__)
+	//	steady_clock is CLOCK_MONOTONIC on linux, so the same times as GetMonotonicNs
+	timespec Time;
+	Time.tv_sec = TimeNs / 1000000000;
+	Time.tv_nsec = TimeNs % 1000000000;
+	while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &Time, nullptr ) == EINTR )
+	{
+	}
+#else
+	auto NowNs = Soy::GetMonotonicNs();
+	if ( TimeNs > NowNs )
+		std::this_thread::sleep_for( std::chrono::nanoseconds( TimeNs - NowNs ) );
+#endif
+}
+
+void TPokeyPollTimer::GetStatus(std::ostream& Status)
+{
+	Status << "poll timer " << mParams.mMode << " " << (mIntervalNs / 1000) << "us spin " << mParams.mSpinUs << "us";
+	Status << ( mTimerFd != -1 ? " timerfd" : " clock_nanosleep" );
+	if ( mParams.mPriority > 0 )
+		Status << " fifo " << mParams.mPriority;
+	if ( mParams.mCpu >= 0 )
+		Status << " cpu " << mParams.mCpu;
+	if ( !mSetupError.empty() )
+		Status << " (" << mSetupError << ")";
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+class TPokeyPollTimerParams
+{
+public:
+	TPokeyPollTimerParams();
+
+	void			Read(const TJobParams& Params,const std::string& Prefix=std::string());	//	Prefix+"pollmode" etc, for a second poll thread
+	bool			IsRealtime() const	{	return mMode == "rt";	}
+
+public:
+	std::string		mMode;			//	sleep (worker thread sleep, drifts) or rt (absolute deadlines)
+	int				mSpinUs;		//	wake this early and spin to the deadline
+	int				mPriority;		//	SCHED_FIFO priority, 0 to leave the thread alone
+	int				mCpu;			//	pin the poll thread to this cpu, -1 for any
+	bool			mUseTimerFd;	//	periodic timerfd rather than clock_nanosleep
+};
+
+
+//	waits for absolute poll deadlines so the interval doesn't drift with how long a poll took or
+//	how late the scheduler woke us. Sleeps to just before the deadline then spins the rest.
+//	Must be created, used and destroyed on the thread it's timing; priority and affinity apply to that
+//	thread and are put back when it goes, so switching back to sleep mode leaves a normal thread
+class TPokeyPollTimer
+{
+public:
+	TPokeyPollTimer(const TPokeyPollTimerParams& Params);
+	~TPokeyPollTimer();
+
+	void			Wait(uint64 IntervalNs);	//	returns at the next deadline
+	void			GetStatus(std::ostream& Status);
+
+private:
+	void			ApplyThreadParams();
+	void			RestoreThreadParams();
+	void			SleepUntil(uint64 TimeNs);
+	bool			WaitTimerFd(uint64 IntervalNs);
+
+public:
+	const TPokeyPollTimerParams	mParams;
+	std::string		mSetupError;		//	anything that didn't apply; we still run, just with more jitter
+
+private:
+	uint64			mNextDeadlineNs;
+	uint64			mIntervalNs;
+	int				mTimerFd;
+
+#if defined(__linux__)
+	pthread_t		mThread;
+	int				mOldTimerSlack;		//	-1 if unchanged
+	bool			mRestoreScheduler;
+	int				mOldPolicy;
+	sched_param		mOldSchedParam;
+	bool			mRestoreAffinity;
+	cpu_set_t		mOldCpus;
+#endif
+};
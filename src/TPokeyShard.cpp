@@ -0,0 +1,403 @@
+#include "TPokeyShard.h"
+#include <RemoteArray.h>
+
+#if !defined(TARGET_WINDOWS)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#endif
+
+
+#if !defined(TARGET_WINDOWS)
+namespace
+{
+	//	subnet broadcast of the interface with this address, empty if it has none
+	std::string GetInterfaceBroadcast(const in_addr& InterfaceAddress)
+	{
+		ifaddrs* Interfaces = nullptr;
+		if ( getifaddrs( &Interfaces ) != 0 )
+			return std::string();
+
+		std::string Broadcast;
+		for ( auto* Interface=Interfaces;	Interface;	Interface=Interface->ifa_next )
+		{
+			if ( !Interface->ifa_addr || Interface->ifa_addr->sa_family != AF_INET )
+				continue;
+			if ( !(Interface->ifa_flags & IFF_BROADCAST) || !Interface->ifa_broadaddr )
+				continue;
+			auto& Address = reinterpret_cast<sockaddr_in*>( Interface->ifa_addr )->sin_addr;
+			if ( Address.s_addr != InterfaceAddress.s_addr )
+				continue;
+			char String[INET_ADDRSTRLEN];
+			if ( inet_ntop( AF_INET, &reinterpret_cast<sockaddr_in*>( Interface->ifa_broadaddr )->sin_addr, String, sizeof(String) ) )
+				Broadcast = String;
+			break;
+		}
+		freeifaddrs( Interfaces );
+		return Broadcast;
+	}
+}
+#endif
+
+
+TPokeyZoneDiscoverThread::TPokeyZoneDiscoverThread(const std::string& InterfaceAddress,const std::string& BroadcastAddress) :
+	SoyWorkerThread		( Soy::GetTypeName(*this), SoyWorkerWaitMode::Sleep ),
+	mEnabled			( true ),
+	mInterfaceAddress	( InterfaceAddress ),
+	mBroadcastAddress	( BroadcastAddress ),
+	mSocket				( -1 ),
+	mLastBroadcastMs	( 0 )
+{
+}
+
+TPokeyZoneDiscoverThread::~TPokeyZoneDiscoverThread()
+{
+	Stop();
+	WaitToFinish();
+#if !defined(TARGET_WINDOWS)
+	if ( mSocket != -1 )
+		close( mSocket );
+#endif
+}
+
+bool TPokeyZoneDiscoverThread::Init(std::stringstream& Error)
+{
+#if defined(TARGET_WINDOWS)
+	Error << "zone discovery is not supported on windows";
+	return false;
+#else
+	mSocket = socket( AF_INET, SOCK_DGRAM, 0 );
+	if ( mSocket == -1 )
+	{
+		Error << "failed to create discovery socket errno " << errno;
+		return false;
+	}
+	int Enable = 1;
+	setsockopt( mSocket, SOL_SOCKET, SO_BROADCAST, &Enable, sizeof(Enable) );
+
+	//	binding to the interface's address gets the replies from that nic. Linux routes the limited
+	//	broadcast (255.255.255.255) out of the default route whatever it's bound to, so discovery goes
+	//	to the interface's subnet broadcast
+	sockaddr_in Address;
+	memset( &Address, 0, sizeof(Address) );
+	Address.sin_family = AF_INET;
+	Address.sin_port = 0;
+	if ( inet_pton( AF_INET, mInterfaceAddress.c_str(), &Address.sin_addr ) != 1 )
+	{
+		Error << "bad interface address " << mInterfaceAddress;
+		return false;
+	}
+	if ( mBroadcastAddress.empty() )
+		mBroadcastAddress = GetInterfaceBroadcast( Address.sin_addr );
+	in_addr BroadcastAddress;
+	if ( mBroadcastAddress.empty() || inet_pton( AF_INET, mBroadcastAddress.c_str(), &BroadcastAddress ) != 1 )
+	{
+		Error << "no subnet broadcast for " << mInterfaceAddress << ( mBroadcastAddress.empty() ? "" : " (bad " + mBroadcastAddress + ")" ) << ", set broadcast=";
+		return false;
+	}
+	if ( BroadcastAddress.s_addr == INADDR_BROADCAST )
+	{
+		Error << "broadcast=255.255.255.255 goes out of the default route, not " << mInterfaceAddress << "; use its subnet broadcast";
+		return false;
+	}
+	if ( bind( mSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address) ) != 0 )
+	{
+		Error << "failed to bind discovery to " << mInterfaceAddress << " errno " << errno;
+		return false;
+	}
+	fcntl( mSocket, F_SETFL, O_NONBLOCK );
+
+	Start();
+	return true;
+#endif
+}
+
+bool TPokeyZoneDiscoverThread::Iteration()
+{
+	if ( mSocket == -1 )
+		return true;
+
+	Recv();
+
+	//	every 2 secs like the default discovery
+	auto NowMs = Soy::GetMonotonicMs();
+	if ( mEnabled && NowMs - mLastBroadcastMs >= 2000 )
+	{
+		mLastBroadcastMs = NowMs;
+		Broadcast();
+	}
+	return true;
+}
+
+void TPokeyZoneDiscoverThread::Broadcast()
+{
+#if !defined(TARGET_WINDOWS)
+	sockaddr_in Address;
+	memset( &Address, 0, sizeof(Address) );
+	Address.sin_family = AF_INET;
+	Address.sin_port = htons( 20055 );
+	inet_pton( AF_INET, mBroadcastAddress.c_str(), &Address.sin_addr );
+
+	//	same single byte TProtocolPokey sends for discovery
+	unsigned char Hello = 0xff;
+	sendto( mSocket, &Hello, 1, 0, reinterpret_cast<sockaddr*>(&Address), sizeof(Address) );
+#endif
+}
+
+void TPokeyZoneDiscoverThread::Recv()
+{
+#if !defined(TARGET_WINDOWS)
+	unsigned char Buffer[100];
+	while ( true )
+	{
+		auto Read = recv( mSocket, Buffer, sizeof(Buffer), 0 );
+		if ( Read <= 0 )
+			break;
+
+		BufferArray<unsigned char,100> Data;
+		GetArrayBridge(Data).PushBackArray( GetRemoteArray( Buffer, Read ) );
+		if ( Data.GetSize() < 14 || Data.GetSize() < TProtocolPokey::GetDiscoveryReplySize( GetArrayBridge(Data) ) )
+			continue;
+
+		TJob Job;
+		if ( !mProtocol.DecodeDiscovery( Job, GetArrayBridge(Data) ) )
+			continue;
+		mOnDiscovery.OnTriggered( Job );
+	}
+#endif
+}
+
+
+
+TPokeyShard::TPokeyShard(const std::string& Name,size_t Index,size_t MergeInput,TPokeyEventMerger& Merger,TChannelManager& Channels,int PollIntervalMs) :
+	mName		( Name ),
+	mIndex		( Index ),
+	mMergeInput	( MergeInput ),
+	mMerger		( Merger )
+{
+	mPollThread.reset( new TPollPokeyThread( *this, Channels, "zone/" + Name ) );
+	mPollThread->mPollIntervalMs = PollIntervalMs;
+}
+
+TPokeyShard::~TPokeyShard()
+{
+	Stop();
+}
+
+void TPokeyShard::Stop()
+{
+	if ( mPollThread )
+	{
+		mPollThread->Stop();
+		mPollThread->WaitToFinish();
+		mPollThread.reset();
+	}
+	mDiscoverThread.reset();
+	
+	if ( mPollMailbox )
+	{
+		mPollMailbox->Stop();
+		mPollMailbox->WaitToFinish();
+	}
+}
+
+void TPokeyShard::OnPrePoll()
+{
+	//	don't leave held events waiting for an input that's gone quiet
+	mMerger.Release( Soy::GetMonotonicNs() );
+}
+
+bool TPokeyShard::StartDiscovery(const std::string& InterfaceAddress,const std::string& BroadcastAddress,std::stringstream& Error)
+{
+	mInterfaceAddress = InterfaceAddress;
+	mDiscoverThread.reset( new TPokeyZoneDiscoverThread( InterfaceAddress, BroadcastAddress ) );
+	if ( !mDiscoverThread->Init( Error ) )
+	{
+		mDiscoverThread.reset();
+		return false;
+	}
+	return true;
+}
+
+void TPokeyShard::AddPokey(std::shared_ptr<TPokeyMeta> Pokey)
+{
+	std::lock_guard<std::mutex> Lock( mPokeysLock );
+	for ( int i=0;	i<mPokeys.GetSize();	i++ )
+	{
+		if ( mPokeys[i] == Pokey )
+			return;
+	}
+	mPokeys.PushBack( Pokey );
+}
+
+void TPokeyShard::RemovePokey(int Serial)
+{
+	std::lock_guard<std::mutex> Lock( mPokeysLock );
+	for ( int i=mPokeys.GetSize()-1;	i>=0;	i-- )
+	{
+		if ( mPokeys[i]->mSerial == Serial )
+			mPokeys.RemoveBlock( i, 1 );
+	}
+}
+
+void TPokeyShard::GetStatus(std::ostream& Status)
+{
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	GetPokeys( GetArrayBridge(Pokeys) );
+
+	Status << "zone " << mName;
+	if ( !mInterfaceAddress.empty() )
+		Status << " on " << mInterfaceAddress;
+	Status << ": " << Pokeys.GetSize() << " pokeys";
+	for ( int i=0;	i<Pokeys.GetSize();	i++ )
+		Status << " " << Pokeys[i]->mSerial;
+	if ( mPollThread )
+	{
+		Status << "; ";
+		mPollThread->GetTimerStatus( Status );
+	}
+	if ( mPollMailbox )
+	{
+		Status << "; ";
+		mPollMailbox->GetStatus( Status );
+	}
+}
+
+
+TPokeyLaserGatePoller::TPokeyLaserGatePoller(TPokeyManager& Registry,TChannelManager& Channels,int PollIntervalMs,const TPokeyPollTimerParams& TimerParams) :
+	mReplyTimeoutNs	( 50 * 1000000ull ),
+	mRegistry		( Registry ),
+	mChannels		( Channels ),
+	mPollIntervalMs	( std::max( 1, PollIntervalMs ) ),
+	mTimerParams	( TimerParams ),
+	mPolling		( false ),
+	mGatePokeysNs	( 0 ),
+	mPollCount		( 0 ),
+	mTimeoutCount	( 0 )
+{
+}
+
+TPokeyLaserGatePoller::~TPokeyLaserGatePoller()
+{
+	Stop();
+}
+
+void TPokeyLaserGatePoller::Stop()
+{
+	if ( mPollThread )
+	{
+		mPollThread->Stop();
+		mPollThread->WaitToFinish();
+		mPollThread.reset();
+	}
+	mPolling = false;
+}
+
+void TPokeyLaserGatePoller::Update()
+{
+	if ( mPolling )
+		return;
+
+	//	cheap enough to do every poll: one mask per board, no pokey touched
+	auto& States = TPokeyBoardStates::Get();
+	bool HasGate = false;
+	for ( size_t s=0;	!HasGate && s<States.GetSlotCount();	s++ )
+	{
+		auto& State = States.GetState( s );
+		HasGate = State.mInUse && State.mLaserGatePins;
+	}
+	if ( !HasGate )
+		return;
+
+	mPollThread.reset( new TPollPokeyThread( *this, mChannels, "lasergate" ) );
+	mPollThread->mPollIntervalMs = mPollIntervalMs;
+	mPollThread->SetTimerParams( mTimerParams );
+	mPolling = true;
+	std::Debug << "polling laser gates every " << mPollIntervalMs << "ms (" << mTimerParams.mMode << ")" << std::endl;
+}
+
+bool TPokeyLaserGatePoller::IsGatePokey(const TPokeyMeta& Pokey) const
+{
+	//	zoned and remote gates stay with whoever polls them
+	return Pokey.GetState().mLaserGatePins && Pokey.mShard == -1 && Pokey.mRemote == -1;
+}
+
+void TPokeyLaserGatePoller::OnPrePoll()
+{
+	auto NowNs = Soy::GetMonotonicNs();
+
+	//	the registry can be big; gate boards come and go rarely
+	if ( NowNs - mGatePokeysNs > 250 * 1000000ull )
+	{
+		mGatePokeysNs = NowNs;
+		Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+		mRegistry.GetPokeys( GetArrayBridge(Pokeys) );
+		std::lock_guard<std::mutex> Lock( mPokeysLock );
+		mPokeys.Clear();
+		for ( int i=0;	i<Pokeys.GetSize();	i++ )
+		{
+			if ( Pokeys[i] && IsGatePokey( *Pokeys[i] ) )
+				mPokeys.PushBack( Pokeys[i] );
+		}
+	}
+
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	GetPokeys( GetArrayBridge(Pokeys) );
+
+	mPollList.Clear();
+	std::lock_guard<std::mutex> Lock( mInFlightLock );
+	for ( int i=0;	i<Pokeys.GetSize();	i++ )
+	{
+		auto& Pokey = *Pokeys[i];
+		if ( Pokey.mIgnored || !IsGatePokey( Pokey ) )
+			continue;
+		auto Channel = mChannels.GetChannel( Pokey.GetChannelRef() );
+		if ( !Channel || !Channel->IsConnected() )
+			continue;
+
+		auto InFlight = mInFlight.find( Pokey.mSerial );
+		if ( InFlight != mInFlight.end() )
+		{
+			if ( NowNs - InFlight->second < mReplyTimeoutNs )
+				continue;
+			mTimeoutCount++;
+		}
+		mInFlight[Pokey.mSerial] = NowNs;
+		mPollList.PushBack( Pokeys[i] );
+		mPollCount++;
+	}
+}
+
+void TPokeyLaserGatePoller::GetPollPokeys(ArrayBridge<std::shared_ptr<TPokeyMeta>>&& Pokeys)
+{
+	Pokeys.Copy( mPollList );
+}
+
+void TPokeyLaserGatePoller::OnReply(const TPokeyMeta& Pokey,uint64 RxTimeNs)
+{
+	std::lock_guard<std::mutex> Lock( mInFlightLock );
+	auto InFlight = mInFlight.find( Pokey.mSerial );
+	if ( InFlight == mInFlight.end() )
+		return;
+	if ( RxTimeNs > InFlight->second )
+		mRoundTripUs.Record( (RxTimeNs - InFlight->second) / 1000 );
+	mInFlight.erase( InFlight );
+}
+
+void TPokeyLaserGatePoller::GetStatus(std::ostream& Status)
+{
+	if ( !mPolling )
+	{
+		Status << "laser gate poll waiting for a gate board";
+		return;
+	}
+	Array<std::shared_ptr<TPokeyMeta>> Pokeys;
+	GetPokeys( GetArrayBridge(Pokeys) );
+	Status << "laser gate poll every " << mPollIntervalMs << "ms: " << Pokeys.GetSize() << " boards, " << mPollCount.load() << " polls, " << mTimeoutCount.load() << " timeouts, round trip p50 " << mRoundTripUs.GetPercentile(50) << "us p99 " << mRoundTripUs.GetPercentile(99) << "us; ";
+	mPollThread->GetTimerStatus( Status );
+}
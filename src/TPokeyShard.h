@@ -0,0 +1,109 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+#include <TChannel.h>
+#include <map>
+#include "PopPokey.h"
+
+
+//	broadcasts discovery out of one interface and reports the replies, so a zone on its own
+//	vlan/nic finds its pokeys without the default broadcast channel
+class TPokeyZoneDiscoverThread : public SoyWorkerThread
+{
+public:
+	TPokeyZoneDiscoverThread(const std::string& InterfaceAddress,const std::string& BroadcastAddress);
+	virtual ~TPokeyZoneDiscoverThread();
+
+	bool			Init(std::stringstream& Error);
+	virtual bool	Iteration() override;
+	virtual std::chrono::milliseconds	GetSleepDuration()	{	return std::chrono::milliseconds(100);	}
+
+private:
+	void			Broadcast();
+	void			Recv();
+
+public:
+	SoyEvent<TJob>	mOnDiscovery;		//	Re:Discover jobs, same as the broadcast channel makes
+	bool			mEnabled;
+
+private:
+	std::string		mInterfaceAddress;
+	std::string		mBroadcastAddress;
+	int				mSocket;
+	uint64			mLastBroadcastMs;
+	TProtocolPokey	mProtocol;
+};
+
+
+//	one zone of the floor; its own partition of the pokeys, its own poll thread and its own input to
+//	the event merger, so one zone's network trouble doesn't hold up the others
+class TPokeyShard : public TPokeyManager
+{
+public:
+	TPokeyShard(const std::string& Name,size_t Index,size_t MergeInput,TPokeyEventMerger& Merger,TChannelManager& Channels,int PollIntervalMs);
+	virtual ~TPokeyShard();
+
+	virtual void	OnPrePoll() override;
+
+	bool			StartDiscovery(const std::string& InterfaceAddress,const std::string& BroadcastAddress,std::stringstream& Error);	//	empty broadcast for the interface's subnet broadcast
+	void			AddPokey(std::shared_ptr<TPokeyMeta> Pokey);
+	void			RemovePokey(int Serial);
+	void			Stop();
+	void			GetStatus(std::ostream& Status);
+
+public:
+	const std::string	mName;
+	const size_t		mIndex;
+	const size_t		mMergeInput;
+	std::string			mInterfaceAddress;
+	std::shared_ptr<TPollPokeyThread>			mPollThread;
+	std::shared_ptr<TPokeyZoneDiscoverThread>	mDiscoverThread;
+	std::shared_ptr<TPokeyPollMailbox>			mPollMailbox;	//	set if replies are coalesced; stopped but kept, channels may still post
+
+private:
+	TPokeyEventMerger&	mMerger;
+};
+
+
+//	polls boards with a gate pin on their own thread, so their rate isn't tied to the floor's poll.
+//	Only one poll is in flight per board; the next goes out on the first tick after the reply, so a
+//	board is polled as fast as it answers, up to the tick rate, and a slow one isn't flooded.
+//	Starts when the first gate board shows up; until then the main poll thread has them.
+//	mPokeys is the gate boards, refreshed from the registry every so often
+class TPokeyLaserGatePoller : public TPokeyManager
+{
+public:
+	TPokeyLaserGatePoller(TPokeyManager& Registry,TChannelManager& Channels,int PollIntervalMs,const TPokeyPollTimerParams& TimerParams);
+	virtual ~TPokeyLaserGatePoller();
+
+	virtual void	OnPrePoll() override;
+	virtual void	GetPollPokeys(ArrayBridge<std::shared_ptr<TPokeyMeta>>&& Pokeys) override;
+
+	void			Update();				//	starts polling once there's a gate board
+	bool			IsPolling() const		{	return mPolling;	}
+	bool			IsGatePokey(const TPokeyMeta& Pokey) const;
+	void			OnReply(const TPokeyMeta& Pokey,uint64 RxTimeNs);
+	void			Stop();
+	void			GetStatus(std::ostream& Status);
+
+public:
+	uint64			mReplyTimeoutNs;		//	poll again if a reply hasn't come back by now
+
+private:
+	TPokeyManager&		mRegistry;
+	TChannelManager&	mChannels;
+	const int			mPollIntervalMs;
+	const TPokeyPollTimerParams	mTimerParams;
+	std::shared_ptr<TPollPokeyThread>	mPollThread;
+	std::atomic<bool>	mPolling;
+	uint64				mGatePokeysNs;		//	when mPokeys was last refreshed from the registry
+
+	std::mutex			mInFlightLock;
+	std::map<int,uint64>	mInFlight;		//	serial -> poll sent time
+	Array<std::shared_ptr<TPokeyMeta>>	mPollList;	//	this tick, only touched on the poll thread
+
+	std::atomic<uint64>	mPollCount;
+	std::atomic<uint64>	mTimeoutCount;
+	TPokeyHistogram		mRoundTripUs;
+};
@@ -0,0 +1,610 @@
+#include "TPokeySimulator.h"
+#include "TProtocolPokey.h"
+#include <SoyString.h>
+#include <fstream>
+
+#if !defined(TARGET_WINDOWS)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+TPokeySimulatorParams::TPokeySimulatorParams() :
+	mDeviceCount	( 15 ),
+	mSerialBase		( 30000 ),
+	mPort			( 20055 ),
+	mProtocol		( "mixed" ),
+	mPattern		( "random" ),
+	mPressRate		( 0.2f ),
+	mPressDuration	( 0.3f ),
+	mLatencyMs		( 1 ),
+	mJitterMs		( 0 ),
+	mLossChance		( 0 ),
+	mCorruptChance	( 0 ),
+	mHangChance		( 0 ),
+	mHangMs			( 3000 ),
+	mSeed			( 1234 )
+{
+}
+
+void TPokeySimulatorParams::Read(const TJobParams& Params)
+{
+	mDeviceCount = Params.GetParamAsWithDefault<int>("simulate", mDeviceCount );
+	mSerialBase = Params.GetParamAsWithDefault<int>("serialbase", mSerialBase );
+	mPort = Params.GetParamAsWithDefault<int>("port", mPort );
+	mProtocol = Params.GetParamAsWithDefault<std::string>("protocol", mProtocol );
+	mPattern = Params.GetParamAsWithDefault<std::string>("pattern", mPattern );
+	mScriptFilename = Params.GetParamAsWithDefault<std::string>("script", mScriptFilename );
+	mPressRate = Params.GetParamAsWithDefault<float>("pressrate", mPressRate );
+	mPressDuration = Params.GetParamAsWithDefault<float>("pressduration", mPressDuration );
+	mLatencyMs = Params.GetParamAsWithDefault<int>("latency", mLatencyMs );
+	mJitterMs = Params.GetParamAsWithDefault<int>("jitter", mJitterMs );
+	mLossChance = Params.GetParamAsWithDefault<float>("loss", mLossChance );
+	mCorruptChance = Params.GetParamAsWithDefault<float>("corrupt", mCorruptChance );
+	mHangChance = Params.GetParamAsWithDefault<float>("hang", mHangChance );
+	mHangMs = Params.GetParamAsWithDefault<int>("hangms", mHangMs );
+	mSeed = Params.GetParamAsWithDefault<int>("seed", mSeed );
+	mAddressCacheFilename = Params.GetParamAsWithDefault<std::string>("writecache", mAddressCacheFilename );
+
+	if ( !mScriptFilename.empty() )
+		mPattern = "script";
+}
+
+
+TPokeySimulator::TPokeySimulator(const TPokeySimulatorParams& Params) :
+	SoyWorkerThread		( "TPokeySimulator", SoyWorkerWaitMode::NoWait ),
+	mParams				( Params ),
+	mDiscoverySocket	( -1 ),
+	mScriptPosition		( 0 ),
+	mStartMs			( Soy::GetMonotonicMs() ),
+	mLastPinUpdateMs	( 0 ),
+	mRandom				( Params.mSeed ),
+	mDiscoveryCount		( 0 ),
+	mLostCount			( 0 ),
+	mCorruptCount		( 0 ),
+	mHangCount			( 0 )
+{
+}
+
+TPokeySimulator::~TPokeySimulator()
+{
+	Stop();
+	WaitToFinish();
+
+#if !defined(TARGET_WINDOWS)
+	for ( int i=0;	i<mDevices.GetSize();	i++ )
+	{
+		auto& Device = mDevices[i];
+		CloseClient( Device );
+		if ( Device.mListenSocket != -1 )
+			close( Device.mListenSocket );
+	}
+	if ( mDiscoverySocket != -1 )
+		close( mDiscoverySocket );
+#endif
+}
+
+std::string TPokeySimulator::GetDeviceIp(size_t Index)
+{
+	//	all of 127/8 routes to loopback on linux so every device gets its own address on the real pokey port
+	std::stringstream Ip;
+	Ip << "127.1." << (Index/250) << "." << (1+(Index%250));
+	return Ip.str();
+}
+
+float TPokeySimulator::GetRandom()
+{
+	return std::uniform_real_distribution<float>(0.f,1.f)( mRandom );
+}
+
+bool TPokeySimulator::Init(std::stringstream& Error)
+{
+#if defined(TARGET_WINDOWS)
+	Error << "pokey simulator is not supported on windows";
+	return false;
+#else
+	if ( mParams.mPattern == "script" && !LoadScript( Error ) )
+		return false;
+
+	//	one discovery socket answers for every device, like a switch full of pokeys would
+	mDiscoverySocket = socket( AF_INET, SOCK_DGRAM, 0 );
+	int Enable = 1;
+	setsockopt( mDiscoverySocket, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable) );
+#if defined(SO_REUSEPORT)
+	setsockopt( mDiscoverySocket, SOL_SOCKET, SO_REUSEPORT, &Enable, sizeof(Enable) );
+#endif
+	setsockopt( mDiscoverySocket, SOL_SOCKET, SO_BROADCAST, &Enable, sizeof(Enable) );
+
+	sockaddr_in DiscoveryAddress;
+	memset( &DiscoveryAddress, 0, sizeof(DiscoveryAddress) );
+	DiscoveryAddress.sin_family = AF_INET;
+	DiscoveryAddress.sin_addr.s_addr = htonl( INADDR_ANY );
+	DiscoveryAddress.sin_port = htons( mParams.mPort );
+	if ( bind( mDiscoverySocket, reinterpret_cast<sockaddr*>(&DiscoveryAddress), sizeof(DiscoveryAddress) ) != 0 )
+	{
+		Error << "failed to bind discovery socket to port " << mParams.mPort << " errno " << errno;
+		return false;
+	}
+	fcntl( mDiscoverySocket, F_SETFL, O_NONBLOCK );
+
+	static const char* Protocols[] = { "33.52", "49.13", "48.0" };
+
+	for ( int i=0;	i<mParams.mDeviceCount;	i++ )
+	{
+		auto& Device = mDevices.PushBack();
+		Device.mSerial = mParams.mSerialBase + i;
+		Device.mIp = GetDeviceIp( i );
+		Device.mVersion = ( mParams.mProtocol == "mixed" ) ? Protocols[i % sizeofarray(Protocols)] : mParams.mProtocol;
+		Device.mPressEndMs.SetSize( 55 );
+		for ( int p=0;	p<Device.mPressEndMs.GetSize();	p++ )
+			Device.mPressEndMs[p] = 0;
+
+		Device.mListenSocket = socket( AF_INET, SOCK_STREAM, 0 );
+		setsockopt( Device.mListenSocket, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable) );
+
+		sockaddr_in Address;
+		memset( &Address, 0, sizeof(Address) );
+		Address.sin_family = AF_INET;
+		inet_pton( AF_INET, Device.mIp.c_str(), &Address.sin_addr );
+		Address.sin_port = htons( mParams.mPort );
+		if ( bind( Device.mListenSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address) ) != 0 || listen( Device.mListenSocket, 1 ) != 0 )
+		{
+			Error << "failed to listen on " << Device.mIp << ":" << mParams.mPort << " errno " << errno;
+			return false;
+		}
+		fcntl( Device.mListenSocket, F_SETFL, O_NONBLOCK );
+	}
+
+	std::Debug << "simulating " << mDevices.GetSize() << " pokeys from " << GetDeviceIp(0) << " to " << GetDeviceIp(mDevices.GetSize()-1) << " (" << mParams.mPattern << " pins)" << std::endl;
+	return true;
+#endif
+}
+
+bool TPokeySimulator::LoadScript(std::stringstream& Error)
+{
+	//	each line; <ms> <serial or *> <pins as 0/1 string, pin 1 first>, loops when finished
+	Array<std::string> Lines;
+	if ( !Soy::FileToStringLines( mParams.mScriptFilename, GetArrayBridge(Lines), Error ) )
+		return false;
+
+	for ( int i=0;	i<Lines.GetSize();	i++ )
+	{
+		auto& Line = Lines[i];
+		if ( Line.empty() || Line[0] == '#' )
+			continue;
+
+		std::stringstream LineStream( Line );
+		TPokeySimulatorScriptStep Step;
+		std::string Serial;
+		std::string Pins;
+		LineStream >> Step.mTimeMs >> Serial >> Pins;
+		if ( LineStream.fail() )
+		{
+			Error << "bad script line " << (i+1) << ": " << Line;
+			return false;
+		}
+		Step.mSerial = ( Serial == "*" ) ? -1 : atoi( Serial.c_str() );
+		Step.mPins = 0;
+		for ( int p=0;	p<Pins.length() && p<55;	p++ )
+			if ( Pins[p] != '0' )
+				Step.mPins |= 1ull << p;
+		mScript.PushBack( Step );
+	}
+
+	if ( mScript.IsEmpty() )
+	{
+		Error << "script " << mParams.mScriptFilename << " has no steps";
+		return false;
+	}
+	return true;
+}
+
+void TPokeySimulatorDevice::SetPins(uint64 Pins)
+{
+	auto Changed = mPins ^ Pins;
+	for ( int p=0;	p<64;	p++ )
+		if ( Changed & (1ull << p) )
+			mEdgeCounts[p]++;
+	mPins = Pins;
+}
+
+void TPokeySimulator::UpdatePins(uint64 NowMs)
+{
+	auto ElapsedMs = NowMs - mStartMs;
+
+	if ( mParams.mPattern == "script" )
+	{
+		auto LoopMs = mScript.GetBack().mTimeMs + 1;
+		auto ScriptMs = ElapsedMs % LoopMs;
+
+		//	looped
+		if ( mScriptPosition > 0 && ScriptMs < mScript[mScriptPosition-1].mTimeMs )
+			mScriptPosition = 0;
+
+		while ( mScriptPosition < mScript.GetSize() && mScript[mScriptPosition].mTimeMs <= ScriptMs )
+		{
+			auto& Step = mScript[mScriptPosition++];
+			for ( int d=0;	d<mDevices.GetSize();	d++ )
+				if ( Step.mSerial == -1 || Step.mSerial == mDevices[d].mSerial )
+					mDevices[d].SetPins( Step.mPins );
+		}
+		return;
+	}
+
+	//	random presses of random lengths
+	float DeltaSecs = mLastPinUpdateMs ? (NowMs - mLastPinUpdateMs) / 1000.f : 0.f;
+	mLastPinUpdateMs = NowMs;
+	float PressChance = mParams.mPressRate * DeltaSecs;
+
+	for ( int d=0;	d<mDevices.GetSize();	d++ )
+	{
+		auto& Device = mDevices[d];
+		for ( int p=0;	p<Device.mPressEndMs.GetSize();	p++ )
+		{
+			if ( Device.mPressEndMs[p] != 0 && Device.mPressEndMs[p] <= NowMs )
+			{
+				Device.mPressEndMs[p] = 0;
+				Device.SetPins( Device.mPins & ~(1ull << p) );
+			}
+		}
+
+		if ( GetRandom() >= PressChance )
+			continue;
+
+		auto Pin = mRandom() % 55;
+		float Duration = mParams.mPressDuration * (0.5f + GetRandom());
+		Device.mPressEndMs[Pin] = NowMs + static_cast<uint64>( Duration * 1000.f );
+		Device.SetPins( Device.mPins | (1ull << Pin) );
+	}
+}
+
+bool TPokeySimulator::Iteration()
+{
+#if defined(TARGET_WINDOWS)
+	return false;
+#else
+	auto NowMs = Soy::GetMonotonicMs();
+	UpdatePins( NowMs );
+	SendDueReplies( NowMs );
+
+	Array<pollfd> Fds;
+	Array<int> FdDevices;		//	device index, -1 for discovery
+	Array<bool> FdIsListen;
+
+	{
+		auto& Fd = Fds.PushBack();
+		Fd.fd = mDiscoverySocket;
+		Fd.events = POLLIN;
+		FdDevices.PushBack( -1 );
+		FdIsListen.PushBack( false );
+	}
+	for ( int d=0;	d<mDevices.GetSize();	d++ )
+	{
+		auto& Device = mDevices[d];
+		auto& ListenFd = Fds.PushBack();
+		ListenFd.fd = Device.mListenSocket;
+		ListenFd.events = POLLIN;
+		FdDevices.PushBack( d );
+		FdIsListen.PushBack( true );
+
+		if ( Device.mClientSocket == -1 )
+			continue;
+		auto& ClientFd = Fds.PushBack();
+		ClientFd.fd = Device.mClientSocket;
+		ClientFd.events = POLLIN;
+		FdDevices.PushBack( d );
+		FdIsListen.PushBack( false );
+	}
+
+	//	wake up for the next delayed reply, or to move pins along
+	int TimeoutMs = 5;
+	if ( !mPendingReplies.empty() )
+	{
+		auto NextMs = mPendingReplies.begin()->first;
+		TimeoutMs = ( NextMs <= NowMs ) ? 0 : std::min<int>( TimeoutMs, static_cast<int>(NextMs - NowMs) );
+	}
+
+	auto Result = poll( Fds.GetArray(), Fds.GetSize(), TimeoutMs );
+	if ( Result <= 0 )
+		return true;
+
+	for ( int f=0;	f<Fds.GetSize();	f++ )
+	{
+		if ( !(Fds[f].revents & (POLLIN|POLLHUP|POLLERR)) )
+			continue;
+
+		auto DeviceIndex = FdDevices[f];
+		if ( DeviceIndex == -1 )
+			OnDiscoveryPacket();
+		else if ( FdIsListen[f] )
+			OnAccept( mDevices[DeviceIndex] );
+		else
+			OnRecv( DeviceIndex );
+	}
+
+	return true;
+#endif
+}
+
+void TPokeySimulator::MakeDiscoveryReply(const TPokeySimulatorDevice& Device,BufferArray<unsigned char,19>& Reply,const std::string& HostIp)
+{
+	int VersionMajor = 0;
+	int VersionMinor = 0;
+	char Dot;
+	std::stringstream( Device.mVersion ) >> VersionMajor >> Dot >> VersionMinor;
+	bool OldProtocol = ( Device.mVersion == "33.52" );
+
+	Reply.SetSize( OldProtocol ? 14 : 19 );
+	for ( int i=0;	i<Reply.GetSize();	i++ )
+		Reply[i] = 0;
+
+	//	layout matches what TProtocolPokey::DecodeHeader expects
+	Reply[0] = 0;	//	user id, must never be 0xAA or it looks like a device reply
+	Reply[1] = (Device.mSerial >> 8) & 0xff;
+	Reply[2] = Device.mSerial & 0xff;
+	Reply[3] = VersionMajor;
+	Reply[4] = VersionMinor;
+
+	in_addr Ip;
+	inet_pton( AF_INET, Device.mIp.c_str(), &Ip );
+	memcpy( &Reply[5], &Ip, 4 );
+	Reply[9] = 0;	//	fixed ip
+
+	in_addr Host;
+	inet_pton( AF_INET, HostIp.c_str(), &Host );
+	memcpy( &Reply[10], &Host, 4 );
+
+	if ( !OldProtocol )
+	{
+		Reply[14] = Device.mSerial & 0xff;
+		Reply[15] = (Device.mSerial >> 8) & 0xff;
+	}
+}
+
+void TPokeySimulator::OnDiscoveryPacket()
+{
+#if !defined(TARGET_WINDOWS)
+	char Buffer[256];
+	sockaddr_in From;
+	socklen_t FromSize = sizeof(From);
+	while ( recvfrom( mDiscoverySocket, Buffer, sizeof(Buffer), 0, reinterpret_cast<sockaddr*>(&From), &FromSize ) >= 0 )
+	{
+		mDiscoveryCount++;
+		char HostIp[INET_ADDRSTRLEN];
+		inet_ntop( AF_INET, &From.sin_addr, HostIp, sizeof(HostIp) );
+
+		for ( int d=0;	d<mDevices.GetSize();	d++ )
+		{
+			auto& Device = mDevices[d];
+			if ( Device.mHangUntilMs > Soy::GetMonotonicMs() )
+				continue;
+
+			BufferArray<unsigned char,19> Reply;
+			MakeDiscoveryReply( Device, Reply, HostIp );
+			sendto( mDiscoverySocket, Reply.GetArray(), Reply.GetSize(), 0, reinterpret_cast<sockaddr*>(&From), FromSize );
+		}
+		FromSize = sizeof(From);
+	}
+#endif
+}
+
+void TPokeySimulator::OnAccept(TPokeySimulatorDevice& Device)
+{
+#if !defined(TARGET_WINDOWS)
+	auto Client = accept( Device.mListenSocket, nullptr, nullptr );
+	if ( Client == -1 )
+		return;
+
+	//	newest connection wins, like the real thing after a reconnect
+	CloseClient( Device );
+	fcntl( Client, F_SETFL, O_NONBLOCK );
+	int Enable = 1;
+	setsockopt( Client, IPPROTO_TCP, TCP_NODELAY, &Enable, sizeof(Enable) );
+	Device.mClientSocket = Client;
+#endif
+}
+
+void TPokeySimulator::CloseClient(TPokeySimulatorDevice& Device)
+{
+#if !defined(TARGET_WINDOWS)
+	if ( Device.mClientSocket == -1 )
+		return;
+	close( Device.mClientSocket );
+	Device.mClientSocket = -1;
+	Device.mRecvBuffer.Clear();
+
+	//	drop anything queued for the old connection
+	for ( auto it=mPendingReplies.begin();	it!=mPendingReplies.end();	)
+	{
+		if ( &mDevices[it->second.mDevice] == &Device )
+			it = mPendingReplies.erase( it );
+		else
+			++it;
+	}
+#endif
+}
+
+void TPokeySimulator::OnRecv(size_t DeviceIndex)
+{
+#if !defined(TARGET_WINDOWS)
+	auto& Device = mDevices[DeviceIndex];
+	char Buffer[1024];
+	while ( true )
+	{
+		auto Read = recv( Device.mClientSocket, Buffer, sizeof(Buffer), 0 );
+		if ( Read == 0 || (Read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) )
+		{
+			CloseClient( Device );
+			return;
+		}
+		if ( Read < 0 )
+			break;
+		Device.mRecvBuffer.PushBackArray( GetRemoteArray( Buffer, Read ) );
+	}
+
+	//	requests are always 64 bytes starting with 0xBB, skip junk to resync
+	while ( !Device.mRecvBuffer.IsEmpty() )
+	{
+		if ( static_cast<unsigned char>(Device.mRecvBuffer[0]) != 0xBB )
+		{
+			Device.mRecvBuffer.RemoveBlock( 0, 1 );
+			continue;
+		}
+		if ( Device.mRecvBuffer.GetSize() < 64 )
+			break;
+
+		OnRequest( DeviceIndex, reinterpret_cast<const unsigned char*>( Device.mRecvBuffer.GetArray() ) );
+		Device.mRecvBuffer.RemoveBlock( 0, 64 );
+	}
+#endif
+}
+
+void TPokeySimulator::OnRequest(size_t DeviceIndex,const unsigned char* Request)
+{
+	auto& Device = mDevices[DeviceIndex];
+	auto NowMs = Soy::GetMonotonicMs();
+	Device.mRequests++;
+
+	if ( Device.mHangUntilMs > NowMs )
+		return;
+
+	if ( mParams.mHangChance > 0 && GetRandom() < mParams.mHangChance )
+	{
+		Device.mHangUntilMs = NowMs + mParams.mHangMs;
+		mHangCount++;
+		return;
+	}
+
+	BufferArray<unsigned char,64> Reply;
+	Reply.SetSize( 64 );
+	for ( int i=0;	i<Reply.GetSize();	i++ )
+		Reply[i] = 0;
+
+	Reply[0] = 0xAA;
+	Reply[1] = Request[1];
+	Reply[6] = Request[6];
+
+	switch ( Request[1] )
+	{
+		case TPokeyCommand::GetDeviceState:
+			for ( int p=0;	p<55;	p++ )
+				if ( Device.mPins & (1ull << p) )
+					Reply[8 + (p/8)] |= 1 << (p%8);
+			break;
+
+		case TPokeyCommand::GetDigitalCounters:
+			for ( int i=0;	i<TPokeyCommand::MaxCounterPins;	i++ )
+			{
+				auto Pin = Request[8+i];
+				auto Count = Device.mEdgeCounts[Pin % 64];
+				for ( int b=0;	b<4;	b++ )
+					Reply[8 + (i*4) + b] = (Count >> (b*8)) & 0xff;
+			}
+			break;
+			
+		case TPokeyCommand::SetExtBus:
+			Reply[2] = 1;	//	enabled
+			for ( int i=0;	i<10;	i++ )
+				Reply[8+i] = Request[8+i];
+			break;
+			
+		case TPokeyCommand::ResetDigitalCounters:
+			for ( int p=0;	p<sizeofarray(Device.mEdgeCounts);	p++ )
+				Device.mEdgeCounts[p] = 0;
+			break;
+			
+		case TPokeyCommand::GetDeviceMeta:
+			Reply[2] = (Device.mSerial >> 8) & 0xff;
+			Reply[3] = Device.mSerial & 0xff;
+			Reply[4] = 0x33;
+			Reply[5] = 1;
+			break;
+
+		default:
+			break;
+	}
+
+	Reply[7] = TPokeyCommand::CalculateChecksum( Reply.GetArray() );
+	QueueReply( DeviceIndex, Reply, NowMs );
+}
+
+void TPokeySimulator::QueueReply(size_t DeviceIndex,BufferArray<unsigned char,64>& Reply,uint64 NowMs)
+{
+	if ( mParams.mLossChance > 0 && GetRandom() < mParams.mLossChance )
+	{
+		mLostCount++;
+		return;
+	}
+
+	if ( mParams.mCorruptChance > 0 && GetRandom() < mParams.mCorruptChance )
+	{
+		Reply[7] ^= 0x5A;
+		mCorruptCount++;
+	}
+
+	int DelayMs = mParams.mLatencyMs;
+	if ( mParams.mJitterMs > 0 )
+		DelayMs += std::uniform_int_distribution<int>( -mParams.mJitterMs, mParams.mJitterMs )( mRandom );
+	DelayMs = std::max( 0, DelayMs );
+
+	TPokeySimulatorReply Pending;
+	Pending.mDevice = DeviceIndex;
+	Pending.mSocket = mDevices[DeviceIndex].mClientSocket;
+	Pending.mData = Reply;
+	mPendingReplies.insert( std::make_pair( NowMs + DelayMs, Pending ) );
+}
+
+void TPokeySimulator::SendDueReplies(uint64 NowMs)
+{
+#if !defined(TARGET_WINDOWS)
+	while ( !mPendingReplies.empty() && mPendingReplies.begin()->first <= NowMs )
+	{
+		auto& Pending = mPendingReplies.begin()->second;
+		auto& Device = mDevices[Pending.mDevice];
+		if ( Device.mClientSocket == Pending.mSocket && Device.mClientSocket != -1 )
+		{
+			send( Device.mClientSocket, Pending.mData.GetArray(), Pending.mData.GetSize(), MSG_NOSIGNAL );
+			Device.mReplies++;
+		}
+		mPendingReplies.erase( mPendingReplies.begin() );
+	}
+#endif
+}
+
+bool TPokeySimulator::WriteAddressCache(const std::string& Filename)
+{
+	//	same format as TPopPokey::SaveAddressCache
+	std::ofstream File( Filename, std::ios::out | std::ios::trunc );
+	File << "# simulated pokeys" << std::endl;
+	for ( int d=0;	d<mDevices.GetSize();	d++ )
+	{
+		auto& Device = mDevices[d];
+		File << Device.mSerial << " " << Device.mIp << ":" << mParams.mPort << " " << Device.mVersion << " 0" << std::endl;
+	}
+	return File.good();
+}
+
+void TPokeySimulator::GetStatus(std::ostream& Status)
+{
+	uint64 Requests = 0;
+	uint64 Replies = 0;
+	int Connected = 0;
+	for ( int d=0;	d<mDevices.GetSize();	d++ )
+	{
+		Requests += mDevices[d].mRequests;
+		Replies += mDevices[d].mReplies;
+		if ( mDevices[d].mClientSocket != -1 )
+			Connected++;
+	}
+
+	Status << Connected << "/" << mDevices.GetSize() << " simulated pokeys connected, ";
+	Status << mDiscoveryCount << " discoveries, ";
+	Status << Requests << " requests, " << Replies << " replies, ";
+	Status << mLostCount << " lost, " << mCorruptCount << " corrupt, " << mHangCount << " hangs";
+}
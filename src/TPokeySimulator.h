@@ -0,0 +1,134 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <TJob.h>
+#include <random>
+#include <map>
+
+
+
+//	how the simulated pokeys misbehave
+class TPokeySimulatorParams
+{
+public:
+	TPokeySimulatorParams();
+
+	void			Read(const TJobParams& Params);
+
+public:
+	int				mDeviceCount;
+	int				mSerialBase;
+	int				mPort;				//	both discovery and device port, pokeys always use 20055
+	std::string		mProtocol;			//	33.52, 49.13, 48.0 or mixed
+	std::string		mPattern;			//	random or script
+	std::string		mScriptFilename;
+	std::string		mAddressCacheFilename;	//	write pokeys here so PopPokey can connect without broadcast
+	float			mPressRate;			//	random presses started per device per second
+	float			mPressDuration;		//	secs
+	int				mLatencyMs;
+	int				mJitterMs;
+	float			mLossChance;		//	0..1 chance a reply is never sent
+	float			mCorruptChance;		//	0..1 chance a reply has a bad checksum
+	float			mHangChance;		//	0..1 chance per request that the device stops replying
+	int				mHangMs;
+	unsigned int	mSeed;
+};
+
+
+class TPokeySimulatorDevice
+{
+public:
+	TPokeySimulatorDevice() :
+		mSerial			( -1 ),
+		mListenSocket	( -1 ),
+		mClientSocket	( -1 ),
+		mPins			( 0 ),
+		mHangUntilMs	( 0 ),
+		mRequests		( 0 ),
+		mReplies		( 0 )
+	{
+		for ( int p=0;	p<sizeofarray(mEdgeCounts);	p++ )
+			mEdgeCounts[p] = 0;
+	}
+	
+	void			SetPins(uint64 Pins);
+
+public:
+	int				mSerial;
+	std::string		mIp;
+	std::string		mVersion;
+	int				mListenSocket;
+	int				mClientSocket;		//	pokeys only take one connection at a time
+	Array<char>		mRecvBuffer;
+	uint64			mPins;				//	bit per pin
+	uint32			mEdgeCounts[64];	//	per pin digital counter, both edges
+	Array<uint64>	mPressEndMs;		//	per pin, when a random press releases
+	uint64			mHangUntilMs;
+	uint64			mRequests;
+	uint64			mReplies;
+};
+
+
+//	a reply waiting for its simulated latency
+class TPokeySimulatorReply
+{
+public:
+	size_t			mDevice;
+	int				mSocket;
+	BufferArray<unsigned char,64>	mData;
+};
+
+
+class TPokeySimulatorScriptStep
+{
+public:
+	uint64			mTimeMs;
+	int				mSerial;		//	-1 for all
+	uint64			mPins;
+};
+
+
+//	stands up N fake pokeys on loopback addresses 127.1.x.y so the real sockets, framing and
+//	poll loop can be exercised without hardware
+class TPokeySimulator : public SoyWorkerThread
+{
+public:
+	TPokeySimulator(const TPokeySimulatorParams& Params);
+	virtual ~TPokeySimulator();
+
+	bool			Init(std::stringstream& Error);
+	virtual bool	Iteration() override;
+	void			GetStatus(std::ostream& Status);
+	bool			WriteAddressCache(const std::string& Filename);
+
+	static std::string	GetDeviceIp(size_t Index);
+
+private:
+	bool			LoadScript(std::stringstream& Error);
+	void			UpdatePins(uint64 NowMs);
+	void			OnDiscoveryPacket();
+	void			OnAccept(TPokeySimulatorDevice& Device);
+	void			OnRecv(size_t DeviceIndex);
+	void			OnRequest(size_t DeviceIndex,const unsigned char* Request);
+	void			QueueReply(size_t DeviceIndex,BufferArray<unsigned char,64>& Reply,uint64 NowMs);
+	void			SendDueReplies(uint64 NowMs);
+	void			CloseClient(TPokeySimulatorDevice& Device);
+	void			MakeDiscoveryReply(const TPokeySimulatorDevice& Device,BufferArray<unsigned char,19>& Reply,const std::string& HostIp);
+	float			GetRandom();
+
+private:
+	TPokeySimulatorParams				mParams;
+	Array<TPokeySimulatorDevice>		mDevices;
+	int									mDiscoverySocket;
+	std::multimap<uint64,TPokeySimulatorReply>	mPendingReplies;
+	Array<TPokeySimulatorScriptStep>	mScript;
+	size_t								mScriptPosition;
+	uint64								mStartMs;
+	uint64								mLastPinUpdateMs;
+	std::mt19937						mRandom;
+
+	std::atomic<uint64>					mDiscoveryCount;
+	std::atomic<uint64>					mLostCount;
+	std::atomic<uint64>					mCorruptCount;
+	std::atomic<uint64>					mHangCount;
+};
@@ -0,0 +1,273 @@
+#include "TPokeySubscriptions.h"
+#include "PopPokey.h"
+
+
+const char* TPokeySubscriptionEventType::ToString(Type Event)
+{
+	switch ( Event )
+	{
+		case Down:	return "down";
+		case Up:	return "up";
+		case All:	return "all";
+	}
+	return "unknown";
+}
+
+bool TPokeySubscriptionEventType::ParseMask(const std::string& Events,uint8& Mask,std::stringstream& Error)
+{
+	if ( Events.empty() )
+	{
+		Mask = All;
+		return true;
+	}
+
+	Mask = 0;
+	std::stringstream Stream( Events );
+	std::string Event;
+	while ( std::getline( Stream, Event, ',' ) )
+	{
+		Event = Soy::StringToLowerCopy( Event );
+		if ( Event == ToString(Down) )
+			Mask |= Down;
+		else if ( Event == ToString(Up) )
+			Mask |= Up;
+		else if ( Event == ToString(All) )
+			Mask |= All;
+		else
+		{
+			Error << "unknown event " << Event << ", expected down, up or all";
+			return false;
+		}
+	}
+	if ( Mask == 0 )
+	{
+		Error << "no events in " << Events;
+		return false;
+	}
+	return true;
+}
+
+
+bool TPokeySubscriptionParams::Read(const std::string& Rect,const std::string& Cells,const std::string& Events,std::stringstream& Error)
+{
+	if ( !mRegion.ParseRegion( Rect, Cells, Error ) )
+		return false;
+	return TPokeySubscriptionEventType::ParseMask( Events, mEvents, Error );
+}
+
+
+TPokeySubscriptions::TPokeySubscriptions() :
+	mNextId			( 1 ),
+	mGeneration		( 0 ),
+	mActiveCount	( 0 ),
+	mEventTextPins	( 0 ),
+	mMatchedCount	( 0 ),
+	mDroppedCount	( 0 )
+{
+}
+
+uint32 TPokeySubscriptions::Subscribe(const TPokeySubscriptionParams& Params)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+
+	//	nobody was listening, so the pins we last saw on each board are stale
+	if ( mActiveCount == 0 )
+		mBoards.clear();
+
+	TSubscriber* Subscriber = nullptr;
+	size_t Slot = 0;
+	for ( ;	Slot<mSubscribers.GetSize();	Slot++ )
+	{
+		if ( mSubscribers[Slot].mId == 0 )
+			break;
+	}
+	if ( Slot == mSubscribers.GetSize() )
+		mSubscribers.PushBack();
+	Subscriber = &mSubscribers[Slot];
+
+	*Subscriber = TSubscriber();
+	Subscriber->mId = mNextId++;
+	if ( mNextId == 0 )
+		mNextId = 1;
+	Subscriber->mParams = Params;
+	mSlotById[Subscriber->mId] = Slot;
+	mActiveCount++;
+
+	//	every board recompiles its masks on its next sample
+	mGeneration++;
+	return Subscriber->mId;
+}
+
+void TPokeySubscriptions::Unsubscribe(uint32 Id)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Slot = mSlotById.find( Id );
+	if ( Slot == mSlotById.end() )
+		return;
+
+	//	boards still point at the slot, but check the id, so there's no need to recompile them.
+	//	Same for a pending id, taking it finds nothing
+	mSubscribers[Slot->second] = TSubscriber();
+	mSlotById.erase( Slot );
+	mActiveCount--;
+}
+
+void TPokeySubscriptions::SetOnPending(std::function<void()> OnPending)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	mOnPending = OnPending;
+}
+
+void TPokeySubscriptions::OnSample(TPokeyMeta& Pokey,uint64 DownPins,uint64 SampleTimeNs)
+{
+	std::function<void()> OnPending;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( mActiveCount == 0 )
+			return;
+
+		auto& Board = mBoards[Pokey.mSerial];
+		if ( Board.mGeneration != mGeneration || Board.mGridMapVersion != Pokey.mGridMapVersion )
+			Compile( Board, Pokey );
+
+		auto Changed = Board.mPins ^ DownPins;
+		bool FirstSample = !Board.mHasPins;
+		Board.mPins = DownPins;
+		Board.mHasPins = true;
+		if ( !Changed || FirstSample )
+			return;
+
+		bool Notify = false;
+		mEventTextPins = 0;
+		for ( int i=0;	i<Board.mSubscribers.GetSize();	i++ )
+		{
+			auto& BoardSubscriber = Board.mSubscribers[i];
+			auto Hits = Changed & BoardSubscriber.mMask;
+			if ( !Hits )
+				continue;
+
+			auto& Subscriber = mSubscribers[BoardSubscriber.mSlot];
+			if ( Subscriber.mId != BoardSubscriber.mId )
+				continue;
+
+			if ( !(Subscriber.mParams.mEvents & TPokeySubscriptionEventType::Down) )
+				Hits &= ~DownPins;
+			if ( !(Subscriber.mParams.mEvents & TPokeySubscriptionEventType::Up) )
+				Hits &= DownPins;
+
+			for ( ;	Hits;	Hits &= Hits-1 )
+			{
+				auto p = TPokeyBoardState::GetLowestPin( Hits );
+				auto& Text = GetEventText( Pokey, p, (DownPins & (1ull<<p)) != 0, SampleTimeNs );
+				if ( Subscriber.mOutbox.size() + Text.size() > MaxOutbox )
+				{
+					Subscriber.mDroppedCount++;
+					mDroppedCount++;
+					continue;
+				}
+				Subscriber.mOutbox += Text;
+				Subscriber.mEventCount++;
+				mMatchedCount++;
+			}
+			if ( !Subscriber.mPending && !Subscriber.mOutbox.empty() )
+			{
+				Subscriber.mPending = true;
+				mPendingIds.PushBack( Subscriber.mId );
+				Notify = true;
+			}
+		}
+
+		if ( Notify )
+			OnPending = mOnPending;
+	}
+
+	if ( OnPending )
+		OnPending();
+}
+
+void TPokeySubscriptions::Compile(TBoard& Board,TPokeyMeta& Pokey)
+{
+	Board.mSubscribers.Clear();
+	Board.mGeneration = mGeneration;
+	Board.mGridMapVersion = Pokey.mGridMapVersion;
+
+	//	pins x subscribers, but only when a map changes or someone subscribes
+	auto& State = Pokey.GetState();
+	for ( int s=0;	s<mSubscribers.GetSize();	s++ )
+	{
+		auto& Subscriber = mSubscribers[s];
+		if ( Subscriber.mId == 0 )
+			continue;
+
+		uint64 Mask = 0;
+		for ( auto Bits = State.mMappedPins;	Bits;	Bits &= Bits-1 )
+		{
+			auto p = TPokeyBoardState::GetLowestPin( Bits );
+			auto Coord = State.mCoord[p];
+			if ( Coord == TPokeyMeta::GridCoordLaserGate )
+				continue;
+			if ( Subscriber.mParams.mRegion.Contains( Coord ) )
+				Mask |= 1ull << p;
+		}
+		if ( Mask == 0 )
+			continue;
+
+		auto& BoardSubscriber = Board.mSubscribers.PushBack();
+		BoardSubscriber.mSlot = s;
+		BoardSubscriber.mId = Subscriber.mId;
+		BoardSubscriber.mMask = Mask;
+	}
+}
+
+const std::string& TPokeySubscriptions::GetEventText(TPokeyMeta& Pokey,size_t Pin,bool Down,uint64 SampleTimeNs)
+{
+	//	formatted once per edge, however many subscribers want it
+	auto& Text = mEventText[Pin];
+	if ( mEventTextPins & (1ull<<Pin) )
+		return Text;
+	mEventTextPins |= 1ull<<Pin;
+
+	auto Coord = Pokey.GetState().mCoord[Pin];
+	std::stringstream Event;
+	Event << "data: {";
+	Event << "\"event\":\"" << TPokeySubscriptionEventType::ToString( Down ? TPokeySubscriptionEventType::Down : TPokeySubscriptionEventType::Up ) << "\",";
+	Event << "\"serial\":" << Pokey.mSerial << ",";
+	Event << "\"pin\":" << Pin << ",";
+	Event << "\"x\":" << Coord.x << ",";
+	Event << "\"y\":" << Coord.y << ",";
+	Event << "\"time_ns\":" << SampleTimeNs;
+	Event << "}\n\n";
+	Text = Event.str();
+	return Text;
+}
+
+void TPokeySubscriptions::TakePending(ArrayBridge<uint32>&& Ids)
+{
+	//	they stay pending until their events are taken, so one the transport can't take yet isn't
+	//	listed again for every event; the transport keeps hold of it instead
+	std::lock_guard<std::mutex> Lock( mLock );
+	Ids.PushBackArray( mPendingIds );
+	mPendingIds.Clear(false);
+}
+
+bool TPokeySubscriptions::TakeEvents(uint32 Id,std::string& Output)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Slot = mSlotById.find( Id );
+	if ( Slot == mSlotById.end() )
+		return false;
+	auto& Subscriber = mSubscribers[Slot->second];
+	Output += Subscriber.mOutbox;
+	Subscriber.mOutbox.clear();
+	Subscriber.mPending = false;
+	return true;
+}
+
+void TPokeySubscriptions::GetStatus(std::ostream& Status)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	size_t Pending = 0;
+	for ( int s=0;	s<mSubscribers.GetSize();	s++ )
+		Pending += mSubscribers[s].mOutbox.size();
+	Status << "subscriptions " << mActiveCount << ", " << mMatchedCount << " events delivered, " << mDroppedCount << " dropped, " << Pending << " bytes pending";
+}
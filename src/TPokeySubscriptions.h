@@ -0,0 +1,133 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <unordered_map>
+#include <functional>
+#include "TPokeyConfig.h"
+
+
+class TPokeyMeta;
+
+
+namespace TPokeySubscriptionEventType
+{
+	enum Type : uint8
+	{
+		Down	= 1<<0,
+		Up		= 1<<1,
+		All		= Down|Up,
+	};
+
+	const char*		ToString(Type Event);
+	bool			ParseMask(const std::string& Events,uint8& Mask,std::stringstream& Error);	//	down,up; empty for all
+}
+
+
+class TPokeySubscriptionParams
+{
+public:
+	TPokeySubscriptionParams() :
+		mEvents	( TPokeySubscriptionEventType::All )
+	{
+	}
+
+	bool			Read(const std::string& Rect,const std::string& Cells,const std::string& Events,std::stringstream& Error);
+
+public:
+	TPokeyTriggerZoneConfig	mRegion;	//	name unused
+	uint8			mEvents;			//	TPokeySubscriptionEventType bits
+};
+
+
+//	clients that only care about part of the floor. Each subscription is compiled against each
+//	board's gridmap into one pin mask, kept only on boards it overlaps, so a sample is an xor with
+//	the board's last pins and then one and per overlapping subscription. Unchanged boards cost one
+//	compare however many subscribers there are, and only subscribers with a matching edge do any
+//	more work. Events are formatted once per edge and appended to each matching subscriber's
+//	outbox as text/event-stream, ready for the transport to write. Subscribers with something in
+//	their outbox are listed, so the transport only visits those
+class TPokeySubscriptions
+{
+public:
+	static const size_t	MaxOutbox = 256*1024;	//	pending bytes per subscriber before its events are dropped
+
+public:
+	TPokeySubscriptions();
+
+	uint32			Subscribe(const TPokeySubscriptionParams& Params);		//	id, never 0
+	void			Unsubscribe(uint32 Id);
+	void			SetOnPending(std::function<void()> OnPending);
+	void			OnSample(TPokeyMeta& Pokey,uint64 DownPins,uint64 SampleTimeNs);	//	ignored pins already removed
+	void			TakePending(ArrayBridge<uint32>&& Ids);		//	subscribers whose outbox has filled since they were last taken
+	bool			TakeEvents(uint32 Id,std::string& Output);	//	appends pending events; false if there's no such subscription
+	void			GetStatus(std::ostream& Status);
+
+private:
+	class TSubscriber
+	{
+	public:
+		TSubscriber() :
+			mId				( 0 ),
+			mPending		( false ),
+			mEventCount		( 0 ),
+			mDroppedCount	( 0 )
+		{
+		}
+
+	public:
+		uint32			mId;			//	0 for a free slot
+		TPokeySubscriptionParams	mParams;
+		std::string		mOutbox;
+		bool			mPending;		//	listed in mPendingIds, or taken from it, since the outbox was last taken
+		uint64			mEventCount;
+		uint64			mDroppedCount;
+	};
+
+	class TBoardSubscriber
+	{
+	public:
+		size_t			mSlot;
+		uint32			mId;			//	slot may have been freed since
+		uint64			mMask;
+	};
+
+	class TBoard
+	{
+	public:
+		TBoard() :
+			mGridMapVersion	( ~0u ),
+			mGeneration		( ~0u ),
+			mPins			( 0 ),
+			mHasPins		( false )
+		{
+		}
+
+	public:
+		uint32			mGridMapVersion;
+		uint32			mGeneration;
+		uint64			mPins;
+		bool			mHasPins;		//	no edges from the first sample
+		Array<TBoardSubscriber>	mSubscribers;	//	only ones with a pin on this board
+	};
+
+	void			Compile(TBoard& Board,TPokeyMeta& Pokey);
+	const std::string&	GetEventText(TPokeyMeta& Pokey,size_t Pin,bool Down,uint64 SampleTimeNs);
+
+private:
+	std::mutex		mLock;			//	samples come from every channel's thread
+	Array<TSubscriber>	mSubscribers;	//	slots, reused
+	std::unordered_map<uint32,size_t>	mSlotById;
+	Array<uint32>	mPendingIds;	//	in the order their outboxes filled
+	uint32			mNextId;
+	uint32			mGeneration;	//	bumped when a subscription is added
+	size_t			mActiveCount;
+	std::unordered_map<int,TBoard>	mBoards;	//	by serial
+	std::function<void()>	mOnPending;	//	a subscriber's outbox went from empty to not
+
+	std::string		mEventText[64];	//	this sample's formatted edges, by pin
+	uint64			mEventTextPins;
+
+	uint64			mMatchedCount;	//	events delivered to outboxes, counting each subscriber
+	uint64			mDroppedCount;
+};
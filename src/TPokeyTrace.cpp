@@ -0,0 +1,133 @@
+#include "TPokeyTrace.h"
+#include "TProtocolPokey.h"
+
+
+const char* TPokeyTraceStage::ToString(Type Stage)
+{
+	switch ( Stage )
+	{
+		case Received:	return "received";
+		case Decoded:	return "decoded";
+		case Edge:		return "edge";
+		case Published:	return "published";
+		case Delivered:	return "delivered";
+		default:		return "unknown";
+	}
+}
+
+
+void TPokeyTrace::Stamp(TPokeyTraceStage::Type Stage)
+{
+	mStageNs[Stage] = Soy::GetMonotonicNs();
+}
+
+
+
+TPokeyTracer::TPokeyTracer() :
+	mSampleRate		( 1 ),
+	mDeliveredCount	( 0 ),
+	mDroppedCount	( 0 ),
+	mNextSample		( 0 )
+{
+}
+
+TPokeyTracer& TPokeyTracer::Get()
+{
+	static TPokeyTracer Tracer;
+	return Tracer;
+}
+
+void TPokeyTracer::OnDelivered(const TPokeyTrace& Trace)
+{
+	if ( !Trace.IsValid() )
+		return;
+
+	auto& Stamps = Trace.mStageNs;
+	auto Delivered = mDeliveredCount++;
+
+	//	latency from the previous stage we have a stamp for
+	uint64 PrevNs = Stamps[TPokeyTraceStage::Received];
+	for ( int s=TPokeyTraceStage::Received+1;	s<TPokeyTraceStage::Count;	s++ )
+	{
+		if ( Stamps[s] == 0 || Stamps[s] < PrevNs )
+			continue;
+		mStageLatencyUs[s].Record( (Stamps[s] - PrevNs) / 1000 );
+		PrevNs = Stamps[s];
+	}
+	if ( PrevNs > Stamps[TPokeyTraceStage::Received] )
+		mStageLatencyUs[TPokeyTraceStage::Received].Record( (PrevNs - Stamps[TPokeyTraceStage::Received]) / 1000 );
+
+	if ( mSampleRate <= 0 || (Delivered % mSampleRate) != 0 )
+		return;
+
+	std::lock_guard<std::mutex> Lock( mSamplesLock );
+	if ( mSamples.GetSize() < MaxSamples )
+		mSamples.PushBack( Trace );
+	else
+		mSamples[mNextSample] = Trace;
+	mNextSample = (mNextSample+1) % MaxSamples;
+}
+
+void TPokeyTracer::WritePrometheus(std::ostream& Output)
+{
+	Output << "# TYPE poppokey_press_stage_microseconds histogram\n";
+	for ( int s=0;	s<TPokeyTraceStage::Count;	s++ )
+	{
+		//	[Received] holds the whole pipeline
+		std::string Stage = (s == TPokeyTraceStage::Received) ? "total" : TPokeyTraceStage::ToString( static_cast<TPokeyTraceStage::Type>(s) );
+		mStageLatencyUs[s].WritePrometheus( Output, "poppokey_press_stage_microseconds", "stage=\"" + Stage + "\"" );
+	}
+	Output << "# TYPE poppokey_press_traces_dropped_total counter\n";
+	Output << "poppokey_press_traces_dropped_total " << mDroppedCount.load() << "\n";
+}
+
+void TPokeyTracer::WriteJson(std::ostream& Output)
+{
+	Output << "{";
+	Output << "\"delivered\":" << mDeliveredCount.load() << ",";
+	Output << "\"dropped\":" << mDroppedCount.load() << ",";
+	Output << "\"total_us\":";
+	mStageLatencyUs[TPokeyTraceStage::Received].WriteJson( Output );
+	for ( int s=TPokeyTraceStage::Received+1;	s<TPokeyTraceStage::Count;	s++ )
+	{
+		Output << ",\"" << TPokeyTraceStage::ToString( static_cast<TPokeyTraceStage::Type>(s) ) << "_us\":";
+		mStageLatencyUs[s].WriteJson( Output );
+	}
+	Output << "}";
+}
+
+void TPokeyTracer::WriteChromeTrace(std::ostream& Output)
+{
+	Array<TPokeyTrace> Samples;
+	{
+		std::lock_guard<std::mutex> Lock( mSamplesLock );
+		Samples.Copy( mSamples );
+	}
+
+	//	one complete ("X") event per stage, on a track per pokey
+	Output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool First = true;
+	for ( int t=0;	t<Samples.GetSize();	t++ )
+	{
+		auto& Trace = Samples[t];
+		uint64 PrevNs = Trace.mStageNs[TPokeyTraceStage::Received];
+		for ( int s=TPokeyTraceStage::Received+1;	s<TPokeyTraceStage::Count;	s++ )
+		{
+			auto StageNs = Trace.mStageNs[s];
+			if ( StageNs == 0 || StageNs < PrevNs )
+				continue;
+
+			if ( !First )
+				Output << ",";
+			First = false;
+			Output << "{\"name\":\"" << TPokeyTraceStage::ToString( static_cast<TPokeyTraceStage::Type>(s) ) << "\",";
+			Output << "\"cat\":\"press\",\"ph\":\"X\",\"pid\":1,";
+			Output << "\"tid\":" << Trace.mSerial << ",";
+			Output << "\"ts\":" << (PrevNs / 1000) << "." << ((PrevNs / 100) % 10) << ",";
+			Output << "\"dur\":" << ((StageNs - PrevNs) / 1000) << "." << (((StageNs - PrevNs) / 100) % 10) << ",";
+			Output << "\"args\":{\"x\":" << Trace.mCoord.x << ",\"y\":" << Trace.mCoord.y << "}}";
+			PrevNs = StageNs;
+		}
+	}
+	Output << "]}";
+}
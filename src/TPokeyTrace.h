@@ -0,0 +1,77 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include "TPokeyMetrics.h"
+
+
+namespace TPokeyTraceStage
+{
+	enum Type
+	{
+		Received = 0,	//	reply bytes reached the decoder, after the socket read
+		Decoded,		//	reply turned into a job
+		Edge,			//	UpdatePins saw a pin go down
+		Published,		//	PushGridCoord stored it
+		Delivered,		//	a consumer read it with pop/peek
+
+		Count
+	};
+
+	const char*		ToString(Type Stage);
+}
+
+
+//	monotonic stamps for one press as it moves through the pipeline. 0 is a stage not reached
+class TPokeyTrace
+{
+public:
+	TPokeyTrace() :
+		mSerial		( -1 ),
+		mCoord		( -1, -1 )
+	{
+		for ( int s=0;	s<TPokeyTraceStage::Count;	s++ )
+			mStageNs[s] = 0;
+	}
+
+	bool			IsValid() const	{	return mStageNs[TPokeyTraceStage::Received] != 0;	}
+	void			Stamp(TPokeyTraceStage::Type Stage);
+
+public:
+	int				mSerial;
+	vec2x<int>		mCoord;
+	uint64			mStageNs[TPokeyTraceStage::Count];
+};
+
+
+//	aggregates stage-to-stage latency of delivered presses and keeps a sample of whole traces to
+//	export as chrome://tracing json
+class TPokeyTracer
+{
+public:
+	static const size_t	MaxSamples = 1024;
+
+public:
+	TPokeyTracer();
+
+	static TPokeyTracer&	Get();
+
+	void			OnDelivered(const TPokeyTrace& Trace);
+	void			OnDropped()		{	mDroppedCount++;	}		//	replaced before anything read it
+
+	void			WritePrometheus(std::ostream& Output);
+	void			WriteJson(std::ostream& Output);
+	void			WriteChromeTrace(std::ostream& Output);
+
+public:
+	int				mSampleRate;		//	keep every Nth delivered trace
+
+private:
+	TPokeyHistogram		mStageLatencyUs[TPokeyTraceStage::Count];	//	from previous stage, [Received] is the total
+	std::atomic<uint64>	mDeliveredCount;
+	std::atomic<uint64>	mDroppedCount;
+
+	std::mutex			mSamplesLock;
+	Array<TPokeyTrace>	mSamples;			//	ring
+	size_t				mNextSample;
+};
@@ -0,0 +1,427 @@
+#include "TPokeyTracker.h"
+#include <unordered_set>
+#include <cmath>
+
+
+namespace
+{
+	const vec2x<int>	NeighbourOffsets[] =
+	{
+		vec2x<int>(-1,-1),	vec2x<int>(0,-1),	vec2x<int>(1,-1),
+		vec2x<int>(-1,0),						vec2x<int>(1,0),
+		vec2x<int>(-1,1),	vec2x<int>(0,1),	vec2x<int>(1,1),
+	};
+
+	template<typename ARRAY,typename TYPE>
+	bool Contains(const ARRAY& Array,const TYPE& Value)
+	{
+		for ( int i=0;	i<Array.GetSize();	i++ )
+			if ( Array[i] == Value )
+				return true;
+		return false;
+	}
+
+	template<typename ARRAY,typename TYPE>
+	void RemoveValue(ARRAY& Array,const TYPE& Value)
+	{
+		for ( int i=Array.GetSize()-1;	i>=0;	i-- )
+			if ( Array[i] == Value )
+				Array.RemoveBlock( i, 1 );
+	}
+}
+
+
+const char* TPokeyTrackEventType::ToString(Type Event)
+{
+	switch ( Event )
+	{
+		case Create:	return "create";
+		case Update:	return "update";
+		case Lose:		return "lose";
+	}
+	return "unknown";
+}
+
+
+void TPokeyTrackEvent::WriteJson(std::ostream& Output) const
+{
+	Output << "{";
+	Output << "\"event\":\"" << TPokeyTrackEventType::ToString( mType ) << "\",";
+	Output << "\"track\":" << mTrack << ",";
+	Output << "\"x\":" << mPosition.x << ",\"y\":" << mPosition.y << ",";
+	Output << "\"vx\":" << mVelocity.x << ",\"vy\":" << mVelocity.y << ",";
+	Output << "\"cells\":" << mCellCount << ",";
+	Output << "\"time_ns\":" << mTimeNs;
+	Output << "}";
+}
+
+
+TPokeyTracker::TPokeyTracker() :
+	mJoinDistance		( 2.5f ),
+	mLoseNs				( 500 * 1000000ull ),
+	mMaxQueuedEvents	( 1000 ),
+	mNextBlob			( 0 ),
+	mNextTrack			( 1 ),
+	mDroppedEvents		( 0 )
+{
+}
+
+void TPokeyTracker::OnSample(const TPokeyBoardSample& Sample)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto& Board = mBoards[Sample.mSerial];
+
+	//	nearly every sample is the same as the last; a pin becoming ignored changes mDown but not the pins
+	if ( Board.mPins == Sample.mPins && Board.mDown.GetSize() == Sample.mDown.GetSize() )
+		return;
+
+	for ( int i=0;	i<Board.mDown.GetSize();	i++ )
+		if ( !Contains( Sample.mDown, Board.mDown[i] ) )
+			CellUp( Board.mDown[i], Sample.mSampleTimeNs );
+
+	for ( int i=0;	i<Sample.mDown.GetSize();	i++ )
+		if ( !Contains( Board.mDown, Sample.mDown[i] ) )
+			CellDown( Sample.mDown[i], Sample.mSampleTimeNs );
+
+	Board.mPins = Sample.mPins;
+	Board.mDown.Copy( Sample.mDown );
+}
+
+void TPokeyTracker::OnCellDown(vec2x<int> Cell,uint64 TimeNs)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	CellDown( Cell, TimeNs );
+}
+
+void TPokeyTracker::OnCellUp(vec2x<int> Cell,uint64 TimeNs)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	CellUp( Cell, TimeNs );
+}
+
+int TPokeyTracker::GetCellBlob(vec2x<int> Cell) const
+{
+	auto it = mCellBlob.find( GetCellKey(Cell) );
+	return ( it == mCellBlob.end() ) ? -1 : it->second;
+}
+
+void TPokeyTracker::CellDown(vec2x<int> Cell,uint64 TimeNs)
+{
+	auto Key = GetCellKey( Cell );
+	if ( mCellRefs[Key]++ > 0 )
+		return;
+
+	BufferArray<int,8> Neighbours;
+	for ( int n=0;	n<sizeofarray(NeighbourOffsets);	n++ )
+	{
+		auto NeighbourBlob = GetCellBlob( vec2x<int>( Cell.x + NeighbourOffsets[n].x, Cell.y + NeighbourOffsets[n].y ) );
+		if ( NeighbourBlob != -1 && !Contains( Neighbours, NeighbourBlob ) )
+			Neighbours.PushBack( NeighbourBlob );
+	}
+
+	int Blob = -1;
+	if ( Neighbours.IsEmpty() )
+	{
+		auto Track = FindTrackNear( Cell, TimeNs );
+		if ( Track == -1 )
+			Track = NewTrack( Cell );
+		Blob = NewBlob( Track );
+		AttachBlob( Track, Blob, TimeNs );
+	}
+	else
+	{
+		//	bridged several blobs; the biggest swallows the rest so the fewest cells get relabelled
+		Blob = Neighbours[0];
+		for ( int n=1;	n<Neighbours.GetSize();	n++ )
+			if ( mBlobs[Neighbours[n]].mCells.GetSize() > mBlobs[Blob].mCells.GetSize() )
+				Blob = Neighbours[n];
+
+		auto& Target = mBlobs[Blob];
+		for ( int n=0;	n<Neighbours.GetSize();	n++ )
+		{
+			if ( Neighbours[n] == Blob )
+				continue;
+			auto& Other = mBlobs[Neighbours[n]];
+			for ( int c=0;	c<Other.mCells.GetSize();	c++ )
+			{
+				mCellBlob[ GetCellKey(Other.mCells[c]) ] = Blob;
+				Target.mCells.PushBack( Other.mCells[c] );
+			}
+			DetachBlob( Other.mTrack, Neighbours[n], TimeNs );
+			mBlobs.erase( Neighbours[n] );
+		}
+	}
+
+	auto& NewCellBlob = mBlobs[Blob];
+	NewCellBlob.mCells.PushBack( Cell );
+	mCellBlob[Key] = Blob;
+	mTracks[NewCellBlob.mTrack].mDirty = true;
+}
+
+void TPokeyTracker::CellUp(vec2x<int> Cell,uint64 TimeNs)
+{
+	auto Key = GetCellKey( Cell );
+	auto RefIt = mCellRefs.find( Key );
+	if ( RefIt == mCellRefs.end() )
+		return;
+	if ( --RefIt->second > 0 )
+		return;
+	mCellRefs.erase( RefIt );
+
+	auto BlobIt = mCellBlob.find( Key );
+	if ( BlobIt == mCellBlob.end() )
+		return;
+	auto BlobIndex = BlobIt->second;
+	mCellBlob.erase( BlobIt );
+
+	auto& Blob = mBlobs[BlobIndex];
+	RemoveValue( Blob.mCells, Cell );
+	mTracks[Blob.mTrack].mDirty = true;
+
+	if ( Blob.mCells.IsEmpty() )
+	{
+		DetachBlob( Blob.mTrack, BlobIndex, TimeNs );
+		mBlobs.erase( BlobIndex );
+		return;
+	}
+
+	SplitBlob( BlobIndex, TimeNs );
+}
+
+void TPokeyTracker::FloodBlob(vec2x<int> Start,int Blob,ArrayBridge<vec2x<int>>&& Cells)
+{
+	//	blobs are a footprint or two, so this is a handful of lookups
+	std::unordered_set<uint64> Visited;
+	Visited.insert( GetCellKey(Start) );
+	Cells.PushBack( Start );
+	for ( int i=0;	i<Cells.GetSize();	i++ )
+	{
+		auto Cell = Cells[i];
+		for ( int n=0;	n<sizeofarray(NeighbourOffsets);	n++ )
+		{
+			vec2x<int> Neighbour( Cell.x + NeighbourOffsets[n].x, Cell.y + NeighbourOffsets[n].y );
+			if ( GetCellBlob( Neighbour ) != Blob )
+				continue;
+			if ( !Visited.insert( GetCellKey(Neighbour) ).second )
+				continue;
+			Cells.PushBack( Neighbour );
+		}
+	}
+}
+
+void TPokeyTracker::SplitBlob(int BlobIndex,uint64 TimeNs)
+{
+	auto& Blob = mBlobs[BlobIndex];
+	Array<vec2x<int>> Connected;
+	FloodBlob( Blob.mCells[0], BlobIndex, GetArrayBridge(Connected) );
+	if ( Connected.GetSize() == Blob.mCells.GetSize() )
+		return;
+
+	//	lifted a cell in the middle; each other piece becomes its own blob on the same track
+	Array<vec2x<int>> Remaining;
+	for ( int c=0;	c<Blob.mCells.GetSize();	c++ )
+		if ( !Contains( Connected, Blob.mCells[c] ) )
+			Remaining.PushBack( Blob.mCells[c] );
+	Blob.mCells.Copy( Connected );
+	auto Track = Blob.mTrack;
+
+	while ( !Remaining.IsEmpty() )
+	{
+		Array<vec2x<int>> Piece;
+		FloodBlob( Remaining[0], BlobIndex, GetArrayBridge(Piece) );
+
+		auto PieceBlob = NewBlob( Track );
+		auto& NewPiece = mBlobs[PieceBlob];
+		for ( int c=0;	c<Piece.GetSize();	c++ )
+		{
+			mCellBlob[ GetCellKey(Piece[c]) ] = PieceBlob;
+			NewPiece.mCells.PushBack( Piece[c] );
+			RemoveValue( Remaining, Piece[c] );
+		}
+		AttachBlob( Track, PieceBlob, TimeNs );
+	}
+}
+
+int TPokeyTracker::NewBlob(int Track)
+{
+	auto Index = mNextBlob++;
+	mBlobs[Index].mTrack = Track;
+	return Index;
+}
+
+int TPokeyTracker::NewTrack(vec2x<int> Cell)
+{
+	auto Index = mNextTrack++;
+	auto& Track = mTracks[Index];
+	Track.mPosition = vec2x<float>( static_cast<float>(Cell.x), static_cast<float>(Cell.y) );
+	return Index;
+}
+
+int TPokeyTracker::FindTrackNear(vec2x<int> Cell,uint64 TimeNs)
+{
+	//	one track per person, so this is a few dozen at most. Someone standing here beats a track
+	//	that's only waiting for its feet to come back, else a passer-by steals the waiting track
+	int Nearest = -1;
+	bool NearestEmpty = true;
+	float NearestDistance = mJoinDistance;
+	for ( auto it=mTracks.begin();	it!=mTracks.end();	it++ )
+	{
+		auto& Track = it->second;
+		bool Empty = ( Track.mEmptySinceNs != 0 );
+		if ( Empty && TimeNs > Track.mEmptySinceNs + mLoseNs )
+			continue;
+		if ( Empty && !NearestEmpty )
+			continue;
+		auto dx = Track.mPosition.x - Cell.x;
+		auto dy = Track.mPosition.y - Cell.y;
+		auto Distance = std::sqrt( dx*dx + dy*dy );
+		if ( Distance > mJoinDistance )
+			continue;
+		if ( Empty == NearestEmpty && Distance > NearestDistance )
+			continue;
+		Nearest = it->first;
+		NearestEmpty = Empty;
+		NearestDistance = Distance;
+	}
+	return Nearest;
+}
+
+void TPokeyTracker::AttachBlob(int TrackIndex,int Blob,uint64 TimeNs)
+{
+	auto& Track = mTracks[TrackIndex];
+	Track.mBlobs.PushBack( Blob );
+	Track.mEmptySinceNs = 0;
+	Track.mDirty = true;
+	mBlobs[Blob].mTrack = TrackIndex;
+}
+
+void TPokeyTracker::DetachBlob(int TrackIndex,int Blob,uint64 TimeNs)
+{
+	auto& Track = mTracks[TrackIndex];
+	RemoveValue( Track.mBlobs, Blob );
+	Track.mDirty = true;
+	if ( Track.mBlobs.IsEmpty() )
+		Track.mEmptySinceNs = std::max<uint64>( TimeNs, 1 );
+}
+
+TPokeyTrackEvent TPokeyTracker::MakeEvent(TPokeyTrackEventType::Type Type,int TrackId,const TTrack& Track,uint64 TimeNs) const
+{
+	TPokeyTrackEvent Event;
+	Event.mType = Type;
+	Event.mTrack = TrackId;
+	Event.mPosition = Track.mPosition;
+	Event.mVelocity = Track.mVelocity;
+	Event.mCellCount = Track.mCellCount;
+	Event.mTimeNs = TimeNs;
+	return Event;
+}
+
+void TPokeyTracker::Update(uint64 NowNs)
+{
+	Array<TPokeyTrackEvent> Events;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		for ( auto it=mTracks.begin();	it!=mTracks.end();	)
+		{
+			auto& Track = it->second;
+
+			//	stepped off, or lifted both feet too long
+			if ( Track.mEmptySinceNs != 0 && NowNs > Track.mEmptySinceNs + mLoseNs )
+			{
+				if ( Track.mCreated )
+					Events.PushBack( MakeEvent( TPokeyTrackEventType::Lose, it->first, Track, NowNs ) );
+				it = mTracks.erase( it );
+				continue;
+			}
+
+			//	only tracks whose cells changed cost anything
+			if ( !Track.mDirty || Track.mBlobs.IsEmpty() )
+			{
+				it++;
+				continue;
+			}
+			Track.mDirty = false;
+
+			vec2x<float> Sum( 0, 0 );
+			size_t CellCount = 0;
+			for ( int b=0;	b<Track.mBlobs.GetSize();	b++ )
+			{
+				auto& Cells = mBlobs[Track.mBlobs[b]].mCells;
+				for ( int c=0;	c<Cells.GetSize();	c++ )
+				{
+					Sum.x += Cells[c].x;
+					Sum.y += Cells[c].y;
+				}
+				CellCount += Cells.GetSize();
+			}
+			vec2x<float> Position( Sum.x / CellCount, Sum.y / CellCount );
+
+			//	smoothed, a step moves the centroid in jumps
+			if ( Track.mCreated && NowNs > Track.mLastMoveNs )
+			{
+				auto Secs = (NowNs - Track.mLastMoveNs) / 1000000000.0f;
+				vec2x<float> Instant( (Position.x - Track.mPosition.x) / Secs, (Position.y - Track.mPosition.y) / Secs );
+				Track.mVelocity.x = (Track.mVelocity.x + Instant.x) * 0.5f;
+				Track.mVelocity.y = (Track.mVelocity.y + Instant.y) * 0.5f;
+			}
+			Track.mPosition = Position;
+			Track.mCellCount = CellCount;
+			Track.mLastMoveNs = NowNs;
+
+			Events.PushBack( MakeEvent( Track.mCreated ? TPokeyTrackEventType::Update : TPokeyTrackEventType::Create, it->first, Track, NowNs ) );
+			Track.mCreated = true;
+			it++;
+		}
+	}
+
+	if ( Events.IsEmpty() )
+		return;
+
+	{
+		std::lock_guard<std::mutex> Lock( mEventsLock );
+		for ( int e=0;	e<Events.GetSize();	e++ )
+			mEvents.push_back( Events[e] );
+		while ( mEvents.size() > mMaxQueuedEvents )
+		{
+			mEvents.pop_front();
+			mDroppedEvents++;
+		}
+	}
+
+	for ( int e=0;	e<Events.GetSize();	e++ )
+		mOnTrackEvent.OnTriggered( Events[e] );
+}
+
+void TPokeyTracker::GetTracks(ArrayBridge<TPokeyTrackEvent>&& Tracks)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	for ( auto it=mTracks.begin();	it!=mTracks.end();	it++ )
+	{
+		if ( !it->second.mCreated )
+			continue;
+		Tracks.PushBack( MakeEvent( TPokeyTrackEventType::Update, it->first, it->second, it->second.mLastMoveNs ) );
+	}
+}
+
+void TPokeyTracker::PopEvents(ArrayBridge<TPokeyTrackEvent>&& Events)
+{
+	std::lock_guard<std::mutex> Lock( mEventsLock );
+	for ( auto it=mEvents.begin();	it!=mEvents.end();	it++ )
+		Events.PushBack( *it );
+	mEvents.clear();
+}
+
+void TPokeyTracker::GetStatus(std::ostream& Status)
+{
+	size_t TrackCount;
+	size_t BlobCount;
+	size_t CellCount;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		TrackCount = mTracks.size();
+		BlobCount = mBlobs.size();
+		CellCount = mCellBlob.size();
+	}
+	std::lock_guard<std::mutex> Lock( mEventsLock );
+	Status << "tracks " << TrackCount << " blobs " << BlobCount << " cells " << CellCount << " queued events " << mEvents.size() << " dropped " << mDroppedEvents;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include "TPokeyFrameAssembler.h"
+
+
+namespace TPokeyTrackEventType
+{
+	enum Type
+	{
+		Create,
+		Update,
+		Lose,
+	};
+
+	const char*		ToString(Type Event);
+}
+
+class TPokeyTrackEvent
+{
+public:
+	TPokeyTrackEvent() :
+		mType		( TPokeyTrackEventType::Update ),
+		mTrack		( -1 ),
+		mPosition	( 0, 0 ),
+		mVelocity	( 0, 0 ),
+		mCellCount	( 0 ),
+		mTimeNs		( 0 )
+	{
+	}
+
+	void			WriteJson(std::ostream& Output) const;
+
+public:
+	TPokeyTrackEventType::Type	mType;
+	int				mTrack;
+	vec2x<float>	mPosition;		//	centroid of the track's cells, in grid cells
+	vec2x<float>	mVelocity;		//	cells per second
+	size_t			mCellCount;
+	uint64			mTimeNs;
+};
+
+
+//	clusters pressed cells into blobs (8-connected) and blobs into tracks, one per person. Cells are
+//	only touched when they change; a press joins/merges its neighbours' blobs and a release only
+//	re-floods the blob it was in, so cost follows activity, not floor size.
+//	A track can own several blobs (two feet), and a blob appearing near a track, or where a track
+//	was lost within mLoseNs, joins it, so steps keep the same id
+class TPokeyTracker
+{
+public:
+	TPokeyTracker();
+
+	void			OnSample(const TPokeyBoardSample& Sample);		//	diffs against the board's last sample
+	void			OnCellDown(vec2x<int> Cell,uint64 TimeNs);
+	void			OnCellUp(vec2x<int> Cell,uint64 TimeNs);
+	void			Update(uint64 NowNs);			//	publish changed tracks and lose stale ones, once per frame
+
+	void			GetTracks(ArrayBridge<TPokeyTrackEvent>&& Tracks);
+	void			PopEvents(ArrayBridge<TPokeyTrackEvent>&& Events);
+	void			GetStatus(std::ostream& Status);
+
+public:
+	SoyEvent<const TPokeyTrackEvent>	mOnTrackEvent;	//	called on the Update thread
+	float			mJoinDistance;			//	cells; a new blob this close to a track is the same person
+	uint64			mLoseNs;				//	a track with no cells lasts this long before it's lost
+	size_t			mMaxQueuedEvents;		//	oldest dropped if nobody pops them
+
+private:
+	class TBlob
+	{
+	public:
+		Array<vec2x<int>>	mCells;
+		int					mTrack;
+	};
+
+	class TTrack
+	{
+	public:
+		TTrack() :
+			mPosition		( 0, 0 ),
+			mVelocity		( 0, 0 ),
+			mCellCount		( 0 ),
+			mLastMoveNs		( 0 ),
+			mEmptySinceNs	( 0 ),
+			mDirty			( true ),
+			mCreated		( false )
+		{
+		}
+
+	public:
+		Array<int>			mBlobs;
+		vec2x<float>		mPosition;
+		vec2x<float>		mVelocity;
+		size_t				mCellCount;
+		uint64				mLastMoveNs;
+		uint64				mEmptySinceNs;	//	0 while it has blobs
+		bool				mDirty;
+		bool				mCreated;		//	create event sent
+	};
+
+	class TBoardState
+	{
+	public:
+		TBoardState() :
+			mPins	( 0 )
+		{
+		}
+
+	public:
+		uint64						mPins;
+		BufferArray<vec2x<int>,64>	mDown;
+	};
+
+	static uint64	GetCellKey(vec2x<int> Cell)	{	return (static_cast<uint64>(static_cast<uint32>(Cell.x)) << 32) | static_cast<uint32>(Cell.y);	}
+	void			CellDown(vec2x<int> Cell,uint64 TimeNs);
+	void			CellUp(vec2x<int> Cell,uint64 TimeNs);
+	int				GetCellBlob(vec2x<int> Cell) const;
+	void			FloodBlob(vec2x<int> Start,int Blob,ArrayBridge<vec2x<int>>&& Cells);
+	int				NewBlob(int Track);
+	int				NewTrack(vec2x<int> Cell);
+	int				FindTrackNear(vec2x<int> Cell,uint64 TimeNs);
+	void			AttachBlob(int Track,int Blob,uint64 TimeNs);
+	void			DetachBlob(int Track,int Blob,uint64 TimeNs);
+	void			SplitBlob(int Blob,uint64 TimeNs);
+	TPokeyTrackEvent	MakeEvent(TPokeyTrackEventType::Type Type,int TrackId,const TTrack& Track,uint64 TimeNs) const;
+
+private:
+	std::mutex		mLock;		//	samples come from every channel's thread
+	std::unordered_map<uint64,int>		mCellRefs;		//	boards can share a cell, so refcount
+	std::unordered_map<uint64,int>		mCellBlob;
+	std::unordered_map<int,TBlob>		mBlobs;
+	std::map<int,TTrack>				mTracks;
+	std::map<int,TBoardState>			mBoards;		//	by serial
+	int				mNextBlob;
+	int				mNextTrack;
+
+	std::mutex		mEventsLock;
+	std::deque<TPokeyTrackEvent>		mEvents;
+	uint64			mDroppedEvents;
+};
@@ -0,0 +1,249 @@
+#include "TPokeyTriggerZones.h"
+#include "PopPokey.h"
+
+#if defined(TARGET_WINDOWS)
+#include <intrin.h>
+#endif
+
+
+namespace
+{
+	int CountBits(uint64 Bits)
+	{
+#if defined(TARGET_WINDOWS)
+		return static_cast<int>( __popcnt64( Bits ) );
+#else
+		return __builtin_popcountll( Bits );
+#endif
+	}
+}
+
+
+const char* TPokeyTriggerEventType::ToString(Type Event)
+{
+	switch ( Event )
+	{
+		case Enter:	return "enter";
+		case Exit:	return "exit";
+		case Count:	return "count";
+	}
+	return "unknown";
+}
+
+
+void TPokeyTriggerEvent::WriteJson(std::ostream& Output) const
+{
+	Output << "{";
+	Output << "\"event\":\"" << TPokeyTriggerEventType::ToString( mType ) << "\",";
+	Output << "\"zone\":\"" << mZone << "\",";
+	Output << "\"cells\":" << mCellCount << ",";
+	Output << "\"time_ns\":" << mTimeNs;
+	Output << "}";
+}
+
+
+TPokeyTriggerZones::TPokeyTriggerZones() :
+	mMaxQueuedEvents	( 1000 ),
+	mGeneration			( 0 ),
+	mDroppedEvents		( 0 )
+{
+}
+
+void TPokeyTriggerZones::SetZones(const ArrayBridge<TPokeyTriggerZoneConfig>& Zones,uint64 NowNs)
+{
+	Array<TPokeyTriggerEvent> Events;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+
+		//	unchanged config reloads shouldn't make everyone exit and re-enter
+		bool Same = ( Zones.GetSize() == mZones.GetSize() );
+		for ( int z=0;	Same && z<Zones.GetSize();	z++ )
+			Same = ( Zones[z] == mZones[z].mConfig );
+		if ( Same )
+			return;
+
+		for ( int z=0;	z<mZones.GetSize();	z++ )
+		{
+			if ( mZones[z].mCellCount == 0 )
+				continue;
+			auto& Event = Events.PushBack();
+			Event.mType = TPokeyTriggerEventType::Exit;
+			Event.mZone = mZones[z].mConfig.mName;
+			Event.mCellCount = 0;
+			Event.mTimeNs = NowNs;
+		}
+
+		mZones.Clear();
+		for ( int z=0;	z<Zones.GetSize();	z++ )
+			mZones.PushBack().mConfig = Zones[z];
+
+		//	every board recompiles and re-enters its zones on its next sample
+		mGeneration++;
+	}
+	QueueEvents( GetArrayBridge(Events) );
+}
+
+void TPokeyTriggerZones::OnSample(TPokeyMeta& Pokey,uint64 DownPins,uint64 SampleTimeNs)
+{
+	BufferArray<TPokeyTriggerEvent,32> Events;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( mZones.IsEmpty() )
+			return;
+
+		auto& Board = mBoards[Pokey.mSerial];
+		bool Stale = ( Board.mGeneration != mGeneration || Board.mGridMapVersion != Pokey.mGridMapVersion );
+		if ( !Stale && Board.mPins == DownPins )
+			return;
+
+		if ( Stale )
+		{
+			//	take this board's cells out of its old zones, then count them again with the new masks.
+			//	Zones from an old generation have gone, and were already reset
+			if ( Board.mGeneration == mGeneration )
+				ApplyPins( Board, 0 );
+			Board.mPins = 0;
+			Compile( Board, Pokey );
+		}
+		ApplyPins( Board, DownPins );
+
+		TakeEvents( SampleTimeNs, GetArrayBridge(Events) );
+	}
+	QueueEvents( GetArrayBridge(Events) );
+}
+
+void TPokeyTriggerZones::Compile(TBoard& Board,TPokeyMeta& Pokey)
+{
+	Board.mZones.Clear();
+	Board.mGeneration = mGeneration;
+	Board.mGridMapVersion = Pokey.mGridMapVersion;
+
+	//	pins x zones, but only when a map or the zones change
+	for ( int z=0;	z<mZones.GetSize();	z++ )
+	{
+		uint64 Mask = 0;
+		auto& State = Pokey.GetState();
+		for ( auto Bits = State.mMappedPins;	Bits;	Bits &= Bits-1 )
+		{
+			auto p = TPokeyBoardState::GetLowestPin( Bits );
+			auto Coord = State.mCoord[p];
+			if ( Coord == TPokeyMeta::GridCoordLaserGate )
+				continue;
+			if ( mZones[z].mConfig.Contains( Coord ) )
+				Mask |= 1ull << p;
+		}
+		if ( Mask == 0 )
+			continue;
+
+		auto& BoardZone = Board.mZones.PushBack();
+		BoardZone.mZone = z;
+		BoardZone.mMask = Mask;
+	}
+}
+
+void TPokeyTriggerZones::ApplyPins(TBoard& Board,uint64 Pins)
+{
+	auto Changed = Board.mPins ^ Pins;
+	for ( int i=0;	i<Board.mZones.GetSize();	i++ )
+	{
+		auto& BoardZone = Board.mZones[i];
+		if ( !(BoardZone.mMask & Changed) )
+			continue;
+		auto Delta = CountBits( Pins & BoardZone.mMask ) - CountBits( Board.mPins & BoardZone.mMask );
+		if ( Delta != 0 )
+			AddCells( BoardZone.mZone, Delta );
+	}
+	Board.mPins = Pins;
+}
+
+void TPokeyTriggerZones::AddCells(size_t ZoneIndex,int Delta)
+{
+	auto& Zone = mZones[ZoneIndex];
+	if ( !Zone.mChanged )
+	{
+		Zone.mChanged = true;
+		Zone.mOldCellCount = Zone.mCellCount;
+		mChangedZones.PushBack( ZoneIndex );
+	}
+	Zone.mCellCount += Delta;
+}
+
+void TPokeyTriggerZones::TakeEvents(uint64 TimeNs,ArrayBridge<TPokeyTriggerEvent>&& Events)
+{
+	//	one event per zone per sample, however many of its cells changed
+	for ( int i=0;	i<mChangedZones.GetSize();	i++ )
+	{
+		auto& Zone = mZones[ mChangedZones[i] ];
+		Zone.mChanged = false;
+		if ( Zone.mCellCount == Zone.mOldCellCount )
+			continue;
+
+		auto& Event = Events.PushBack();
+		if ( Zone.mOldCellCount == 0 )
+			Event.mType = TPokeyTriggerEventType::Enter;
+		else if ( Zone.mCellCount == 0 )
+			Event.mType = TPokeyTriggerEventType::Exit;
+		else
+			Event.mType = TPokeyTriggerEventType::Count;
+		Event.mZone = Zone.mConfig.mName;
+		Event.mCellCount = Zone.mCellCount;
+		Event.mTimeNs = TimeNs;
+	}
+	mChangedZones.Clear(false);
+}
+
+void TPokeyTriggerZones::QueueEvents(const ArrayBridge<TPokeyTriggerEvent>& Events)
+{
+	if ( Events.IsEmpty() )
+		return;
+
+	{
+		std::lock_guard<std::mutex> Lock( mEventsLock );
+		for ( int e=0;	e<Events.GetSize();	e++ )
+			mEvents.push_back( Events[e] );
+		while ( mEvents.size() > mMaxQueuedEvents )
+		{
+			mEvents.pop_front();
+			mDroppedEvents++;
+		}
+	}
+
+	for ( int e=0;	e<Events.GetSize();	e++ )
+		mOnTriggerEvent.OnTriggered( Events[e] );
+}
+
+void TPokeyTriggerZones::WriteJson(std::ostream& Output)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	Output << "[";
+	for ( int z=0;	z<mZones.GetSize();	z++ )
+	{
+		if ( z > 0 )
+			Output << ",";
+		Output << "{\"zone\":\"" << mZones[z].mConfig.mName << "\",\"cells\":" << mZones[z].mCellCount << "}";
+	}
+	Output << "]";
+}
+
+void TPokeyTriggerZones::PopEvents(ArrayBridge<TPokeyTriggerEvent>&& Events)
+{
+	std::lock_guard<std::mutex> Lock( mEventsLock );
+	for ( auto it=mEvents.begin();	it!=mEvents.end();	it++ )
+		Events.PushBack( *it );
+	mEvents.clear();
+}
+
+void TPokeyTriggerZones::GetStatus(std::ostream& Status)
+{
+	size_t ZoneCount;
+	size_t OccupiedCount = 0;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		ZoneCount = mZones.GetSize();
+		for ( int z=0;	z<mZones.GetSize();	z++ )
+			if ( mZones[z].mCellCount > 0 )
+				OccupiedCount++;
+	}
+	std::lock_guard<std::mutex> Lock( mEventsLock );
+	Status << "trigger zones " << ZoneCount << ", " << OccupiedCount << " occupied, " << mEvents.size() << " queued events, " << mDroppedEvents << " dropped";
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <ofxSoylent.h>
+#include <SoyApp.h>
+#include <SoyMath.h>
+#include <unordered_map>
+#include <deque>
+#include "TPokeyConfig.h"
+
+
+class TPokeyMeta;
+
+
+namespace TPokeyTriggerEventType
+{
+	enum Type
+	{
+		Enter,		//	first cell down
+		Exit,		//	last cell up
+		Count,		//	still occupied, different number of cells down
+	};
+
+	const char*		ToString(Type Event);
+}
+
+class TPokeyTriggerEvent
+{
+public:
+	TPokeyTriggerEvent() :
+		mType		( TPokeyTriggerEventType::Count ),
+		mCellCount	( 0 ),
+		mTimeNs		( 0 )
+	{
+	}
+
+	void			WriteJson(std::ostream& Output) const;
+
+public:
+	TPokeyTriggerEventType::Type	mType;
+	std::string		mZone;
+	int				mCellCount;		//	cells down in the zone after the change
+	uint64			mTimeNs;
+};
+
+
+//	trigger zones from config, compiled against each board's gridmap into one pin mask per zone the
+//	board overlaps. A sample is then an xor with the board's last pins and, for only that board's
+//	zones whose mask has a changed pin, a popcount of the and. Unchanged boards cost one compare,
+//	and zones the board doesn't touch cost nothing, however many there are.
+//	Boards recompile themselves on their next sample when their gridmap or the zones change
+class TPokeyTriggerZones
+{
+public:
+	TPokeyTriggerZones();
+
+	void			SetZones(const ArrayBridge<TPokeyTriggerZoneConfig>& Zones,uint64 NowNs);	//	occupied zones exit
+	void			OnSample(TPokeyMeta& Pokey,uint64 DownPins,uint64 SampleTimeNs);	//	ignored pins already removed
+
+	void			WriteJson(std::ostream& Output);		//	zones and their cell counts
+	void			PopEvents(ArrayBridge<TPokeyTriggerEvent>&& Events);
+	void			GetStatus(std::ostream& Status);
+
+public:
+	SoyEvent<const TPokeyTriggerEvent>	mOnTriggerEvent;	//	called on the sampling thread
+	size_t			mMaxQueuedEvents;		//	oldest dropped if nobody pops them
+
+private:
+	class TZone
+	{
+	public:
+		TZone() :
+			mCellCount		( 0 ),
+			mOldCellCount	( 0 ),
+			mChanged		( false )
+		{
+		}
+
+	public:
+		TPokeyTriggerZoneConfig	mConfig;
+		int				mCellCount;
+		int				mOldCellCount;	//	before this sample, while mChanged
+		bool			mChanged;		//	in mChangedZones
+	};
+
+	class TBoardZone
+	{
+	public:
+		size_t			mZone;
+		uint64			mMask;
+	};
+
+	class TBoard
+	{
+	public:
+		TBoard() :
+			mGridMapVersion	( ~0u ),
+			mGeneration		( ~0u ),
+			mPins			( 0 )
+		{
+		}
+
+	public:
+		uint32			mGridMapVersion;	//	compiled against
+		uint32			mGeneration;		//	of the zone set
+		uint64			mPins;
+		Array<TBoardZone>	mZones;			//	only zones with a pin on this board
+	};
+
+	void			Compile(TBoard& Board,TPokeyMeta& Pokey);
+	void			ApplyPins(TBoard& Board,uint64 Pins);
+	void			AddCells(size_t Zone,int Delta);
+	void			TakeEvents(uint64 TimeNs,ArrayBridge<TPokeyTriggerEvent>&& Events);
+	void			QueueEvents(const ArrayBridge<TPokeyTriggerEvent>& Events);
+
+private:
+	std::mutex		mLock;			//	samples come from every channel's thread
+	Array<TZone>	mZones;
+	uint32			mGeneration;
+	std::unordered_map<int,TBoard>	mBoards;	//	by serial
+	Array<size_t>	mChangedZones;	//	this sample; kept to save allocating every time
+
+	std::mutex		mEventsLock;
+	std::deque<TPokeyTriggerEvent>	mEvents;
+	uint64			mDroppedEvents;
+};
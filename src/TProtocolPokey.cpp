@@ -1,8 +1,11 @@
 #include "TProtocolPokey.h"
+#include "TPokeyCapture.h"
+#include "TPokeyMetrics.h"
 #include <RemoteArray.h>
 
 
 std::atomic<unsigned char> TProtocolPokey::mRequestCounter(0);
+std::shared_ptr<TPokeyCaptureWriter> TProtocolPokey::gCapture;
 
 
 std::map<TPokeyCommand::Type,std::string> TPokeyCommand::EnumMap =
@@ -13,7 +16,11 @@ std::map<TPokeyCommand::Type,std::string> TPokeyCommand::EnumMap =
 	
 	{ TPokeyCommand::GetDeviceMeta,	"GetDeviceMeta" },
 	{ TPokeyCommand::GetUserId,	"GetUserId" },
+	{ TPokeyCommand::SetPinSettings,	"SetPinSettings" },
+	{ TPokeyCommand::ResetDigitalCounters,	"ResetDigitalCounters" },
 	{ TPokeyCommand::GetDeviceState,	"GetDeviceState" },
+	{ TPokeyCommand::GetDigitalCounters,	"GetDigitalCounters" },
+	{ TPokeyCommand::SetExtBus,	"SetExtBus" },
 	
 };
 
@@ -45,6 +52,40 @@ bool TProtocolPokey::DecodeGetDeviceStatus(TJob& Job,const BufferArray<unsigned
 	
 	Job.mParams.AddParam("pins", Pins.str() );
 	
+	//	0 ok, else outputs sent with the poll weren't set
+	Job.mParams.AddParam("status", static_cast<int>(Data[2]) );
+	
+	return true;
+}
+
+
+bool TProtocolPokey::DecodeGetDigitalCounters(TJob& Job,const BufferArray<unsigned char,64>& Data)
+{
+	auto Request = GetRequest( Data[6], true );
+	auto& Pins = Request.mCounterPins;
+	
+	//	a reply to a request we didn't make (or already had a reply for)
+	if ( Pins.IsEmpty() )
+		return false;
+	
+	//	32 bit counts from byte 9 (1-based), LSB first, in the order the pins were requested
+	std::stringstream PinsString;
+	std::stringstream Counters;
+	for ( int i=0;	i<Pins.GetSize();	i++ )
+	{
+		auto* Value = &Data[8 + (i*4)];
+		uint32 Count = Value[0] | (Value[1]<<8) | (Value[2]<<16) | (static_cast<uint32>(Value[3])<<24);
+		if ( i > 0 )
+		{
+			PinsString << ",";
+			Counters << ",";
+		}
+		PinsString << static_cast<int>(Pins[i]);
+		Counters << Count;
+	}
+	
+	Job.mParams.AddParam("counterpins", PinsString.str() );
+	Job.mParams.AddParam("counters", Counters.str() );
 	return true;
 }
 
@@ -91,6 +132,20 @@ bool TProtocolPokey::DecodeReply(TJob& Job,const BufferArray<unsigned char,64>&
 				return true;
 			break;
 			
+		case TPokeyCommand::GetDigitalCounters:
+			if ( DecodeGetDigitalCounters( Job, Data ) )
+				return true;
+			break;
+			
+		case TPokeyCommand::SetExtBus:
+			Job.mParams.AddParam("enabled", static_cast<int>(Data[2]) );
+			return true;
+			
+		case TPokeyCommand::SetPinSettings:
+			//	0 ok, 1 pin out of range or config locked
+			Job.mParams.AddParam("status", static_cast<int>(Data[2]) );
+			return true;
+			
 		default:
 			break;
 	}
@@ -112,6 +167,10 @@ bool TProtocolPokey::DecodeReply(TJob& Job,const BufferArray<unsigned char,64>&
 
 TDecodeResult::Type TProtocolPokey::DecodeHeader(TJob& Job,TChannelStream& Stream)
 {
+	//	"rxtime" is when the decoder got to the frame, not when it came off the wire. The channel's socket
+	//	read and its stream buffering are before this and aren't in any latency we measure from it
+	auto RxTimeNs = Soy::GetMonotonicNs();
+	
 	//	read the first byte, if it's 0xAA we know it's a reply packet
 	//	if it's not, we have to assume it's a broadcast reply with an IP...
 	Array<char> Data;
@@ -129,10 +188,26 @@ TDecodeResult::Type TProtocolPokey::DecodeHeader(TJob& Job,TChannelStream& Strea
 		
 		BufferArray<unsigned char,64> UData;
 		GetArrayBridge(UData).PushBackReinterpret( Data.GetArray(), Data.GetDataSize() );
+		auto Request = GetRequest( UData[6], false );
+		Capture( TPokeyCaptureFrame::Reply, Request.mSerial, GetArrayBridge(UData), RxTimeNs );
+		
+		if ( Request.mMetrics )
+		{
+			bool ChecksumOkay = TPokeyCommand::CalculateChecksum( UData.GetArray() ) == UData[7];
+			bool KnownCommand = TPokeyCommand::Validate( static_cast<TPokeyCommand::Type>(UData[1]) ) != TPokeyCommand::Invalid;
+			bool IsPoll = UData[1] == TPokeyCommand::GetDeviceState;
+			Request.mMetrics->OnReply( UData[6], RxTimeNs, ChecksumOkay, KnownCommand, IsPoll );
+		}
 		
 		if ( !DecodeReply( Job, UData ) )
 			return TDecodeResult::Ignore;
 		
+		//	lets the handler find the pokey without searching every channel
+		if ( Request.mSerial != -1 )
+			Job.mParams.AddParam("serial", Request.mSerial );
+		
+		Job.mParams.AddParam("rxtime", RxTimeNs );
+		Job.mParams.AddParam("decodetime", Soy::GetMonotonicNs() );
 		return TDecodeResult::Success;
 	}
 	else
@@ -150,18 +225,8 @@ TDecodeResult::Type TProtocolPokey::DecodeHeader(TJob& Job,TChannelStream& Strea
 		BufferArray<unsigned char, 100> UData;
 		GetArrayBridge(UData).PushBackReinterpret(Data.GetArray(), Data.GetDataSize());
 
-		std::stringstream Version;
-		Version << (int)UData[3] << "." << (int)UData[4];
-
-		//	if new protocol
-		bool Protocol4913 = Version.str() == "49.13";
-		bool Protocol3352 = Version.str() == "33.52";
-		bool Protocol4800 = Version.str() == "48.0";
-
-		//	same protocol as newer
-		Protocol4913 |= Protocol4800;
-
-		if ( Protocol4913 )
+		//	new protocol has 5 more bytes
+		if ( GetDiscoveryReplySize( GetArrayBridge(UData) ) > UData.GetSize() )
 		{
 			if ( !Stream.Pop(5, DataBridge) )
 			{
@@ -171,45 +236,114 @@ TDecodeResult::Type TProtocolPokey::DecodeHeader(TJob& Job,TChannelStream& Strea
 			UData.Clear();
 			GetArrayBridge(UData).PushBackReinterpret(Data.GetArray(), Data.GetDataSize());
 		}
-		else if ( Protocol3352 )
-		{
-			
-		}
-		else
-		{
-			std::Debug << "unknown pokey protocol " << Version.str() << std::endl;
-			return TDecodeResult::Ignore;
-		}
-		
-		int Serial = 0;
-		if ( Protocol4913 )
-		{
-			Serial = ( (int)UData[15] << 8 ) | (int)UData[14];
-		}
-		else if ( Protocol3352 )
-		{
-			Serial = ( (int)UData[1] << 8 ) | (int)UData[2];
-		}
-
 		
-		std::stringstream Address;
-		Address << (int)UData[5] << "." << (int)UData[6] << "." << (int)UData[7] << "." << (int)UData[8];
-		Address << ":20055";
+		Capture( TPokeyCaptureFrame::Discovery, -1, GetArrayBridge(UData), RxTimeNs );
 		
-		std::stringstream HostAddress;
-		HostAddress << (int)UData[10] << "." << (int)UData[11] << "." << (int)UData[12] << "." << (int)UData[13];
+		if ( !DecodeDiscovery( Job, GetArrayBridge(UData) ) )
+			return TDecodeResult::Ignore;
 		
-		Job.mParams.mCommand = TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::Discover );
-		Job.mParams.AddParam("userid", static_cast<int>(UData[0]) );
-		Job.mParams.AddParam("version", Version.str() );
-		Job.mParams.AddParam("serial", Serial );
-		Job.mParams.AddParam("dhcpenabled", static_cast<int>(UData[9]) );
-		Job.mParams.AddParam("address", Address.str() );
-		Job.mParams.AddParam("hostaddress", HostAddress.str() );
 		return TDecodeResult::Success;
 	}
 }
 
+void TProtocolPokey::SetCapture(std::shared_ptr<TPokeyCaptureWriter> Capture)
+{
+	std::atomic_store( &gCapture, Capture );
+}
+
+std::shared_ptr<TPokeyCaptureWriter> TProtocolPokey::GetCapture()
+{
+	return std::atomic_load( &gCapture );
+}
+
+void TProtocolPokey::Capture(int Type,int Serial,const ArrayBridge<unsigned char>& Data,uint64 RxTimeNs)
+{
+	auto Writer = GetCapture();
+	if ( !Writer )
+		return;
+	
+	Writer->Push( static_cast<TPokeyCaptureFrame::Type>(Type), Serial, Data.GetArray(), Data.GetDataSize(), RxTimeNs );
+}
+
+TProtocolPokey::TRequest TProtocolPokey::GetRequest(unsigned char RequestId,bool TakeCounterPins)
+{
+	std::lock_guard<std::mutex> Lock( mRequestsLock );
+	auto& Request = mRequests[RequestId];
+	TRequest Copy;
+	Copy.mSerial = Request.mSerial;
+	Copy.mMetrics = Request.mMetrics;
+	if ( TakeCounterPins )
+	{
+		Copy.mCounterPins.Copy( Request.mCounterPins );
+		Request.mCounterPins.Clear();
+	}
+	return Copy;
+}
+
+size_t TProtocolPokey::GetDiscoveryReplySize(const ArrayBridge<unsigned char>& Header14)
+{
+	//	old protocol size 14
+	//	new protocol size 19
+	auto VersionMajor = Header14[3];
+	auto VersionMinor = Header14[4];
+	
+	//	49.13, and 48.0 which is the same protocol as newer
+	if ( (VersionMajor == 49 && VersionMinor == 13) || (VersionMajor == 48 && VersionMinor == 0) )
+		return 19;
+	
+	return 14;
+}
+
+bool TProtocolPokey::DecodeDiscovery(TJob& Job,const ArrayBridge<unsigned char>& UData)
+{
+	std::stringstream Version;
+	Version << (int)UData[3] << "." << (int)UData[4];
+
+	//	if new protocol
+	bool Protocol4913 = Version.str() == "49.13";
+	bool Protocol3352 = Version.str() == "33.52";
+	bool Protocol4800 = Version.str() == "48.0";
+
+	//	same protocol as newer
+	Protocol4913 |= Protocol4800;
+
+	if ( !Protocol4913 && !Protocol3352 )
+	{
+		std::Debug << "unknown pokey protocol " << Version.str() << std::endl;
+		return false;
+	}
+	
+	if ( UData.GetSize() < GetDiscoveryReplySize( UData ) )
+		return false;
+	
+	int Serial = 0;
+	if ( Protocol4913 )
+	{
+		Serial = ( (int)UData[15] << 8 ) | (int)UData[14];
+	}
+	else if ( Protocol3352 )
+	{
+		Serial = ( (int)UData[1] << 8 ) | (int)UData[2];
+	}
+
+	
+	std::stringstream Address;
+	Address << (int)UData[5] << "." << (int)UData[6] << "." << (int)UData[7] << "." << (int)UData[8];
+	Address << ":20055";
+	
+	std::stringstream HostAddress;
+	HostAddress << (int)UData[10] << "." << (int)UData[11] << "." << (int)UData[12] << "." << (int)UData[13];
+	
+	Job.mParams.mCommand = TJobParams::CommandReplyPrefix + TPokeyCommand::ToString( TPokeyCommand::Discover );
+	Job.mParams.AddParam("userid", static_cast<int>(UData[0]) );
+	Job.mParams.AddParam("version", Version.str() );
+	Job.mParams.AddParam("serial", Serial );
+	Job.mParams.AddParam("dhcpenabled", static_cast<int>(UData[9]) );
+	Job.mParams.AddParam("address", Address.str() );
+	Job.mParams.AddParam("hostaddress", HostAddress.str() );
+	return true;
+}
+
 TDecodeResult::Type TProtocolPokey::DecodeData(TJob& Job,TChannelStream& Stream)
 {
 	return TDecodeResult::Success;
@@ -230,6 +364,21 @@ bool TProtocolPokey::Encode(const TJob& Job,std::stringstream& Output)
 	return false;
 }
 
+void TProtocolPokey::EncodeOutputBits(const std::string& Outputs,unsigned char* Data,size_t DataSize,bool Invert)
+{
+	//	bit 0 of the first byte is the first output.
+	//	pokey digital outputs are inverted (writing 1 gives 0v) so '1' (high) is written as 0, and
+	//	anything not given stays high like at bootup
+	for ( size_t i=0;	i<DataSize;	i++ )
+		Data[i] = 0;
+	for ( size_t i=0;	i<Outputs.length() && i<DataSize*8;	i++ )
+	{
+		bool High = Outputs[i] != '0';
+		if ( High != Invert )
+			Data[i/8] |= 1 << (i%8);
+	}
+}
+
 bool TProtocolPokey::Encode(const TJob& Job,Array<char>& Output)
 {
 	//	job to command id
@@ -237,16 +386,74 @@ bool TProtocolPokey::Encode(const TJob& Job,Array<char>& Output)
 	
 	unsigned char tempOut[64-8];	//	gr: was 64, but their code NEVER uses more than 56 (64-8)
 	unsigned char data2,data3,data4,data5;
+	BufferArray<unsigned char,TPokeyCommand::MaxCounterPins> CounterPins;
+	memset( tempOut, 0, sizeof(tempOut) );
 	
 	switch ( Command )
 	{
-		case TPokeyCommand::GetDeviceMeta:
 		case TPokeyCommand::GetDeviceState:
+		{
+			data2 = 0;
+			data3 = 0;
+			data4 = 0;
+			data5 = 0;
+			
+			//	outputs ride along with the poll, so writing them costs no extra round trip
+			auto Outputs = Job.mParams.GetParamAs<std::string>("outputs");
+			if ( !Outputs.empty() )
+			{
+				data2 = 1;
+				EncodeOutputBits( Outputs, tempOut, 7, true );
+			}
+			break;
+		}
+			
+		case TPokeyCommand::SetExtBus:
+			data2 = 1;	//	enable
+			data3 = Job.mParams.GetParamAsWithDefault<int>("connector", 0);
+			data4 = 0;
+			data5 = 0;
+			EncodeOutputBits( Job.mParams.GetParamAs<std::string>("extbus"), tempOut, 10, false );
+			break;
+			
+		case TPokeyCommand::GetDeviceMeta:
+		case TPokeyCommand::ResetDigitalCounters:
+			data2 = 0;
+			data3 = 0;
+			data4 = 0;
+			data5 = 0;
+			break;
+			
+		case TPokeyCommand::SetPinSettings:
+			data2 = Job.mParams.GetParamAsWithDefault<int>("pin", 0);
+			data3 = Job.mParams.GetParamAsWithDefault<int>("settings", TPokeyPinSetting::DigitalInput);
+			data4 = Job.mParams.GetParamAsWithDefault<int>("options", 0);
+			data5 = 0;
+			break;
+			
+		case TPokeyCommand::GetDigitalCounters:
+		{
+			//	pin ids go in the data, up to 13
+			auto PinsString = Job.mParams.GetParamAs<std::string>("counterpins");
+			std::stringstream PinsStream( PinsString );
+			std::string Pin;
+			while ( CounterPins.GetSize() < CounterPins.MaxAllocSize() && std::getline( PinsStream, Pin, ',' ) )
+			{
+				if ( Pin.empty() )
+					continue;
+				CounterPins.PushBack( static_cast<unsigned char>( atoi( Pin.c_str() ) ) );
+			}
+			if ( CounterPins.IsEmpty() )
+				return false;
+			
+			for ( int i=0;	i<CounterPins.GetSize();	i++ )
+				tempOut[i] = CounterPins[i];
 			data2 = 0;
 			data3 = 0;
 			data4 = 0;
 			data5 = 0;
 			break;
+		}
 			
 			//	special case where we send zero bytes
 		case TPokeyCommand::Discover:
@@ -270,6 +477,27 @@ bool TProtocolPokey::Encode(const TJob& Job,Array<char>& Output)
 	Header[6] = RequestId;
 	Header[7] = TPokeyCommand::CalculateChecksum(Header);
 	
+	//	the poll thread tells us who we're talking to so replies can be attributed
+	std::shared_ptr<TPokeyBoardMetrics> Metrics;
+	{
+		std::lock_guard<std::mutex> Lock( mRequestsLock );
+		auto Serial = Job.mParams.GetParamAsWithDefault<int>("serial", mSerial);
+		if ( Serial != mSerial || (!mMetrics && Serial != -1) )
+		{
+			mSerial = Serial;
+			mMetrics = ( Serial == -1 ) ? nullptr : TPokeyMetrics::Get().GetBoard( Serial );
+		}
+		
+		auto& Request = mRequests[RequestId];
+		Request.mSerial = mSerial;
+		Request.mMetrics = mMetrics;
+		Request.mCounterPins.Copy( CounterPins );
+		Metrics = mMetrics;
+	}
+	
+	if ( Metrics && Command == TPokeyCommand::GetDeviceState )
+		Metrics->OnPollSent( RequestId, Soy::GetMonotonicNs() );
+	
 	Output.PushBackArray( GetRemoteArray( reinterpret_cast<const char*>(Header), sizeofarray(Header) ) );
 	Output.PushBackArray( GetRemoteArray( reinterpret_cast<const char*>(tempOut), sizeofarray(tempOut) ) );
 	
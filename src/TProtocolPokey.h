@@ -7,6 +7,21 @@
 #include <SoyMath.h>
 
 
+namespace Soy
+{
+	//	SoyTime is wall clock and can jump; use these for receive stamps and intervals
+	inline uint64	GetMonotonicNs()
+	{
+		auto Now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( Now ).count();
+	}
+	
+	inline uint64	GetMonotonicMs()
+	{
+		return GetMonotonicNs() / 1000000;
+	}
+}
+
 
 namespace TPokeyCommand
 {
@@ -20,24 +35,55 @@ namespace TPokeyCommand
 		//	real codes
 		GetDeviceMeta			= 0x00,
 		GetUserId				= 0x03,
+		SetPinSettings			= 0x10,
+		ResetDigitalCounters	= 0x1D,
 		GetDeviceState			= 0xCC,
+		GetDigitalCounters		= 0xD8,
+		SetExtBus				= 0xDA,
 	};
 	DECLARE_SOYENUM( TPokeyCommand );
 	
 	unsigned char	CalculateChecksum(const unsigned char* Header7);
+	
+	static const size_t	MaxCounterPins = 13;		//	pin ids that fit in one GetDigitalCounters request
 };
 
 
+namespace TPokeyPinSetting
+{
+	enum Type : unsigned char
+	{
+		DigitalInput		= 1<<1,
+		DigitalCounter		= 1<<6,
+	};
+	
+	//	digital counter options, byte 5 of SetPinSettings
+	enum CounterOption : unsigned char
+	{
+		CountRising			= 1<<0,
+		CountFalling		= 1<<1,
+	};
+}
+
+
 
 
 
+class TPokeyCaptureWriter;
+class TPokeyBoardMetrics;
+
 class TProtocolPokey : public TProtocol
 {
 public:
 	static std::atomic<unsigned char>	mRequestCounter;	//	gr: per device, but establish when this resets
 	
+	//	every frame decoded by any pokey channel is copied here when set
+	static void			SetCapture(std::shared_ptr<TPokeyCaptureWriter> Capture);
+	static std::shared_ptr<TPokeyCaptureWriter>	GetCapture();
+	
 public:
-	TProtocolPokey()
+	TProtocolPokey() :
+		mSerial		( -1 )
 	{
 	}
 	
@@ -53,8 +99,40 @@ public:
 	
 	bool				DecodeReply(TJob& Job,const BufferArray<unsigned char,64>& Data);
 	bool				DecodeGetDeviceStatus(TJob& Job,const BufferArray<unsigned char,64>& Data);
+	bool				DecodeGetDigitalCounters(TJob& Job,const BufferArray<unsigned char,64>& Data);
+	bool				DecodeDiscovery(TJob& Job,const ArrayBridge<unsigned char>& Data);
+	static size_t		GetDiscoveryReplySize(const ArrayBridge<unsigned char>& Header14);
 
-public:
+	static void			EncodeOutputBits(const std::string& Outputs,unsigned char* Data,size_t DataSize,bool Invert);	//	'0'/'1' per output
+	
+private:
+	//	what a request was sent for; replies only echo the request id
+	class TRequest
+	{
+	public:
+		TRequest() :
+			mSerial	( -1 )
+		{
+		}
+		
+	public:
+		int				mSerial;
+		std::shared_ptr<TPokeyBoardMetrics>	mMetrics;
+		BufferArray<unsigned char,TPokeyCommand::MaxCounterPins>	mCounterPins;	//	counter replies don't say which
+	};
+	
+	void				Capture(int Type,int Serial,const ArrayBridge<unsigned char>& Data,uint64 RxTimeNs);
+	TRequest			GetRequest(unsigned char RequestId,bool TakeCounterPins);
+
+private:
+	static std::shared_ptr<TPokeyCaptureWriter>	gCapture;
+	
+	//	jobs are encoded on the sending thread and replies decoded on the channel's, so both sides go
+	//	through this lock
+	std::mutex			mRequestsLock;
+	TRequest			mRequests[256];
+	int					mSerial;	//	pokey this channel talks to, learnt from the jobs we send. -1 for discovery
+	std::shared_ptr<TPokeyBoardMetrics>	mMetrics;
 };
 
 